@@ -0,0 +1,307 @@
+#ifndef BG_BENCH_H
+#define BG_BENCH_H
+
+/*
+ * A tiny benchmark harness for the bench programs.
+ *
+ *     struct BGBenchSuite suite;
+ *     bg_bench_suite_init(&suite, argc, argv);
+ *
+ *     struct BGBench b;
+ *     bg_bench_begin(&b, &suite, "append/generic", N, N * sizeof(u64));
+ *     while (bg_bench_loop(&b)) {
+ *         BGSlice *s = BGSlice_new(u64, 0, 16, NULL);
+ *         bg_bench_start(&b);
+ *         for (u64 i = 0; i < N; i++)
+ *             BGSlice_append(s, &i);
+ *         bg_bench_stop(&b);
+ *         bg_bench_do_not_optimize(s->buf);
+ *         BGSlice_free(s);
+ *     }
+ *
+ *     return bg_bench_suite_finish(&suite);
+ *
+ * The loop body runs warmup + runs times; only the part between start and
+ * stop is timed, so per-run setup and teardown stay out of the numbers.
+ * When the loop ends the result is reported: median, p99, mean, stddev and
+ * min of the run times, ns per op (median / ops) and, when bytes is not 0,
+ * bytes per second. On x86 the TSC is read alongside the clock and reported
+ * as reference cycles per op.
+ *
+ * Command line: --json prints one JSON document instead of a table, --runs N
+ * and --warmup N override the defaults, and any other argument is a filter
+ * that keeps only benchmarks whose name contains it.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bg_types.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#    define BG_BENCH_HAS_TSC 1
+#else
+#    define BG_BENCH_HAS_TSC 0
+#endif
+
+#define BG_BENCH_MAX_RUNS 1024
+#define BG_BENCH_DEFAULT_WARMUP 1
+#define BG_BENCH_DEFAULT_RUNS 10
+
+/*
+ * Make the compiler assume value is read (do_not_optimize) or that all memory
+ * is read and written (clobber), so the work being timed is not dropped or
+ * hoisted out of the loop.
+ */
+#define bg_bench_do_not_optimize(value)                                      \
+    do {                                                                     \
+        __typeof__(value) __bg_bench_v = (value);                            \
+        __asm__ volatile("" : : "r,m"(__bg_bench_v) : "memory");             \
+    } while (0)
+
+static inline void
+bg_bench_clobber(void)
+{
+    __asm__ volatile("" : : : "memory");
+}
+
+struct BGBenchSuite {
+    bool json;
+    int warmup;
+    int runs;
+    int n_filters;
+    char **filters;
+    size_t n_reported;
+};
+
+struct BGBench {
+    struct BGBenchSuite *suite;
+    const char *name;
+    size_t ops;
+    size_t bytes;
+    int iter;
+    u64 start_ns;
+    u64 start_cycles;
+    u64 ns[BG_BENCH_MAX_RUNS];
+    u64 cycles[BG_BENCH_MAX_RUNS];
+};
+
+struct BGBenchStats {
+    f64 median;
+    f64 p99;
+    f64 mean;
+    f64 stddev;
+    f64 min;
+};
+
+static inline u64
+bg_bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000000000ull + (u64) ts.tv_nsec;
+}
+
+static inline u64
+bg_bench_cycles(void)
+{
+#if BG_BENCH_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static inline void
+bg_bench_suite_init(struct BGBenchSuite *suite, int argc, char **argv)
+{
+    *suite = (struct BGBenchSuite) {
+        .warmup = BG_BENCH_DEFAULT_WARMUP,
+        .runs = BG_BENCH_DEFAULT_RUNS,
+        .filters = argv + 1,
+    };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            suite->json = true;
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            suite->runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            suite->warmup = atoi(argv[++i]);
+        } else {
+            suite->filters[suite->n_filters++] = argv[i];
+        }
+    }
+    if (suite->runs < 1)
+        suite->runs = 1;
+    if (suite->runs > BG_BENCH_MAX_RUNS)
+        suite->runs = BG_BENCH_MAX_RUNS;
+    if (suite->warmup < 0)
+        suite->warmup = 0;
+
+    if (suite->json) {
+        printf("{\"runs\": %d, \"warmup\": %d, \"benchmarks\": [",
+               suite->runs, suite->warmup);
+    } else {
+        printf("%-32s %12s %12s %10s %10s %12s\n", "benchmark", "median ms",
+               "p99 ms", "stddev %", "ns/op", "MB/s");
+    }
+}
+
+static inline int
+bg_bench_suite_finish(struct BGBenchSuite *suite)
+{
+    if (suite->json)
+        printf("\n]}\n");
+    return 0;
+}
+
+static inline bool
+bg_bench_selected(struct BGBenchSuite *suite, const char *name)
+{
+    if (suite->n_filters == 0)
+        return true;
+    for (int i = 0; i < suite->n_filters; i++)
+        if (strstr(name, suite->filters[i]) != NULL)
+            return true;
+    return false;
+}
+
+static inline void
+bg_bench_begin(struct BGBench *b, struct BGBenchSuite *suite,
+               const char *name, size_t ops, size_t bytes)
+{
+    b->suite = suite;
+    b->name = name;
+    b->ops = ops > 0 ? ops : 1;
+    b->bytes = bytes;
+    b->iter = bg_bench_selected(suite, name) ? 0 : -1;
+}
+
+static inline void
+bg_bench_start(struct BGBench *b)
+{
+    bg_bench_clobber();
+    b->start_cycles = bg_bench_cycles();
+    b->start_ns = bg_bench_now_ns();
+}
+
+static inline void
+bg_bench_stop(struct BGBench *b)
+{
+    u64 ns = bg_bench_now_ns();
+    u64 cycles = bg_bench_cycles();
+    bg_bench_clobber();
+    int run = b->iter - 1 - b->suite->warmup;
+    if (run >= 0) {
+        b->ns[run] = ns - b->start_ns;
+        b->cycles[run] = cycles - b->start_cycles;
+    }
+}
+
+static inline int
+bg_bench_cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *) a, y = *(const u64 *) b;
+    return (x > y) - (x < y);
+}
+
+// Sorts samples in place.
+static inline struct BGBenchStats
+bg_bench_stats(u64 *samples, size_t n)
+{
+    qsort(samples, n, sizeof(u64), bg_bench_cmp_u64);
+    f64 sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += (f64) samples[i];
+    f64 mean = sum / (f64) n;
+    f64 var = 0;
+    for (size_t i = 0; i < n; i++)
+        var += ((f64) samples[i] - mean) * ((f64) samples[i] - mean);
+
+    f64 median = (f64) samples[n / 2];
+    if (n % 2 == 0)
+        median = (median + (f64) samples[n / 2 - 1]) / 2;
+    // Nearest-rank p99.
+    size_t p99 = (size_t) ceil(0.99 * (f64) n);
+    return (struct BGBenchStats) {
+        .median = median,
+        .p99 = (f64) samples[p99 > 0 ? p99 - 1 : 0],
+        .mean = mean,
+        .stddev = n > 1 ? sqrt(var / (f64) (n - 1)) : 0,
+        .min = (f64) samples[0],
+    };
+}
+
+// Print s as a JSON string literal, quotes included.
+static inline void
+bg_bench_print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s != '\0'; s++) {
+        unsigned char ch = (unsigned char) *s;
+        if (ch == '"' || ch == '\\')
+            printf("\\%c", ch);
+        else if (ch < 0x20)
+            printf("\\u%04x", ch);
+        else
+            putchar(ch);
+    }
+    putchar('"');
+}
+
+static inline void
+bg_bench_report(struct BGBench *b)
+{
+    struct BGBenchSuite *suite = b->suite;
+    size_t n = suite->runs;
+    struct BGBenchStats t = bg_bench_stats(b->ns, n);
+    struct BGBenchStats c = bg_bench_stats(b->cycles, n);
+    f64 ns_per_op = t.median / (f64) b->ops;
+    f64 bytes_per_sec = t.median > 0 ? (f64) b->bytes / t.median * 1e9 : 0;
+
+    if (suite->json) {
+        printf("%s\n  {\"name\": ", suite->n_reported > 0 ? "," : "");
+        bg_bench_print_json_string(b->name);
+        printf(", \"ops\": %zu, \"bytes\": %zu, "
+               "\"median_ns\": %.0f, \"p99_ns\": %.0f, \"mean_ns\": %.1f, "
+               "\"stddev_ns\": %.1f, \"min_ns\": %.0f, \"ns_per_op\": %.4f, "
+               "\"bytes_per_sec\": %.0f, \"cycles_per_op\": %.4f}",
+               b->ops, b->bytes, t.median, t.p99, t.mean, t.stddev, t.min,
+               ns_per_op, bytes_per_sec, c.median / (f64) b->ops);
+    } else {
+        printf("%-32s %12.3f %12.3f %10.2f %10.3f ", b->name, t.median / 1e6,
+               t.p99 / 1e6, t.mean > 0 ? t.stddev / t.mean * 100 : 0,
+               ns_per_op);
+        if (b->bytes > 0)
+            printf("%12.1f\n", bytes_per_sec / 1e6);
+        else
+            printf("%12s\n", "-");
+    }
+    fflush(stdout);
+    suite->n_reported++;
+}
+
+/*
+ * True while there are runs left. Reports the result after the last one.
+ * A benchmark excluded by the filters never runs.
+ */
+static inline bool
+bg_bench_loop(struct BGBench *b)
+{
+    if (b->iter < 0)
+        return false;
+    if (b->iter == b->suite->warmup + b->suite->runs) {
+        bg_bench_report(b);
+        b->iter = -1;
+        return false;
+    }
+    b->iter++;
+    return true;
+}
+
+#endif // BG_BENCH_H
@@ -50,6 +50,8 @@ static const bool assert_enabled =
 #        endif
 #    elif defined(__clang__)
 #        define BG_DEBUG_TRAP() __builtin_debugtrap()
+#    elif defined(__GNUC__)
+#        define BG_DEBUG_TRAP() __builtin_trap()
 #    else
 #        define BG_DEBUG_TRAP() __asm int 3
 #    endif
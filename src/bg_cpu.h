@@ -0,0 +1,45 @@
+#ifndef BG_CPU_H
+#define BG_CPU_H
+
+/*
+ * Runtime CPU feature detection for kernels that ship several instruction
+ * set variants. Variants are compiled with __attribute__((target(...))) so
+ * the library itself needs no -m flags; callers pick one with bg_cpu_level()
+ * (cpuid, via __builtin_cpu_supports) at the start of an operation.
+ *
+ * Define BG_NO_SIMD to force the scalar paths everywhere.
+ */
+
+#if !defined(BG_NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#    define BG_CPU_X86 1
+#    include <immintrin.h>
+#    define BG_TARGET(isa) __attribute__((target(isa)))
+#else
+#    define BG_CPU_X86 0
+#    define BG_TARGET(isa)
+#endif
+
+enum BGCpuLevel {
+    BG_CPU_SCALAR,
+    BG_CPU_SSE42,
+    BG_CPU_AVX2,
+    BG_CPU_AVX512,
+};
+
+static inline enum BGCpuLevel
+bg_cpu_level(void)
+{
+#if BG_CPU_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512vl"))
+        return BG_CPU_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return BG_CPU_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return BG_CPU_SSE42;
+#endif
+    return BG_CPU_SCALAR;
+}
+
+#endif // BG_CPU_H
@@ -0,0 +1,138 @@
+#include "bg_stats.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fields of struct BGStats that add up across threads.
+#define STATS_SUMS(X)      \
+    X(slice_grows)         \
+    X(slice_shrinks)       \
+    X(bytes_copied)        \
+    X(allocs)              \
+    X(reallocs)            \
+    X(frees)               \
+    X(bytes_allocated)
+
+#ifdef BG_STATS
+
+static void
+stats_merge(struct BGStats *dst, struct BGStats *src)
+{
+#    define STATS_SUM(f) dst->f += __atomic_load_n(&src->f, __ATOMIC_RELAXED);
+    STATS_SUMS(STATS_SUM)
+#    undef STATS_SUM
+    u64 peak = __atomic_load_n(&src->peak_cap_bytes, __ATOMIC_RELAXED);
+    if (peak > dst->peak_cap_bytes)
+        dst->peak_cap_bytes = peak;
+}
+
+struct stats_block {
+    struct BGStats stats;
+    struct stats_block *prev;
+    struct stats_block *next;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+// Blocks of live threads, and the totals of threads that have exited.
+static struct stats_block *stats_blocks;
+static struct BGStats stats_retired;
+
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+
+_Thread_local struct BGStats *__bg_stats_local;
+
+// Thread exit: fold the block into stats_retired.
+static void
+stats_block_retire(void *arg)
+{
+    struct stats_block *b = arg;
+    pthread_mutex_lock(&stats_lock);
+    stats_merge(&stats_retired, &b->stats);
+    if (b->prev != NULL)
+        b->prev->next = b->next;
+    else
+        stats_blocks = b->next;
+    if (b->next != NULL)
+        b->next->prev = b->prev;
+    pthread_mutex_unlock(&stats_lock);
+    __bg_stats_local = NULL;
+    free(b);
+}
+
+static void
+stats_init(void)
+{
+    pthread_key_create(&stats_key, stats_block_retire);
+}
+
+/*
+ * First count on this thread: link a fresh block. Uses libc directly, as the
+ * counters themselves must not go through a counted allocator. If that
+ * fails, counts land in a thread-local overflow block that snapshots ignore.
+ */
+struct BGStats *
+__bg_stats_register(void)
+{
+    static _Thread_local struct BGStats overflow;
+
+    pthread_once(&stats_once, stats_init);
+    struct stats_block *b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        __bg_stats_local = &overflow;
+        return &overflow;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    b->next = stats_blocks;
+    if (stats_blocks != NULL)
+        stats_blocks->prev = b;
+    stats_blocks = b;
+    pthread_mutex_unlock(&stats_lock);
+
+    pthread_setspecific(stats_key, b);
+    __bg_stats_local = &b->stats;
+    return &b->stats;
+}
+
+struct BGStats
+bg_stats_snapshot(void)
+{
+    struct BGStats total = { 0 };
+    pthread_mutex_lock(&stats_lock);
+    stats_merge(&total, &stats_retired);
+    for (struct stats_block *b = stats_blocks; b != NULL; b = b->next)
+        stats_merge(&total, &b->stats);
+    pthread_mutex_unlock(&stats_lock);
+    return total;
+}
+
+void
+bg_stats_reset(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    memset(&stats_retired, 0, sizeof(stats_retired));
+    for (struct stats_block *b = stats_blocks; b != NULL; b = b->next) {
+#    define STATS_ZERO(f) __atomic_store_n(&b->stats.f, 0, __ATOMIC_RELAXED);
+        STATS_SUMS(STATS_ZERO)
+        STATS_ZERO(peak_cap_bytes)
+#    undef STATS_ZERO
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+#else
+
+struct BGStats
+bg_stats_snapshot(void)
+{
+    return (struct BGStats) { 0 };
+}
+
+void
+bg_stats_reset(void)
+{
+}
+
+#endif // BG_STATS
@@ -0,0 +1,87 @@
+#ifndef BG_STATS_H
+#define BG_STATS_H
+
+/*
+ * Opt-in counters for slice growth and allocator traffic.
+ *
+ * Build with -DBG_STATS to turn them on. Each thread bumps its own block of
+ * counters with plain (relaxed) stores, so counting costs a thread-local
+ * add and no shared cache line. bg_stats_snapshot sums the blocks of every
+ * live thread plus what exited threads left behind. Without BG_STATS the
+ * bg_stats_add/bg_stats_max hooks compile to nothing and snapshots are all
+ * zero.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bg_types.h"
+
+struct BGStats {
+    // Buffer resizes that raised (lowered) a slice's capacity: BGSlice_grow,
+    // BGSlice_grow_to_cap, BGSlice_reserve, bulk inserts, shrink_to_fit.
+    u64 slice_grows;
+    u64 slice_shrinks;
+    // Bytes carried over when a resize put the items at a new address. An
+    // upper bound: realloc may remap pages rather than copy them.
+    u64 bytes_copied;
+    // Largest capacity, in bytes, any slice has been resized to.
+    u64 peak_cap_bytes;
+    // Calls through struct Allocator. allocs - frees is the number of live
+    // allocations; bytes_allocated counts malloc, calloc and realloc sizes.
+    u64 allocs;
+    u64 reallocs;
+    u64 frees;
+    u64 bytes_allocated;
+};
+
+// Totals over all threads so far. Counters being bumped concurrently may or
+// may not be included.
+struct BGStats bg_stats_snapshot(void);
+// Zero every counter. Counts racing with the reset may survive it.
+void bg_stats_reset(void);
+
+#ifdef BG_STATS
+
+extern _Thread_local struct BGStats *__bg_stats_local;
+struct BGStats *__bg_stats_register(void);
+
+static inline struct BGStats *
+bg_stats_local(void)
+{
+    struct BGStats *stats = __bg_stats_local;
+    if (__builtin_expect(stats == NULL, 0))
+        stats = __bg_stats_register();
+    return stats;
+}
+
+// Only the owning thread writes a block, so load + store cannot lose counts;
+// the atomics just keep concurrent snapshots well-defined.
+static inline void
+__bg_stats_add(u64 *counter, u64 n)
+{
+    u64 v = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    __atomic_store_n(counter, v + n, __ATOMIC_RELAXED);
+}
+
+static inline void
+__bg_stats_max(u64 *counter, u64 v)
+{
+    if (v > __atomic_load_n(counter, __ATOMIC_RELAXED))
+        __atomic_store_n(counter, v, __ATOMIC_RELAXED);
+}
+
+#    define bg_stats_add(field, n) \
+        __bg_stats_add(&bg_stats_local()->field, (n))
+#    define bg_stats_max(field, v) \
+        __bg_stats_max(&bg_stats_local()->field, (v))
+
+#else
+
+// sizeof keeps the arguments "used" without evaluating them.
+#    define bg_stats_add(field, n) ((void) sizeof(n))
+#    define bg_stats_max(field, v) ((void) sizeof(v))
+
+#endif // BG_STATS
+
+#endif // BG_STATS_H
@@ -2,6 +2,9 @@
 #define TESTUTILS_H
 
 #include <setjmp.h>
+#include <stdlib.h>
+
+#include "mem/bg_allocator.h"
 
 #ifndef bg_expect_assertion
 // The third argument is how many assertion is expected to run.
@@ -34,4 +37,26 @@
 // Used to test if assertion works.
 jmp_buf test_resume_env;
 
+// aligned_alloc calls bg_failing_allocator lets through before failing; may
+// be changed at any point of a test.
+int bg_failing_budget;
+
+static inline void *
+bg_failing_aligned_alloc(size_t alignment, size_t size)
+{
+    if (bg_failing_budget-- <= 0)
+        return NULL;
+    return aligned_alloc(alignment, size);
+}
+
+// The malloc allocator, except that aligned_alloc fails after budget calls.
+static inline struct Allocator
+bg_failing_allocator(int budget)
+{
+    struct Allocator failing = *malloc_allocator;
+    failing.aligned_alloc = bg_failing_aligned_alloc;
+    bg_failing_budget = budget;
+    return failing;
+}
+
 #endif // TESTUTILS_H
\ No newline at end of file
@@ -0,0 +1,373 @@
+#include "bg_cslice.h"
+
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_types.h"
+#include "mem/bg_allocator.h"
+
+#define assert_cslice(condition, fmt, ...) \
+    bg_assert("BGCSlice", condition, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+// Counters that many threads bump each get a cache line to themselves.
+#define CSLICE_LINE 64
+
+/*
+ * Segment k lives in slot k + 1 - 2^b of directory block b, where
+ * b = floor(log2(k + 1)); block b holds 2^b segments. Blocks are allocated
+ * on first use, each twice the size of the one before, so the directory
+ * never moves either and finding a segment is O(1) at any length.
+ */
+#define CSLICE_BLOCKS 48
+
+// The header of a segment takes one cache line; its items follow.
+struct cslice_segment {
+    // Items committed in this segment, out of seg_items.
+    size_t committed;
+};
+
+#define cslice_items(seg) ((char *) (seg) + CSLICE_LINE)
+
+struct BGCSlice {
+    size_t elem_size;
+    size_t seg_shift;
+    size_t seg_bytes;
+    struct Allocator *allocator;
+    // Set when a segment could not be allocated: appends fail from then on.
+    bool failed;
+    // Leading segments known to be fully committed; a hint for
+    // committed_len that may lag behind.
+    size_t full_segments;
+    struct cslice_segment **blocks[CSLICE_BLOCKS];
+    // Next index to hand out.
+    _Alignas(CSLICE_LINE) size_t len;
+};
+
+BGCSlice *
+__BGCSlice_new(size_t elem_size, size_t seg_items,
+               struct Allocator *allocator)
+{
+    assert_cslice(elem_size > 0, "elem_size cannot be zero");
+
+    if (allocator == NULL)
+        allocator = malloc_allocator;
+    if (seg_items == 0)
+        seg_items = BG_CSLICE_SEGMENT_ITEMS;
+    size_t shift = 0;
+    while (((size_t) 1 << shift) < seg_items)
+        shift++;
+
+    size_t size = (sizeof(BGCSlice) + CSLICE_LINE - 1) & ~(CSLICE_LINE - 1);
+    BGCSlice *s = bg_allocator_aligned_alloc(allocator, CSLICE_LINE, size);
+    if (s == NULL)
+        return NULL;
+    memset(s, 0, sizeof(*s));
+    s->elem_size = elem_size;
+    s->seg_shift = shift;
+    s->seg_bytes = CSLICE_LINE
+                   + (((elem_size << shift) + CSLICE_LINE - 1)
+                      & ~(size_t) (CSLICE_LINE - 1));
+    s->allocator = allocator;
+    return s;
+}
+
+void
+BGCSlice_free(BGCSlice *s)
+{
+    if (bg_unlikely(s == NULL))
+        return;
+    for (size_t b = 0; b < CSLICE_BLOCKS; b++) {
+        if (s->blocks[b] == NULL)
+            continue;
+        for (size_t i = 0; i < (size_t) 1 << b; i++)
+            bg_allocator_free(s->allocator, s->blocks[b][i]);
+        bg_allocator_free(s->allocator, s->blocks[b]);
+    }
+    bg_allocator_free(s->allocator, s);
+}
+
+size_t
+BGCSlice_elem_size(BGCSlice *s)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+    return s->elem_size;
+}
+
+size_t
+BGCSlice_segment_items(BGCSlice *s)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+    return (size_t) 1 << s->seg_shift;
+}
+
+size_t
+BGCSlice_reserved_len(BGCSlice *s)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+    return __atomic_load_n(&s->len, __ATOMIC_RELAXED);
+}
+
+////////////////////
+// Segments
+//
+
+// Directory slot of segment k, allocating its block if create is set.
+static struct cslice_segment **
+cslice_slot(BGCSlice *s, size_t k, bool create)
+{
+    size_t b = 63 - __builtin_clzll(k + 1);
+    assert_cslice(b < CSLICE_BLOCKS, "segment %zu is beyond the directory",
+                  k);
+
+    struct cslice_segment **block =
+        __atomic_load_n(&s->blocks[b], __ATOMIC_ACQUIRE);
+    if (block == NULL) {
+        if (!create)
+            return NULL;
+        block = bg_allocator_calloc(s->allocator, (size_t) 1 << b,
+                                    sizeof(*block));
+        if (block == NULL)
+            return NULL;
+        struct cslice_segment **seen = NULL;
+        if (!__atomic_compare_exchange_n(&s->blocks[b], &seen, block, false,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+            bg_allocator_free(s->allocator, block);
+            block = seen;
+        }
+    }
+    return &block[k + 1 - ((size_t) 1 << b)];
+}
+
+/*
+ * Segment k, or NULL if it does not exist yet. With create set, producers
+ * that reach a missing segment race to install one; the losers free
+ * theirs. NULL then means allocation failed.
+ */
+static struct cslice_segment *
+cslice_segment(BGCSlice *s, size_t k, bool create)
+{
+    struct cslice_segment **slot = cslice_slot(s, k, create);
+    if (slot == NULL)
+        return NULL;
+    struct cslice_segment *seg = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (seg != NULL || !create)
+        return seg;
+
+    seg = bg_allocator_aligned_alloc(s->allocator, CSLICE_LINE,
+                                     s->seg_bytes);
+    if (seg == NULL)
+        return NULL;
+    seg->committed = 0;
+    struct cslice_segment *seen = NULL;
+    if (!__atomic_compare_exchange_n(slot, &seen, seg, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        bg_allocator_free(s->allocator, seg);
+        seg = seen;
+    }
+    return seg;
+}
+
+/*
+ * How many items of segment k, from its start, are committed. committed is
+ * read before len: every commit it counts was for a range reserved before
+ * that len was read, so the two can only agree when nothing reserved in the
+ * segment is still being written. Otherwise nothing in a partly written
+ * segment is known to be complete.
+ */
+static size_t
+cslice_visible(BGCSlice *s, size_t k, struct cslice_segment *seg)
+{
+    size_t seg_items = (size_t) 1 << s->seg_shift;
+    size_t committed = __atomic_load_n(&seg->committed, __ATOMIC_ACQUIRE);
+    if (committed == seg_items)
+        return seg_items;
+
+    size_t reserved = __atomic_load_n(&s->len, __ATOMIC_RELAXED)
+                      - (k << s->seg_shift);
+    if (reserved > seg_items)
+        reserved = seg_items;
+    return committed == reserved ? committed : 0;
+}
+
+////////////////////
+// Producers
+//
+
+/*
+ * Claim n items, returning the first index and its segment in *seg; -1 on
+ * failure. Every segment the claim touches is made to exist before the
+ * claim is published, so a failed allocation claims nothing: there is no
+ * hole for readers to stop at, and the items appended before stay visible.
+ * A compare-and-swap in place of a fetch-add, since the range has to be
+ * known before it is taken; the segments are only allocated once, by
+ * whichever claim first reaches them.
+ */
+static ssize_t
+cslice_reserve(BGCSlice *s, size_t n, struct cslice_segment **seg)
+{
+    size_t idx = __atomic_load_n(&s->len, __ATOMIC_RELAXED);
+    do {
+        if (__atomic_load_n(&s->failed, __ATOMIC_RELAXED))
+            return -1;
+        if (n == 0)
+            return idx;
+
+        size_t first = idx >> s->seg_shift;
+        size_t last = (idx + n - 1) >> s->seg_shift;
+        for (size_t k = first; k <= last; k++) {
+            struct cslice_segment *got = cslice_segment(s, k, true);
+            if (got == NULL) {
+                __atomic_store_n(&s->failed, true, __ATOMIC_RELAXED);
+                return -1;
+            }
+            if (k == first)
+                *seg = got;
+        }
+    } while (!__atomic_compare_exchange_n(&s->len, &idx, idx + n, true,
+                                          __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    return idx;
+}
+
+ssize_t
+BGCSlice_reserve(BGCSlice *s, size_t n)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+
+    struct cslice_segment *seg;
+    return cslice_reserve(s, n, &seg);
+}
+
+void
+BGCSlice_commit(BGCSlice *s, size_t idx, size_t n)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+
+    size_t seg_items = (size_t) 1 << s->seg_shift;
+    while (n > 0) {
+        struct cslice_segment *seg =
+            cslice_segment(s, idx >> s->seg_shift, false);
+        assert_cslice(seg != NULL, "item %zu has not been reserved", idx);
+        size_t count = seg_items - (idx & (seg_items - 1));
+        if (count > n)
+            count = n;
+        // Release: readers that see the count see the items.
+        __atomic_fetch_add(&seg->committed, count, __ATOMIC_RELEASE);
+        idx += count;
+        n -= count;
+    }
+}
+
+void *
+BGCSlice_at(BGCSlice *s, size_t idx, size_t *run)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+
+    struct cslice_segment *seg =
+        cslice_segment(s, idx >> s->seg_shift, false);
+    assert_cslice(seg != NULL, "item %zu has not been reserved", idx);
+    size_t off = idx & (((size_t) 1 << s->seg_shift) - 1);
+    if (run != NULL)
+        *run = ((size_t) 1 << s->seg_shift) - off;
+    return cslice_items(seg) + off * s->elem_size;
+}
+
+ssize_t
+BGCSlice_append(BGCSlice *s, const void *item)
+{
+    return BGCSlice_append_n(s, item, 1);
+}
+
+// Copies and commits a segment at a time, looking each one up once.
+ssize_t
+BGCSlice_append_n(BGCSlice *s, const void *items, size_t n)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+    assert_cslice(items != NULL || n == 0, "items cannot be NULL");
+
+    struct cslice_segment *seg = NULL;
+    ssize_t first = cslice_reserve(s, n, &seg);
+    if (first < 0)
+        return -1;
+
+    size_t seg_items = (size_t) 1 << s->seg_shift;
+    const char *src = items;
+    size_t idx = first, left = n;
+    while (left > 0) {
+        if (seg == NULL)
+            seg = cslice_segment(s, idx >> s->seg_shift, false);
+        size_t off = idx & (seg_items - 1);
+        size_t run = seg_items - off < left ? seg_items - off : left;
+        memcpy(cslice_items(seg) + off * s->elem_size, src,
+               run * s->elem_size);
+        __atomic_fetch_add(&seg->committed, run, __ATOMIC_RELEASE);
+        src += run * s->elem_size;
+        idx += run;
+        left -= run;
+        seg = NULL;
+    }
+    return first;
+}
+
+////////////////////
+// Readers
+//
+
+size_t
+BGCSlice_committed_len(BGCSlice *s)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+
+    // The hint is published with release so that starting from it still
+    // orders this thread after the commits of the segments it skips. Racing
+    // readers may store an older hint over a newer one, which only costs a
+    // longer walk next time.
+    size_t seg_items = (size_t) 1 << s->seg_shift;
+    size_t k = __atomic_load_n(&s->full_segments, __ATOMIC_ACQUIRE);
+    size_t start = k;
+    size_t len;
+    for (;; k++) {
+        struct cslice_segment *seg = cslice_segment(s, k, false);
+        if (seg == NULL) {
+            len = k << s->seg_shift;
+            break;
+        }
+        size_t visible = cslice_visible(s, k, seg);
+        if (visible < seg_items) {
+            len = (k << s->seg_shift) + visible;
+            break;
+        }
+    }
+    if (k != start)
+        __atomic_store_n(&s->full_segments, k, __ATOMIC_RELEASE);
+    return len;
+}
+
+struct BGCSliceIterator
+BGCSlice_iter(BGCSlice *s)
+{
+    assert_cslice(s != NULL, "slice cannot be NULL");
+    return (struct BGCSliceIterator) { .s = s, .idx = 0 };
+}
+
+size_t
+BGCSlice_iter_next_chunk(struct BGCSliceIterator *it, void **chunk)
+{
+    assert_cslice(it != NULL && chunk != NULL, "arguments cannot be NULL");
+
+    BGCSlice *s = it->s;
+    size_t k = it->idx >> s->seg_shift;
+    size_t off = it->idx & (((size_t) 1 << s->seg_shift) - 1);
+    struct cslice_segment *seg = cslice_segment(s, k, false);
+    if (seg == NULL)
+        return 0;
+    // Finishing a segment moves idx to the start of the next one, so off
+    // is always inside this one.
+    size_t visible = cslice_visible(s, k, seg);
+    if (visible <= off)
+        return 0;
+    *chunk = cslice_items(seg) + off * s->elem_size;
+    it->idx += visible - off;
+    return visible - off;
+}
@@ -0,0 +1,100 @@
+#ifndef BG_CSLICE_H
+#define BG_CSLICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "bg_types.h"
+#include "mem/bg_allocator.h"
+
+/*
+ * Append-only slice for many producer threads and any number of readers,
+ * without a lock.
+ *
+ * A producer claims an index range with an atomic compare-and-swap on the
+ * length, writes its items in place and commits them, which adds their
+ * count to the commit counter of each segment they fall in. The segments a
+ * range needs are allocated before it is claimed. Items live in fixed-size
+ * segments that are never moved or freed before the slice is, so an item's
+ * address is stable from the moment it is reserved; growing allocates a new
+ * segment and links it into the directory, touching nothing that exists.
+ *
+ * Readers only see whole prefixes: a segment's items become visible once
+ * every item reserved in it so far has been committed, which is when its
+ * producers pause or when it fills. Smaller segments publish sooner, larger
+ * ones allocate less often.
+ *
+ *     BGCSlice *log = BGCSlice_new(struct event, 0, NULL);
+ *     // Any thread:
+ *     BGCSlice_append(log, &ev);
+ *     // Reader:
+ *     struct BGCSliceIterator it = BGCSlice_iter(log);
+ *     void *chunk;
+ *     size_t n;
+ *     while ((n = BGCSlice_iter_next_chunk(&it, &chunk)) != 0)
+ *         handle(chunk, n);
+ *
+ * If a segment cannot be allocated, the append that needed it and every
+ * later one fail without claiming anything, so readers still see every
+ * item appended before.
+ */
+
+typedef struct BGCSlice BGCSlice;
+
+// Items per segment when 0 is asked for.
+#define BG_CSLICE_SEGMENT_ITEMS 4096
+
+// seg_items is rounded up to a power of two. allocator may be NULL. NULL on
+// failure.
+BGCSlice *__BGCSlice_new(size_t elem_size, size_t seg_items,
+                         struct Allocator *allocator);
+#define BGCSlice_new(type, seg_items, allocator) \
+    __BGCSlice_new(sizeof(type), seg_items, allocator)
+// No other thread may be using s.
+void BGCSlice_free(BGCSlice *s);
+
+size_t BGCSlice_elem_size(BGCSlice *s);
+size_t BGCSlice_segment_items(BGCSlice *s);
+// Items reserved so far, committed or not.
+size_t BGCSlice_reserved_len(BGCSlice *s);
+// Length of the prefix whose items are all committed and may be read.
+size_t BGCSlice_committed_len(BGCSlice *s);
+
+/*
+ * Producers. append and append_n reserve, copy and commit in one go and
+ * return the index of the first item; -1 on allocation failure.
+ */
+ssize_t BGCSlice_append(BGCSlice *s, const void *item);
+ssize_t BGCSlice_append_n(BGCSlice *s, const void *items, size_t n);
+
+/*
+ * Writing in place: reserve n items, fill them through BGCSlice_at, then
+ * commit exactly that range once. The range may cross segments, so it is
+ * not necessarily contiguous.
+ */
+ssize_t BGCSlice_reserve(BGCSlice *s, size_t n);
+void BGCSlice_commit(BGCSlice *s, size_t idx, size_t n);
+
+/*
+ * Address of item idx, which must have been reserved. run, unless NULL,
+ * gets the number of items from idx to the end of its segment, which are
+ * contiguous. Readers must stay below BGCSlice_committed_len.
+ */
+void *BGCSlice_at(BGCSlice *s, size_t idx, size_t *run);
+
+/*
+ * Reader over the committed items, in index order. next_chunk hands out
+ * the next contiguous run of committed items and returns its length; 0
+ * means the reader has caught up for now, and a later call picks up
+ * whatever has been committed since.
+ */
+struct BGCSliceIterator {
+    BGCSlice *s;
+    size_t idx;
+};
+
+struct BGCSliceIterator BGCSlice_iter(BGCSlice *s);
+size_t BGCSlice_iter_next_chunk(struct BGCSliceIterator *it, void **chunk);
+
+#endif // BG_CSLICE_H
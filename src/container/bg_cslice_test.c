@@ -0,0 +1,275 @@
+#include "bg_cslice.h"
+#include "unity.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_testutils.h"
+#include "bg_types.h"
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+void
+test_cslice_append(void)
+{
+    BGCSlice *s = BGCSlice_new(u64, 5, NULL);
+    TEST_ASSERT_EQUAL(8, BGCSlice_segment_items(s));
+    TEST_ASSERT_EQUAL(sizeof(u64), BGCSlice_elem_size(s));
+
+    // Addresses stay put as segments are added.
+    u64 first = 100;
+    TEST_ASSERT_EQUAL(0, BGCSlice_append(s, &first));
+    u64 *p0 = BGCSlice_at(s, 0, NULL);
+    u64 items[20];
+    for (u64 i = 0; i < 20; i++)
+        items[i] = 101 + i;
+    TEST_ASSERT_EQUAL(1, BGCSlice_append_n(s, items, 20));
+    TEST_ASSERT_EQUAL_PTR(p0, BGCSlice_at(s, 0, NULL));
+    TEST_ASSERT_EQUAL(21, BGCSlice_reserved_len(s));
+    TEST_ASSERT_EQUAL(21, BGCSlice_committed_len(s));
+
+    size_t run;
+    TEST_ASSERT_EQUAL_UINT64(110, *(u64 *) BGCSlice_at(s, 10, &run));
+    TEST_ASSERT_EQUAL(6, run);
+
+    // The iterator hands out one chunk per segment.
+    struct BGCSliceIterator it = BGCSlice_iter(s);
+    void *chunk;
+    size_t n, total = 0, chunks = 0;
+    while ((n = BGCSlice_iter_next_chunk(&it, &chunk)) != 0) {
+        for (size_t i = 0; i < n; i++)
+            TEST_ASSERT_EQUAL_UINT64(100 + total + i, ((u64 *) chunk)[i]);
+        total += n;
+        chunks++;
+    }
+    TEST_ASSERT_EQUAL(21, total);
+    TEST_ASSERT_EQUAL(3, chunks);
+
+    // Picks up where it left off.
+    u64 next = 121;
+    BGCSlice_append(s, &next);
+    TEST_ASSERT_EQUAL(1, BGCSlice_iter_next_chunk(&it, &chunk));
+    TEST_ASSERT_EQUAL_UINT64(121, *(u64 *) chunk);
+    TEST_ASSERT_EQUAL(0, BGCSlice_iter_next_chunk(&it, &chunk));
+
+    BGCSlice_free(s);
+}
+
+void
+test_cslice_reserve_commit(void)
+{
+    BGCSlice *s = BGCSlice_new(u32, 4, NULL);
+
+    // A reservation that crosses into the next segment.
+    ssize_t a = BGCSlice_reserve(s, 3);
+    ssize_t b = BGCSlice_reserve(s, 3);
+    TEST_ASSERT_EQUAL(0, a);
+    TEST_ASSERT_EQUAL(3, b);
+    for (size_t i = 0; i < 3; i++)
+        *(u32 *) BGCSlice_at(s, b + i, NULL) = 10 + i;
+    BGCSlice_commit(s, b, 3);
+
+    // b is done, but a, before it in the same segment, is not.
+    TEST_ASSERT_EQUAL(0, BGCSlice_committed_len(s));
+    struct BGCSliceIterator it = BGCSlice_iter(s);
+    void *chunk;
+    TEST_ASSERT_EQUAL(0, BGCSlice_iter_next_chunk(&it, &chunk));
+
+    for (size_t i = 0; i < 3; i++)
+        *(u32 *) BGCSlice_at(s, a + i, NULL) = i;
+    BGCSlice_commit(s, a, 3);
+    TEST_ASSERT_EQUAL(6, BGCSlice_committed_len(s));
+    TEST_ASSERT_EQUAL(4, BGCSlice_iter_next_chunk(&it, &chunk));
+    TEST_ASSERT_EQUAL_UINT32(10, ((u32 *) chunk)[3]);
+    TEST_ASSERT_EQUAL(2, BGCSlice_iter_next_chunk(&it, &chunk));
+    TEST_ASSERT_EQUAL_UINT32(12, ((u32 *) chunk)[1]);
+
+    BGCSlice_free(s);
+}
+
+#define CSLICE_PRODUCERS 4
+#define CSLICE_PER_PRODUCER 20000
+
+struct cslice_event {
+    u32 producer;
+    u32 seq;
+};
+
+static void *
+cslice_producer(void *arg)
+{
+    BGCSlice *s = ((void **) arg)[0];
+    u32 producer = (u32) (uintptr_t) ((void **) arg)[1];
+    for (u32 i = 0; i < CSLICE_PER_PRODUCER; i++) {
+        struct cslice_event ev = { producer, i + 1 };
+        if (i % 2 == 0)
+            BGCSlice_append(s, &ev);
+        else
+            BGCSlice_append_n(s, &ev, 1);
+    }
+    return NULL;
+}
+
+struct cslice_reader_ctx {
+    BGCSlice *s;
+    // Items that were not the next one expected from their producer.
+    size_t bad;
+};
+
+/*
+ * Reads along while the producers run, until it has seen every item. Each
+ * producer appends seq 1, 2, ... in order, so anything else read, such as
+ * whatever an unwritten slot happens to hold, is caught.
+ */
+static void *
+cslice_reader(void *arg)
+{
+    struct cslice_reader_ctx *ctx = arg;
+    struct BGCSliceIterator it = BGCSlice_iter(ctx->s);
+    u32 last[CSLICE_PRODUCERS] = { 0 };
+    size_t seen = 0;
+    while (seen < (size_t) CSLICE_PRODUCERS * CSLICE_PER_PRODUCER) {
+        void *chunk;
+        size_t n = BGCSlice_iter_next_chunk(&it, &chunk);
+        for (size_t i = 0; i < n; i++) {
+            struct cslice_event *ev = &((struct cslice_event *) chunk)[i];
+            if (ev->producer >= CSLICE_PRODUCERS
+                || ev->seq != last[ev->producer] + 1) {
+                ctx->bad++;
+                continue;
+            }
+            last[ev->producer] = ev->seq;
+        }
+        seen += n;
+    }
+    return NULL;
+}
+
+void
+test_cslice_threads(void)
+{
+    BGCSlice *s = BGCSlice_new(struct cslice_event, 64, NULL);
+    pthread_t producers[CSLICE_PRODUCERS], reader;
+    void *args[CSLICE_PRODUCERS][2];
+    struct cslice_reader_ctx ctx = { .s = s };
+    pthread_create(&reader, NULL, cslice_reader, &ctx);
+    for (uintptr_t p = 0; p < CSLICE_PRODUCERS; p++) {
+        args[p][0] = s;
+        args[p][1] = (void *) p;
+        pthread_create(&producers[p], NULL, cslice_producer, args[p]);
+    }
+    for (int p = 0; p < CSLICE_PRODUCERS; p++)
+        pthread_join(producers[p], NULL);
+    pthread_join(reader, NULL);
+    TEST_ASSERT_EQUAL(0, ctx.bad);
+
+    // Each producer's items appear once, in the order it appended them.
+    size_t n = (size_t) CSLICE_PRODUCERS * CSLICE_PER_PRODUCER;
+    TEST_ASSERT_EQUAL(n, BGCSlice_reserved_len(s));
+    TEST_ASSERT_EQUAL(n, BGCSlice_committed_len(s));
+    u32 next[CSLICE_PRODUCERS] = { 0 };
+    for (size_t i = 0; i < n; i++) {
+        struct cslice_event *ev = BGCSlice_at(s, i, NULL);
+        TEST_ASSERT_TRUE(ev->producer < CSLICE_PRODUCERS);
+        TEST_ASSERT_EQUAL_UINT32(++next[ev->producer], ev->seq);
+    }
+    for (int p = 0; p < CSLICE_PRODUCERS; p++)
+        TEST_ASSERT_EQUAL_UINT32(CSLICE_PER_PRODUCER, next[p]);
+
+    BGCSlice_free(s);
+}
+
+void
+test_cslice_alloc_failure(void)
+{
+    // The slice itself and its first segment.
+    struct Allocator failing = bg_failing_allocator(2);
+    BGCSlice *s = BGCSlice_new(u64, 4, &failing);
+    u64 items[6] = { 1, 2, 3, 4, 5, 6 };
+    TEST_ASSERT_EQUAL(0, BGCSlice_append_n(s, items, 3));
+    TEST_ASSERT_EQUAL(-1, BGCSlice_append_n(s, items, 3));
+    bg_failing_budget = 10;
+    TEST_ASSERT_EQUAL(-1, BGCSlice_append(s, items));
+
+    // The failed appends claimed nothing: what came before stays visible.
+    TEST_ASSERT_EQUAL(3, BGCSlice_reserved_len(s));
+    TEST_ASSERT_EQUAL(3, BGCSlice_committed_len(s));
+    struct BGCSliceIterator it = BGCSlice_iter(s);
+    void *chunk;
+    TEST_ASSERT_EQUAL(3, BGCSlice_iter_next_chunk(&it, &chunk));
+    TEST_ASSERT_EQUAL_MEMORY(items, chunk, 3 * sizeof(u64));
+    BGCSlice_free(s);
+}
+
+typedef struct {
+    void (*test_func)(void);
+    const char *test_name;
+} test_case_t;
+
+static const test_case_t all_tests[] = {
+    { test_cslice_append, "test_cslice_append" },
+    { test_cslice_reserve_commit, "test_cslice_reserve_commit" },
+    { test_cslice_threads, "test_cslice_threads" },
+    { test_cslice_alloc_failure, "test_cslice_alloc_failure" },
+};
+
+#define NUM_TESTS (sizeof(all_tests) / sizeof(all_tests[0]))
+
+void
+run_all_tests(void)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        UnityDefaultTestRun(all_tests[i].test_func, all_tests[i].test_name,
+                            __LINE__);
+    }
+}
+
+void
+run_single_test(const char *test_name)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        if (strcmp(all_tests[i].test_name, test_name) == 0) {
+            UnityDefaultTestRun(all_tests[i].test_func,
+                                all_tests[i].test_name, __LINE__);
+            return;
+        }
+    }
+    printf("Test '%s' not found!\n", test_name);
+}
+
+void
+list_all_tests(void)
+{
+    printf("Available tests (%zu total):\n", NUM_TESTS);
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        printf("  [%2zu] %s\n", i, all_tests[i].test_name);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc == 1) {
+        run_all_tests();
+    } else if (argc == 2) {
+        if (strcmp(argv[1], "--list") == 0)
+            list_all_tests();
+        else
+            run_single_test(argv[1]);
+    } else {
+        printf("Usage: %s [test_name|--list]\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,835 @@
+#include "bg_search.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_types.h"
+
+/*
+ * The binary searches keep a window [base, base + n) that holds the answer
+ * or ends right before it. Each step looks at base[half], half = n / 2, and
+ * either keeps the window where it is or moves it past base[half], shrinking
+ * it to n - half either way. The move is written so that the compiler turns
+ * it into a cmov: there is no branch to mispredict and the loop runs
+ * exactly ceil(log2 n) times for every key. Whichever way a step goes, the
+ * next one reads one of two known items, and both are prefetched.
+ */
+
+#define assert_search(condition, fmt, ...) \
+    bg_assert("BGSearch", condition, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+static inline void
+search_check(BGSlice *s, size_t elem_size)
+{
+    assert_search(s != NULL, "slice cannot be NULL");
+    assert_search(s->elem_size == elem_size,
+                  "slice elem_size %zu does not match the search type size "
+                  "%zu",
+                  s->elem_size, elem_size);
+}
+
+static inline void
+search_check_out(BGSlice *out, const void *keys, size_t n)
+{
+    assert_search(out != NULL, "out cannot be NULL");
+    assert_search(keys != NULL || n == 0, "keys cannot be NULL");
+    assert_search(out->elem_size == sizeof(size_t),
+                  "out must be a slice of size_t, not of %zu byte items",
+                  out->elem_size);
+}
+
+////////////////////
+// Sorted slices
+//
+
+/*
+ * The answer is the first item for which `item < key` (lower bound) or
+ * `!(key < item)` (upper bound) stops holding.
+ */
+#define BG_SEARCH_BOUND_DEFINE(T, name, before)                            \
+    static size_t search_##name##_##T(const T *a, size_t n, T key)         \
+    {                                                                      \
+        if (n == 0)                                                        \
+            return 0;                                                      \
+        const T *base = a;                                                 \
+        while (n > 1) {                                                    \
+            size_t half = n / 2;                                           \
+            n -= half;                                                     \
+            __builtin_prefetch(base + n / 2);                              \
+            __builtin_prefetch(base + half + n / 2);                       \
+            T item = base[half];                                           \
+            base = (before) ? base + half : base;                          \
+        }                                                                  \
+        T item = *base;                                                    \
+        return (size_t) (base - a) + (before);                             \
+    }
+
+// Searches advanced together by the batched lower_bound.
+#define SEARCH_GROUP 16
+
+/*
+ * The group version of search_lower_bound: g searches over the same n
+ * items, each step done for all of them before the next. After a step the
+ * next item a search reads is known, so it is prefetched then; by the time
+ * the group comes back to it, the line is there or on its way.
+ */
+#define BG_SEARCH_GROUP_DEFINE(T)                                             \
+    static void search_lower_bound_group_##T(const T *a, size_t n,            \
+                                             const T *keys, size_t g,         \
+                                             size_t *out)                     \
+    {                                                                         \
+        if (n == 0) {                                                         \
+            memset(out, 0, g * sizeof(size_t));                               \
+            return;                                                           \
+        }                                                                     \
+        const T *base[SEARCH_GROUP];                                          \
+        for (size_t j = 0; j < g; j++)                                        \
+            base[j] = a;                                                      \
+        while (n > 1) {                                                       \
+            size_t half = n / 2;                                              \
+            n -= half;                                                        \
+            for (size_t j = 0; j < g; j++) {                                  \
+                base[j] = base[j][half] < keys[j] ? base[j] + half : base[j]; \
+                __builtin_prefetch(base[j] + n / 2);                          \
+            }                                                                 \
+        }                                                                     \
+        for (size_t j = 0; j < g; j++)                                        \
+            out[j] = (size_t) (base[j] - a) + (*base[j] < keys[j]);           \
+    }
+
+#define BG_SEARCH_DEFINE(T)                                                  \
+    BG_SEARCH_BOUND_DEFINE(T, lower_bound, item < key)                       \
+    BG_SEARCH_BOUND_DEFINE(T, upper_bound, !(key < item))                    \
+    BG_SEARCH_GROUP_DEFINE(T)                                                \
+                                                                             \
+    size_t BGSlice_lower_bound_##T(BGSlice *s, T key)                        \
+    {                                                                        \
+        search_check(s, sizeof(T));                                          \
+        return search_lower_bound_##T(s->buf, s->len, key);                  \
+    }                                                                        \
+                                                                             \
+    size_t BGSlice_upper_bound_##T(BGSlice *s, T key)                        \
+    {                                                                        \
+        search_check(s, sizeof(T));                                          \
+        return search_upper_bound_##T(s->buf, s->len, key);                  \
+    }                                                                        \
+                                                                             \
+    struct BGSearchRange BGSlice_equal_range_##T(BGSlice *s, T key)          \
+    {                                                                        \
+        search_check(s, sizeof(T));                                          \
+        const T *a = s->buf;                                                 \
+        size_t lo = search_lower_bound_##T(a, s->len, key);                  \
+        size_t hi = lo + search_upper_bound_##T(a + lo, s->len - lo, key);   \
+        return (struct BGSearchRange) { .lo = lo, .hi = hi };                \
+    }                                                                        \
+                                                                             \
+    enum BGStatus BGSlice_lower_bound_batch_##T(BGSlice *s, const T *keys,   \
+                                                size_t n, BGSlice *out)      \
+    {                                                                        \
+        search_check(s, sizeof(T));                                          \
+        search_check_out(out, keys, n);                                      \
+        if (BGSlice_reserve(out, n) == NULL)                                 \
+            return BG_ERR_ALLOC;                                             \
+        size_t *res = (size_t *) out->buf + out->len;                        \
+        for (size_t i = 0; i < n; i += SEARCH_GROUP) {                       \
+            size_t g = n - i < SEARCH_GROUP ? n - i : SEARCH_GROUP;          \
+            search_lower_bound_group_##T(s->buf, s->len, keys + i, g,        \
+                                         res + i);                           \
+        }                                                                    \
+        BGSlice_set_len(out, out->len + n);                                  \
+        return BG_OK;                                                        \
+    }
+
+BG_SEARCH_DEFINE(i32)
+BG_SEARCH_DEFINE(u32)
+BG_SEARCH_DEFINE(i64)
+BG_SEARCH_DEFINE(u64)
+BG_SEARCH_DEFINE(f32)
+BG_SEARCH_DEFINE(f64)
+
+/*
+ * Same loop over bytes. The comparator call is indirect, so this is bound
+ * by it rather than by memory until the slice is far out of cache.
+ */
+static size_t
+search_generic(BGSlice *s, size_t from, const void *key, void *ctx,
+               BGSlice_sort_comparator comparator, bool upper)
+{
+    if (comparator == NULL)
+        comparator = BGSlice_default_comparator_asc;
+    size_t size = s->elem_size;
+    size_t n = s->len - from;
+    if (n == 0)
+        return from;
+    char *a = (char *) s->buf + from * size;
+    char *base = a;
+    comparable k = (comparable) key;
+    while (true) {
+        size_t half = n / 2;
+        char *item = n > 1 ? base + half * size : base;
+        bool before = upper ? comparator(s, k, (comparable) item, ctx) >= 0
+                            : comparator(s, (comparable) item, k, ctx) < 0;
+        if (n == 1)
+            return from + (size_t) (base - a) / size + before;
+        n -= half;
+        __builtin_prefetch(base + (n / 2) * size);
+        __builtin_prefetch(base + (half + n / 2) * size);
+        base = before ? item : base;
+    }
+}
+
+size_t
+BGSlice_lower_bound(BGSlice *s, const void *key, void *ctx,
+                    BGSlice_sort_comparator comparator)
+{
+    assert_search(s != NULL && key != NULL, "arguments cannot be NULL");
+    return search_generic(s, 0, key, ctx, comparator, false);
+}
+
+size_t
+BGSlice_upper_bound(BGSlice *s, const void *key, void *ctx,
+                    BGSlice_sort_comparator comparator)
+{
+    assert_search(s != NULL && key != NULL, "arguments cannot be NULL");
+    return search_generic(s, 0, key, ctx, comparator, true);
+}
+
+struct BGSearchRange
+BGSlice_equal_range(BGSlice *s, const void *key, void *ctx,
+                    BGSlice_sort_comparator comparator)
+{
+    assert_search(s != NULL && key != NULL, "arguments cannot be NULL");
+    size_t lo = search_generic(s, 0, key, ctx, comparator, false);
+    size_t hi = search_generic(s, lo, key, ctx, comparator, true);
+    return (struct BGSearchRange) { .lo = lo, .hi = hi };
+}
+
+////////////////////
+// Eytzinger layout
+//
+
+/*
+ * Positions are 0-based, nodes 1-based: position p holds node p + 1, whose
+ * children are nodes 2p + 2 and 2p + 3. The tree has h levels, all full but
+ * the last, which is filled from the left.
+ *
+ * In the full tree of h levels, node k at depth d, the j-th of its level,
+ * has in-order rank (2j + 1) * 2^(h - 1 - d) - 1. The nodes of the last
+ * level have the even ranks 0, 2, 4, ..., so the last-level nodes before
+ * rank r number (r + 1) / 2, and those beyond the m that exist have to be
+ * taken off.
+ */
+size_t
+BGSlice_eytzinger_rank(size_t n, size_t pos)
+{
+    assert_search(pos < n, "position %zu is out of range %zu", pos, n);
+
+    size_t h = 64 - __builtin_clzll(n);
+    size_t k = pos + 1;
+    size_t d = 63 - __builtin_clzll(k);
+    size_t r = ((2 * (k - ((size_t) 1 << d)) + 1) << (h - 1 - d)) - 1;
+    size_t m = n - ((size_t) 1 << (h - 1)) + 1;
+    size_t before = (r + 1) / 2;
+    return before > m ? r - (before - m) : r;
+}
+
+BGSlice *
+BGSlice_eytzinger_new(BGSlice *sorted, struct BGSliceOption *option)
+{
+    assert_search(sorted != NULL, "slice cannot be NULL");
+
+    size_t n = sorted->len, size = sorted->elem_size;
+    // A zero capacity buffer may come back as NULL, so ask for one.
+    BGSlice *e = __BGSlice_new(n, n == 0 ? 1 : n, size, option);
+    if (e == NULL)
+        return NULL;
+    // Writes go in order; reads jump around, a level of the tree per pass
+    // of the sorted slice.
+    char *dst = e->buf;
+    const char *src = sorted->buf;
+    for (size_t pos = 0; pos < n; pos++)
+        memcpy(dst + pos * size, src + BGSlice_eytzinger_rank(n, pos) * size,
+               size);
+    return e;
+}
+
+/*
+ * Walk down from the root, going right past every node less than key. The
+ * answer is the last node where the walk went left: the trailing 1 bits of
+ * the final node number are the right turns taken after it, so shifting
+ * them out, and the 0 for that left turn, leaves the node. No left turn at
+ * all means every item is less than key.
+ *
+ * The nodes log2(per_line) levels below node k are the per_line nodes from
+ * k * per_line on, which span one or two cache lines; the first is fetched
+ * while the levels above it are being searched.
+ */
+#define BG_EYTZINGER_DEFINE(T)                                               \
+    size_t BGSlice_eytzinger_lower_bound_##T(BGSlice *e, T key)              \
+    {                                                                        \
+        search_check(e, sizeof(T));                                          \
+        const size_t per_line = 64 / sizeof(T);                              \
+        const T *a = e->buf;                                                 \
+        size_t n = e->len;                                                   \
+        size_t k = 1;                                                        \
+        while (k <= n) {                                                     \
+            __builtin_prefetch(a + k * per_line - 1);                        \
+            k = 2 * k + (a[k - 1] < key);                                    \
+        }                                                                    \
+        k >>= __builtin_ctzll(~(u64) k) + 1;                                 \
+        return k == 0 ? n : BGSlice_eytzinger_rank(n, k - 1);               \
+    }
+
+BG_EYTZINGER_DEFINE(i32)
+BG_EYTZINGER_DEFINE(u32)
+BG_EYTZINGER_DEFINE(i64)
+BG_EYTZINGER_DEFINE(u64)
+BG_EYTZINGER_DEFINE(f32)
+BG_EYTZINGER_DEFINE(f64)
+
+////////////////////
+// S+tree
+//
+
+/*
+ * Layer 0 is the leaves: the sorted keys, padded with the largest key to
+ * whole nodes of B. Each layer above has one node per B + 1 nodes below,
+ * and key j of node k in layer h is the smallest key under child j + 1,
+ * which is node k * (B + 1) + j + 1 of layer h - 1. Layer h starts at
+ * offset[h], leaves first and the root, a single node, last.
+ *
+ * Keys are stored with their sign bit flipped, so that the signed compares
+ * AVX2 has order them as unsigned; padding becomes the largest signed key.
+ */
+
+#define STREE_MAX_HEIGHT 32
+
+struct BGSTree {
+    size_t n;
+    size_t elem_size;
+    size_t height;
+    // Start of layer h in keys, in keys; offset[height] is the total.
+    size_t offset[STREE_MAX_HEIGHT + 1];
+    enum BGCpuLevel level;
+    struct Allocator *allocator;
+    void *keys;
+};
+
+#ifdef __BG_RUNNING_TEST__
+static int search_forced_level = -1;
+
+void
+bg_search_set_level(enum BGCpuLevel level)
+{
+    search_forced_level = level;
+}
+#endif
+
+static enum BGCpuLevel
+search_level(void)
+{
+#ifdef __BG_RUNNING_TEST__
+    if (search_forced_level >= 0)
+        return search_forced_level;
+#endif
+    return bg_cpu_level();
+}
+
+/*
+ * Node rank: how many of the B keys of node are less than x, which picks
+ * the child to go down to. Scalar and AVX2 variants; both compare the
+ * sign-flipped keys as signed.
+ */
+static inline size_t
+stree_rank_scalar_u32(const i32 *node, i32 x)
+{
+    size_t r = 0;
+    for (size_t j = 0; j < 16; j++)
+        r += node[j] < x;
+    return r;
+}
+
+static inline size_t
+stree_rank_scalar_u64(const i64 *node, i64 x)
+{
+    size_t r = 0;
+    for (size_t j = 0; j < 8; j++)
+        r += node[j] < x;
+    return r;
+}
+
+#if BG_CPU_X86
+BG_TARGET("avx2")
+static inline size_t
+stree_rank_avx2_u32(const i32 *node, i32 x)
+{
+    __m256i xv = _mm256_set1_epi32(x);
+    __m256i lo = _mm256_cmpgt_epi32(
+        xv, _mm256_load_si256((const __m256i *) node));
+    __m256i hi = _mm256_cmpgt_epi32(
+        xv, _mm256_load_si256((const __m256i *) (node + 8)));
+    u32 mask = (u32) _mm256_movemask_ps(_mm256_castsi256_ps(lo))
+               | (u32) _mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8;
+    return __builtin_popcount(mask);
+}
+
+BG_TARGET("avx2")
+static inline size_t
+stree_rank_avx2_u64(const i64 *node, i64 x)
+{
+    __m256i xv = _mm256_set1_epi64x(x);
+    __m256i lo = _mm256_cmpgt_epi64(
+        xv, _mm256_load_si256((const __m256i *) node));
+    __m256i hi = _mm256_cmpgt_epi64(
+        xv, _mm256_load_si256((const __m256i *) (node + 4)));
+    u32 mask = (u32) _mm256_movemask_pd(_mm256_castsi256_pd(lo))
+               | (u32) _mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+    return __builtin_popcount(mask);
+}
+#endif
+
+static inline size_t
+stree_blocks(size_t n, size_t b)
+{
+    return (n + b - 1) / b;
+}
+
+// Keys in the layer above a layer of n keys.
+static inline size_t
+stree_prev_keys(size_t n, size_t b)
+{
+    return (stree_blocks(n, b) + b) / (b + 1) * b;
+}
+
+// Lay out the layers of a tree of n keys; false if it would not fit.
+static bool
+stree_layout(BGSTree *t, size_t n, size_t b)
+{
+    t->height = 0;
+    t->offset[0] = 0;
+    for (size_t keys = n;; keys = stree_prev_keys(keys, b)) {
+        if (t->height == STREE_MAX_HEIGHT)
+            return false;
+        t->offset[t->height + 1] =
+            t->offset[t->height] + stree_blocks(keys, b) * b;
+        t->height++;
+        if (keys <= b)
+            return true;
+    }
+}
+
+static BGSTree *
+stree_new(BGSlice *sorted, struct Allocator *allocator, size_t elem_size)
+{
+    search_check(sorted, elem_size);
+    if (allocator == NULL)
+        allocator = malloc_allocator;
+
+    BGSTree *t = bg_allocator_malloc(allocator, sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    t->n = sorted->len;
+    t->elem_size = elem_size;
+    t->level = search_level();
+    t->allocator = allocator;
+    t->keys = NULL;
+    if (!stree_layout(t, sorted->len, 64 / elem_size))
+        goto fail;
+    // Always at least one node, so that an empty tree has a root.
+    size_t total = t->offset[t->height] == 0 ? 64 / elem_size
+                                             : t->offset[t->height];
+    t->keys = bg_allocator_aligned_alloc(allocator, 64, total * elem_size);
+    if (t->keys == NULL)
+        goto fail;
+    return t;
+
+fail:
+    bg_allocator_free(allocator, t);
+    return NULL;
+}
+
+/*
+ * Leaves are the keys with the sign bit flipped, then padding. Key j of
+ * node k in layer h > 0 is the first leaf key under child j + 1: its
+ * leftmost descendant in layer 0 is node (k * (B + 1) + j + 1) *
+ * (B + 1)^(h - 1).
+ */
+#define BG_STREE_DEFINE(T, S, B, SIGN)                                        \
+    BGSTree *BGSTree_new_##T(BGSlice *sorted, struct Allocator *allocator)    \
+    {                                                                         \
+        BGSTree *t = stree_new(sorted, allocator, sizeof(T));                 \
+        if (t == NULL)                                                        \
+            return NULL;                                                      \
+        const T *src = sorted->buf;                                           \
+        S *keys = t->keys;                                                    \
+        size_t n = t->n;                                                      \
+        const S pad = (S) ((T) ~(T) 0 ^ (SIGN));                              \
+        for (size_t i = 0; i < n; i++)                                        \
+            keys[i] = (S) (src[i] ^ (SIGN));                                  \
+        for (size_t i = n; i < t->offset[1] || i < (B); i++)                  \
+            keys[i] = pad;                                                    \
+        for (size_t h = 1; h < t->height; h++) {                              \
+            S *layer = keys + t->offset[h];                                   \
+            size_t len = t->offset[h + 1] - t->offset[h];                     \
+            for (size_t i = 0; i < len; i++) {                                \
+                size_t leaf = (i / (B)) * ((B) + 1) + i % (B) + 1;            \
+                for (size_t l = 1; l < h && leaf * (B) < n; l++)              \
+                    leaf *= (B) + 1;                                          \
+                layer[i] = leaf * (B) < n ? keys[leaf * (B)] : pad;           \
+            }                                                                 \
+        }                                                                     \
+        return t;                                                             \
+    }                                                                         \
+                                                                              \
+    BG_STREE_SEARCH_DEFINE(scalar, , T, S, B)                                 \
+    BG_STREE_SEARCH_X86_DEFINE(avx2, "avx2", T, S, B)                         \
+                                                                              \
+    size_t BGSTree_lower_bound_##T(BGSTree *t, T key)                         \
+    {                                                                         \
+        assert_search(t != NULL, "tree cannot be NULL");                      \
+        assert_search(t->elem_size == sizeof(T),                              \
+                      "tree of %zu byte keys searched with a " #T " key",     \
+                      t->elem_size);                                          \
+        S x = (S) (key ^ (SIGN));                                             \
+        if (BG_CPU_X86 && t->level >= BG_CPU_AVX2)                            \
+            return BG_STREE_SEARCH_X86_CALL(avx2, T, t, x);                   \
+        return stree_search_scalar_##T(t, x);                                 \
+    }
+
+/*
+ * Walk from the root to a leaf, one node per layer; k is the first key of
+ * the current node within its layer.
+ */
+#define BG_STREE_SEARCH_DEFINE(isa, target, T, S, B)                          \
+    target static size_t stree_search_##isa##_##T(BGSTree *t, S x)            \
+    {                                                                         \
+        const S *keys = t->keys;                                              \
+        size_t k = 0;                                                         \
+        for (size_t h = t->height - 1; h > 0; h--) {                          \
+            size_t i = stree_rank_##isa##_##T(keys + t->offset[h] + k, x);    \
+            k = k * ((B) + 1) + i * (B);                                      \
+        }                                                                     \
+        size_t idx = k + stree_rank_##isa##_##T(keys + k, x);                 \
+        return idx < t->n ? idx : t->n;                                       \
+    }
+
+#if BG_CPU_X86
+#    define BG_STREE_SEARCH_X86_DEFINE(isa, target, T, S, B) \
+        BG_STREE_SEARCH_DEFINE(isa, BG_TARGET(target), T, S, B)
+#    define BG_STREE_SEARCH_X86_CALL(isa, T, t, x) \
+        stree_search_##isa##_##T(t, x)
+#else
+#    define BG_STREE_SEARCH_X86_DEFINE(isa, target, T, S, B)
+#    define BG_STREE_SEARCH_X86_CALL(isa, T, t, x) \
+        stree_search_scalar_##T(t, x)
+#endif
+
+BG_STREE_DEFINE(u32, i32, 16, (u32) 1 << 31)
+BG_STREE_DEFINE(u64, i64, 8, (u64) 1 << 63)
+
+void
+BGSTree_free(BGSTree *t)
+{
+    if (bg_unlikely(t == NULL))
+        return;
+    bg_allocator_free(t->allocator, t->keys);
+    bg_allocator_free(t->allocator, t);
+}
+
+size_t
+BGSTree_len(BGSTree *t)
+{
+    assert_search(t != NULL, "tree cannot be NULL");
+    return t->n;
+}
+
+size_t
+BGSTree_size(BGSTree *t)
+{
+    assert_search(t != NULL, "tree cannot be NULL");
+    return t->offset[t->height] * t->elem_size;
+}
+
+////////////////////
+// PGM index
+//
+
+// Epsilon of the levels above the first.
+#define PGM_EPSILON_INNER 4
+#define PGM_MAX_LEVELS 32
+
+/*
+ * Keys from key up to the next segment's first key are predicted at
+ * intercept + slope * (x - key). Within a level, intercepts are positions
+ * in the level below, or in the keys for level 0.
+ */
+struct pgm_segment {
+    u64 key;
+    f64 slope;
+    size_t intercept;
+};
+
+struct BGPGMIndex {
+    BGSlice *sorted;
+    size_t n;
+    size_t elem_size;
+    size_t epsilon;
+    // Level l is segs[level[l]] up to segs[level[l + 1]]; level 0 is over
+    // the keys and the last one is the root.
+    size_t levels;
+    size_t level[PGM_MAX_LEVELS + 1];
+    struct pgm_segment *segs;
+    size_t cap;
+    struct Allocator *allocator;
+};
+
+// The slopes still open to the segment being built, which starts at
+// (k0, p0).
+struct pgm_cone {
+    bool open;
+    u64 k0;
+    size_t p0;
+    f64 lo;
+    f64 hi;
+};
+
+// Close the segment being built and append it to the level being built.
+static bool
+pgm_push(BGPGMIndex *p, struct pgm_cone *c)
+{
+    size_t len = p->level[p->levels + 1];
+    if (len == p->cap) {
+        size_t cap = p->cap < 16 ? 16 : p->cap * 2;
+        struct pgm_segment *segs = bg_allocator_realloc(
+            p->allocator, p->segs, cap * sizeof(struct pgm_segment));
+        if (segs == NULL)
+            return false;
+        p->segs = segs;
+        p->cap = cap;
+    }
+    // Any slope in the cone keeps every point within epsilon; the middle
+    // one leaves the most room for rounding.
+    f64 slope = c->hi == INFINITY ? 0 : (c->lo + c->hi) / 2;
+    p->segs[len] = (struct pgm_segment) {
+        .key = c->k0,
+        .slope = slope,
+        .intercept = c->p0,
+    };
+    p->level[p->levels + 1] = len + 1;
+    c->open = false;
+    return true;
+}
+
+/*
+ * Feed the point (k, pos), keys increasing. The line from (k0, p0) passes
+ * within eps of it for slopes in [(dy - eps) / dx, (dy + eps) / dx]; the
+ * cone narrows to that, or, when the two do not meet, the segment is
+ * closed and a new one starts at the point.
+ */
+static bool
+pgm_add(BGPGMIndex *p, struct pgm_cone *c, u64 k, size_t pos, f64 eps)
+{
+    if (c->open) {
+        f64 dx = (f64) (k - c->k0);
+        f64 dy = (f64) (pos - c->p0);
+        f64 lo = (dy - eps) / dx, hi = (dy + eps) / dx;
+        if (lo <= c->hi && hi >= c->lo) {
+            c->lo = lo > c->lo ? lo : c->lo;
+            c->hi = hi < c->hi ? hi : c->hi;
+            return true;
+        }
+        if (!pgm_push(p, c))
+            return false;
+    }
+    *c = (struct pgm_cone) {
+        .open = true, .k0 = k, .p0 = pos, .lo = 0, .hi = INFINITY
+    };
+    return true;
+}
+
+// Finish level 0, whose points have all been fed to c, and build the
+// levels above it up to a single root.
+static bool
+pgm_build_levels(BGPGMIndex *p, struct pgm_cone *c)
+{
+    if (c->open && !pgm_push(p, c))
+        return false;
+    p->levels = 1;
+    while (p->level[p->levels] - p->level[p->levels - 1] > 1) {
+        if (p->levels == PGM_MAX_LEVELS)
+            return false;
+        size_t from = p->level[p->levels - 1], to = p->level[p->levels];
+        p->level[p->levels + 1] = to;
+        for (size_t j = from; j < to; j++)
+            if (!pgm_add(p, c, p->segs[j].key, j - from, PGM_EPSILON_INNER))
+                return false;
+        if (!pgm_push(p, c))
+            return false;
+        p->levels++;
+    }
+    return true;
+}
+
+static BGPGMIndex *
+pgm_new(BGSlice *sorted, size_t epsilon, struct Allocator *allocator,
+        size_t elem_size)
+{
+    search_check(sorted, elem_size);
+    assert_search(epsilon > 0, "epsilon cannot be zero");
+    if (allocator == NULL)
+        allocator = malloc_allocator;
+
+    BGPGMIndex *p = bg_allocator_malloc(allocator, sizeof(*p));
+    if (p == NULL)
+        return NULL;
+    memset(p, 0, sizeof(*p));
+    p->sorted = sorted;
+    p->n = sorted->len;
+    p->elem_size = elem_size;
+    p->epsilon = epsilon;
+    p->allocator = allocator;
+    return p;
+}
+
+void
+BGPGMIndex_free(BGPGMIndex *p)
+{
+    if (bg_unlikely(p == NULL))
+        return;
+    bg_allocator_free(p->allocator, p->segs);
+    bg_allocator_free(p->allocator, p);
+}
+
+size_t
+BGPGMIndex_segments(BGPGMIndex *p)
+{
+    assert_search(p != NULL, "index cannot be NULL");
+    return p->level[1];
+}
+
+size_t
+BGPGMIndex_size(BGPGMIndex *p)
+{
+    assert_search(p != NULL, "index cannot be NULL");
+    return sizeof(*p) + p->level[p->levels] * sizeof(struct pgm_segment);
+}
+
+// Where segment s puts x, but not past end, where the next segment
+// starts: between the last key of s and the next segment's first key the
+// line would run on unchecked.
+static inline size_t
+pgm_predict(const struct pgm_segment *s, u64 x, size_t end)
+{
+    if (x <= s->key)
+        return s->intercept;
+    f64 pos = (f64) s->intercept + s->slope * (f64) (x - s->key);
+    return pos < (f64) end ? (size_t) pos : end;
+}
+
+// The positions around a prediction the answer must be in, with one more
+// on each side for rounding.
+static inline void
+pgm_window(size_t pos, size_t eps, size_t len, size_t *lo, size_t *hi)
+{
+    *lo = pos > eps + 1 ? pos - eps - 1 : 0;
+    *hi = pos + eps + 2 < len ? pos + eps + 2 : len;
+}
+
+// First segment in [lo, hi) whose key is greater than x.
+static inline size_t
+pgm_segs_upper(const struct pgm_segment *s, size_t lo, size_t hi, u64 x)
+{
+    size_t n = hi - lo;
+    if (n == 0)
+        return lo;
+    const struct pgm_segment *base = s + lo;
+    while (n > 1) {
+        size_t half = n / 2;
+        n -= half;
+        base = base[half].key <= x ? base + half : base;
+    }
+    return (size_t) (base - s) + (base->key <= x);
+}
+
+// Level 0 segment covering x, going down from the root. The window is
+// widened to the whole level in the unlikely case that rounding put the
+// answer outside it.
+static size_t
+pgm_find_segment(BGPGMIndex *p, u64 x)
+{
+    size_t seg = p->level[p->levels - 1];
+    for (size_t l = p->levels - 1; l > 0; l--) {
+        size_t base = p->level[l - 1], len = p->level[l] - base;
+        size_t end =
+            seg + 1 < p->level[l + 1] ? p->segs[seg + 1].intercept : len;
+        size_t pos = pgm_predict(&p->segs[seg], x, end);
+        size_t lo, hi;
+        pgm_window(pos, PGM_EPSILON_INNER, len, &lo, &hi);
+        const struct pgm_segment *s = p->segs + base;
+        size_t r = pgm_segs_upper(s, lo, hi, x);
+        if (bg_unlikely(r == lo && lo > 0 && s[lo - 1].key > x))
+            r = pgm_segs_upper(s, 0, lo, x);
+        else if (bg_unlikely(r == hi && hi < len && s[hi].key <= x))
+            r = pgm_segs_upper(s, hi, len, x);
+        seg = base + (r == 0 ? 0 : r - 1);
+    }
+    return seg;
+}
+
+/*
+ * Level 0 is fed the first position of every distinct key: lower_bound of
+ * a key is its first position, and of a key between two others the
+ * position after the run of the smaller one, which the window misses only
+ * when that run is longer than epsilon. The search is then widened to the
+ * rest of the keys on that side.
+ */
+#define BG_PGM_DEFINE(T)                                                     \
+    BGPGMIndex *BGPGMIndex_new_##T(BGSlice *sorted, size_t epsilon,          \
+                                   struct Allocator *allocator)              \
+    {                                                                        \
+        BGPGMIndex *p = pgm_new(sorted, epsilon, allocator, sizeof(T));      \
+        if (p == NULL)                                                       \
+            return NULL;                                                     \
+        const T *a = sorted->buf;                                            \
+        struct pgm_cone c = { 0 };                                           \
+        for (size_t i = 0; i < p->n; i++) {                                  \
+            if (i > 0 && a[i] == a[i - 1])                                   \
+                continue;                                                    \
+            if (!pgm_add(p, &c, a[i], i, (f64) epsilon))                     \
+                goto fail;                                                   \
+        }                                                                    \
+        if (!pgm_build_levels(p, &c))                                        \
+            goto fail;                                                       \
+        return p;                                                            \
+                                                                             \
+    fail:                                                                    \
+        BGPGMIndex_free(p);                                                  \
+        return NULL;                                                         \
+    }                                                                        \
+                                                                             \
+    size_t BGPGMIndex_lower_bound_##T(BGPGMIndex *p, T key)                  \
+    {                                                                        \
+        assert_search(p != NULL, "index cannot be NULL");                    \
+        assert_search(p->elem_size == sizeof(T),                             \
+                      "index of %zu byte keys searched with a " #T " key",   \
+                      p->elem_size);                                         \
+        size_t n = p->n;                                                     \
+        if (n == 0)                                                          \
+            return 0;                                                        \
+        size_t seg = pgm_find_segment(p, key);                               \
+        size_t end = seg + 1 < p->level[1] ? p->segs[seg + 1].intercept : n; \
+        size_t pos = pgm_predict(&p->segs[seg], key, end);                   \
+        size_t lo, hi;                                                       \
+        pgm_window(pos, p->epsilon, n, &lo, &hi);                            \
+        const T *a = p->sorted->buf;                                         \
+        size_t r = lo + search_lower_bound_##T(a + lo, hi - lo, key);        \
+        if (bg_unlikely(r == lo && lo > 0 && a[lo - 1] >= key))              \
+            r = search_lower_bound_##T(a, lo, key);                          \
+        else if (bg_unlikely(r == hi && hi < n && a[hi] < key))              \
+            r = hi + search_lower_bound_##T(a + hi, n - hi, key);            \
+        return r;                                                            \
+    }
+
+BG_PGM_DEFINE(u32)
+BG_PGM_DEFINE(u64)
@@ -0,0 +1,185 @@
+#ifndef BG_SEARCH_H
+#define BG_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bg_cpu.h"
+#include "bg_slice.h"
+#include "bg_types.h"
+#include "mem/bg_allocator.h"
+
+/*
+ * Binary search over sorted slices.
+ *
+ * lower_bound is the index of the first item not less than key, upper_bound
+ * the index of the first item greater than key; both are the slice length
+ * when there is none. equal_range is the two together: the items equal to
+ * key are [lo, hi).
+ *
+ * The typed searches compare with `<` and never branch on a comparison: each
+ * step halves the range with a conditional move and prefetches both places
+ * the next step may look, so on slices much larger than the cache the misses
+ * of consecutive steps overlap instead of waiting on each other. The slice's
+ * elem_size must match the type, and floating point slices must not contain
+ * NaN.
+ */
+
+struct BGSearchRange {
+    size_t lo;
+    size_t hi;
+};
+
+size_t BGSlice_lower_bound_i32(BGSlice *s, i32 key);
+size_t BGSlice_lower_bound_u32(BGSlice *s, u32 key);
+size_t BGSlice_lower_bound_i64(BGSlice *s, i64 key);
+size_t BGSlice_lower_bound_u64(BGSlice *s, u64 key);
+size_t BGSlice_lower_bound_f32(BGSlice *s, f32 key);
+size_t BGSlice_lower_bound_f64(BGSlice *s, f64 key);
+size_t BGSlice_upper_bound_i32(BGSlice *s, i32 key);
+size_t BGSlice_upper_bound_u32(BGSlice *s, u32 key);
+size_t BGSlice_upper_bound_i64(BGSlice *s, i64 key);
+size_t BGSlice_upper_bound_u64(BGSlice *s, u64 key);
+size_t BGSlice_upper_bound_f32(BGSlice *s, f32 key);
+size_t BGSlice_upper_bound_f64(BGSlice *s, f64 key);
+struct BGSearchRange BGSlice_equal_range_i32(BGSlice *s, i32 key);
+struct BGSearchRange BGSlice_equal_range_u32(BGSlice *s, u32 key);
+struct BGSearchRange BGSlice_equal_range_i64(BGSlice *s, i64 key);
+struct BGSearchRange BGSlice_equal_range_u64(BGSlice *s, u64 key);
+struct BGSearchRange BGSlice_equal_range_f32(BGSlice *s, f32 key);
+struct BGSearchRange BGSlice_equal_range_f64(BGSlice *s, f64 key);
+
+/*
+ * Batched lower_bound: look up n keys and append their indices to out, a
+ * slice of size_t. Searches run in groups in lock-step: every search of a
+ * group takes the same number of steps, so each step is done for the whole
+ * group, prefetching the item each search reads next, before any of them
+ * takes the next one. The misses of a group then overlap instead of each
+ * search waiting on its own, one after the other. BG_ERR_ALLOC if out could
+ * not grow.
+ */
+enum BGStatus BGSlice_lower_bound_batch_i32(BGSlice *s, const i32 *keys,
+                                            size_t n, BGSlice *out);
+enum BGStatus BGSlice_lower_bound_batch_u32(BGSlice *s, const u32 *keys,
+                                            size_t n, BGSlice *out);
+enum BGStatus BGSlice_lower_bound_batch_i64(BGSlice *s, const i64 *keys,
+                                            size_t n, BGSlice *out);
+enum BGStatus BGSlice_lower_bound_batch_u64(BGSlice *s, const u64 *keys,
+                                            size_t n, BGSlice *out);
+enum BGStatus BGSlice_lower_bound_batch_f32(BGSlice *s, const f32 *keys,
+                                            size_t n, BGSlice *out);
+enum BGStatus BGSlice_lower_bound_batch_f64(BGSlice *s, const f64 *keys,
+                                            size_t n, BGSlice *out);
+
+/*
+ * Any item type, sorted by comparator, which is called as
+ * comparator(s, item, key, ctx) for lower_bound and
+ * comparator(s, key, item, ctx) for upper_bound. key points to something
+ * the comparator can compare with an item, usually an item itself. A NULL
+ * comparator compares bytes, like BGSlice_default_comparator_asc.
+ */
+size_t BGSlice_lower_bound(BGSlice *s, const void *key, void *ctx,
+                           BGSlice_sort_comparator comparator);
+size_t BGSlice_upper_bound(BGSlice *s, const void *key, void *ctx,
+                           BGSlice_sort_comparator comparator);
+struct BGSearchRange BGSlice_equal_range(BGSlice *s, const void *key,
+                                         void *ctx,
+                                         BGSlice_sort_comparator comparator);
+
+/*
+ * Eytzinger layout: the items of a sorted slice in the order a breadth-first
+ * walk visits the balanced binary search tree over them, so item k has its
+ * children at 2k + 1 and 2k + 2. The first levels of the tree, which every
+ * search goes through, share a few cache lines, and the four or so levels
+ * below any node are contiguous and are fetched one line ahead of the
+ * search. Worth it over plain binary search once the slice is well past
+ * the last level cache size; below that the two are about even.
+ *
+ * BGSlice_eytzinger_new returns a new slice of the same items in that order,
+ * or NULL on failure. The searches over it return indices into the sorted
+ * slice, not into the layout, so the sorted slice can stay the one that
+ * holds the records while the layout is a search index over it.
+ */
+BGSlice *BGSlice_eytzinger_new(BGSlice *sorted, struct BGSliceOption *option);
+// Index in the sorted slice of the item at position pos of a layout of n
+// items; constant time.
+size_t BGSlice_eytzinger_rank(size_t n, size_t pos);
+
+size_t BGSlice_eytzinger_lower_bound_i32(BGSlice *e, i32 key);
+size_t BGSlice_eytzinger_lower_bound_u32(BGSlice *e, u32 key);
+size_t BGSlice_eytzinger_lower_bound_i64(BGSlice *e, i64 key);
+size_t BGSlice_eytzinger_lower_bound_u64(BGSlice *e, u64 key);
+size_t BGSlice_eytzinger_lower_bound_f32(BGSlice *e, f32 key);
+size_t BGSlice_eytzinger_lower_bound_f64(BGSlice *e, f64 key);
+
+/*
+ * Static B+tree (S+tree) over a sorted slice of u32 or u64 keys, for key
+ * sets that are built once and then only searched.
+ *
+ * Every node is one cache line of keys, 16 u32 or 8 u64, and has one more
+ * child than it has keys; the tree is implicit, so children are found by
+ * arithmetic and nodes hold nothing but keys. The leaves are the sorted
+ * keys themselves, padded to whole nodes. A lookup reads one line per
+ * level, about log17 or log9 of the length instead of the log2 of binary
+ * search, and ranks the key within a node with two AVX2 compares and
+ * movemasks when the CPU has them. The inner levels add about one key in
+ * every 16 (u32) or 8 (u64) to the keys.
+ *
+ * Lookups return indices into the sorted slice, which is copied and no
+ * longer needed once the tree is built. NULL on allocation failure;
+ * allocator may be NULL.
+ */
+typedef struct BGSTree BGSTree;
+
+BGSTree *BGSTree_new_u32(BGSlice *sorted, struct Allocator *allocator);
+BGSTree *BGSTree_new_u64(BGSlice *sorted, struct Allocator *allocator);
+void BGSTree_free(BGSTree *t);
+// Number of keys.
+size_t BGSTree_len(BGSTree *t);
+// Bytes taken by the tree's nodes.
+size_t BGSTree_size(BGSTree *t);
+// Index of the first key not less than key, or the length if none is.
+size_t BGSTree_lower_bound_u32(BGSTree *t, u32 key);
+size_t BGSTree_lower_bound_u64(BGSTree *t, u64 key);
+
+/*
+ * Learned index over a sorted slice of u32 or u64 keys, after the PGM-index:
+ * a piecewise linear map from key to position, built in one pass, that
+ * predicts where a key is to within epsilon positions. A lookup evaluates
+ * one segment and searches the 2 * epsilon + 3 items around the prediction.
+ * Segments are found the same way, through levels of segments over the
+ * first keys of the level below (with an epsilon of 4) up to a single root,
+ * so a lookup is a few predictions and short searches, and the index is a
+ * few segments per smooth stretch of keys instead of a node per B of them.
+ *
+ * Each segment is grown greedily while a line through its first key can
+ * stay within epsilon of every key so far (a shrinking cone of slopes).
+ * This takes O(1) per key, and may cut a few more segments than the
+ * optimal convex hull construction of the PGM-index.
+ *
+ * The index refers to the sorted slice, which must outlive it unchanged.
+ * Runs of equal keys longer than epsilon, or gaps the model does not
+ * capture, are still found correctly, by widening the search. NULL on
+ * allocation failure; allocator may be NULL.
+ */
+typedef struct BGPGMIndex BGPGMIndex;
+
+BGPGMIndex *BGPGMIndex_new_u32(BGSlice *sorted, size_t epsilon,
+                               struct Allocator *allocator);
+BGPGMIndex *BGPGMIndex_new_u64(BGSlice *sorted, size_t epsilon,
+                               struct Allocator *allocator);
+void BGPGMIndex_free(BGPGMIndex *p);
+// Segments over the keys, not counting the levels above.
+size_t BGPGMIndex_segments(BGPGMIndex *p);
+// Bytes taken by the index, not counting the keys.
+size_t BGPGMIndex_size(BGPGMIndex *p);
+// Index of the first key not less than key, or the length if none is.
+size_t BGPGMIndex_lower_bound_u32(BGPGMIndex *p, u32 key);
+size_t BGPGMIndex_lower_bound_u64(BGPGMIndex *p, u64 key);
+
+#ifdef __BG_RUNNING_TEST__
+// Pin the instruction set that trees built from now on search with.
+void bg_search_set_level(enum BGCpuLevel level);
+#endif
+
+#endif // BG_SEARCH_H
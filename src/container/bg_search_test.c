@@ -0,0 +1,455 @@
+#include "bg_search.h"
+#include "bg_slice.h"
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_cpu.h"
+#include "bg_testutils.h"
+#include "bg_types.h"
+
+void
+setUp(void)
+{
+    bg_search_set_level(bg_cpu_level());
+}
+
+void
+tearDown(void)
+{
+    bg_search_set_level(bg_cpu_level());
+}
+
+///////////////////////
+// Helpers
+//
+
+static const size_t test_lengths[] = { 0,  1,   2,   3,    7,   16,
+                                       33, 100, 257, 1021, 4099 };
+
+/*
+ * Check the typed searches over sorted slices of every length in
+ * test_lengths, with runs of equal items and gaps between them, against a
+ * linear scan. Items step by 0, 2 or 4 from start, and every key from just
+ * below the first item to just above the last is looked up, one at a time
+ * and as a batch, so keys hit items, gaps and both ends.
+ */
+#define SEARCH_CHECK_DEFINE(T, start)                                        \
+    static void check_search_##T(void)                                       \
+    {                                                                        \
+        for (size_t t = 0; t < bg_arr_length(test_lengths); t++) {           \
+            size_t n = test_lengths[t];                                      \
+            T *data = malloc((n + 1) * sizeof(T));                           \
+            T v = (start);                                                   \
+            for (size_t i = 0; i < n; i++) {                                 \
+                data[i] = v;                                                 \
+                v = (T) (v + 2 * (rand() % 3));                              \
+            }                                                                \
+            BGSlice *s = BGSlice_new_copy_from_buf(data, n, n, n + 1, NULL); \
+            BGSlice *e = BGSlice_eytzinger_new(s, NULL);                     \
+            TEST_ASSERT_NOT_NULL(e);                                         \
+            TEST_ASSERT_EQUAL(n, e->len);                                    \
+                                                                             \
+            for (T key = (T) ((start) - 3); key <= (T) (v + 3);              \
+                 key = (T) (key + 1)) {                                      \
+                size_t lo = 0, hi = 0;                                       \
+                while (lo < n && data[lo] < key)                             \
+                    lo++;                                                    \
+                hi = lo;                                                     \
+                while (hi < n && data[hi] == key)                            \
+                    hi++;                                                    \
+                TEST_ASSERT_EQUAL(lo, BGSlice_lower_bound_##T(s, key));      \
+                TEST_ASSERT_EQUAL(hi, BGSlice_upper_bound_##T(s, key));      \
+                struct BGSearchRange r = BGSlice_equal_range_##T(s, key);    \
+                TEST_ASSERT_EQUAL(lo, r.lo);                                 \
+                TEST_ASSERT_EQUAL(hi, r.hi);                                 \
+                TEST_ASSERT_EQUAL(lo,                                        \
+                                  BGSlice_eytzinger_lower_bound_##T(e, key)); \
+            }                                                                \
+                                                                             \
+            /* The batch appends after what out already holds. */            \
+            size_t nkeys = 0;                                                \
+            T *keys = malloc((4 * n + 8) * sizeof(T));                       \
+            for (T key = (T) ((start) - 3); key <= (T) (v + 3);              \
+                 key = (T) (key + 1))                                        \
+                keys[nkeys++] = key;                                         \
+            BGSlice *out = BGSlice_new(size_t, 1, 1, NULL);                  \
+            TEST_ASSERT_EQUAL(BG_OK, BGSlice_lower_bound_batch_##T(          \
+                                         s, keys, nkeys, out));              \
+            TEST_ASSERT_EQUAL(nkeys + 1, out->len);                          \
+            for (size_t i = 0; i < nkeys; i++)                               \
+                TEST_ASSERT_EQUAL(BGSlice_lower_bound_##T(s, keys[i]),       \
+                                  ((size_t *) out->buf)[i + 1]);             \
+            BGSlice_free(out);                                               \
+            free(keys);                                                      \
+            BGSlice_free(e);                                                 \
+            BGSlice_free(s);                                                 \
+            free(data);                                                      \
+        }                                                                    \
+    }
+
+SEARCH_CHECK_DEFINE(i32, -1000)
+SEARCH_CHECK_DEFINE(u32, 10)
+SEARCH_CHECK_DEFINE(i64, -((i64) 1 << 40))
+SEARCH_CHECK_DEFINE(u64, (u64) 1 << 40)
+SEARCH_CHECK_DEFINE(f32, -100.0f)
+SEARCH_CHECK_DEFINE(f64, -100.0)
+
+/*
+ * Check S+trees over sorted keys of every length up to a few layers deep,
+ * at every instruction set level, against BGSlice_lower_bound. Keys come
+ * in runs and include 0 and the largest key, so that they meet the
+ * padding; every key and the ones on either side of it are looked up.
+ */
+#define STREE_CHECK_DEFINE(T)                                                \
+    static void check_stree_##T(size_t n)                                    \
+    {                                                                        \
+        const T max = (T) ~(T) 0;                                            \
+        T *data = malloc((n + 1) * sizeof(T));                               \
+        T v = 0;                                                             \
+        for (size_t i = 0; i < n; i++) {                                     \
+            data[i] = v;                                                     \
+            v += (T) (rand() % 3) * 5;                                       \
+        }                                                                    \
+        if (n > 2)                                                           \
+            data[n - 1] = max;                                               \
+        BGSlice *s = BGSlice_new_copy_from_buf(data, n, n, n + 1, NULL);     \
+        for (enum BGCpuLevel level = BG_CPU_SCALAR;                          \
+             level <= bg_cpu_level(); level++) {                             \
+            bg_search_set_level(level);                                      \
+            BGSTree *t = BGSTree_new_##T(s, NULL);                           \
+            TEST_ASSERT_NOT_NULL(t);                                         \
+            TEST_ASSERT_EQUAL(n, BGSTree_len(t));                            \
+            for (size_t i = 0; i <= n; i++) {                                \
+                T key = i < n ? data[i] : v;                                 \
+                for (T d = 0; d < 3; d++) {                                  \
+                    T k = d == 0 ? key : d == 1 ? key - 1 : key + 1;         \
+                    TEST_ASSERT_EQUAL(BGSlice_lower_bound_##T(s, k),         \
+                                      BGSTree_lower_bound_##T(t, k));        \
+                }                                                            \
+            }                                                                \
+            TEST_ASSERT_EQUAL(0, BGSTree_lower_bound_##T(t, 0));             \
+            TEST_ASSERT_EQUAL(BGSlice_lower_bound_##T(s, max),               \
+                              BGSTree_lower_bound_##T(t, max));              \
+            BGSTree_free(t);                                                 \
+        }                                                                    \
+        BGSlice_free(s);                                                     \
+        free(data);                                                          \
+    }
+
+STREE_CHECK_DEFINE(u32)
+STREE_CHECK_DEFINE(u64)
+
+/*
+ * Check PGM indexes over keys of a few shapes and a few epsilons against
+ * BGSlice_lower_bound: every key and the ones on either side of it, and
+ * both ends of the key range, are looked up.
+ */
+enum pgm_shape {
+    PGM_LINEAR,
+    PGM_GAPS,
+    PGM_JUMPS,
+    PGM_RUNS,
+};
+
+#define PGM_CHECK_DEFINE(T)                                                  \
+    static void check_pgm_##T(size_t n, enum pgm_shape shape)                \
+    {                                                                        \
+        static const size_t epsilons[] = { 1, 4, 64 };                       \
+        const T max = (T) ~(T) 0;                                            \
+        T *data = malloc((n + 1) * sizeof(T));                               \
+        T v = 1;                                                             \
+        for (size_t i = 0; i < n; i++) {                                     \
+            data[i] = v;                                                     \
+            switch (shape) {                                                 \
+            case PGM_LINEAR:                                                 \
+                v += 3;                                                      \
+                break;                                                       \
+            case PGM_GAPS:                                                   \
+                v += 1 + rand() % 9;                                         \
+                break;                                                       \
+            case PGM_JUMPS:                                                  \
+                v += rand() % 50 == 0 ? (T) 1 << 20 : 1;                     \
+                break;                                                       \
+            case PGM_RUNS:                                                   \
+                v += rand() % 100 == 0;                                      \
+                break;                                                       \
+            }                                                                \
+        }                                                                    \
+        if (n > 2)                                                           \
+            data[n - 1] = max;                                               \
+        BGSlice *s = BGSlice_new_copy_from_buf(data, n, n, n + 1, NULL);     \
+        for (size_t e = 0; e < bg_arr_length(epsilons); e++) {               \
+            BGPGMIndex *p = BGPGMIndex_new_##T(s, epsilons[e], NULL);        \
+            TEST_ASSERT_NOT_NULL(p);                                         \
+            for (size_t i = 0; i < n; i++) {                                 \
+                for (T d = 0; d < 3; d++) {                                  \
+                    T k = d == 0   ? data[i]                                 \
+                          : d == 1 ? data[i] - 1                             \
+                                   : data[i] + 1;                            \
+                    TEST_ASSERT_EQUAL(BGSlice_lower_bound_##T(s, k),         \
+                                      BGPGMIndex_lower_bound_##T(p, k));     \
+                }                                                            \
+            }                                                                \
+            TEST_ASSERT_EQUAL(0, BGPGMIndex_lower_bound_##T(p, 0));          \
+            TEST_ASSERT_EQUAL(BGSlice_lower_bound_##T(s, max),               \
+                              BGPGMIndex_lower_bound_##T(p, max));           \
+            BGPGMIndex_free(p);                                              \
+        }                                                                    \
+        BGSlice_free(s);                                                     \
+        free(data);                                                          \
+    }
+
+PGM_CHECK_DEFINE(u32)
+PGM_CHECK_DEFINE(u64)
+
+///////////////////////
+// Tests
+//
+
+void
+test_search_primitive(void)
+{
+    check_search_i32();
+    check_search_u32();
+    check_search_i64();
+    check_search_u64();
+    check_search_f32();
+    check_search_f64();
+}
+
+struct search_record {
+    u32 id;
+    char name[12];
+};
+
+static ssize_t
+search_record_by_id(BGSlice *s, comparable a, comparable b, void *ctx)
+{
+    u32 x = ((struct search_record *) a)->id;
+    u32 y = ((struct search_record *) b)->id;
+    return (x > y) - (x < y);
+}
+
+void
+test_search_generic(void)
+{
+    struct search_record records[] = {
+        { 2, "b" }, { 4, "d" }, { 4, "dd" }, { 4, "ddd" }, { 9, "i" },
+    };
+    BGSlice *s = BGSlice_new_copy_from_buf(records, 5, 5, 5, NULL);
+
+    struct search_record key = { 4, "" };
+    TEST_ASSERT_EQUAL(1, BGSlice_lower_bound(s, &key, NULL,
+                                             search_record_by_id));
+    TEST_ASSERT_EQUAL(4, BGSlice_upper_bound(s, &key, NULL,
+                                             search_record_by_id));
+    struct BGSearchRange r =
+        BGSlice_equal_range(s, &key, NULL, search_record_by_id);
+    TEST_ASSERT_EQUAL(1, r.lo);
+    TEST_ASSERT_EQUAL(4, r.hi);
+
+    key.id = 1;
+    TEST_ASSERT_EQUAL(0, BGSlice_lower_bound(s, &key, NULL,
+                                             search_record_by_id));
+    key.id = 5;
+    r = BGSlice_equal_range(s, &key, NULL, search_record_by_id);
+    TEST_ASSERT_EQUAL(4, r.lo);
+    TEST_ASSERT_EQUAL(4, r.hi);
+    key.id = 10;
+    TEST_ASSERT_EQUAL(5, BGSlice_upper_bound(s, &key, NULL,
+                                             search_record_by_id));
+    BGSlice_free(s);
+
+    // Without a comparator items compare as bytes.
+    const char words[][4] = { "ant", "bee", "cat", "cat", "dog" };
+    s = BGSlice_new_copy_from_buf(words, 5, 5, 5, NULL);
+    r = BGSlice_equal_range(s, "cat", NULL, NULL);
+    TEST_ASSERT_EQUAL(2, r.lo);
+    TEST_ASSERT_EQUAL(4, r.hi);
+    TEST_ASSERT_EQUAL(1, BGSlice_lower_bound(s, "bat", NULL, NULL));
+    BGSlice_free(s);
+
+    s = BGSlice_new(u32, 0, 1, NULL);
+    r = BGSlice_equal_range(s, &key, NULL, NULL);
+    TEST_ASSERT_EQUAL(0, r.lo);
+    TEST_ASSERT_EQUAL(0, r.hi);
+    BGSlice_free(s);
+}
+
+void
+test_search_eytzinger_layout(void)
+{
+    for (size_t n = 1; n <= 300; n++) {
+        u32 *sorted = malloc(n * sizeof(u32));
+        for (size_t i = 0; i < n; i++)
+            sorted[i] = i;
+        BGSlice *s = BGSlice_new_copy_from_buf(sorted, n, n, n, NULL);
+        BGSlice *e = BGSlice_eytzinger_new(s, NULL);
+        u32 *t = e->buf;
+
+        // Every item once, at the position rank says, and in search tree
+        // order: a node is greater than every node in its left subtree and
+        // less than every node in its right one.
+        bool *seen = calloc(n, sizeof(bool));
+        for (size_t p = 0; p < n; p++) {
+            TEST_ASSERT_EQUAL_UINT32(BGSlice_eytzinger_rank(n, p), t[p]);
+            TEST_ASSERT_FALSE(seen[t[p]]);
+            seen[t[p]] = true;
+            for (size_t c = p; c > 0; c = (c - 1) / 2) {
+                size_t parent = (c - 1) / 2;
+                if (c == 2 * parent + 1)
+                    TEST_ASSERT_TRUE(t[p] < t[parent]);
+                else
+                    TEST_ASSERT_TRUE(t[p] > t[parent]);
+            }
+        }
+        free(seen);
+        BGSlice_free(e);
+        BGSlice_free(s);
+        free(sorted);
+    }
+
+    BGSlice *s = BGSlice_new(u64, 0, 1, NULL);
+    BGSlice *e = BGSlice_eytzinger_new(s, NULL);
+    TEST_ASSERT_EQUAL(0, e->len);
+    TEST_ASSERT_EQUAL(0, BGSlice_eytzinger_lower_bound_u64(e, 7));
+    BGSlice_free(e);
+    BGSlice_free(s);
+}
+
+void
+test_search_stree(void)
+{
+    // Up to three layers of u32 nodes and four of u64 ones.
+    for (size_t n = 0; n <= 300; n++) {
+        check_stree_u32(n);
+        check_stree_u64(n);
+    }
+    for (size_t t = 0; t < bg_arr_length(test_lengths); t++) {
+        check_stree_u32(test_lengths[t] * 7);
+        check_stree_u64(test_lengths[t] * 7);
+    }
+
+    // Memory: the leaves, padded, and about one key in 16 (8) more.
+    BGSlice *s = BGSlice_new(u32, 1000, 1000, NULL);
+    BGSTree *t = BGSTree_new_u32(s, NULL);
+    TEST_ASSERT_EQUAL((63 + 4 + 1) * 64, BGSTree_size(t));
+    bg_expect_assertion(BGSTree_lower_bound_u64(t, 1);, "lower_bound_u64");
+    BGSTree_free(t);
+    BGSlice_free(s);
+}
+
+void
+test_search_pgm(void)
+{
+    for (enum pgm_shape shape = PGM_LINEAR; shape <= PGM_RUNS; shape++) {
+        for (size_t t = 0; t < bg_arr_length(test_lengths); t++) {
+            check_pgm_u32(test_lengths[t], shape);
+            check_pgm_u64(test_lengths[t], shape);
+        }
+        check_pgm_u32(100000, shape);
+        check_pgm_u64(100000, shape);
+    }
+
+    // Evenly spaced keys fit one line; random gaps need more the smaller
+    // epsilon is.
+    size_t n = 100000;
+    BGSlice *s = BGSlice_new(u64, n, n, NULL);
+    u64 *keys = s->buf;
+    for (size_t i = 0; i < n; i++)
+        keys[i] = 1000 + 7 * i;
+    BGPGMIndex *p = BGPGMIndex_new_u64(s, 8, NULL);
+    TEST_ASSERT_EQUAL(1, BGPGMIndex_segments(p));
+    BGPGMIndex_free(p);
+    for (size_t i = 1; i < n; i++)
+        keys[i] = keys[i - 1] + 1 + rand() % 16;
+    BGPGMIndex *fine = BGPGMIndex_new_u64(s, 4, NULL);
+    BGPGMIndex *coarse = BGPGMIndex_new_u64(s, 128, NULL);
+    TEST_ASSERT_TRUE(BGPGMIndex_segments(coarse)
+                     < BGPGMIndex_segments(fine));
+    TEST_ASSERT_TRUE(BGPGMIndex_size(coarse) < n * sizeof(u64) / 100);
+    TEST_ASSERT_EQUAL(777, BGPGMIndex_lower_bound_u64(coarse, keys[777]));
+    bg_expect_assertion(BGPGMIndex_lower_bound_u32(coarse, 1);,
+                        "lower_bound_u32");
+    bg_expect_assertion(BGPGMIndex_new_u64(s, 0, NULL);, "epsilon 0");
+    BGPGMIndex_free(fine);
+    BGPGMIndex_free(coarse);
+    BGSlice_free(s);
+}
+
+void
+test_search_elem_size_mismatch(void)
+{
+    BGSlice *s = BGSlice_new(u32, 4, 4, NULL);
+    bg_expect_assertion(BGSlice_lower_bound_u64(s, 1);, "lower_bound_u64");
+    bg_expect_assertion(BGSlice_eytzinger_lower_bound_i32(NULL, 1);,
+                        "eytzinger_lower_bound_i32");
+    BGSlice_free(s);
+}
+
+typedef struct {
+    void (*test_func)(void);
+    const char *test_name;
+} test_case_t;
+
+static const test_case_t all_tests[] = {
+    { test_search_primitive, "test_search_primitive" },
+    { test_search_generic, "test_search_generic" },
+    { test_search_eytzinger_layout, "test_search_eytzinger_layout" },
+    { test_search_stree, "test_search_stree" },
+    { test_search_pgm, "test_search_pgm" },
+    { test_search_elem_size_mismatch, "test_search_elem_size_mismatch" },
+};
+
+#define NUM_TESTS (sizeof(all_tests) / sizeof(all_tests[0]))
+
+void
+run_all_tests(void)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        UnityDefaultTestRun(all_tests[i].test_func, all_tests[i].test_name,
+                            __LINE__);
+    }
+}
+
+void
+run_single_test(const char *test_name)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        if (strcmp(all_tests[i].test_name, test_name) == 0) {
+            UnityDefaultTestRun(all_tests[i].test_func,
+                                all_tests[i].test_name, __LINE__);
+            return;
+        }
+    }
+    printf("Test '%s' not found!\n", test_name);
+}
+
+void
+list_all_tests(void)
+{
+    printf("Available tests (%zu total):\n", NUM_TESTS);
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        printf("  [%2zu] %s\n", i, all_tests[i].test_name);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc == 1) {
+        run_all_tests();
+    } else if (argc == 2) {
+        if (strcmp(argv[1], "--list") == 0)
+            list_all_tests();
+        else
+            run_single_test(argv[1]);
+    } else {
+        printf("Usage: %s [test_name|--list]\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,14 +1,26 @@
+#ifdef __linux__
+#    define _GNU_SOURCE
+#endif
+
 #include "bg_slice.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "bg_common.h"
+#include "bg_sort.h"
+#include "bg_stats.h"
 #include "bg_types.h"
 #include "math/bg_math.h"
 #include "mem/bg_allocator.h"
+#include "mem/bg_vm.h"
 
 #define min(a, b) (a < b ? a : b)
 #define max(a, b) (a > b ? a : b)
@@ -47,15 +59,6 @@
         bg_assert("BGSlice", condition, fmt, __VA_ARGS__); \
     } while (0)
 
-typedef struct BGSlice_s {
-    size_t cap;
-    size_t len;
-    size_t elem_size;
-    void *buf;
-    struct Allocator *allocator;
-    u32 flags;
-} BGSlice_s;
-
 struct BGSliceOption *
 BGSlice_with_allocator(struct BGSliceOption *option,
                        struct Allocator *allocator)
@@ -63,7 +66,8 @@ BGSlice_with_allocator(struct BGSliceOption *option,
     assert_slice(allocator != NULL, "allocator cannot be NULL");
 
     if (option == NULL) {
-        option = malloc(sizeof(struct BGSliceOption));
+        option =
+            bg_allocator_calloc(allocator, 1, sizeof(struct BGSliceOption));
         if (option == NULL)
             return NULL;
     }
@@ -72,6 +76,21 @@ BGSlice_with_allocator(struct BGSliceOption *option,
     return option;
 }
 
+struct BGSliceOption *
+BGSlice_with_growth(struct BGSliceOption *option,
+                    const struct BGSliceGrowth *growth)
+{
+    if (option == NULL) {
+        option = bg_allocator_calloc(malloc_allocator, 1,
+                                     sizeof(struct BGSliceOption));
+        if (option == NULL)
+            return NULL;
+    }
+
+    option->growth = growth;
+    return option;
+}
+
 struct Allocator *
 get_allocator(struct BGSliceOption *option)
 {
@@ -87,18 +106,24 @@ BGSlice_allocate_backing_buffer(size_t cap, size_t elem_size,
 {
     struct Allocator *allocator = get_allocator(option);
 
-    void *buf = allocator->calloc(cap, elem_size);
+    void *buf = bg_allocator_calloc(allocator, cap, elem_size);
     if (buf == NULL)
         return NULL;
 
     return buf;
 }
 
+static const struct BGSliceGrowth *
+get_growth(struct BGSliceOption *option)
+{
+    return option != NULL ? option->growth : NULL;
+}
+
 BGSlice *
 allocate_slice(struct BGSliceOption *option)
 {
     struct Allocator *allocator = get_allocator(option);
-    return allocator->malloc(sizeof(BGSlice_s));
+    return bg_allocator_malloc(allocator, sizeof(BGSlice_s));
 }
 
 #define BGSlice_assert_params_for_slice_new(len, cap, elem_size)           \
@@ -124,14 +149,19 @@ __BGSlice_new(size_t len, size_t cap, size_t elem_size,
         return NULL;
 
     BGSlice_s *s = allocate_slice(option);
-    if (s == NULL)
+    if (s == NULL) {
+        bg_allocator_free(allocator, buf);
         return NULL;
+    }
 
     s->allocator = allocator;
     s->cap = cap;
     s->len = len;
     s->elem_size = elem_size;
     s->buf = buf;
+    s->backing = NULL;
+    s->growth = get_growth(option);
+    s->flags = 0;
 
     return (BGSlice *) s;
 }
@@ -167,20 +197,27 @@ __BGSlice_new_copy_from_buf(void *buf, size_t size, size_t len, size_t cap,
         s->len = len;
 
     s->elem_size = elem_size;
+    s->backing = NULL;
+    s->growth = get_growth(option);
+    s->flags = 0;
     s->buf = BGSlice_allocate_backing_buffer(s->cap, s->elem_size, option);
-    if (s->buf == NULL)
+    if (s->buf == NULL) {
+        bg_allocator_free(allocator, s);
         return NULL;
+    }
 
     memcpy(s->buf, buf, size * s->elem_size);
 
     return (BGSlice *) s;
 }
 
-// Create new slice, making buf as the backing buffer.
+// Create new slice, borrowing buf as the backing buffer.
 BGSlice *
 __BGSlice_new_from_buf(void *buf, size_t len, size_t cap, size_t elem_size,
                        struct BGSliceOption *option)
 {
+    if (cap == BG_SIZE_AUTO)
+        cap = len;
     BGSlice_assert_params_for_slice_new(len, cap, elem_size);
     assert_slice(buf != NULL,
                  "Source buffer to be used as the backing buffer is NULL.");
@@ -196,112 +233,628 @@ __BGSlice_new_from_buf(void *buf, size_t len, size_t cap, size_t elem_size,
     s->len = len;
     s->elem_size = elem_size;
     s->buf = buf;
+    s->backing = NULL;
+    s->growth = get_growth(option);
+    s->flags = BG_SLICE_FLAG_BORROWED;
 
     return s;
 }
 
-#define BGSlice_assert_params_for_slice_copy(src, low, high, _cap)           \
-    do {                                                                     \
-        assert_slice(                                                        \
-            (low) != -1 && ((size_t) (low)) >= src->cap,                     \
-            "Cannot copy from a slice starting at index >= src->cap. "       \
-            "Trying to copy from index %zu, but the slice capacity is %zu.", \
-            (low), src->cap);                                                \
-        assert_slice((high) != -1 && ((size_t) (high)) > src->cap,           \
-                     "Cannot copy from a slice with high index > src->cap. " \
-                     "Trying to copy "                                       \
-                     "with high index %zu, but the slice capacity is %zu.",  \
-                     (high), src->cap);                                      \
-        assert_slice(                                                        \
-            (_cap) != -1 && ((size_t) (_cap)) > src->cap,                    \
-            "Cannot specify capacity of new slice larger than source "       \
-            "capacity. "                                                     \
-            "New slice capacity is %zu but source slice capacity is %zu.",   \
-            (_cap), src->cap);                                               \
-        assert_slice((_cap) == 0,                                            \
-                     "New slice capacity cannot be zero. If you are trying " \
-                     "to copy slice "                                        \
-                     "without specifying capacity, pass -1 to the cap "      \
-                     "parameter. The new "                                   \
-                     "slice will have capacity of (src->cap - low).");       \
-    } while (0)
+enum BGStatus
+__BGSlice_init(BGSlice_s *s, size_t len, size_t cap, size_t elem_size,
+               struct BGSliceOption *option)
+{
+    assert_slice(s != NULL, "slice cannot be NULL");
+    BGSlice_assert_params_for_slice_new(len, cap, elem_size);
+
+    void *buf = BGSlice_allocate_backing_buffer(cap, elem_size, option);
+    if (buf == NULL)
+        return BG_ERR_ALLOC;
+
+    *s = (BGSlice_s) {
+        .cap = cap,
+        .len = len,
+        .elem_size = elem_size,
+        .buf = buf,
+        .allocator = get_allocator(option),
+        .growth = get_growth(option),
+        .flags = BG_SLICE_FLAG_EMBEDDED,
+    };
+    return BG_OK;
+}
+
+void
+__BGSlice_init_inline(BGSlice_s *s, void *storage, size_t n, size_t elem_size,
+                      struct BGSliceOption *option)
+{
+    assert_slice(s != NULL && storage != NULL,
+                 "slice and storage cannot be NULL");
+    BGSlice_assert_params_for_slice_new((size_t) 0, n, elem_size);
+
+    *s = (BGSlice_s) {
+        .cap = n,
+        .elem_size = elem_size,
+        .buf = storage,
+        .allocator = get_allocator(option),
+        .growth = get_growth(option),
+        .flags = BG_SLICE_FLAG_EMBEDDED | BG_SLICE_FLAG_BORROWED
+                 | BG_SLICE_FLAG_INLINE,
+    };
+}
 
-/*
- * Create a new slice from a slice, using the same backing buffer.
- * This can be used to change the offset and length of the slice.
- *
- * Another use case is to perform a BGSlice_copy when you only have ptr. You
- * can make a slice from the ptr.
- *
- * TODO:
- * This has a potentially critical issue. When the newly created slice needs
- * to grow, the original slice s->data might now be some random memory blocks!
- * So I think either we copy the data; or during grow, we allocate new memory
- * using malloc and let the original memory untouched. Performing malloc on
- * grow has major drawback: we'll miss optimization from realloc which
- * potentially just need to coalesce with adjacent blocks. If using malloc
- * instead, there will be those expensive block finding and stuff (though it's
- * probably implementation dependent).
- *
- */
 BGSlice *
-BGSlice_new_from_slice(BGSlice_s *src, ssize_t low, ssize_t high,
-                       struct BGSliceOption *option)
+__BGSlice_new_small(size_t n, size_t elem_size, struct BGSliceOption *option)
 {
-    BGSlice_assert_params_for_slice_copy(src, low, high, (ssize_t) -1);
+    BGSlice_assert_params_for_slice_new((size_t) 0, n, elem_size);
 
-    BGSlice_s *s = allocate_slice(option);
+    // Inline items start at the first max_align_t boundary past the header.
+    const size_t align = _Alignof(max_align_t);
+    size_t offset = (sizeof(BGSlice_s) + align - 1) / align * align;
+    struct Allocator *allocator = get_allocator(option);
+    BGSlice_s *s = bg_allocator_malloc(allocator, offset + n * elem_size);
     if (s == NULL)
         return NULL;
 
-    memcpy(s, src, sizeof(BGSlice_s));
+    // The inline buffer is freed with the header, so it is borrowed.
+    *s = (BGSlice_s) {
+        .cap = n,
+        .elem_size = elem_size,
+        .buf = (char *) s + offset,
+        .allocator = allocator,
+        .growth = get_growth(option),
+        .flags = BG_SLICE_FLAG_BORROWED | BG_SLICE_FLAG_INLINE,
+    };
+    return s;
+}
 
-    if (low == -1)
-        low = 0;
+////////////////////
+// Shared buffers
+//
 
-    if (high == -1)
-        s->len = src->len - low;
-    else
-        s->len = high - low;
+enum BGSliceBackingKind {
+    // From the slice's allocator.
+    SLICE_BACKING_HEAP,
+    // A file mapping (BGSlice_new_mmap).
+    SLICE_BACKING_FILE,
+    // An anonymous mapping (BGSlice_new_vm).
+    SLICE_BACKING_VM,
+};
 
-    s->buf = ((char *) s->buf) + BGSlice_get_size_in_bytes(src, low);
+// A mapping of a file that views still point into after the owner moved to
+// a larger one; unmapped with the block.
+struct slice_old_mapping {
+    void *buf;
+    size_t size;
+    struct slice_old_mapping *next;
+};
 
-    return s;
+// The block behind a set of slices sharing one buffer.
+struct BGSliceBacking {
+    size_t refcount;
+    // Start of the allocation, which the slices may point into at any
+    // offset.
+    void *buf;
+    struct Allocator *allocator;
+    enum BGSliceBackingKind kind;
+
+    // Mapped bytes; for reserved VM blocks, the committed part.
+    size_t map_size;
+    // Size of the address space reservation, 0 when not reserved.
+    size_t reserve_size;
+
+    // For file mappings, the file, -1 otherwise.
+    int fd;
+    u32 mmap_flags;
+    // Bytes of the file holding items, which it is truncated to once
+    // unmapped: the owning slice's length when it lets go of the mapping.
+    size_t file_size;
+    // Earlier mappings of the file, kept for the views into them.
+    struct slice_old_mapping *old_mappings;
+};
+
+static void
+slice_backing_free(struct BGSliceBacking *b)
+{
+    switch (b->kind) {
+    case SLICE_BACKING_HEAP:
+        bg_allocator_free(b->allocator, b->buf);
+        break;
+    case SLICE_BACKING_FILE:
+        if (b->mmap_flags & BG_MMAP_WRITE)
+            (void) ftruncate(b->fd, (off_t) b->file_size);
+        bg_vm_unmap(b->buf, b->map_size);
+        while (b->old_mappings != NULL) {
+            struct slice_old_mapping *m = b->old_mappings;
+            b->old_mappings = m->next;
+            bg_vm_unmap(m->buf, m->size);
+            bg_allocator_free(b->allocator, m);
+        }
+        close(b->fd);
+        break;
+    case SLICE_BACKING_VM:
+        bg_vm_unmap(b->buf, b->reserve_size ? b->reserve_size : b->map_size);
+        break;
+    }
+    bg_allocator_free(b->allocator, b);
+}
+
+/*
+ * Make s's buffer shareable, turning it into a reference-counted block if
+ * it is not one already. Returns the backing (NULL for borrowed buffers,
+ * which need no tracking) with one reference taken for the caller.
+ */
+static enum BGStatus
+slice_share(BGSlice_s *s, struct BGSliceBacking **backing)
+{
+    *backing = NULL;
+    if (s->flags & BG_SLICE_FLAG_BORROWED)
+        return BG_OK;
+
+    if (!(s->flags & BG_SLICE_FLAG_SHARED)) {
+        struct BGSliceBacking *b =
+            bg_allocator_malloc(s->allocator, sizeof(struct BGSliceBacking));
+        if (b == NULL)
+            return BG_ERR_ALLOC;
+        b->refcount = 1;
+        b->buf = s->buf;
+        b->allocator = s->allocator;
+        b->kind = SLICE_BACKING_HEAP;
+        b->old_mappings = NULL;
+        s->backing = b;
+        s->flags |= BG_SLICE_FLAG_SHARED;
+    }
+
+    __atomic_fetch_add(&s->backing->refcount, 1, __ATOMIC_RELAXED);
+    *backing = s->backing;
+    return BG_OK;
+}
+
+// Drop s's reference to its shared block, freeing the block if it was the
+// last one.
+static void
+slice_release(BGSlice_s *s)
+{
+    struct BGSliceBacking *b = s->backing;
+    if (s->flags & BG_SLICE_FLAG_MAPPED)
+        b->file_size = BGSlice_get_len_in_bytes(s);
+    if (__atomic_sub_fetch(&b->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+        slice_backing_free(b);
+    s->backing = NULL;
+    s->flags &= ~(BG_SLICE_FLAG_SHARED | BG_SLICE_FLAG_MAPPED);
 }
 
 /*
- * Create a new slice from a slice, using new backing buffer.
+ * Try to turn a shared buffer back into an owned one: possible when s holds
+ * the last reference and starts at the beginning of the block, and the
+ * block came from s's allocator, so that it can realloc it.
  */
+static bool
+slice_reclaim(BGSlice_s *s)
+{
+    struct BGSliceBacking *b = s->backing;
+    if (b->kind != SLICE_BACKING_HEAP
+        || __atomic_load_n(&b->refcount, __ATOMIC_ACQUIRE) != 1
+        || b->buf != s->buf || b->allocator != s->allocator)
+        return false;
+
+    bg_allocator_free(b->allocator, b);
+    s->backing = NULL;
+    s->flags &= ~BG_SLICE_FLAG_SHARED;
+    return true;
+}
+
+/*
+ * Resize the mapping s owns in place of reallocating it. Only the slice
+ * that created the mapping gets here: views are never MAPPED, so a growing
+ * view copies its items out like any shared buffer.
+ *
+ *  - a writable file mapping: resize the file and remap it, or map it
+ *    again if views are left in the old mapping, which stays until they
+ *    are gone;
+ *  - a VM reservation: commit pages up to the new capacity, even with
+ *    views alive, since the buffer does not move;
+ *  - another VM block s owns alone: mremap it, which moves page table
+ *    entries instead of copying.
+ *
+ * Capacity is rounded up to whatever fits in the mapped pages. False when
+ * none of these apply, in which case s has to copy its items out instead.
+ */
+static bool
+slice_resize_mapping(BGSlice_s *s, size_t cap, enum BGStatus *status)
+{
+    struct BGSliceBacking *b = s->backing;
+    bool alone = __atomic_load_n(&b->refcount, __ATOMIC_ACQUIRE) == 1;
+    size_t size = BGSlice_get_size_in_bytes(s, cap);
+    // Keep at least a page mapped so that buf stays valid when cap is 0.
+    size_t map_size = bg_vm_page_align(max(size, 1));
+    void *buf;
+
+    *status = BG_ERR_ALLOC;
+    if (b->kind == SLICE_BACKING_FILE) {
+        if (!(b->mmap_flags & BG_MMAP_WRITE))
+            return false;
+        // Views may still use the items past the new end.
+        if (!alone && cap <= s->cap) {
+            *status = BG_OK;
+            return true;
+        }
+        // With views, map the grown file again and keep the old mapping
+        // for them; both are MAP_SHARED, so they see the same pages.
+        struct slice_old_mapping *old = NULL;
+        if (!alone) {
+            old = bg_allocator_malloc(b->allocator, sizeof(*old));
+            if (old == NULL)
+                return true;
+        }
+        if (ftruncate(b->fd, (off_t) size) == 0)
+            buf = alone ? bg_vm_remap_file(b->buf, b->map_size, map_size,
+                                           b->fd, true)
+                        : bg_vm_map_file(b->fd, map_size, true);
+        else
+            buf = NULL;
+        if (buf == NULL) {
+            (void) ftruncate(b->fd, (off_t) BGSlice_get_cap_in_bytes(s));
+            if (old != NULL)
+                bg_allocator_free(b->allocator, old);
+            return true;
+        }
+        if (old != NULL) {
+            old->buf = b->buf;
+            old->size = b->map_size;
+            old->next = b->old_mappings;
+            b->old_mappings = old;
+        }
+        // The file holds exactly cap items, unlike the mapping.
+        map_size = max(size, 1);
+    } else if (b->reserve_size != 0) {
+        if (map_size > b->reserve_size)
+            return true;
+        char *end = (char *) b->buf + b->map_size;
+        if (map_size > b->map_size
+            && bg_vm_commit(end, map_size - b->map_size) != 0)
+            return true;
+        // Views may still use the pages past the new end.
+        if (map_size < b->map_size && !alone)
+            map_size = b->map_size;
+        if (map_size < b->map_size
+            && bg_vm_decommit((char *) b->buf + map_size,
+                              b->map_size - map_size)
+                   != 0)
+            return true;
+        buf = b->buf;
+    } else {
+        if (!alone)
+            return false;
+        buf = bg_vm_remap(b->buf, b->map_size, map_size);
+        if (buf == NULL)
+            return true;
+    }
+
+    b->buf = buf;
+    b->map_size = map_size;
+    s->buf = buf;
+    s->cap = map_size / s->elem_size;
+    *status = BG_OK;
+    return true;
+}
+
+// Whether s can resize its buffer without copying it: it is the only user of
+// memory it may reallocate, truncate or remap.
+static bool
+slice_owns_alone(BGSlice_s *s)
+{
+    if (s->flags & BG_SLICE_FLAG_BORROWED)
+        return false;
+    if (!(s->flags & BG_SLICE_FLAG_SHARED))
+        return true;
+
+    struct BGSliceBacking *b = s->backing;
+    if (__atomic_load_n(&b->refcount, __ATOMIC_ACQUIRE) != 1
+        || b->buf != s->buf)
+        return false;
+    if (b->kind == SLICE_BACKING_HEAP)
+        return b->allocator == s->allocator;
+    return b->kind != SLICE_BACKING_FILE || (b->mmap_flags & BG_MMAP_WRITE);
+}
+
+/*
+ * Resize s's buffer to cap items, keeping the first len. Owned buffers are
+ * realloc'd and writable file mappings grow the file; borrowed and shared
+ * ones are copied into a new owned buffer and left untouched for their
+ * other users. s is unchanged on failure.
+ */
+static enum BGStatus
+slice_resize_storage(BGSlice_s *s, size_t cap)
+{
+    size_t size = BGSlice_get_size_in_bytes(s, cap);
+    enum BGStatus status;
+
+    if ((s->flags & BG_SLICE_FLAG_MAPPED)
+        && slice_resize_mapping(s, cap, &status))
+        return status;
+    if ((s->flags & BG_SLICE_FLAG_SHARED) && slice_reclaim(s))
+        goto owned;
+
+    if (s->flags & (BG_SLICE_FLAG_BORROWED | BG_SLICE_FLAG_SHARED)) {
+        void *buf = bg_allocator_malloc(s->allocator, size);
+        if (buf == NULL)
+            return BG_ERR_ALLOC;
+        memcpy(buf, s->buf, BGSlice_get_len_in_bytes(s));
+        if (s->flags & BG_SLICE_FLAG_SHARED)
+            slice_release(s);
+        s->flags &= ~(BG_SLICE_FLAG_BORROWED | BG_SLICE_FLAG_INLINE);
+        s->buf = buf;
+        s->cap = cap;
+        return BG_OK;
+    }
+
+owned:;
+    void *buf = bg_allocator_realloc(s->allocator, s->buf, size);
+    if (buf == NULL)
+        return BG_ERR_ALLOC;
+    s->buf = buf;
+    s->cap = cap;
+    return BG_OK;
+}
+
+// slice_resize_storage, counted for BG_STATS.
+static enum BGStatus
+slice_resize_buffer(BGSlice_s *s, size_t cap)
+{
+    size_t old_cap = s->cap;
+    void *old_buf = s->buf;
+    enum BGStatus status = slice_resize_storage(s, cap);
+    if (status != BG_OK)
+        return status;
+
+    if (cap > old_cap)
+        bg_stats_add(slice_grows, 1);
+    else
+        bg_stats_add(slice_shrinks, 1);
+    // File and VM mappings move by remapping pages, not copying them.
+    if (s->buf != old_buf && old_buf != NULL
+        && !(s->flags & BG_SLICE_FLAG_MAPPED))
+        bg_stats_add(bytes_copied, BGSlice_get_len_in_bytes(s));
+    bg_stats_max(peak_cap_bytes, BGSlice_get_cap_in_bytes(s));
+    return BG_OK;
+}
+
+#define BGSlice_assert_params_for_slice_range(src, low, high)               \
+    do {                                                                     \
+        assert_slice((low) >= 0 && (low) <= (high),                          \
+                     "Invalid slice range [%zd, %zd).", (low), (high));      \
+        assert_slice(((size_t) (high)) <= src->cap,                          \
+                     "Cannot slice with high index > src->cap. Trying to "   \
+                     "slice with high index %zd, but the slice capacity is " \
+                     "%zu.",                                                 \
+                     (high), src->cap);                                      \
+    } while (0)
+
+// Create a view of src[low, high) sharing src's backing buffer.
 BGSlice *
-BGSlice_new_copy_from_slice(BGSlice_s *src, ssize_t low, ssize_t high,
-                            ssize_t cap, struct BGSliceOption *option)
+BGSlice_new_from_slice(BGSlice_s *src, ssize_t low, ssize_t high,
+                       struct BGSliceOption *option)
 {
-    BGSlice_assert_params_for_slice_copy(src, low, high, cap);
+    assert_slice(src != NULL, "slice cannot be NULL");
+    if (low == -1)
+        low = 0;
+    if (high == -1)
+        high = src->len;
+    BGSlice_assert_params_for_slice_range(src, low, high);
+
+    // Whatever option leaves unset comes from src. The shared block keeps
+    // its own allocator, so the view's only serves its header and the
+    // buffer it copies out to when it grows.
+    struct Allocator *allocator = src->allocator;
+    const struct BGSliceGrowth *growth = src->growth;
+    if (option != NULL && option->allocator != NULL)
+        allocator = option->allocator;
+    if (option != NULL && option->growth != NULL)
+        growth = option->growth;
 
-    BGSlice_s *s = allocate_slice(option);
+    BGSlice_s *s = bg_allocator_malloc(allocator, sizeof(BGSlice_s));
     if (s == NULL)
         return NULL;
-    memcpy(s, src, sizeof(BGSlice_s));
 
+    // Inline items go away with src's header: move them to a buffer the
+    // view can hold on to.
+    if ((src->flags & BG_SLICE_FLAG_INLINE)
+        && slice_resize_storage(src, max(src->cap, 1)) != BG_OK) {
+        bg_allocator_free(allocator, s);
+        return NULL;
+    }
+
+    struct BGSliceBacking *backing;
+    if (slice_share(src, &backing) != BG_OK) {
+        bg_allocator_free(allocator, s);
+        return NULL;
+    }
+
+    *s = *src;
+    s->allocator = allocator;
+    s->growth = growth;
+    s->flags &= ~(BG_SLICE_FLAG_MAPPED | BG_SLICE_FLAG_EMBEDDED);
+    s->buf = ((char *) src->buf) + BGSlice_get_size_in_bytes(src, low);
+    s->len = high - low;
+    s->cap = high - low;
+    s->backing = backing;
+    return s;
+}
+
+// Create a new slice from src[low, high), copied into a new backing buffer.
+BGSlice *
+BGSlice_copy_from_slice(BGSlice_s *src, ssize_t low, ssize_t high,
+                        ssize_t cap, struct BGSliceOption *option)
+{
+    assert_slice(src != NULL, "slice cannot be NULL");
     if (low == -1)
         low = 0;
-
     if (high == -1)
-        s->len = src->len - low;
-    else
-        s->len = high - low;
+        high = src->len;
+    BGSlice_assert_params_for_slice_range(src, low, high);
 
+    size_t len = high - low;
     if (cap == -1)
-        s->cap = src->cap - low;
+        cap = src->cap - low;
+    assert_slice((size_t) cap >= len && cap != 0,
+                 "New slice capacity %zd cannot be zero or less than the "
+                 "copied length %zu. Pass -1 to use (src->cap - low).",
+                 cap, len);
+
+    return __BGSlice_new_copy_from_buf(
+        ((char *) src->buf) + BGSlice_get_size_in_bytes(src, low), len, len,
+        cap, src->elem_size, option);
+}
 
-    void *data = BGSlice_allocate_backing_buffer(cap, src->elem_size, option);
-    if (data == NULL)
+// Map the file at path as a slice of its records.
+BGSlice *
+BGSlice_new_mmap(const char *path, size_t elem_size, u32 flags)
+{
+    assert_slice(path != NULL, "path cannot be NULL");
+    assert_slice(elem_size != 0, "Slice element size cannot be zero.");
+
+    bool writable = flags & (BG_MMAP_WRITE | BG_MMAP_CREATE);
+    if (writable)
+        flags |= BG_MMAP_WRITE;
+    int open_flags = writable ? O_RDWR : O_RDONLY;
+    if (flags & BG_MMAP_CREATE)
+        open_flags |= O_CREAT;
+
+    int fd = open(path, open_flags | O_CLOEXEC, 0644);
+    if (fd < 0)
         return NULL;
 
-    memcpy(s->buf, BGSlice_get_data_ptr_offset(src),
-           BGSlice_get_size_in_bytes(src, s->len));
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        goto err_close;
+    size_t size = (size_t) st.st_size;
+    if (size % elem_size != 0) {
+        errno = EINVAL;
+        goto err_close;
+    }
+
+    // An empty file still gets a page mapped, so that buf is valid and the
+    // mapping can later be grown with it.
+    size_t map_size = max(size, 1);
+    void *buf = bg_vm_map_file(fd, map_size, writable);
+    if (buf == NULL)
+        goto err_close;
+
+    if (flags & BG_MMAP_SEQUENTIAL)
+        bg_vm_advise(buf, map_size, BG_VM_SEQUENTIAL);
+    if (flags & BG_MMAP_RANDOM)
+        bg_vm_advise(buf, map_size, BG_VM_RANDOM);
+    if (flags & BG_MMAP_WILLNEED)
+        bg_vm_advise(buf, map_size, BG_VM_WILLNEED);
+
+    struct Allocator *allocator = get_allocator(NULL);
+    struct BGSliceBacking *b = bg_allocator_malloc(allocator, sizeof(*b));
+    if (b == NULL)
+        goto err_unmap;
+    BGSlice_s *s = __BGSlice_new_from_buf(buf, size / elem_size, BG_AUTO,
+                                          elem_size, NULL);
+    if (s == NULL) {
+        bg_allocator_free(allocator, b);
+        goto err_unmap;
+    }
 
+    b->refcount = 1;
+    b->buf = buf;
+    b->allocator = allocator;
+    b->kind = SLICE_BACKING_FILE;
+    b->map_size = map_size;
+    b->reserve_size = 0;
+    b->fd = fd;
+    b->mmap_flags = flags;
+    b->file_size = size;
+    b->old_mappings = NULL;
+    s->backing = b;
+    s->flags = BG_SLICE_FLAG_SHARED | BG_SLICE_FLAG_MAPPED;
     return s;
+
+err_unmap:
+    bg_vm_unmap(buf, map_size);
+err_close:;
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return NULL;
+}
+
+// Create a new slice in its own anonymous mapping.
+BGSlice *
+__BGSlice_new_vm(size_t len, size_t cap, size_t reserve, size_t elem_size,
+                 u32 flags)
+{
+    BGSlice_assert_params_for_slice_new(len, cap, elem_size);
+    assert_slice(reserve == 0 || reserve >= cap,
+                 "Reserved capacity %zu is less than the capacity %zu.",
+                 reserve, cap);
+
+    size_t map_size = bg_vm_page_align(max(cap * elem_size, 1));
+    size_t reserve_size = 0;
+    void *buf;
+    if (reserve != 0) {
+        reserve_size = bg_vm_page_align(max(reserve * elem_size, map_size));
+        size_t align = 0;
+        if (flags & BG_SLICE_VM_HUGEPAGE) {
+            align = BG_VM_HUGEPAGE_SIZE;
+            reserve_size = (reserve_size + align - 1) & ~(align - 1);
+        }
+        buf = bg_vm_reserve(reserve_size, align);
+        if (buf == NULL)
+            return NULL;
+        if (flags & BG_SLICE_VM_HUGEPAGE)
+            bg_vm_advise(buf, reserve_size, BG_VM_HUGEPAGE);
+        if (bg_vm_commit(buf, map_size) != 0) {
+            bg_vm_unmap(buf, reserve_size);
+            return NULL;
+        }
+    } else {
+        buf = bg_vm_map_anon(map_size);
+        if (buf == NULL)
+            return NULL;
+        if (flags & BG_SLICE_VM_HUGEPAGE)
+            bg_vm_advise(buf, map_size, BG_VM_HUGEPAGE);
+    }
+    size_t mapped = reserve_size ? reserve_size : map_size;
+
+    struct Allocator *allocator = get_allocator(NULL);
+    struct BGSliceBacking *b = bg_allocator_malloc(allocator, sizeof(*b));
+    if (b == NULL) {
+        bg_vm_unmap(buf, mapped);
+        return NULL;
+    }
+    BGSlice_s *s =
+        __BGSlice_new_from_buf(buf, len, map_size / elem_size, elem_size, NULL);
+    if (s == NULL) {
+        bg_allocator_free(allocator, b);
+        bg_vm_unmap(buf, mapped);
+        return NULL;
+    }
+
+    b->refcount = 1;
+    b->buf = buf;
+    b->allocator = allocator;
+    b->kind = SLICE_BACKING_VM;
+    b->map_size = map_size;
+    b->reserve_size = reserve_size;
+    b->fd = -1;
+    b->old_mappings = NULL;
+    s->backing = b;
+    s->flags = BG_SLICE_FLAG_SHARED | BG_SLICE_FLAG_MAPPED;
+    return s;
+}
+
+int
+BGSlice_mmap_sync(BGSlice_s *s)
+{
+    assert_slice(s != NULL, "slice cannot be NULL");
+    assert_slice(s->backing != NULL
+                     && s->backing->kind == SLICE_BACKING_FILE,
+                 "slice is not backed by a file mapping");
+
+    return bg_vm_sync(s->backing->buf, s->backing->map_size);
 }
 
 BGSlice *
@@ -376,14 +929,74 @@ BGSlice_get_usable_cap(BGSlice_s *s)
     return s->cap - s->len;
 }
 
+// Let go of s's buffer, whichever way it is held.
+static void
+slice_release_buffer(BGSlice_s *s)
+{
+    if (s->flags & BG_SLICE_FLAG_SHARED)
+        slice_release(s);
+    else if (!(s->flags & BG_SLICE_FLAG_BORROWED) && s->buf != NULL)
+        bg_allocator_free(s->allocator, s->buf);
+}
+
 void
 BGSlice_free(BGSlice_s *s)
 {
     if (bg_unlikely(s == NULL))
         return;
-    if (bg_unlikely(s->buf != NULL))
-        free(s->buf);
-    free(s);
+    assert_slice(!(s->flags & BG_SLICE_FLAG_EMBEDDED),
+                 "slice was initialized in place; use BGSlice_deinit");
+    slice_release_buffer(s);
+    bg_allocator_free(s->allocator, s);
+}
+
+void
+BGSlice_deinit(BGSlice_s *s)
+{
+    if (bg_unlikely(s == NULL))
+        return;
+    assert_slice(s->flags & BG_SLICE_FLAG_EMBEDDED,
+                 "slice was not initialized in place; use BGSlice_free");
+    slice_release_buffer(s);
+    s->buf = NULL;
+    s->len = 0;
+    s->cap = 0;
+}
+
+// The capacity to grow s to, per its growth policy, when it needs room for
+// at least min_cap items.
+static size_t
+slice_growth_cap(BGSlice_s *s, size_t min_cap)
+{
+    const struct BGSliceGrowth *g = s->growth;
+    enum BGSliceGrowthKind kind = g != NULL ? g->kind : BG_GROWTH_DEFAULT;
+    f64 factor = g != NULL && g->factor != 0 ? g->factor : 1.5;
+
+    size_t new_cap = 0;
+    switch (kind) {
+    case BG_GROWTH_DEFAULT:
+        if (s->cap < 256)
+            new_cap = s->cap * 2;
+        else
+            new_cap = s->cap * 1.25;
+        break;
+    case BG_GROWTH_GEOMETRIC:
+    case BG_GROWTH_PAGE:
+        new_cap = s->cap * factor;
+        break;
+    case BG_GROWTH_STEP:
+        new_cap = s->cap + (g->step != 0 ? g->step : 64);
+        break;
+    case BG_GROWTH_CUSTOM:
+        new_cap = g->fn(s->cap, s->elem_size);
+        break;
+    }
+
+    if (new_cap < min_cap)
+        new_cap = min_cap;
+    if (kind == BG_GROWTH_PAGE)
+        new_cap = bg_vm_page_align(new_cap * s->elem_size) / s->elem_size;
+    return new_cap;
 }
 
 size_t
@@ -391,12 +1004,7 @@ BGSlice_new_cap(BGSlice_s *s)
 {
     assert_slice(s != NULL, "slice cannot be NULL");
 
-    size_t new_cap = 0;
-    if (s->cap < 256)
-        new_cap = s->cap * 2;
-    else
-        new_cap = s->cap * 1.25;
-    return new_cap;
+    return slice_growth_cap(s, s->cap + 1);
 }
 
 BGSlice *
@@ -407,9 +1015,7 @@ BGSlice_grow(BGSlice_s *s)
     if (bg_unlikely(s == NULL))
         return NULL;
 
-    s->cap = BGSlice_new_cap(s);
-    s->buf = s->allocator->realloc(s->buf, BGSlice_get_cap_in_bytes(s));
-    if (s->buf == NULL)
+    if (slice_resize_buffer(s, BGSlice_new_cap(s)) != BG_OK)
         return NULL;
 
     return s;
@@ -444,12 +1050,38 @@ BGSlice_grow_to_cap(BGSlice_s *s, size_t cap)
     if (cap <= s->cap)
         return s;
 
-    s->buf = s->allocator->realloc(s->buf, BGSlice_get_size_in_bytes(s, cap));
-    if (s->buf == NULL)
+    if (slice_resize_buffer(s, cap) != BG_OK)
         return NULL;
 
-    s->cap = cap;
+    return s;
+}
+
+BGSlice *
+BGSlice_reserve(BGSlice_s *s, size_t additional)
+{
+    assert_slice(s != NULL, "slice cannot be NULL");
+    assert_slice(additional <= BG_SLICE_MAX_SIZE - s->len,
+                 "Cannot reserve %zu more items for a slice of length %zu.",
+                 additional, s->len);
+
+    size_t cap = s->len + additional;
+    if (cap <= s->cap)
+        return s;
+    if (slice_resize_buffer(s, cap) != BG_OK)
+        return NULL;
+    return s;
+}
+
+BGSlice *
+BGSlice_shrink_to_fit(BGSlice_s *s)
+{
+    assert_slice(s != NULL, "slice cannot be NULL");
 
+    size_t cap = max(s->len, 1);
+    if (cap >= s->cap || !slice_owns_alone(s))
+        return s;
+    if (slice_resize_buffer(s, cap) != BG_OK)
+        return NULL;
     return s;
 }
 
@@ -469,25 +1101,131 @@ BGSlice_append(BGSlice_s *s, void *const item)
     return s;
 }
 
+/*
+ * Make room for n more items, growing at most once, per the growth policy.
+ * *items, when it points into s's buffer, is moved along with it.
+ */
+static enum BGStatus
+slice_make_room(BGSlice_s *s, size_t n, char **items)
+{
+    assert_slice(n <= BG_SLICE_MAX_SIZE - s->len,
+                 "Cannot add %zu items to a slice of length %zu.", n, s->len);
+    if (s->len + n <= s->cap)
+        return BG_OK;
+
+    char *old = s->buf;
+    bool inside = *items >= old && *items < old + BGSlice_get_cap_in_bytes(s);
+    if (slice_resize_buffer(s, slice_growth_cap(s, s->len + n)) != BG_OK)
+        return BG_ERR_ALLOC;
+    if (inside)
+        *items = (char *) s->buf + (*items - old);
+    return BG_OK;
+}
+
+// Append the n items at items with one copy. items may point into s.
 BGSlice *
-BGSlice_append_n(BGSlice_s *s, void *const item, size_t n)
+BGSlice_append_n(BGSlice_s *s, void *const items, size_t n)
 {
     assert_slice(s != NULL, "slice cannot be NULL");
+    assert_slice(items != NULL || n == 0, "items cannot be NULL");
+    if (bg_unlikely(n == 0))
+        return s;
 
-    if ((s->len + n) >= s->cap) {
-        s = BGSlice_grow_to_cap(s, max(BGSlice_new_cap(s), n));
-    }
-    char *item_ptr = item;
-    // TODO: make this auto-vectorizable
-    while (n--) {
-        if (BGSlice_append(s, item_ptr) == NULL) {
-            return NULL;
-        }
-        item_ptr += s->elem_size;
+    char *src = items;
+    if (slice_make_room(s, n, &src) != BG_OK)
+        return NULL;
+    memcpy(BGSlice_get_data_ptr_offset(s), src,
+           BGSlice_get_size_in_bytes(s, n));
+    s->len += n;
+    return s;
+}
+
+BGSlice *
+BGSlice_extend(BGSlice_s *dst, BGSlice_s *src)
+{
+    assert_slice(dst != NULL && src != NULL, "slices cannot be NULL");
+    assert_slice(dst->elem_size == src->elem_size,
+                 "cannot extend a slice of elem_size %zu with items of "
+                 "elem_size %zu",
+                 dst->elem_size, src->elem_size);
+
+    return BGSlice_append_n(dst, src->buf, src->len);
+}
+
+/*
+ * Insert the n items at items before index idx (idx == len appends), with
+ * one memmove of the tail. items may point into s.
+ */
+BGSlice *
+BGSlice_insert_n(BGSlice_s *s, size_t idx, void *const items, size_t n)
+{
+    assert_slice(s != NULL, "slice cannot be NULL");
+    assert_slice(items != NULL || n == 0, "items cannot be NULL");
+    assert_slice(idx <= s->len,
+                 "cannot insert at index %zu of slice length %zu", idx,
+                 s->len);
+    if (bg_unlikely(n == 0))
+        return s;
+
+    char *src = items;
+    if (slice_make_room(s, n, &src) != BG_OK)
+        return NULL;
+
+    char *at = (char *) s->buf + BGSlice_get_size_in_bytes(s, idx);
+    char *end = (char *) s->buf + BGSlice_get_len_in_bytes(s);
+    size_t bytes = BGSlice_get_size_in_bytes(s, n);
+    memmove(at + bytes, at, end - at);
+
+    if (src < (char *) s->buf || src >= end) {
+        memcpy(at, src, bytes);
+    } else if (src >= at) {
+        // Items from the tail moved up with it.
+        memcpy(at, src + bytes, bytes);
+    } else if (src + bytes <= at) {
+        memcpy(at, src, bytes);
+    } else {
+        // Straddling idx: the part from idx on moved.
+        size_t head = at - src;
+        memcpy(at, src, head);
+        memcpy(at + head, at + bytes, bytes - head);
     }
+    s->len += n;
     return s;
 }
 
+// Remove items [lo, hi), moving the tail down with one memmove.
+void
+BGSlice_erase_range(BGSlice_s *s, size_t lo, size_t hi)
+{
+    assert_slice(s != NULL, "slice cannot be NULL");
+    assert_slice(lo <= hi && hi <= s->len,
+                 "invalid erase range [%zu, %zu) for slice length %zu", lo,
+                 hi, s->len);
+
+    char *buf = s->buf;
+    memmove(buf + BGSlice_get_size_in_bytes(s, lo),
+            buf + BGSlice_get_size_in_bytes(s, hi),
+            BGSlice_get_size_in_bytes(s, (s->len - hi)));
+    s->len -= hi - lo;
+}
+
+// Remove the item at idx in O(1) by moving the last item into its place.
+// The removed item is copied to out unless it is NULL.
+void
+BGSlice_swap_remove(BGSlice_s *s, size_t idx, void *out)
+{
+    assert_slice(s != NULL, "slice cannot be NULL");
+    assert_slice_len_bound_check(s, idx);
+
+    char *item = (char *) s->buf + BGSlice_get_size_in_bytes(s, idx);
+    char *last = (char *) s->buf + BGSlice_get_size_in_bytes(s, (s->len - 1));
+    if (out != NULL)
+        memcpy(out, item, s->elem_size);
+    if (item != last)
+        memcpy(item, last, s->elem_size);
+    s->len--;
+}
+
 bool
 BGSlice_is_full(BGSlice_s *s)
 {
@@ -572,102 +1310,74 @@ BGSlice_range(BGSlice_s *s, void *ctx, BGSlice_range_callback callback)
     }
 }
 
-#define BG_SLICE_ITERATOR_FLAG_NO_BOUND_CHECK (1 << 0)
-
 ////////////////////
-// Iterator
+// Filtering
 //
-// struct BGSliceIterator {
-//     BGSlice *slice;
-//     size_t idx;
-//     void *(*next)(struct BGSliceIterator *iter);
-// };
-
-// struct BGSliceIterator
-// BGSlice_iter(BGSlice *slice, size_t hint_low, size_t hint_max)
-// {
-//     struct BGSliceIterator iter = { .slice = slice, .idx = 0 };
-
-//     u32 flags = 0;
-//     if (hint_low >= 0 && hint_max < slice->len)
-//         iter.next = BGSlice_iter_next_no_bound_check;
-//     else
-//         iter.next = BGSlice_iter_next_bound_checked;
-
-//     return iter;
-// }
-
-// void *
-// BGSlice_iter_next_bound_checked(struct BGSliceIterator *iter)
-// {
-//     void *item = BGSlice_get(iter->slice, iter->idx);
-//     iter->idx++;
-//     return item;
-// }
-
-// void *
-// BGSlice_iter_next_no_bound_check(struct BGSliceIterator *iter)
-// {
-//     void *item = __BGSlice_get(iter->slice, iter->idx);
-//     iter->idx++;
-//     return item;
-// }
-
-#ifdef BG_SLICE_EXAMPLE
-int
-main(void)
+
+size_t
+BGSlice_retain_if(BGSlice_s *s, void *ctx, BGSlice_range_callback pred)
 {
-    int data[] = { 5, 1, 4, 1, 6, 7, 9, 2, 3, 5 };
-    BGSlice *slice =
-        BGSlice_new_copy_all_from_array(data, BG_AUTO, BG_AUTO, NULL);
-    struct BGSliceIterator iter = BGSlice_iter(slice, 0, `);
+    assert_slice(s != NULL, "slice cannot be NULL");
+    assert_slice(pred != NULL, "predicate cannot be NULL");
+
+    char *buf = s->buf;
+    size_t size = s->elem_size, n = s->len;
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        char *item = buf + i * size;
+        if (!pred(item, i, ctx))
+            continue;
+        if (k != i)
+            memcpy(buf + k * size, item, size);
+        k++;
+    }
+    s->len = k;
+    return k;
 }
-#endif
 
-////////////////////
-// Searching
-//
+enum BGStatus
+BGSlice_partition(BGSlice_s *s, void *ctx, BGSlice_range_callback pred,
+                  size_t *n_first)
+{
+    assert_slice(s != NULL, "slice cannot be NULL");
+    assert_slice(pred != NULL, "predicate cannot be NULL");
+
+    char *buf = s->buf;
+    size_t size = s->elem_size, n = s->len;
+    char *rest = NULL;
+    if (n > 0) {
+        rest = bg_allocator_malloc(s->allocator, n * size);
+        if (rest == NULL)
+            return BG_ERR_ALLOC;
+    }
 
-/**
- * Search item matching `term` in the slice using binary search, return the
- * index. Needs to be sorted first.
- */
-// ssize_t
-// BGSlice_binary_search_indexof(BGSlice *s, void *term)
-// {
-//     if (s->len <= 10)
-//         return BGSlice_linear_search_indexof(s, term);
-
-//     size_t low = 0;
-//     size_t high = s->len;
-//     size_t mid = (high - low) / 2;
-//     while (true) {
-//         void *item = __BGSlice_get(s, mid);
-//         int cmp_ret = memcmp(item, term, s->elem_size);
-//         if (cmp_ret == 0)
-//             return mid;
-//         else if (cmp_ret < 0)
-//             high = mid - 1;
-//         else if (cmp_ret > 0)
-//             low = mid + 1;
-//     }
-// }
-
-// ssize_t
-// BGSlice_linear_search_indexof(BGSlice *s, void *term)
-// {
-// }
+    // The first group compacts in place like retain_if, the second queues
+    // up in scratch and is copied in behind it.
+    size_t k = 0, m = 0;
+    for (size_t i = 0; i < n; i++) {
+        char *item = buf + i * size;
+        if (pred(item, i, ctx)) {
+            if (k != i)
+                memcpy(buf + k * size, item, size);
+            k++;
+        } else {
+            memcpy(rest + m * size, item, size);
+            m++;
+        }
+    }
+    if (m > 0)
+        memcpy(buf + k * size, rest, m * size);
+    bg_allocator_free(s->allocator, rest);
+
+    if (n_first != NULL)
+        *n_first = k;
+    return BG_OK;
+}
 
 ////////////////////
 // Sorting
 //
 
-comparable BG_INLINE
-BGSlice_key_fn_default(void *item, size_t idx)
-{
-    return (comparable) item;
-}
-
 ssize_t
 BGSlice_default_comparator_asc(BGSlice_s *s, comparable a, comparable b,
                                void *ctx)
@@ -682,41 +1392,15 @@ BGSlice_default_comparator_desc(BGSlice_s *s, comparable a, comparable b,
     return -memcmp(a, b, s->elem_size);
 }
 
+// BGSlice_isort sorts the slice with a shifting insertion sort. Only worth it
+// for short slices; see bg_sort.h.
 enum BGStatus
 BGSlice_isort(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
               BGSlice_sort_comparator comparator)
 {
     assert_slice(s != NULL, "slice cannot be NULL");
 
-    if (s->len <= 1)
-        return 0;
-
-    key_fn = key_fn == NULL ? BGSlice_key_fn_default : key_fn;
-    comparator =
-        comparator == NULL ? BGSlice_default_comparator_asc : comparator;
-
-    void *swap_tmp = s->allocator->malloc(s->elem_size);
-    if (swap_tmp == NULL)
-        return BG_ERR_ALLOC;
-
-    for (size_t i = 1; i < s->len; i++) {
-        ssize_t j = i;
-
-        while ((j - 1) >= 0) {
-            void *item_a = BGSlice_get(s, j);
-            comparable key_a = key_fn(item_a, j);
-
-            void *item_b = BGSlice_get(s, j - 1);
-            comparable key_b = key_fn(item_b, j - 1);
-
-            ssize_t compare_ret = comparator(s, key_b, key_a, ctx);
-            if (compare_ret > 0)
-                bg_swap_generic(item_a, item_b, swap_tmp, s->elem_size);
-            j--;
-        }
-    }
-
-    return BG_OK;
+    return BGSlice_insertion_sort(s, ctx, key_fn, comparator);
 }
 
 bool
@@ -727,190 +1411,13 @@ print_slice_item(void *item, size_t idx, void *ctx)
     return true;
 }
 
-struct pivot_buf_t {
-    void *value;
-    size_t index;
-};
-
-struct qsort_mo3_pick_median_args {
-    BGSlice_s *s;
-    BGSlice_s *pivot_indices;
-    size_t low;
-    size_t high;
-    size_t median_idx_result;
-};
-
-void
-BGSlice_qsort_mo3_pick_median(struct qsort_mo3_pick_median_args *args)
-{
-    size_t space_size = args->high - args->low;
-
-    struct fastrand rng = bg_fast_rand_init();
-
-    for (size_t i = 0; i < 3; i++) {
-        size_t idx = bg_fast_rand_n(&rng, space_size) + args->low;
-        for (ssize_t j = i - 1; j > 0; j--) {
-            while (idx == *(size_t *) BGSlice_get(args->pivot_indices, j)) {
-                idx = bg_fast_rand_n(&rng, space_size) + args->low;
-            }
-        }
-        BGSlice_set(args->pivot_indices, i, &idx);
-    }
-
-    BGSlice_isort(args->pivot_indices, NULL, NULL, NULL);
-    args->median_idx_result = *(size_t *) BGSlice_get(args->pivot_indices, 1);
-}
-
-struct qsort_mo3_partition_args {
-    BGSlice_s *s;
-    size_t low;
-    size_t high;
-    void *swap_tmp;
-    size_t median_idx_result;
-    BGSlice *pivot_indices;
-};
-
-void
-BGSlice_qsort_mo3_partition(struct qsort_mo3_partition_args *args)
-{
-    struct qsort_mo3_pick_median_args margs = {
-        .s = args->s,
-        .pivot_indices = args->pivot_indices,
-        .low = args->low,
-        .high = args->high,
-    };
-
-    BGSlice_qsort_mo3_pick_median(&margs);
-
-    size_t median_idx = margs.median_idx_result;
-
-    // printf("median_idx=%zu\n", median_idx);
-
-    bg_swap_generic(BGSlice_get(args->s, median_idx),
-                    BGSlice_get(args->s, args->high - 1), args->swap_tmp,
-                    args->s->elem_size);
-
-    void *pivot = BGSlice_get(args->s, args->high - 1);
-    ssize_t i = args->low;
-    ssize_t j = args->high - 2;
-
-    while (1) {
-        while (1) {
-            if (memcmp(BGSlice_get(args->s, i), pivot, args->s->elem_size)
-                >= 0)
-                break;
-            if (i < args->high - 1)
-                i++;
-            else
-                break;
-        }
-        while (1) {
-            if (memcmp(BGSlice_get(args->s, j), pivot, args->s->elem_size)
-                <= 0)
-                break;
-            if (j > 0)
-                j--;
-            else
-                break;
-        }
-        if (i >= j)
-            break;
-
-        bg_swap_generic(BGSlice_get(args->s, i), BGSlice_get(args->s, j),
-                        args->swap_tmp, args->s->elem_size);
-    }
-    bg_swap_generic(BGSlice_get(args->s, i), pivot, args->swap_tmp,
-                    args->s->elem_size);
-    args->median_idx_result = i;
-}
-
-struct __qsort_args {
-    BGSlice_s *s;
-    void *ctx;
-    BGSlice_sort_key_fn key_fn;
-    BGSlice_sort_comparator comparator;
-    size_t low;
-    size_t high;
-    void *swap_tmp;
-    BGSlice *pivot_indices;
-};
-
-void
-__BGSlice_qsort(struct __qsort_args *args)
-{
-    struct qsort_mo3_partition_args partition_args = {
-        .s = args->s,
-        .low = args->low,
-        .high = args->high,
-        .swap_tmp = args->swap_tmp,
-        .pivot_indices = args->pivot_indices,
-    };
-
-    BGSlice_qsort_mo3_partition(&partition_args);
-
-    size_t pivot_idx = partition_args.median_idx_result;
-
-    args->low = args->low;
-    args->high = pivot_idx - 1;
-    __BGSlice_qsort(args);
-
-    args->low = pivot_idx + 1;
-    args->high = args->high;
-    __BGSlice_qsort(args);
-}
-
-// BGSlice_qsort is an implementation of quicksort.
+// BGSlice_qsort sorts the slice with pattern-defeating quicksort
+// (BGSlice_pdqsort). Not stable.
 enum BGStatus
 BGSlice_qsort(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
               BGSlice_sort_comparator comparator)
 {
     assert_slice(s != NULL, "slice cannot be NULL");
 
-    enum BGStatus ret = BG_OK;
-
-    if (s->len <= 1)
-        goto done;
-
-    key_fn = key_fn == NULL ? BGSlice_key_fn_default : key_fn;
-    comparator =
-        comparator == NULL ? BGSlice_default_comparator_asc : comparator;
-
-    if (s->len <= 15) {
-        BGSlice_isort(s, ctx, key_fn, comparator);
-        goto done;
-    }
-
-    void *swap_tmp = s->allocator->malloc(s->elem_size);
-    if (swap_tmp == NULL) {
-        ret = BG_ERR_ALLOC;
-        goto free_swap_tmp;
-    }
-
-    BGSlice *pivot_indices = __BGSlice_new(
-        3, 3, sizeof(size_t), BGSlice_with_allocator(NULL, s->allocator));
-    if (pivot_indices == NULL) {
-        ret = BG_ERR_ALLOC;
-        goto free_pivot_indices;
-    }
-
-    struct __qsort_args args = {
-        .s = s,
-        .ctx = ctx,
-        .key_fn = key_fn,
-        .comparator = comparator,
-        .low = 0,
-        .high = s->len,
-        .swap_tmp = swap_tmp,
-        .pivot_indices = pivot_indices,
-    };
-
-    __BGSlice_qsort(&args);
-
-free_pivot_indices:
-    s->allocator->free(pivot_indices);
-free_swap_tmp:
-    s->allocator->free(swap_tmp);
-
-done:
-    return ret;
-}
\ No newline at end of file
+    return BGSlice_pdqsort(s, ctx, key_fn, comparator);
+}
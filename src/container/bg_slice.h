@@ -17,14 +17,104 @@ enum BGStatus {
 #define BG_SLICE_MAX_SIZE ((size_t) 0x10000000000)
 #define BG_SIZE_AUTO (BG_SLICE_MAX_SIZE + (size_t) 1)
 
+/*
+ * Slice header fields. Kept in a macro so that type-specialized slices (see
+ * bg_slice_typed.h) can mirror the exact layout of BGSlice_s with a typed
+ * buffer pointer.
+ */
+#define __BG_SLICE_FIELDS(buf_type)     \
+    size_t cap;                         \
+    size_t len;                         \
+    size_t elem_size;                   \
+    buf_type *buf;                      \
+    struct Allocator *allocator;        \
+    struct BGSliceBacking *backing;     \
+    const struct BGSliceGrowth *growth; \
+    u32 flags;
+
+/*
+ * Buffer ownership, kept in BGSlice_s.flags. A slice with neither flag set
+ * owns buf outright: growing reallocs it and freeing the slice frees it.
+ */
+// buf belongs to the caller (BGSlice_new_from_buf). It is never freed, and
+// growing copies the items into a new buffer the slice owns.
+#define BG_SLICE_FLAG_BORROWED ((u32) 1 << 0)
+// buf lies in a block shared with other slices (BGSlice_new_from_slice) and
+// tracked by the reference-counted `backing`. The block is freed with its
+// last reference. Growing copies the items out unless this slice holds the
+// last reference and starts at the beginning of the block, in which case
+// it simply takes the block back.
+#define BG_SLICE_FLAG_SHARED ((u32) 1 << 1)
+// s is the slice BGSlice_new_mmap or BGSlice_new_vm returned and owns the
+// mapping buf lies in (also SHARED; views of it are not MAPPED). Growing
+// resizes the mapping instead of copying where possible, see those
+// constructors. A file ends up holding the owner's items: it is truncated
+// to the slice's length when unmapped.
+#define BG_SLICE_FLAG_MAPPED ((u32) 1 << 2)
+// The header itself belongs to the caller (BGSlice_init): the slice is
+// released with BGSlice_deinit, and BGSlice_free refuses it.
+#define BG_SLICE_FLAG_EMBEDDED ((u32) 1 << 3)
+// buf is the inline storage of a small slice (BGSlice_new_small,
+// BGSlice_init_inline), which goes away with the header; also BORROWED.
+// Views move the items to the heap first, so that they can outlive it.
+#define BG_SLICE_FLAG_INLINE ((u32) 1 << 4)
+
+struct BGSliceBacking;
+
+/*
+ * How a slice picks its new capacity once it is full: a bigger factor means
+ * fewer reallocs, a smaller one less unused memory. The result is never
+ * less than the capacity the operation needs.
+ */
+enum BGSliceGrowthKind {
+    // 2x up to 256 items, 1.25x after.
+    BG_GROWTH_DEFAULT,
+    // cap * factor.
+    BG_GROWTH_GEOMETRIC,
+    // cap * factor, rounded up to whole pages so that the last page of the
+    // buffer is never partly wasted. Suits large slices.
+    BG_GROWTH_PAGE,
+    // cap + step: bounded overhead, at the cost of a realloc every step
+    // items.
+    BG_GROWTH_STEP,
+    // fn(cap, elem_size).
+    BG_GROWTH_CUSTOM,
+};
+
+struct BGSliceGrowth {
+    enum BGSliceGrowthKind kind;
+    // GEOMETRIC and PAGE: growth factor, 0 meaning 1.5.
+    f64 factor;
+    // STEP: items to add, 0 meaning 64.
+    size_t step;
+    // CUSTOM: capacity to grow a slice of cap items to.
+    size_t (*fn)(size_t cap, size_t elem_size);
+};
+
+typedef struct BGSlice_s {
+    __BG_SLICE_FIELDS(void)
+} BGSlice_s;
+
 typedef struct BGSlice_s BGSlice;
 
 struct BGSliceOption {
+    // Everything the slice allocates comes from here, malloc_allocator when
+    // NULL.
     struct Allocator *allocator;
+    // Referenced, not copied: it must outlive the slice, and is usually a
+    // static. NULL means BG_GROWTH_DEFAULT.
+    const struct BGSliceGrowth *growth;
 };
 
+/*
+ * Set a field of option and return it. A NULL option is allocated, zeroed,
+ * from the given allocator (with_allocator) or malloc (with_growth), and
+ * must be freed with it.
+ */
 struct BGSliceOption *BGSlice_with_allocator(struct BGSliceOption *option,
                                              struct Allocator *allocator);
+struct BGSliceOption *BGSlice_with_growth(struct BGSliceOption *option,
+                                          const struct BGSliceGrowth *growth);
 
 BGSlice *__BGSlice_new(size_t len, size_t cap, size_t elem_size,
                        struct BGSliceOption *option);
@@ -41,18 +131,131 @@ BGSlice *__BGSlice_new_copy_from_buf(void *ptr, size_t size, size_t len,
     __BGSlice_new_copy_from_buf((void *) arr, bg_arr_length(arr), len, cap, \
                                 sizeof(arr[0]), option)
 
+// Use buf as the backing buffer without taking ownership of it (see
+// BG_SLICE_FLAG_BORROWED). cap == BG_AUTO means len.
 BGSlice *__BGSlice_new_from_buf(void *ptr, size_t len, size_t cap,
                                 size_t elem_size,
                                 struct BGSliceOption *option);
 #define BGSlice_new_from_buf(buf, len, cap, option) \
     __BGSlice_new_from_buf((void *) buf, len, cap, sizeof(buf[0]), option)
 
+/*
+ * Slice headers by value, e.g. as a member of a larger struct, so that a
+ * slice costs one allocation (its buffer) instead of two. Release them with
+ * BGSlice_deinit, never BGSlice_free. BGSlice_init allocates the buffer;
+ * returns BG_ERR_ALLOC and leaves s untouched on failure.
+ */
+enum BGStatus __BGSlice_init(BGSlice *s, size_t len, size_t cap,
+                             size_t elem_size, struct BGSliceOption *option);
+#define BGSlice_init(s, type, len, cap, option) \
+    __BGSlice_init(s, len, cap, sizeof(type), option)
+// Empty slice whose first n items live in storage, which is borrowed (see
+// BG_SLICE_FLAG_BORROWED): nothing is allocated until the items outgrow it.
+void __BGSlice_init_inline(BGSlice *s, void *storage, size_t n,
+                           size_t elem_size, struct BGSliceOption *option);
+void BGSlice_deinit(BGSlice *s);
+
+/*
+ * Small-vector: a header with inline room for n items, spilling to the
+ * allocator only when they overflow.
+ *
+ *     typedef BGSmallSlice(u32, 8) TagList;
+ *     TagList tags;
+ *     BGSmallSlice_init(&tags, NULL);
+ *     BGSlice_append(&tags.slice, &tag);
+ *     ...
+ *     BGSlice_deinit(&tags.slice);
+ *
+ * While the items are inline, the struct must not be moved or copied, and
+ * views of it must not outlive it.
+ */
+#define BGSmallSlice(type, n) \
+    struct {                  \
+        BGSlice slice;        \
+        type storage[n];      \
+    }
+#define BGSmallSlice_init(v, option)                              \
+    __BGSlice_init_inline(&(v)->slice, (v)->storage,              \
+                          bg_arr_length((v)->storage),            \
+                          sizeof((v)->storage[0]), option)
+
+// Heap-allocated small-vector: header and inline room for n items in one
+// allocation. Freed with BGSlice_free as usual.
+BGSlice *__BGSlice_new_small(size_t n, size_t elem_size,
+                             struct BGSliceOption *option);
+#define BGSlice_new_small(type, n, option) \
+    __BGSlice_new_small(n, sizeof(type), option)
+
+/*
+ * Zero-copy view of src[low, high), -1 meaning 0 and src->len respectively.
+ * The view shares src's buffer, so writes through either are visible in
+ * both, and either may be freed first. The view's capacity is its length,
+ * so appending to it copies it out (copy-on-grow) instead of overwriting
+ * items src can see; growing src likewise leaves the view's memory alone.
+ * Views can be handed to other threads: the reference count is atomic,
+ * access to the items is up to the caller. The view's allocator and growth
+ * policy are option's, or src's for those option leaves NULL; the shared
+ * buffer is always freed with the allocator it came from.
+ */
 BGSlice *BGSlice_new_from_slice(BGSlice *src, ssize_t low, ssize_t high,
                                 struct BGSliceOption *option);
 
+// Copy of src[low, high) in a new buffer with the given capacity; -1 means
+// src->cap - low.
 BGSlice *BGSlice_copy_from_slice(BGSlice *src, ssize_t low, ssize_t high,
                                  ssize_t cap, struct BGSliceOption *option);
 
+// Flags for BGSlice_new_mmap.
+// Map read-write; writes through the slice go to the file.
+#define BG_MMAP_WRITE ((u32) 1 << 0)
+// Create the file if it does not exist. Implies BG_MMAP_WRITE.
+#define BG_MMAP_CREATE ((u32) 1 << 1)
+// madvise hints for the expected access pattern.
+#define BG_MMAP_SEQUENTIAL ((u32) 1 << 2)
+#define BG_MMAP_RANDOM ((u32) 1 << 3)
+#define BG_MMAP_WILLNEED ((u32) 1 << 4)
+
+/*
+ * Map the file at path as a slice of elem_size records, without reading it:
+ * pages are loaded as they are touched. len and cap are the number of
+ * records; a file size that is not a multiple of elem_size fails with
+ * EINVAL. Read-only mappings must not be written to, and appending to them
+ * copies the items to the heap. Appending to a writable mapping grows the
+ * file, views or not: views stay in the mapping they were taken from until
+ * they are freed. Returns NULL with errno set on failure.
+ */
+BGSlice *BGSlice_new_mmap(const char *path, size_t elem_size, u32 flags);
+// msync the mapping behind s, blocking until it is written out.
+int BGSlice_mmap_sync(BGSlice *s);
+
+// Flags for BGSlice_new_vm.
+// Ask for transparent huge pages (madvise(MADV_HUGEPAGE)), and align
+// reservations to the huge page size.
+#define BG_SLICE_VM_HUGEPAGE ((u32) 1 << 0)
+
+/*
+ * Slice in its own anonymous memory mapping, for slices that grow very
+ * large: growing it never copies the items.
+ *
+ * With reserve != 0, address space for reserve items is reserved up front
+ * and pages are committed as the slice grows into it. buf never moves, so
+ * pointers into the slice, and views of it, stay valid while it grows, even
+ * with views alive; growing past reserve fails. Only the slice itself grows
+ * in place: a view that grows is copied to the heap like any other view.
+ * Reserving costs no memory, only address space, so reserve can be
+ * generous.
+ *
+ * With reserve == 0, growth mremaps the mapping, which moves page table
+ * entries rather than bytes; buf may move. A slice with live views copies
+ * to the heap instead, like any shared buffer.
+ *
+ * Capacity is rounded up to whole pages.
+ */
+BGSlice *__BGSlice_new_vm(size_t len, size_t cap, size_t reserve,
+                          size_t elem_size, u32 flags);
+#define BGSlice_new_vm(type, len, cap, reserve, flags) \
+    __BGSlice_new_vm(len, cap, reserve, sizeof(type), flags)
+
 BGSlice *BGSlice_reset(BGSlice *s);
 
 ssize_t BGSlice_get_len(BGSlice *s);
@@ -62,11 +265,41 @@ size_t BGSlice_get_usable_cap(BGSlice *s);
 
 void BGSlice_free(BGSlice *s);
 
+// The capacity the next growth would pick, per the slice's growth policy.
+size_t BGSlice_new_cap(BGSlice *s);
+BGSlice *BGSlice_grow(BGSlice *s);
+BGSlice *BGSlice_grow_to_cap(BGSlice *s, size_t cap);
+// Make room for at least additional more items, growing to exactly
+// len + additional if there is not enough. NULL on failure, s unchanged.
+BGSlice *BGSlice_reserve(BGSlice *s, size_t additional);
+/*
+ * Release unused capacity, down to the length (at least one item). Buffers
+ * the slice does not own alone (borrowed, or shared with live views) and
+ * read-only file mappings are left as they are. NULL on failure, s
+ * unchanged.
+ */
+BGSlice *BGSlice_shrink_to_fit(BGSlice *s);
+
 void *BGSlice_get_data_ptr(BGSlice *s);
 void *BGSlice_get_data_ptr_offset(BGSlice *s);
 
 BGSlice *BGSlice_append(BGSlice *s, void *const item);
-BGSlice *BGSlice_append_n(BGSlice *s, void *const item, size_t n);
+/*
+ * Bulk operations: each grows at most once and moves memory at most once.
+ * items may point into s itself. The growing ones return NULL on failure,
+ * leaving s unchanged.
+ */
+BGSlice *BGSlice_append_n(BGSlice *s, void *const items, size_t n);
+// Append all of src's items to dst.
+BGSlice *BGSlice_extend(BGSlice *dst, BGSlice *src);
+// Insert n items before index idx; idx == len appends.
+BGSlice *BGSlice_insert_n(BGSlice *s, size_t idx, void *const items,
+                          size_t n);
+// Remove items [lo, hi), keeping the order of the rest.
+void BGSlice_erase_range(BGSlice *s, size_t lo, size_t hi);
+// Remove the item at idx by moving the last item into its place; O(1) but
+// does not keep the order. The removed item is copied to out unless NULL.
+void BGSlice_swap_remove(BGSlice *s, size_t idx, void *out);
 bool BGSlice_is_full(BGSlice *s);
 ssize_t BGSlice_copy(BGSlice *dst, BGSlice *src);
 void *BGSlice_get(BGSlice *s, size_t index);
@@ -76,8 +309,149 @@ void *BGSlice_set(BGSlice *s, size_t index, void *item);
 typedef bool (*BGSlice_range_callback)(void *item, size_t idx, void *ctx);
 void BGSlice_range(BGSlice *s, void *ctx, BGSlice_range_callback callback);
 
+/*
+ * Filtering in place, keeping the order of the items that stay. pred is
+ * called once per item, in order, with the item's original index, before
+ * that item moves; items before it may already have. To filter primitive
+ * items against a value or by a precomputed mask, the vectorized
+ * BGSlice_retain_<type> and BGSlice_compact in bg_slice_kernels.h are much
+ * faster.
+ */
+// Keep the items pred returns true for. Returns the new length.
+size_t BGSlice_retain_if(BGSlice *s, void *ctx, BGSlice_range_callback pred);
+/*
+ * Stable partition: the items pred returns true for first, then the rest,
+ * each group in its original order. The size of the first group goes to
+ * n_first unless it is NULL. The second group is collected in len items of
+ * scratch from s's allocator; BG_ERR_ALLOC, before pred is ever called, if
+ * that fails.
+ */
+enum BGStatus BGSlice_partition(BGSlice *s, void *ctx,
+                                BGSlice_range_callback pred, size_t *n_first);
+
 #define BG_AUTO BG_SIZE_AUTO
 
+/*
+ * Iterator over items [low, high) of a slice.
+ *
+ * The range is checked against the slice length once, when the iterator is
+ * created; stepping is then a pointer compare and add, and everything is
+ * inline so loops over it unroll and vectorize like loops over an array.
+ * The iterator holds raw pointers into the buffer: appending to the slice
+ * while iterating invalidates it.
+ *
+ *     struct BGSliceIterator it = BGSlice_iter(s, 0, BG_AUTO);
+ *     for (u64 *x; (x = BGSlice_iter_next(&it)) != NULL;)
+ *         sum += *x;
+ *
+ * Chunked mode hands out contiguous (ptr, count) spans instead, for inner
+ * loops that want a plain array:
+ *
+ *     void *chunk;
+ *     size_t n;
+ *     while ((n = BGSlice_iter_next_chunk(&it, 4096, &chunk)) != 0) {
+ *         u64 *p = chunk;
+ *         for (size_t i = 0; i < n; i++)
+ *             sum += p[i];
+ *     }
+ */
+struct BGSliceIterator {
+    char *ptr;
+    char *end;
+    size_t elem_size;
+    // Index of the item ptr points at.
+    size_t idx;
+};
+
+// high == BG_AUTO iterates up to the slice length.
+static inline struct BGSliceIterator
+BGSlice_iter(BGSlice *s, size_t low, size_t high)
+{
+    bg_assert("BGSlice", s != NULL, "slice cannot be NULL");
+    if (high == BG_AUTO)
+        high = s->len;
+    bg_assert("BGSlice", low <= high && high <= s->len,
+              "invalid iterator range [%zu, %zu) for slice length %zu", low,
+              high, s->len);
+
+    char *buf = (char *) s->buf;
+    return (struct BGSliceIterator) {
+        .ptr = buf + low * s->elem_size,
+        .end = buf + high * s->elem_size,
+        .elem_size = s->elem_size,
+        .idx = low,
+    };
+}
+
+// The next item, or NULL once the range is exhausted.
+static inline void *
+BGSlice_iter_next(struct BGSliceIterator *it)
+{
+    if (it->ptr == it->end)
+        return NULL;
+    void *item = it->ptr;
+    it->ptr += it->elem_size;
+    it->idx++;
+    return item;
+}
+
+static inline size_t
+BGSlice_iter_remaining(const struct BGSliceIterator *it)
+{
+    return (size_t) (it->end - it->ptr) / it->elem_size;
+}
+
+/*
+ * Point *ptr at the next up to max_count items (0 means all remaining) and
+ * return how many that is; 0 once the range is exhausted.
+ */
+static inline size_t
+BGSlice_iter_next_chunk(struct BGSliceIterator *it, size_t max_count,
+                        void **ptr)
+{
+    size_t n = BGSlice_iter_remaining(it);
+    if (max_count != 0 && n > max_count)
+        n = max_count;
+    *ptr = it->ptr;
+    it->ptr += n * it->elem_size;
+    it->idx += n;
+    return n;
+}
+
+static inline BGSlice *
+__BGSlice_for_each_slice(BGSlice *s)
+{
+    bg_assert("BGSlice", s != NULL, "cannot iterate a NULL slice");
+    return s;
+}
+
+static inline void *
+__BGSlice_for_each_buf(BGSlice *s, size_t elem_size)
+{
+    bg_assert("BGSlice", s->elem_size == elem_size,
+              "cannot iterate slice with elem_size %zu as items of size %zu",
+              s->elem_size, elem_size);
+    return s->buf;
+}
+
+/*
+ * Loop over every item of s as a T *, bounds resolved once:
+ *
+ *     BGSlice_for_each(u64, x, s)
+ *         sum += *x;
+ *
+ * s is evaluated once. The outer loop only holds it and runs once, so break
+ * and continue act on the items as usual.
+ */
+#define BGSlice_for_each(T, item, s)                                       \
+    for (BGSlice *__bg_s_##item = __BGSlice_for_each_slice(s);             \
+         __bg_s_##item != NULL;                                            \
+         __bg_s_##item = NULL)                                             \
+        for (T *item = (T *) __BGSlice_for_each_buf(__bg_s_##item,         \
+                                                    sizeof(T)),            \
+               *__bg_end_##item = item + __bg_s_##item->len;               \
+             item < __bg_end_##item; item++)
+
 typedef i8 *comparable;
 typedef ssize_t (*BGSlice_sort_comparator)(BGSlice *s, comparable a,
                                            comparable b, void *ctx);
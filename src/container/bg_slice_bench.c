@@ -0,0 +1,929 @@
+#include "bg_cslice.h"
+#include "bg_search.h"
+#include "bg_slice.h"
+#include "bg_slice_kernels.h"
+#include "bg_soa.h"
+#include "bg_slice_typed.h"
+#include "bg_sort.h"
+#include "bg_table.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bg_bench.h"
+#include "bg_common.h"
+#include "bg_types.h"
+
+#define BENCH_N ((size_t) 1 << 24)
+#define BENCH_SORT_N ((size_t) 1 << 20)
+
+static struct BGBenchSuite suite;
+
+////////////////////
+// Append
+//
+
+static void
+bench_append_raw(void)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "append/raw", BENCH_N, BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        size_t len = 0, cap = 16;
+        u64 *arr = malloc(cap * sizeof(u64));
+        bg_bench_start(&b);
+        for (u64 i = 0; i < BENCH_N; i++) {
+            if (len == cap) {
+                cap *= 2;
+                arr = realloc(arr, cap * sizeof(u64));
+            }
+            arr[len++] = i;
+        }
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(arr[len - 1]);
+        free(arr);
+    }
+}
+
+static void
+bench_append_generic(void)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "append/generic", BENCH_N,
+                   BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        BGSlice *s = BGSlice_new(u64, 0, 16, NULL);
+        bg_bench_start(&b);
+        for (u64 i = 0; i < BENCH_N; i++)
+            BGSlice_append(s, &i);
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(*(u64 *) BGSlice_get_last(s));
+        BGSlice_free(s);
+    }
+}
+
+static void
+bench_append_typed(void)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "append/typed", BENCH_N,
+                   BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        BGSlice_u64 *s = BGSlice_u64_new(0, 16, NULL);
+        bg_bench_start(&b);
+        for (u64 i = 0; i < BENCH_N; i++)
+            BGSlice_u64_append(s, i);
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(BGSlice_u64_get(s, BENCH_N - 1));
+        BGSlice_free(BGSlice_u64_base(s));
+    }
+}
+
+// Ingest-style: 4K-record batches of 64-byte records.
+struct bench_record {
+    u64 fields[8];
+};
+
+#define BENCH_BATCH 4096
+
+static void
+bench_append_batches(bool bulk)
+{
+    static struct bench_record batch[BENCH_BATCH];
+    size_t n_batches = BENCH_N / 16 / BENCH_BATCH;
+    size_t n = n_batches * BENCH_BATCH;
+    // Reuse one warm buffer so that page faults don't drown the copies.
+    BGSlice *s = BGSlice_new(struct bench_record, 0, 16, NULL);
+    BGSlice_reserve(s, n);
+
+    struct BGBench b;
+    bg_bench_begin(&b, &suite,
+                   bulk ? "append/batch append_n" : "append/batch per-item",
+                   n, n * sizeof(struct bench_record));
+    while (bg_bench_loop(&b)) {
+        BGSlice_reset(s);
+        bg_bench_start(&b);
+        for (size_t i = 0; i < n_batches; i++) {
+            if (bulk) {
+                BGSlice_append_n(s, batch, BENCH_BATCH);
+            } else {
+                for (size_t j = 0; j < BENCH_BATCH; j++)
+                    BGSlice_append(s, &batch[j]);
+            }
+        }
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(BGSlice_get_len(s));
+    }
+    BGSlice_free(s);
+}
+
+static void
+bench_append_vm(const char *name, size_t reserve, u32 flags)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, name, BENCH_N, BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        BGSlice *s = BGSlice_new_vm(u64, 0, 16, reserve, flags);
+        bg_bench_start(&b);
+        for (u64 i = 0; i < BENCH_N; i++)
+            BGSlice_append(s, &i);
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(*(u64 *) BGSlice_get_last(s));
+        BGSlice_free(s);
+    }
+}
+
+// Short-lived slices of a few items, as in per-request tag lists.
+#define BENCH_SMALL_N ((size_t) 1 << 20)
+#define BENCH_SMALL_ITEMS 6
+
+enum bench_small_kind {
+    BENCH_SMALL_HEAP,
+    BENCH_SMALL_NEW_SMALL,
+    BENCH_SMALL_INLINE,
+};
+
+static void
+bench_small(const char *name, enum bench_small_kind kind)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, name, BENCH_SMALL_N, 0);
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        for (size_t i = 0; i < BENCH_SMALL_N; i++) {
+            BGSmallSlice(u32, 8) tags;
+            BGSlice *s;
+            if (kind == BENCH_SMALL_HEAP) {
+                s = BGSlice_new(u32, 0, 8, NULL);
+            } else if (kind == BENCH_SMALL_NEW_SMALL) {
+                s = BGSlice_new_small(u32, 8, NULL);
+            } else {
+                BGSmallSlice_init(&tags, NULL);
+                s = &tags.slice;
+            }
+            for (u32 j = 0; j < BENCH_SMALL_ITEMS; j++)
+                BGSlice_append(s, &j);
+            sum += *(u32 *) BGSlice_get_last(s);
+            if (kind == BENCH_SMALL_INLINE)
+                BGSlice_deinit(s);
+            else
+                BGSlice_free(s);
+        }
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+////////////////////
+// Get
+//
+
+static void
+bench_get_raw(BGSlice *s)
+{
+    u64 *arr = BGSlice_get_data_ptr(s);
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "get/raw", BENCH_N, BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        for (size_t i = 0; i < BENCH_N; i++)
+            sum += arr[i];
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+static void
+bench_get_generic(BGSlice *s)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "get/generic", BENCH_N, BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        for (size_t i = 0; i < BENCH_N; i++)
+            sum += *(u64 *) BGSlice_get(s, i);
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+static void
+bench_get_typed(BGSlice *s)
+{
+    BGSlice_u64 *ts = BGSlice_u64_from(s);
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "get/typed", BENCH_N, BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        for (size_t i = 0; i < BGSlice_u64_len(ts); i++)
+            sum += BGSlice_u64_get(ts, i);
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+////////////////////
+// Iterate
+//
+
+static bool
+bench_sum_callback(void *item, size_t idx, void *ctx)
+{
+    *(u64 *) ctx += *(u64 *) item;
+    return true;
+}
+
+static void
+bench_iterate_range(BGSlice *s)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "iterate/range", BENCH_N,
+                   BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        BGSlice_range(s, &sum, bench_sum_callback);
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+static void
+bench_iterate_iter(BGSlice *s)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "iterate/iter", BENCH_N,
+                   BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        struct BGSliceIterator it = BGSlice_iter(s, 0, BG_AUTO);
+        for (u64 *x; (x = BGSlice_iter_next(&it)) != NULL;)
+            sum += *x;
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+static void
+bench_iterate_chunked(BGSlice *s)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "iterate/chunked", BENCH_N,
+                   BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        struct BGSliceIterator it = BGSlice_iter(s, 0, BG_AUTO);
+        void *chunk;
+        size_t n;
+        while ((n = BGSlice_iter_next_chunk(&it, 4096, &chunk)) != 0) {
+            u64 *p = chunk;
+            for (size_t i = 0; i < n; i++)
+                sum += p[i];
+        }
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+static void
+bench_iterate_for_each(BGSlice *s)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "iterate/for_each", BENCH_N,
+                   BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        BGSlice_for_each(u64, x, s)
+            sum += *x;
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+////////////////////
+// Sort
+//
+
+static int
+bench_cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *) a, y = *(const u64 *) b;
+    return (x > y) - (x < y);
+}
+
+// Not one of the primitive comparators, so pdqsort takes the generic path.
+static ssize_t
+bench_slice_cmp_u64(BGSlice *s, comparable a, comparable b, void *ctx)
+{
+    return bench_cmp_u64(a, b);
+}
+
+enum bench_sorter {
+    BENCH_SORT_LIBC_QSORT,
+    BENCH_SORT_PDQSORT,
+    BENCH_SORT_PRIMITIVE,
+    BENCH_SORT_STABLE,
+    BENCH_SORT_RADIX,
+};
+
+static void
+bench_sort(const char *name, const u64 *input, enum bench_sorter sorter)
+{
+    BGSlice *s = BGSlice_new(u64, BENCH_SORT_N, BENCH_SORT_N, NULL);
+    u64 *arr = BGSlice_get_data_ptr(s);
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, name, BENCH_SORT_N,
+                   BENCH_SORT_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        memcpy(arr, input, BENCH_SORT_N * sizeof(u64));
+        bg_bench_start(&b);
+        switch (sorter) {
+        case BENCH_SORT_LIBC_QSORT:
+            qsort(arr, BENCH_SORT_N, sizeof(u64), bench_cmp_u64);
+            break;
+        case BENCH_SORT_PDQSORT:
+            BGSlice_pdqsort(s, NULL, NULL, bench_slice_cmp_u64);
+            break;
+        case BENCH_SORT_PRIMITIVE:
+            BGSlice_sort_primitive(s, BG_PRIM_U64, false);
+            break;
+        case BENCH_SORT_STABLE:
+            BGSlice_stable_sort(s, NULL, NULL, BGSlice_comparator_u64_asc,
+                                NULL);
+            break;
+        case BENCH_SORT_RADIX:
+            BGSlice_radix_sort(s, NULL, BG_RADIX_KEY_U64);
+            break;
+        }
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(arr[BENCH_SORT_N / 2]);
+    }
+    BGSlice_free(s);
+}
+
+////////////////////
+// Records: one field of 64-byte records, as structs (AoS) or columns (SoA)
+//
+
+#define BENCH_RECORDS (BENCH_N / 8)
+
+static void
+bench_records_aos(BGSlice *aos)
+{
+    struct bench_record *recs = BGSlice_get_data_ptr(aos);
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "records/aos field sum", BENCH_RECORDS,
+                   BENCH_RECORDS * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        bg_bench_start(&b);
+        for (size_t i = 0; i < BENCH_RECORDS; i++)
+            sum += recs[i].fields[3];
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+static void
+bench_records_soa(BGSoA *soa)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "records/soa field sum", BENCH_RECORDS,
+                   BENCH_RECORDS * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        bg_bench_start(&b);
+        u64 sum = BGSlice_sum_u64(BGSoA_column(soa, 3));
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+static void
+bench_records(void)
+{
+    struct BGSoAField schema[8];
+    for (int i = 0; i < 8; i++)
+        schema[i] = BG_SOA_FIELD(struct bench_record, fields[0]);
+    BGSlice *aos = BGSlice_new(struct bench_record, 0, BENCH_RECORDS, NULL);
+    BGSoA *soa = BGSoA_new(schema, 8, BENCH_RECORDS, NULL);
+    for (u64 i = 0; i < BENCH_RECORDS; i++) {
+        struct bench_record r;
+        for (int f = 0; f < 8; f++)
+            r.fields[f] = i * 8 + f;
+        BGSlice_append(aos, &r);
+        BGSoA_push(soa, &r);
+    }
+
+    bench_records_aos(aos);
+    bench_records_soa(soa);
+    BGSoA_free(soa);
+    BGSlice_free(aos);
+}
+
+////////////////////
+// Kernels
+//
+
+static void
+bench_kernel_sum(BGSlice *s)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "kernel/sum_u64", BENCH_N,
+                   BENCH_N * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        bg_bench_start(&b);
+        u64 sum = BGSlice_sum_u64(s);
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+}
+
+static void
+bench_argmin_loop(BGSlice *f)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "kernel/argmin_f32 loop", BENCH_N,
+                   BENCH_N * sizeof(f32));
+    while (bg_bench_loop(&b)) {
+        bg_bench_start(&b);
+        f32 *p = BGSlice_get_data_ptr(f);
+        size_t idx = 0;
+        for (size_t i = 1; i < BENCH_N; i++)
+            if (p[i] < p[idx])
+                idx = i;
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(idx);
+    }
+}
+
+static void
+bench_kernel_argmin(BGSlice *f)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "kernel/argmin_f32", BENCH_N,
+                   BENCH_N * sizeof(f32));
+    while (bg_bench_loop(&b)) {
+        bg_bench_start(&b);
+        ssize_t idx = BGSlice_argmin_f32(f);
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(idx);
+    }
+}
+
+static void
+bench_prefix_sum_loop(BGSlice *f)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "kernel/prefix_sum_f32 loop", BENCH_N,
+                   BENCH_N * sizeof(f32));
+    while (bg_bench_loop(&b)) {
+        bg_bench_start(&b);
+        f32 *p = BGSlice_get_data_ptr(f);
+        f32 sum = 0;
+        for (size_t i = 0; i < BENCH_N; i++) {
+            sum += p[i];
+            p[i] = sum;
+        }
+        bg_bench_stop(&b);
+    }
+}
+
+static void
+bench_kernel_prefix_sum(BGSlice *f)
+{
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, "kernel/prefix_sum_f32", BENCH_N,
+                   BENCH_N * sizeof(f32));
+    while (bg_bench_loop(&b)) {
+        bg_bench_start(&b);
+        BGSlice_prefix_sum_f32(f, true);
+        bg_bench_stop(&b);
+    }
+}
+
+////////////////////
+// Filter
+//
+// Keep the half of BENCH_N random u32 below BENCH_FILTER_PIVOT: as bad a
+// case for branches as there is.
+
+#define BENCH_FILTER_PIVOT 500
+
+enum bench_filter {
+    BENCH_FILTER_LOOP,
+    BENCH_FILTER_RETAIN_IF,
+    BENCH_FILTER_RETAIN,
+    BENCH_FILTER_COMPACT,
+};
+
+static bool
+bench_filter_pred(void *item, size_t idx, void *ctx)
+{
+    return *(u32 *) item < BENCH_FILTER_PIVOT;
+}
+
+static void
+bench_filter(const char *name, const u32 *input, enum bench_filter filter)
+{
+    BGSlice *s = BGSlice_new(u32, BENCH_N, BENCH_N, NULL);
+    BGSlice *out = BGSlice_new(u32, 0, BENCH_N, NULL);
+    u8 *keep = malloc(BENCH_N);
+    for (size_t i = 0; i < BENCH_N; i++)
+        keep[i] = input[i] < BENCH_FILTER_PIVOT;
+    u32 *arr = BGSlice_get_data_ptr(s);
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, name, BENCH_N, BENCH_N * sizeof(u32));
+    while (bg_bench_loop(&b)) {
+        BGSlice_set_len(s, BENCH_N);
+        BGSlice_set_len(out, 0);
+        memcpy(arr, input, BENCH_N * sizeof(u32));
+        bg_bench_start(&b);
+        switch (filter) {
+        case BENCH_FILTER_LOOP:
+            // Copying out with a branch per item.
+            for (size_t i = 0; i < BENCH_N; i++)
+                if (arr[i] < BENCH_FILTER_PIVOT)
+                    BGSlice_append(out, &arr[i]);
+            break;
+        case BENCH_FILTER_RETAIN_IF:
+            BGSlice_retain_if(s, NULL, bench_filter_pred);
+            break;
+        case BENCH_FILTER_RETAIN:
+            BGSlice_retain_u32(s, BG_CMP_LT, BENCH_FILTER_PIVOT);
+            break;
+        case BENCH_FILTER_COMPACT:
+            BGSlice_compact(s, keep);
+            break;
+        }
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(arr[0]);
+    }
+    free(keep);
+    BGSlice_free(out);
+    BGSlice_free(s);
+}
+
+////////////////////
+// Search
+//
+// BENCH_SEARCH_QUERIES random lower_bound lookups into 2^10 to
+// 2^BENCH_SEARCH_MAX_LOG2 sorted u64 keys, about half of them present: the
+// keys step by 1 or 3 at random, smooth overall but not a line. The
+// default top size fits a small machine; -DBENCH_SEARCH_MAX_LOG2=30 goes to
+// 1G keys and needs about 20 GB.
+
+#ifndef BENCH_SEARCH_MAX_LOG2
+#    define BENCH_SEARCH_MAX_LOG2 25
+#endif
+#define BENCH_SEARCH_QUERIES ((size_t) 1 << 20)
+#define BENCH_PGM_EPSILON 64
+
+enum bench_search {
+    BENCH_SEARCH_BRANCHY,
+    BENCH_SEARCH_BRANCHLESS,
+    BENCH_SEARCH_EYTZINGER,
+    BENCH_SEARCH_STREE,
+    BENCH_SEARCH_BATCH,
+    BENCH_SEARCH_PGM,
+};
+
+static BGSlice *
+bench_search_keys(size_t n)
+{
+    BGSlice *s = BGSlice_new(u64, n, n, NULL);
+    u64 *arr = BGSlice_get_data_ptr(s);
+    u64 key = 0;
+    for (size_t i = 0; i < n; i++) {
+        arr[i] = key;
+        key += 1 + 2 * (rand() & 1);
+    }
+    return s;
+}
+
+// The textbook loop, which mispredicts about every other step.
+static size_t
+bench_search_branchy(const u64 *a, size_t n, u64 key)
+{
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void
+bench_search(const char *kind_name, enum bench_search kind, size_t log2_n,
+             const u64 *random)
+{
+    size_t n = (size_t) 1 << log2_n;
+    char name[64];
+    snprintf(name, sizeof(name), "search/%s 2^%zu", kind_name, log2_n);
+    if (!bg_bench_selected(&suite, name))
+        return;
+
+    BGSlice *s = bench_search_keys(n);
+    u64 *arr = BGSlice_get_data_ptr(s);
+    u64 *queries = malloc(BENCH_SEARCH_QUERIES * sizeof(u64));
+    for (size_t q = 0; q < BENCH_SEARCH_QUERIES; q++)
+        queries[q] = random[q] % (2 * n);
+    BGSlice *e = NULL;
+    BGSTree *t = NULL;
+    BGPGMIndex *p = NULL;
+    BGSlice *out = BGSlice_new(size_t, 0, BENCH_SEARCH_QUERIES, NULL);
+    if (kind == BENCH_SEARCH_EYTZINGER)
+        e = BGSlice_eytzinger_new(s, NULL);
+    if (kind == BENCH_SEARCH_STREE)
+        t = BGSTree_new_u64(s, NULL);
+    if (kind == BENCH_SEARCH_PGM)
+        p = BGPGMIndex_new_u64(s, BENCH_PGM_EPSILON, NULL);
+
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, name, BENCH_SEARCH_QUERIES, 0);
+    while (bg_bench_loop(&b)) {
+        size_t sum = 0;
+        BGSlice_set_len(out, 0);
+        bg_bench_start(&b);
+        switch (kind) {
+        case BENCH_SEARCH_BRANCHY:
+            for (size_t q = 0; q < BENCH_SEARCH_QUERIES; q++)
+                sum += bench_search_branchy(arr, n, queries[q]);
+            break;
+        case BENCH_SEARCH_BRANCHLESS:
+            for (size_t q = 0; q < BENCH_SEARCH_QUERIES; q++)
+                sum += BGSlice_lower_bound_u64(s, queries[q]);
+            break;
+        case BENCH_SEARCH_EYTZINGER:
+            for (size_t q = 0; q < BENCH_SEARCH_QUERIES; q++)
+                sum += BGSlice_eytzinger_lower_bound_u64(e, queries[q]);
+            break;
+        case BENCH_SEARCH_STREE:
+            for (size_t q = 0; q < BENCH_SEARCH_QUERIES; q++)
+                sum += BGSTree_lower_bound_u64(t, queries[q]);
+            break;
+        case BENCH_SEARCH_BATCH:
+            BGSlice_lower_bound_batch_u64(s, queries, BENCH_SEARCH_QUERIES,
+                                          out);
+            sum = ((size_t *) BGSlice_get_data_ptr(out))[0];
+            break;
+        case BENCH_SEARCH_PGM:
+            for (size_t q = 0; q < BENCH_SEARCH_QUERIES; q++)
+                sum += BGPGMIndex_lower_bound_u64(p, queries[q]);
+            break;
+        }
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+    BGSlice_free(out);
+    BGPGMIndex_free(p);
+    BGSTree_free(t);
+    BGSlice_free(e);
+    BGSlice_free(s);
+    free(queries);
+}
+
+/*
+ * Building a PGM index over the search keys. The name carries the size of
+ * the index and its segment count, which the table has no column for.
+ */
+static void
+bench_pgm_build(size_t log2_n, size_t epsilon)
+{
+    size_t n = (size_t) 1 << log2_n;
+    char name[96];
+    snprintf(name, sizeof(name), "pgm/build 2^%zu eps=%zu", log2_n, epsilon);
+    if (!bg_bench_selected(&suite, name))
+        return;
+
+    BGSlice *s = bench_search_keys(n);
+    BGPGMIndex *p = BGPGMIndex_new_u64(s, epsilon, NULL);
+    snprintf(name + strlen(name), sizeof(name) - strlen(name),
+             " (%zu segs, %zu KB)", BGPGMIndex_segments(p),
+             BGPGMIndex_size(p) >> 10);
+    BGPGMIndex_free(p);
+
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, name, n, n * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        bg_bench_start(&b);
+        p = BGPGMIndex_new_u64(s, epsilon, NULL);
+        bg_bench_stop(&b);
+        BGPGMIndex_free(p);
+    }
+    BGSlice_free(s);
+}
+
+////////////////////
+// Table
+//
+// BENCH_SEARCH_QUERIES lookups of present keys in a BGTable of
+// BENCH_TABLE_N random keys, one at a time or as one batch.
+
+#define BENCH_TABLE_N ((size_t) 1 << 22)
+
+static void
+bench_table(const char *name, bool batch, const u64 *random)
+{
+    if (!bg_bench_selected(&suite, name))
+        return;
+    BGTable *t = BGTable_new(BENCH_TABLE_N, NULL);
+    u64 *keys = malloc(BENCH_TABLE_N * sizeof(u64));
+    for (size_t i = 0; i < BENCH_TABLE_N; i++) {
+        keys[i] = (random[i % BENCH_SEARCH_QUERIES] << 22) ^ i;
+        BGTable_put(t, keys[i], i);
+    }
+    u64 *queries = malloc(BENCH_SEARCH_QUERIES * sizeof(u64));
+    for (size_t q = 0; q < BENCH_SEARCH_QUERIES; q++)
+        queries[q] = keys[random[q] % BENCH_TABLE_N];
+    BGSlice *out = BGSlice_new(u64, 0, BENCH_SEARCH_QUERIES, NULL);
+
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, name, BENCH_SEARCH_QUERIES, 0);
+    while (bg_bench_loop(&b)) {
+        u64 sum = 0;
+        BGSlice_set_len(out, 0);
+        bg_bench_start(&b);
+        if (batch) {
+            BGTable_get_batch(t, queries, BENCH_SEARCH_QUERIES, 0, out);
+            sum = ((u64 *) BGSlice_get_data_ptr(out))[0];
+        } else {
+            for (size_t q = 0; q < BENCH_SEARCH_QUERIES; q++) {
+                u64 v = 0;
+                BGTable_get(t, queries[q], &v);
+                sum += v;
+            }
+        }
+        bg_bench_stop(&b);
+        bg_bench_do_not_optimize(sum);
+    }
+    BGSlice_free(out);
+    free(queries);
+    free(keys);
+    BGTable_free(t);
+}
+
+////////////////////
+// Concurrent append
+//
+// BENCH_PRODUCERS threads append BENCH_PRODUCER_N items each into one
+// shared slice, behind a mutex or into a BGCSlice.
+
+#define BENCH_PRODUCERS 4
+#define BENCH_PRODUCER_N ((size_t) 1 << 20)
+
+struct bench_shared {
+    BGSlice *locked;
+    pthread_mutex_t lock;
+    BGCSlice *cslice;
+};
+
+static void *
+bench_producer_locked(void *arg)
+{
+    struct bench_shared *shared = arg;
+    for (u64 i = 0; i < BENCH_PRODUCER_N; i++) {
+        pthread_mutex_lock(&shared->lock);
+        BGSlice_append(shared->locked, &i);
+        pthread_mutex_unlock(&shared->lock);
+    }
+    return NULL;
+}
+
+static void *
+bench_producer_cslice(void *arg)
+{
+    struct bench_shared *shared = arg;
+    for (u64 i = 0; i < BENCH_PRODUCER_N; i++)
+        BGCSlice_append(shared->cslice, &i);
+    return NULL;
+}
+
+static void
+bench_concurrent_append(const char *name, bool cslice)
+{
+    const size_t n = BENCH_PRODUCERS * BENCH_PRODUCER_N;
+    struct BGBench b;
+    bg_bench_begin(&b, &suite, name, n, n * sizeof(u64));
+    while (bg_bench_loop(&b)) {
+        struct bench_shared shared = { 0 };
+        pthread_mutex_init(&shared.lock, NULL);
+        shared.locked = BGSlice_new(u64, 0, 16, NULL);
+        shared.cslice = BGCSlice_new(u64, 0, NULL);
+        pthread_t threads[BENCH_PRODUCERS];
+        bg_bench_start(&b);
+        for (int t = 0; t < BENCH_PRODUCERS; t++)
+            pthread_create(&threads[t], NULL,
+                           cslice ? bench_producer_cslice
+                                  : bench_producer_locked,
+                           &shared);
+        for (int t = 0; t < BENCH_PRODUCERS; t++)
+            pthread_join(threads[t], NULL);
+        bg_bench_stop(&b);
+        BGCSlice_free(shared.cslice);
+        BGSlice_free(shared.locked);
+        pthread_mutex_destroy(&shared.lock);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    bg_bench_suite_init(&suite, argc, argv);
+
+    bench_append_raw();
+    bench_append_generic();
+    bench_append_typed();
+    bench_append_batches(false);
+    bench_append_batches(true);
+    bench_append_vm("append/vm_remap", 0, 0);
+    bench_append_vm("append/vm_reserve", (size_t) 1 << 32, 0);
+    bench_append_vm("append/vm_reserve_huge", (size_t) 1 << 32,
+                    BG_SLICE_VM_HUGEPAGE);
+
+    bench_concurrent_append("append/4 threads mutex", false);
+    bench_concurrent_append("append/4 threads cslice", true);
+
+    bench_small("small/heap", BENCH_SMALL_HEAP);
+    bench_small("small/new_small", BENCH_SMALL_NEW_SMALL);
+    bench_small("small/inline", BENCH_SMALL_INLINE);
+
+    BGSlice *s = BGSlice_new(u64, BENCH_N, BENCH_N, NULL);
+    u64 *arr = BGSlice_get_data_ptr(s);
+    for (size_t i = 0; i < BENCH_N; i++)
+        arr[i] = i;
+
+    bench_get_raw(s);
+    bench_get_generic(s);
+    bench_get_typed(s);
+
+    bench_iterate_range(s);
+    bench_iterate_iter(s);
+    bench_iterate_chunked(s);
+    bench_iterate_for_each(s);
+
+    bench_kernel_sum(s);
+
+    // Random keys; the first BENCH_SORT_N items of s are reused as input.
+    srand(42);
+    for (size_t i = 0; i < BENCH_SORT_N; i++)
+        arr[i] = ((u64) rand() << 33) ^ ((u64) rand() << 11) ^ (u64) rand();
+    bench_sort("sort/libc qsort", arr, BENCH_SORT_LIBC_QSORT);
+    bench_sort("sort/pdqsort", arr, BENCH_SORT_PDQSORT);
+    bench_sort("sort/sort_primitive", arr, BENCH_SORT_PRIMITIVE);
+    bench_sort("sort/stable_sort", arr, BENCH_SORT_STABLE);
+    bench_sort("sort/radix_sort", arr, BENCH_SORT_RADIX);
+
+    bench_records();
+
+    BGSlice *f = BGSlice_new(f32, BENCH_N, BENCH_N, NULL);
+    f32 *farr = BGSlice_get_data_ptr(f);
+    for (size_t i = 0; i < BENCH_N; i++)
+        farr[i] = (f32) (rand() % 1000);
+    bench_argmin_loop(f);
+    bench_kernel_argmin(f);
+    bench_prefix_sum_loop(f);
+    bench_kernel_prefix_sum(f);
+    BGSlice_free(f);
+
+    u32 *filter_input = malloc(BENCH_N * sizeof(u32));
+    for (size_t i = 0; i < BENCH_N; i++)
+        filter_input[i] = (u32) (rand() % (2 * BENCH_FILTER_PIVOT));
+    bench_filter("filter/append loop", filter_input, BENCH_FILTER_LOOP);
+    bench_filter("filter/retain_if", filter_input, BENCH_FILTER_RETAIN_IF);
+    bench_filter("filter/retain_u32", filter_input, BENCH_FILTER_RETAIN);
+    bench_filter("filter/compact", filter_input, BENCH_FILTER_COMPACT);
+    free(filter_input);
+
+    u64 *search_random = malloc(BENCH_SEARCH_QUERIES * sizeof(u64));
+    for (size_t i = 0; i < BENCH_SEARCH_QUERIES; i++)
+        search_random[i] = ((u64) rand() << 31) ^ (u64) rand();
+    for (size_t lg = 10; lg <= BENCH_SEARCH_MAX_LOG2; lg += 5) {
+        bench_search("branchy", BENCH_SEARCH_BRANCHY, lg, search_random);
+        bench_search("lower_bound_u64", BENCH_SEARCH_BRANCHLESS, lg,
+                     search_random);
+        bench_search("eytzinger", BENCH_SEARCH_EYTZINGER, lg, search_random);
+        bench_search("stree", BENCH_SEARCH_STREE, lg, search_random);
+        bench_search("lower_bound_batch_u64", BENCH_SEARCH_BATCH, lg,
+                     search_random);
+        bench_search("pgm", BENCH_SEARCH_PGM, lg, search_random);
+    }
+    for (size_t eps = 16; eps <= 256; eps *= 4)
+        bench_pgm_build(BENCH_SEARCH_MAX_LOG2, eps);
+    bench_table("table/get", false, search_random);
+    bench_table("table/get_batch", true, search_random);
+    free(search_random);
+
+    BGSlice_free(s);
+    return bg_bench_suite_finish(&suite);
+}
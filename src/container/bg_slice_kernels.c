@@ -0,0 +1,826 @@
+#include "bg_slice_kernels.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_cpu.h"
+#include "bg_types.h"
+
+/*
+ * Every kernel has a scalar variant and, on x86, one per register width
+ * written once with GCC/Clang vector extensions: the same source compiled
+ * under target("sse4.2"), target("avx2") and target("avx512f,...") becomes
+ * 16, 32 and 64 byte code. Reductions keep four independent accumulators so
+ * loops are bound by loads rather than by add or compare latency.
+ *
+ * argmin/argmax take two passes, a min/max reduction and then a search for
+ * the first item equal to the result; both passes run at full vector width,
+ * which beats carrying indices through the reduction.
+ *
+ * Prefix sums scan each register in log2(lanes) shift-and-add steps and add
+ * the running total of the previous registers, so the loop-carried
+ * dependency is one add and one lane extract per register instead of one
+ * add per item.
+ */
+
+#define assert_kernels(condition, fmt, ...) \
+    bg_assert("BGSliceKernels", condition, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+// Items counted into per-lane accumulators before they are flushed, small
+// enough that a 32-bit lane cannot overflow.
+#define KERNEL_COUNT_BLOCK ((size_t) 1 << 24)
+
+////////////////////
+// Scalar
+//
+
+#define BG_KERNELS_SCALAR_DEFINE(T, S)                                      \
+    static S kernel_sum_scalar_##T(const T *a, size_t n)                    \
+    {                                                                       \
+        S s0 = 0, s1 = 0, s2 = 0, s3 = 0;                                   \
+        size_t i = 0;                                                       \
+        for (; i + 4 <= n; i += 4) {                                        \
+            s0 += (S) a[i];                                                 \
+            s1 += (S) a[i + 1];                                             \
+            s2 += (S) a[i + 2];                                             \
+            s3 += (S) a[i + 3];                                             \
+        }                                                                   \
+        for (; i < n; i++)                                                  \
+            s0 += (S) a[i];                                                 \
+        return (s0 + s1) + (s2 + s3);                                       \
+    }                                                                       \
+                                                                            \
+    BG_KERNEL_PICK_SCALAR_DEFINE(T, min, <)                                 \
+    BG_KERNEL_PICK_SCALAR_DEFINE(T, max, >)                                 \
+                                                                            \
+    static size_t kernel_find_scalar_##T(const T *a, size_t n, T x)         \
+    {                                                                       \
+        for (size_t i = 0; i < n; i++)                                      \
+            if (a[i] == x)                                                  \
+                return i;                                                   \
+        return n;                                                           \
+    }                                                                       \
+                                                                            \
+    BG_KERNEL_COUNT_SCALAR_DEFINE(T, lt, <)                                 \
+    BG_KERNEL_COUNT_SCALAR_DEFINE(T, gt, >)                                 \
+    BG_KERNEL_COUNT_SCALAR_DEFINE(T, eq, ==)                                 \
+                                                                            \
+    BG_KERNEL_RETAIN_SCALAR_DEFINE(T, lt, <)                                \
+    BG_KERNEL_RETAIN_SCALAR_DEFINE(T, gt, >)                                \
+    BG_KERNEL_RETAIN_SCALAR_DEFINE(T, eq, ==)
+
+// The item x of a[0, n), n > 0, for which no other item y has `y op x`.
+#define BG_KERNEL_PICK_SCALAR_DEFINE(T, name, op)                  \
+    static T kernel_##name##_scalar_##T(const T *a, size_t n)      \
+    {                                                              \
+        T m0 = a[0], m1 = a[0], m2 = a[0], m3 = a[0];              \
+        size_t i = 0;                                              \
+        for (; i + 4 <= n; i += 4) {                               \
+            m0 = a[i] op m0 ? a[i] : m0;                           \
+            m1 = a[i + 1] op m1 ? a[i + 1] : m1;                   \
+            m2 = a[i + 2] op m2 ? a[i + 2] : m2;                   \
+            m3 = a[i + 3] op m3 ? a[i + 3] : m3;                   \
+        }                                                          \
+        for (; i < n; i++)                                         \
+            m0 = a[i] op m0 ? a[i] : m0;                           \
+        m0 = m1 op m0 ? m1 : m0;                                   \
+        m2 = m3 op m2 ? m3 : m2;                                   \
+        return m2 op m0 ? m2 : m0;                                 \
+    }
+
+#define BG_KERNEL_COUNT_SCALAR_DEFINE(T, name, op)                          \
+    static size_t kernel_count_##name##_scalar_##T(const T *a, size_t n, T x) \
+    {                                                                       \
+        size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;                              \
+        size_t i = 0;                                                       \
+        for (; i + 4 <= n; i += 4) {                                        \
+            c0 += a[i] op x;                                                \
+            c1 += a[i + 1] op x;                                            \
+            c2 += a[i + 2] op x;                                            \
+            c3 += a[i + 3] op x;                                            \
+        }                                                                   \
+        for (; i < n; i++)                                                  \
+            c0 += a[i] op x;                                                \
+        return (c0 + c1) + (c2 + c3);                                       \
+    }
+
+/*
+ * Move the items x of a[0, n) for which `(x op value) != invert` to the
+ * front, in order, and return how many there are. Every item is stored at
+ * the write cursor and the cursor advances by the condition, so there is no
+ * branch to mispredict.
+ */
+#define BG_KERNEL_RETAIN_SCALAR_DEFINE(T, name, op)                     \
+    static size_t kernel_retain_##name##_scalar_##T(T *a, size_t n, T x, \
+                                                    bool invert)         \
+    {                                                                   \
+        size_t k = 0;                                                   \
+        for (size_t i = 0; i < n; i++) {                                \
+            T v = a[i];                                                 \
+            a[k] = v;                                                   \
+            k += (v op x) != invert;                                    \
+        }                                                               \
+        return k;                                                       \
+    }
+
+// The same with one keep byte per item. Compaction only moves bits, so it
+// is defined for unsigned types of each item size.
+#define BG_KERNEL_COMPACT_SCALAR_DEFINE(T)                                  \
+    static size_t kernel_compact_scalar_##T(T *a, const u8 *keep, size_t n) \
+    {                                                                       \
+        size_t k = 0;                                                       \
+        for (size_t i = 0; i < n; i++) {                                    \
+            T v = a[i];                                                     \
+            a[k] = v;                                                       \
+            k += keep[i] != 0;                                              \
+        }                                                                   \
+        return k;                                                           \
+    }
+
+// Prefix sums only exist for unsigned and floating point types; signed
+// slices are scanned as unsigned so that overflow wraps.
+#define BG_KERNEL_SCAN_SCALAR_DEFINE(T)                                    \
+    static void kernel_scan_scalar_##T(T *a, size_t n, bool inclusive)     \
+    {                                                                      \
+        T sum = 0;                                                         \
+        for (size_t i = 0; i < n; i++) {                                   \
+            T prev = sum;                                                  \
+            sum += a[i];                                                   \
+            a[i] = inclusive ? sum : prev;                                 \
+        }                                                                  \
+    }
+
+BG_KERNELS_SCALAR_DEFINE(i32, u64)
+BG_KERNELS_SCALAR_DEFINE(u32, u64)
+BG_KERNELS_SCALAR_DEFINE(i64, u64)
+BG_KERNELS_SCALAR_DEFINE(u64, u64)
+BG_KERNELS_SCALAR_DEFINE(f32, f64)
+BG_KERNELS_SCALAR_DEFINE(f64, f64)
+
+BG_KERNEL_SCAN_SCALAR_DEFINE(u32)
+BG_KERNEL_SCAN_SCALAR_DEFINE(u64)
+BG_KERNEL_SCAN_SCALAR_DEFINE(f32)
+BG_KERNEL_SCAN_SCALAR_DEFINE(f64)
+
+BG_KERNEL_COMPACT_SCALAR_DEFINE(u32)
+BG_KERNEL_COMPACT_SCALAR_DEFINE(u64)
+
+#if BG_CPU_X86
+
+/*
+ * Vector variants. V is a register of T, VI the same register as signed
+ * lanes of T's width, which is what vector comparisons produce (all ones
+ * where true).
+ */
+#    define BG_KERNELS_SIMD_DEFINE(isa, target, W, T, S, I)                   \
+        static BG_TARGET(target) S kernel_sum_##isa##_##T(const T *a,        \
+                                                          size_t n)          \
+        {                                                                    \
+            typedef T V __attribute__((vector_size(W)));                     \
+            typedef S VS                                                     \
+                __attribute__((vector_size(W / sizeof(T) * sizeof(S))));     \
+            const size_t L = W / sizeof(T);                                  \
+            VS s0 = { 0 }, s1 = { 0 }, s2 = { 0 }, s3 = { 0 };               \
+            size_t i = 0;                                                    \
+            for (; i + 4 * L <= n; i += 4 * L) {                             \
+                V x0, x1, x2, x3;                                            \
+                memcpy(&x0, a + i, W);                                       \
+                memcpy(&x1, a + i + L, W);                                   \
+                memcpy(&x2, a + i + 2 * L, W);                               \
+                memcpy(&x3, a + i + 3 * L, W);                               \
+                s0 += __builtin_convertvector(x0, VS);                       \
+                s1 += __builtin_convertvector(x1, VS);                       \
+                s2 += __builtin_convertvector(x2, VS);                       \
+                s3 += __builtin_convertvector(x3, VS);                       \
+            }                                                                \
+            for (; i + L <= n; i += L) {                                     \
+                V x;                                                         \
+                memcpy(&x, a + i, W);                                        \
+                s0 += __builtin_convertvector(x, VS);                        \
+            }                                                                \
+            s0 = (s0 + s1) + (s2 + s3);                                      \
+            S sum = 0;                                                       \
+            for (size_t l = 0; l < L; l++)                                   \
+                sum += s0[l];                                                \
+            for (; i < n; i++)                                               \
+                sum += (S) a[i];                                             \
+            return sum;                                                      \
+        }                                                                    \
+                                                                             \
+        BG_KERNEL_PICK_SIMD_DEFINE(isa, target, W, T, I, min, <)             \
+        BG_KERNEL_PICK_SIMD_DEFINE(isa, target, W, T, I, max, >)             \
+                                                                             \
+        static BG_TARGET(target) size_t kernel_find_##isa##_##T(             \
+            const T *a, size_t n, T x)                                       \
+        {                                                                    \
+            typedef T V __attribute__((vector_size(W)));                     \
+            typedef I VI __attribute__((vector_size(W)));                    \
+            const size_t L = W / sizeof(T);                                  \
+            V vx = (V) { 0 } + x;                                            \
+            size_t i = 0;                                                    \
+            for (; i + L <= n; i += L) {                                     \
+                V v;                                                         \
+                memcpy(&v, a + i, W);                                        \
+                VI eq = (VI) (v == vx);                                      \
+                I any = 0;                                                   \
+                for (size_t l = 0; l < L; l++)                               \
+                    any |= eq[l];                                            \
+                if (any)                                                     \
+                    break;                                                   \
+            }                                                                \
+            for (; i < n; i++)                                               \
+                if (a[i] == x)                                               \
+                    return i;                                                \
+            return n;                                                        \
+        }                                                                    \
+                                                                             \
+        BG_KERNEL_COUNT_SIMD_DEFINE(isa, target, W, T, I, lt, <)             \
+        BG_KERNEL_COUNT_SIMD_DEFINE(isa, target, W, T, I, gt, >)             \
+        BG_KERNEL_COUNT_SIMD_DEFINE(isa, target, W, T, I, eq, ==)
+
+// m = x op m ? x : m, lane by lane.
+#    define KERNEL_PICK(V, VI, m, x, op)                                   \
+        do {                                                              \
+            VI take = (VI) ((x) op (m));                                  \
+            (m) = (V) (((VI) (x) & take) | ((VI) (m) & ~take));           \
+        } while (0)
+
+#    define BG_KERNEL_PICK_SIMD_DEFINE(isa, target, W, T, I, name, op)    \
+        static BG_TARGET(target) T kernel_##name##_##isa##_##T(           \
+            const T *a, size_t n)                                         \
+        {                                                                 \
+            typedef T V __attribute__((vector_size(W)));                  \
+            typedef I VI __attribute__((vector_size(W)));                 \
+            const size_t L = W / sizeof(T);                               \
+            if (n < L)                                                    \
+                return kernel_##name##_scalar_##T(a, n);                  \
+            V m0;                                                         \
+            memcpy(&m0, a, W);                                            \
+            V m1 = m0, m2 = m0, m3 = m0;                                  \
+            size_t i = L;                                                 \
+            for (; i + 4 * L <= n; i += 4 * L) {                          \
+                V x0, x1, x2, x3;                                         \
+                memcpy(&x0, a + i, W);                                    \
+                memcpy(&x1, a + i + L, W);                                \
+                memcpy(&x2, a + i + 2 * L, W);                            \
+                memcpy(&x3, a + i + 3 * L, W);                            \
+                KERNEL_PICK(V, VI, m0, x0, op);                           \
+                KERNEL_PICK(V, VI, m1, x1, op);                           \
+                KERNEL_PICK(V, VI, m2, x2, op);                           \
+                KERNEL_PICK(V, VI, m3, x3, op);                           \
+            }                                                             \
+            for (; i + L <= n; i += L) {                                  \
+                V x;                                                      \
+                memcpy(&x, a + i, W);                                     \
+                KERNEL_PICK(V, VI, m0, x, op);                            \
+            }                                                             \
+            KERNEL_PICK(V, VI, m0, m1, op);                               \
+            KERNEL_PICK(V, VI, m2, m3, op);                               \
+            KERNEL_PICK(V, VI, m0, m2, op);                               \
+            T m = m0[0];                                                  \
+            for (size_t l = 1; l < L; l++)                                \
+                m = m0[l] op m ? m0[l] : m;                               \
+            for (; i < n; i++)                                            \
+                m = a[i] op m ? a[i] : m;                                 \
+            return m;                                                     \
+        }
+
+// Each true comparison is -1 in its lane, so subtracting the comparison
+// counts it.
+#    define BG_KERNEL_COUNT_SIMD_DEFINE(isa, target, W, T, I, name, op)   \
+        static BG_TARGET(target) size_t kernel_count_##name##_##isa##_##T( \
+            const T *a, size_t n, T x)                                    \
+        {                                                                 \
+            typedef T V __attribute__((vector_size(W)));                  \
+            typedef I VI __attribute__((vector_size(W)));                 \
+            const size_t L = W / sizeof(T);                               \
+            V vx = (V) { 0 } + x;                                         \
+            size_t count = 0;                                             \
+            size_t i = 0;                                                 \
+            while (i + L <= n) {                                          \
+                size_t end = n - i > KERNEL_COUNT_BLOCK                   \
+                                 ? i + KERNEL_COUNT_BLOCK                 \
+                                 : n;                                     \
+                VI c0 = { 0 }, c1 = { 0 }, c2 = { 0 }, c3 = { 0 };        \
+                for (; i + 4 * L <= end; i += 4 * L) {                    \
+                    V x0, x1, x2, x3;                                     \
+                    memcpy(&x0, a + i, W);                                \
+                    memcpy(&x1, a + i + L, W);                            \
+                    memcpy(&x2, a + i + 2 * L, W);                        \
+                    memcpy(&x3, a + i + 3 * L, W);                        \
+                    c0 -= (VI) (x0 op vx);                                \
+                    c1 -= (VI) (x1 op vx);                                \
+                    c2 -= (VI) (x2 op vx);                                \
+                    c3 -= (VI) (x3 op vx);                                \
+                }                                                         \
+                for (; i + L <= end; i += L) {                            \
+                    V v;                                                  \
+                    memcpy(&v, a + i, W);                                 \
+                    c0 -= (VI) (v op vx);                                 \
+                }                                                         \
+                c0 = (c0 + c1) + (c2 + c3);                               \
+                for (size_t l = 0; l < L; l++)                            \
+                    count += (size_t) c0[l];                              \
+            }                                                             \
+            for (; i < n; i++)                                            \
+                count += a[i] op x;                                       \
+            return count;                                                 \
+        }
+
+/*
+ * Shuffle indices moving the lanes of v up by k in
+ * __builtin_shufflevector(zero, v, ...): lane i takes zero's lane 0 when
+ * i < k, otherwise v's lane i - k (index L + i - k).
+ */
+#    define KERNEL_SHIFT_2_1 0, 2
+#    define KERNEL_SHIFT_4_1 0, 4, 5, 6
+#    define KERNEL_SHIFT_4_2 0, 1, 4, 5
+#    define KERNEL_SHIFT_8_1 0, 8, 9, 10, 11, 12, 13, 14
+#    define KERNEL_SHIFT_8_2 0, 1, 8, 9, 10, 11, 12, 13
+#    define KERNEL_SHIFT_8_4 0, 1, 2, 3, 8, 9, 10, 11
+#    define KERNEL_SHIFT_16_1 \
+        0, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30
+#    define KERNEL_SHIFT_16_2 \
+        0, 1, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29
+#    define KERNEL_SHIFT_16_4 \
+        0, 1, 2, 3, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27
+#    define KERNEL_SHIFT_16_8 \
+        0, 1, 2, 3, 4, 5, 6, 7, 16, 17, 18, 19, 20, 21, 22, 23
+
+#    define KERNEL_SHIFT(v, zero, L, k) \
+        __builtin_shufflevector((zero), (v), KERNEL_SHIFT_##L##_##k)
+
+// In-register inclusive scan of L lanes.
+#    define KERNEL_SCAN_2(v, zero) (v) += KERNEL_SHIFT(v, zero, 2, 1)
+#    define KERNEL_SCAN_4(v, zero)              \
+        do {                                    \
+            (v) += KERNEL_SHIFT(v, zero, 4, 1); \
+            (v) += KERNEL_SHIFT(v, zero, 4, 2); \
+        } while (0)
+#    define KERNEL_SCAN_8(v, zero)              \
+        do {                                    \
+            (v) += KERNEL_SHIFT(v, zero, 8, 1); \
+            (v) += KERNEL_SHIFT(v, zero, 8, 2); \
+            (v) += KERNEL_SHIFT(v, zero, 8, 4); \
+        } while (0)
+#    define KERNEL_SCAN_16(v, zero)              \
+        do {                                     \
+            (v) += KERNEL_SHIFT(v, zero, 16, 1); \
+            (v) += KERNEL_SHIFT(v, zero, 16, 2); \
+            (v) += KERNEL_SHIFT(v, zero, 16, 4); \
+            (v) += KERNEL_SHIFT(v, zero, 16, 8); \
+        } while (0)
+
+// L must be spelled out as W / sizeof(T) for the shuffle indices.
+#    define BG_KERNEL_SCAN_SIMD_DEFINE(isa, target, W, L, T)               \
+        static BG_TARGET(target) void kernel_scan_##isa##_##T(             \
+            T *a, size_t n, bool inclusive)                                \
+        {                                                                  \
+            typedef T V __attribute__((vector_size(W)));                   \
+            const V zero = { 0 };                                          \
+            T carry = 0;                                                   \
+            size_t i = 0;                                                  \
+            for (; i + L <= n; i += L) {                                   \
+                V v;                                                       \
+                memcpy(&v, a + i, W);                                      \
+                KERNEL_SCAN_##L(v, zero);                                  \
+                v += carry;                                                \
+                if (inclusive) {                                           \
+                    memcpy(a + i, &v, W);                                  \
+                } else {                                                   \
+                    V e = KERNEL_SHIFT(v, zero, L, 1);                     \
+                    e[0] = carry;                                          \
+                    memcpy(a + i, &e, W);                                  \
+                }                                                          \
+                carry = v[L - 1];                                          \
+            }                                                              \
+            for (; i < n; i++) {                                           \
+                T prev = carry;                                            \
+                carry += a[i];                                             \
+                a[i] = inclusive ? carry : prev;                           \
+            }                                                              \
+        }
+
+#    define BG_KERNELS_ISA_DEFINE(isa, target, W)              \
+        BG_KERNELS_SIMD_DEFINE(isa, target, W, i32, u64, i32) \
+        BG_KERNELS_SIMD_DEFINE(isa, target, W, u32, u64, i32) \
+        BG_KERNELS_SIMD_DEFINE(isa, target, W, i64, u64, i64) \
+        BG_KERNELS_SIMD_DEFINE(isa, target, W, u64, u64, i64) \
+        BG_KERNELS_SIMD_DEFINE(isa, target, W, f32, f64, i32) \
+        BG_KERNELS_SIMD_DEFINE(isa, target, W, f64, f64, i64)
+
+BG_KERNELS_ISA_DEFINE(sse42, "sse4.2", 16)
+BG_KERNEL_SCAN_SIMD_DEFINE(sse42, "sse4.2", 16, 4, u32)
+BG_KERNEL_SCAN_SIMD_DEFINE(sse42, "sse4.2", 16, 2, u64)
+BG_KERNEL_SCAN_SIMD_DEFINE(sse42, "sse4.2", 16, 4, f32)
+BG_KERNEL_SCAN_SIMD_DEFINE(sse42, "sse4.2", 16, 2, f64)
+
+BG_KERNELS_ISA_DEFINE(avx2, "avx2", 32)
+BG_KERNEL_SCAN_SIMD_DEFINE(avx2, "avx2", 32, 8, u32)
+BG_KERNEL_SCAN_SIMD_DEFINE(avx2, "avx2", 32, 4, u64)
+BG_KERNEL_SCAN_SIMD_DEFINE(avx2, "avx2", 32, 8, f32)
+BG_KERNEL_SCAN_SIMD_DEFINE(avx2, "avx2", 32, 4, f64)
+
+#    define AVX512 "avx512f,avx512vl,avx512bw"
+BG_KERNELS_ISA_DEFINE(avx512, AVX512, 64)
+BG_KERNEL_SCAN_SIMD_DEFINE(avx512, AVX512, 64, 16, u32)
+BG_KERNEL_SCAN_SIMD_DEFINE(avx512, AVX512, 64, 8, u64)
+BG_KERNEL_SCAN_SIMD_DEFINE(avx512, AVX512, 64, 16, f32)
+BG_KERNEL_SCAN_SIMD_DEFINE(avx512, AVX512, 64, 8, f64)
+
+/*
+ * Compaction. Each register of items becomes a bitmask, from a comparison
+ * or from its keep bytes; the selected lanes are packed to the front of the
+ * register, which is stored whole at the write cursor, and the cursor
+ * advances by the popcount. The cursor never passes the read position, so
+ * the store only overwrites items that have already been loaded.
+ *
+ * AVX-512 packs with vpcompressd/q into a register followed by a plain
+ * store, rather than the compressing store, which is microcoded on some
+ * cores. AVX2 has no compress: vpermd takes its lane indices from
+ * kernel_compress_lut, and 64-bit lanes use the same table with each mask
+ * bit doubled. SSE4.2 machines use the scalar loop.
+ */
+
+// Byte j of entry m is the lane index of the j-th set bit of m: lane j goes
+// to byte popcount(m & ((1 << j) - 1)). Lane 0 only ever contributes zero.
+#    define KERNEL_LUT_LANE(m, j)                                     \
+        ((((m) >> (j)) & 1ull)                                        \
+         * ((u64) (j) << (8 * __builtin_popcount((m) & ((1u << (j)) - 1)))))
+#    define KERNEL_LUT(m)                                                \
+        (KERNEL_LUT_LANE(m, 1) | KERNEL_LUT_LANE(m, 2)                   \
+         | KERNEL_LUT_LANE(m, 3) | KERNEL_LUT_LANE(m, 4)                 \
+         | KERNEL_LUT_LANE(m, 5) | KERNEL_LUT_LANE(m, 6)                 \
+         | KERNEL_LUT_LANE(m, 7))
+#    define KERNEL_LUT_4(m) \
+        KERNEL_LUT(m), KERNEL_LUT(m + 1), KERNEL_LUT(m + 2), KERNEL_LUT(m + 3)
+#    define KERNEL_LUT_16(m)                                      \
+        KERNEL_LUT_4(m), KERNEL_LUT_4(m + 4), KERNEL_LUT_4(m + 8), \
+            KERNEL_LUT_4(m + 12)
+#    define KERNEL_LUT_64(m)                                          \
+        KERNEL_LUT_16(m), KERNEL_LUT_16(m + 16), KERNEL_LUT_16(m + 32), \
+            KERNEL_LUT_16(m + 48)
+
+static const u64 kernel_compress_lut[256] = {
+    KERNEL_LUT_64(0u),
+    KERNEL_LUT_64(64u),
+    KERNEL_LUT_64(128u),
+    KERNEL_LUT_64(192u),
+};
+
+// Bit l set when keep[l] is nonzero, for l < L <= 16.
+static inline BG_TARGET("sse2") unsigned
+kernel_keep_bits(const u8 *keep, size_t L)
+{
+    __m128i k = _mm_setzero_si128();
+    memcpy(&k, keep, L);
+    return (unsigned) _mm_movemask_epi8(
+               _mm_cmpeq_epi8(k, _mm_setzero_si128()))
+           ^ 0xffff;
+}
+
+// Store the lanes of src selected by bits contiguously at dst, returning
+// how many there are.
+static inline BG_TARGET("avx2") size_t
+kernel_compress_avx2_u32(u32 *dst, const u32 *src, unsigned bits)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *) src);
+    __m256i idx = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64((const __m128i *) &kernel_compress_lut[bits]));
+    _mm256_storeu_si256((__m256i *) dst, _mm256_permutevar8x32_epi32(v, idx));
+    return __builtin_popcount(bits);
+}
+
+static inline BG_TARGET("avx2") size_t
+kernel_compress_avx2_u64(u64 *dst, const u64 *src, unsigned bits)
+{
+    unsigned pairs = (bits & 1) * 0x03 | (bits & 2) * 0x06
+                     | (bits & 4) * 0x0c | (bits & 8) * 0x18;
+    return kernel_compress_avx2_u32((u32 *) dst, (const u32 *) src, pairs)
+           / 2;
+}
+
+static inline BG_TARGET(AVX512) size_t
+kernel_compress_avx512_u32(u32 *dst, const u32 *src, unsigned bits)
+{
+    __m512i v = _mm512_loadu_si512(src);
+    _mm512_storeu_si512(dst, _mm512_maskz_compress_epi32(bits, v));
+    return __builtin_popcount(bits);
+}
+
+static inline BG_TARGET(AVX512) size_t
+kernel_compress_avx512_u64(u64 *dst, const u64 *src, unsigned bits)
+{
+    __m512i v = _mm512_loadu_si512(src);
+    _mm512_storeu_si512(dst, _mm512_maskz_compress_epi64(bits, v));
+    return __builtin_popcount(bits);
+}
+
+// A whole register, as the intrinsics spell it.
+#    define KERNEL_VEC_avx2 __m256i
+#    define KERNEL_VEC_avx512 __m512i
+
+// Bitmask of the lanes of a comparison result that are all ones.
+static inline BG_TARGET("avx2") unsigned
+kernel_movemask_avx2_u32(__m256i m)
+{
+    return _mm256_movemask_ps((__m256) m);
+}
+
+static inline BG_TARGET("avx2") unsigned
+kernel_movemask_avx2_u64(__m256i m)
+{
+    return _mm256_movemask_pd((__m256d) m);
+}
+
+static inline BG_TARGET(AVX512) unsigned
+kernel_movemask_avx512_u32(__m512i m)
+{
+    return _mm512_cmplt_epi32_mask(m, _mm512_setzero_si512());
+}
+
+static inline BG_TARGET(AVX512) unsigned
+kernel_movemask_avx512_u64(__m512i m)
+{
+    return _mm512_cmplt_epi64_mask(m, _mm512_setzero_si512());
+}
+
+#    define BG_KERNEL_COMPACT_SIMD_DEFINE(isa, target, W, T)               \
+        static BG_TARGET(target) size_t kernel_compact_##isa##_##T(        \
+            T *a, const u8 *keep, size_t n)                                \
+        {                                                                  \
+            const size_t L = W / sizeof(T);                                \
+            size_t k = 0, i = 0;                                           \
+            for (; i + L <= n; i += L)                                     \
+                k += kernel_compress_##isa##_##T(                          \
+                    a + k, a + i, kernel_keep_bits(keep + i, L));          \
+            for (; i < n; i++) {                                           \
+                T v = a[i];                                                \
+                a[k] = v;                                                  \
+                k += keep[i] != 0;                                         \
+            }                                                              \
+            return k;                                                      \
+        }
+
+// U is the unsigned type of T's size, which the lanes are moved as.
+#    define BG_KERNEL_RETAIN_SIMD_DEFINE(isa, target, W, T, U, name, op)    \
+        static BG_TARGET(target) size_t kernel_retain_##name##_##isa##_##T( \
+            T *a, size_t n, T x, bool invert)                               \
+        {                                                                   \
+            typedef T V __attribute__((vector_size(W)));                    \
+            const size_t L = W / sizeof(T);                                 \
+            const unsigned flip = invert ? (1u << L) - 1 : 0;               \
+            V vx = (V) { 0 } + x;                                           \
+            size_t k = 0, i = 0;                                            \
+            for (; i + L <= n; i += L) {                                    \
+                V v;                                                        \
+                memcpy(&v, a + i, W);                                       \
+                unsigned bits = kernel_movemask_##isa##_##U(                \
+                                    (KERNEL_VEC_##isa) (v op vx))           \
+                                ^ flip;                                     \
+                k += kernel_compress_##isa##_##U((U *) a + k,               \
+                                                 (const U *) a + i, bits);  \
+            }                                                               \
+            for (; i < n; i++) {                                            \
+                T v = a[i];                                                 \
+                a[k] = v;                                                   \
+                k += (v op x) != invert;                                    \
+            }                                                               \
+            return k;                                                       \
+        }
+
+#    define BG_KERNEL_RETAIN_TYPE_DEFINE(isa, target, W, T, U)          \
+        BG_KERNEL_RETAIN_SIMD_DEFINE(isa, target, W, T, U, lt, <)       \
+        BG_KERNEL_RETAIN_SIMD_DEFINE(isa, target, W, T, U, gt, >)       \
+        BG_KERNEL_RETAIN_SIMD_DEFINE(isa, target, W, T, U, eq, ==)
+
+#    define BG_KERNELS_COMPRESS_DEFINE(isa, target, W)                    \
+        BG_KERNEL_COMPACT_SIMD_DEFINE(isa, target, W, u32)                \
+        BG_KERNEL_COMPACT_SIMD_DEFINE(isa, target, W, u64)                \
+        BG_KERNEL_RETAIN_TYPE_DEFINE(isa, target, W, i32, u32)            \
+        BG_KERNEL_RETAIN_TYPE_DEFINE(isa, target, W, u32, u32)            \
+        BG_KERNEL_RETAIN_TYPE_DEFINE(isa, target, W, i64, u64)            \
+        BG_KERNEL_RETAIN_TYPE_DEFINE(isa, target, W, u64, u64)            \
+        BG_KERNEL_RETAIN_TYPE_DEFINE(isa, target, W, f32, u32)            \
+        BG_KERNEL_RETAIN_TYPE_DEFINE(isa, target, W, f64, u64)
+
+BG_KERNELS_COMPRESS_DEFINE(avx2, "avx2", 32)
+BG_KERNELS_COMPRESS_DEFINE(avx512, AVX512, 64)
+
+#    define BG_KERNEL_CALL(level, fn, T, ...)               \
+        ((level) >= BG_CPU_AVX512                           \
+             ? kernel_##fn##_avx512_##T(__VA_ARGS__)        \
+         : (level) >= BG_CPU_AVX2                           \
+             ? kernel_##fn##_avx2_##T(__VA_ARGS__)          \
+         : (level) >= BG_CPU_SSE42                          \
+             ? kernel_##fn##_sse42_##T(__VA_ARGS__)         \
+             : kernel_##fn##_scalar_##T(__VA_ARGS__))
+
+// Compaction has no SSE4.2 variant.
+#    define BG_KERNEL_CALL_COMPRESS(level, fn, T, ...)      \
+        ((level) >= BG_CPU_AVX512                           \
+             ? kernel_##fn##_avx512_##T(__VA_ARGS__)        \
+         : (level) >= BG_CPU_AVX2                           \
+             ? kernel_##fn##_avx2_##T(__VA_ARGS__)          \
+             : kernel_##fn##_scalar_##T(__VA_ARGS__))
+#else
+#    define BG_KERNEL_CALL(level, fn, T, ...) \
+        ((void) (level), kernel_##fn##_scalar_##T(__VA_ARGS__))
+#    define BG_KERNEL_CALL_COMPRESS BG_KERNEL_CALL
+#endif // BG_CPU_X86
+
+////////////////////
+// Entry points
+//
+
+#ifdef __BG_RUNNING_TEST__
+static int kernels_forced_level = -1;
+
+void
+bg_kernels_set_level(enum BGCpuLevel level)
+{
+    kernels_forced_level = level;
+}
+#endif
+
+static enum BGCpuLevel
+kernels_level(void)
+{
+#ifdef __BG_RUNNING_TEST__
+    if (kernels_forced_level >= 0)
+        return kernels_forced_level;
+#endif
+    return bg_cpu_level();
+}
+
+static void
+kernels_check(BGSlice *s, size_t elem_size)
+{
+    assert_kernels(s != NULL, "slice cannot be NULL");
+    assert_kernels(s->elem_size == elem_size,
+                   "slice elem_size %zu does not match the kernel type size "
+                   "%zu",
+                   s->elem_size, elem_size);
+}
+
+// A is the type prefix sums are computed in.
+#define BG_KERNELS_ENTRY_DEFINE(T, R, A)                                     \
+    R BGSlice_sum_##T(BGSlice *s)                                            \
+    {                                                                        \
+        kernels_check(s, sizeof(T));                                         \
+        return (R) BG_KERNEL_CALL(kernels_level(), sum, T, s->buf, s->len);  \
+    }                                                                        \
+                                                                             \
+    BG_KERNELS_PICK_ENTRY_DEFINE(T, min)                                     \
+    BG_KERNELS_PICK_ENTRY_DEFINE(T, max)                                     \
+                                                                             \
+    size_t BGSlice_count_##T(BGSlice *s, enum BGCmpOp op, T value)           \
+    {                                                                        \
+        kernels_check(s, sizeof(T));                                         \
+        enum BGCpuLevel level = kernels_level();                             \
+        const T *a = s->buf;                                                 \
+        size_t n = s->len;                                                   \
+        switch (op) {                                                        \
+        case BG_CMP_LT:                                                      \
+            return BG_KERNEL_CALL(level, count_lt, T, a, n, value);          \
+        case BG_CMP_LE:                                                      \
+            return n - BG_KERNEL_CALL(level, count_gt, T, a, n, value);      \
+        case BG_CMP_EQ:                                                      \
+            return BG_KERNEL_CALL(level, count_eq, T, a, n, value);          \
+        case BG_CMP_NE:                                                      \
+            return n - BG_KERNEL_CALL(level, count_eq, T, a, n, value);      \
+        case BG_CMP_GE:                                                      \
+            return n - BG_KERNEL_CALL(level, count_lt, T, a, n, value);      \
+        case BG_CMP_GT:                                                      \
+            return BG_KERNEL_CALL(level, count_gt, T, a, n, value);          \
+        }                                                                    \
+        assert_kernels(false, "unknown comparison %d", (int) op);            \
+        return 0;                                                            \
+    }                                                                        \
+                                                                             \
+    void BGSlice_prefix_sum_##T(BGSlice *s, bool inclusive)                  \
+    {                                                                        \
+        kernels_check(s, sizeof(T));                                         \
+        BG_KERNEL_CALL(kernels_level(), scan, A, (A *) s->buf, s->len,       \
+                       inclusive);                                           \
+    }
+
+#define BG_KERNELS_PICK_ENTRY_DEFINE(T, name)                            \
+    bool BGSlice_##name##_##T(BGSlice *s, T *out)                        \
+    {                                                                    \
+        kernels_check(s, sizeof(T));                                     \
+        if (s->len == 0)                                                 \
+            return false;                                                \
+        *out = BG_KERNEL_CALL(kernels_level(), name, T, s->buf, s->len); \
+        return true;                                                     \
+    }                                                                    \
+                                                                         \
+    ssize_t BGSlice_arg##name##_##T(BGSlice *s)                          \
+    {                                                                    \
+        kernels_check(s, sizeof(T));                                     \
+        if (s->len == 0)                                                 \
+            return -1;                                                   \
+        enum BGCpuLevel level = kernels_level();                         \
+        T m = BG_KERNEL_CALL(level, name, T, s->buf, s->len);            \
+        return BG_KERNEL_CALL(level, find, T, s->buf, s->len, m);        \
+    }
+
+BG_KERNELS_ENTRY_DEFINE(i32, i64, u32)
+BG_KERNELS_ENTRY_DEFINE(u32, u64, u32)
+BG_KERNELS_ENTRY_DEFINE(i64, i64, u64)
+BG_KERNELS_ENTRY_DEFINE(u64, u64, u64)
+BG_KERNELS_ENTRY_DEFINE(f32, f64, f32)
+BG_KERNELS_ENTRY_DEFINE(f64, f64, f64)
+
+/*
+ * Items of any other size move down a run of kept items at a time, one
+ * memmove per run: [run, i) is waiting to move to k.
+ */
+static size_t
+kernels_compact_runs(char *buf, size_t size, const u8 *keep, size_t n)
+{
+    size_t k = 0, run = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (keep[i])
+            continue;
+        if (k != run)
+            memmove(buf + k * size, buf + run * size, (i - run) * size);
+        k += i - run;
+        run = i + 1;
+    }
+    if (k != run)
+        memmove(buf + k * size, buf + run * size, (n - run) * size);
+    return k + (n - run);
+}
+
+size_t
+BGSlice_compact(BGSlice *s, const u8 *keep)
+{
+    assert_kernels(s != NULL, "slice cannot be NULL");
+    assert_kernels(keep != NULL || s->len == 0, "keep cannot be NULL");
+
+    enum BGCpuLevel level = kernels_level();
+    switch (s->elem_size) {
+    case 4:
+        s->len = BG_KERNEL_CALL_COMPRESS(level, compact, u32, s->buf, keep,
+                                         s->len);
+        break;
+    case 8:
+        s->len = BG_KERNEL_CALL_COMPRESS(level, compact, u64, s->buf, keep,
+                                         s->len);
+        break;
+    default:
+        s->len = kernels_compact_runs(s->buf, s->elem_size, keep, s->len);
+        break;
+    }
+    return s->len;
+}
+
+// `x op value` for each op in terms of the lt, gt and eq kernels, negated
+// where invert is set.
+#define BG_KERNELS_RETAIN_ENTRY_DEFINE(T)                                   \
+    size_t BGSlice_retain_##T(BGSlice *s, enum BGCmpOp op, T value)         \
+    {                                                                       \
+        kernels_check(s, sizeof(T));                                        \
+        enum BGCpuLevel level = kernels_level();                            \
+        T *a = s->buf;                                                      \
+        size_t n = s->len;                                                  \
+        switch (op) {                                                       \
+        case BG_CMP_LT:                                                     \
+            n = BG_KERNEL_CALL_COMPRESS(level, retain_lt, T, a, n, value,   \
+                                        false);                             \
+            break;                                                          \
+        case BG_CMP_LE:                                                     \
+            n = BG_KERNEL_CALL_COMPRESS(level, retain_gt, T, a, n, value,   \
+                                        true);                              \
+            break;                                                          \
+        case BG_CMP_EQ:                                                     \
+            n = BG_KERNEL_CALL_COMPRESS(level, retain_eq, T, a, n, value,   \
+                                        false);                             \
+            break;                                                          \
+        case BG_CMP_NE:                                                     \
+            n = BG_KERNEL_CALL_COMPRESS(level, retain_eq, T, a, n, value,   \
+                                        true);                              \
+            break;                                                          \
+        case BG_CMP_GE:                                                     \
+            n = BG_KERNEL_CALL_COMPRESS(level, retain_lt, T, a, n, value,   \
+                                        true);                              \
+            break;                                                          \
+        case BG_CMP_GT:                                                     \
+            n = BG_KERNEL_CALL_COMPRESS(level, retain_gt, T, a, n, value,   \
+                                        false);                             \
+            break;                                                          \
+        default:                                                            \
+            assert_kernels(false, "unknown comparison %d", (int) op);       \
+        }                                                                   \
+        s->len = n;                                                         \
+        return n;                                                           \
+    }
+
+BG_KERNELS_RETAIN_ENTRY_DEFINE(i32)
+BG_KERNELS_RETAIN_ENTRY_DEFINE(u32)
+BG_KERNELS_RETAIN_ENTRY_DEFINE(i64)
+BG_KERNELS_RETAIN_ENTRY_DEFINE(u64)
+BG_KERNELS_RETAIN_ENTRY_DEFINE(f32)
+BG_KERNELS_RETAIN_ENTRY_DEFINE(f64)
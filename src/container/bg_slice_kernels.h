@@ -0,0 +1,114 @@
+#ifndef BG_SLICE_KERNELS_H
+#define BG_SLICE_KERNELS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "bg_cpu.h"
+#include "bg_slice.h"
+#include "bg_types.h"
+
+/*
+ * Reductions, scans and filters over slices of primitive types.
+ *
+ * These run straight over the slice buffer with several independent
+ * accumulators, using AVX-512, AVX2 or SSE4.2 when the CPU has them (see
+ * bg_cpu.h) and a plain C loop otherwise. Use them instead of BGSlice_range
+ * with a callback, which costs an indirect call per item and cannot
+ * vectorize. The slice's elem_size must match the type.
+ *
+ * Floating point slices must not contain NaN, and floating point sums and
+ * prefix sums add in a different order than a left-to-right loop, so the
+ * last bits of the result may differ from one.
+ */
+
+// Sums accumulate in 64 bits. Integer sums wrap around on overflow.
+i64 BGSlice_sum_i32(BGSlice *s);
+u64 BGSlice_sum_u32(BGSlice *s);
+i64 BGSlice_sum_i64(BGSlice *s);
+u64 BGSlice_sum_u64(BGSlice *s);
+f64 BGSlice_sum_f32(BGSlice *s);
+f64 BGSlice_sum_f64(BGSlice *s);
+
+// Store the smallest (largest) item in *out. False for an empty slice.
+bool BGSlice_min_i32(BGSlice *s, i32 *out);
+bool BGSlice_min_u32(BGSlice *s, u32 *out);
+bool BGSlice_min_i64(BGSlice *s, i64 *out);
+bool BGSlice_min_u64(BGSlice *s, u64 *out);
+bool BGSlice_min_f32(BGSlice *s, f32 *out);
+bool BGSlice_min_f64(BGSlice *s, f64 *out);
+bool BGSlice_max_i32(BGSlice *s, i32 *out);
+bool BGSlice_max_u32(BGSlice *s, u32 *out);
+bool BGSlice_max_i64(BGSlice *s, i64 *out);
+bool BGSlice_max_u64(BGSlice *s, u64 *out);
+bool BGSlice_max_f32(BGSlice *s, f32 *out);
+bool BGSlice_max_f64(BGSlice *s, f64 *out);
+
+// Index of the first smallest (largest) item; -1 for an empty slice.
+ssize_t BGSlice_argmin_i32(BGSlice *s);
+ssize_t BGSlice_argmin_u32(BGSlice *s);
+ssize_t BGSlice_argmin_i64(BGSlice *s);
+ssize_t BGSlice_argmin_u64(BGSlice *s);
+ssize_t BGSlice_argmin_f32(BGSlice *s);
+ssize_t BGSlice_argmin_f64(BGSlice *s);
+ssize_t BGSlice_argmax_i32(BGSlice *s);
+ssize_t BGSlice_argmax_u32(BGSlice *s);
+ssize_t BGSlice_argmax_i64(BGSlice *s);
+ssize_t BGSlice_argmax_u64(BGSlice *s);
+ssize_t BGSlice_argmax_f32(BGSlice *s);
+ssize_t BGSlice_argmax_f64(BGSlice *s);
+
+enum BGCmpOp {
+    BG_CMP_LT,
+    BG_CMP_LE,
+    BG_CMP_EQ,
+    BG_CMP_NE,
+    BG_CMP_GE,
+    BG_CMP_GT,
+};
+
+// Number of items x for which `x op value` holds.
+size_t BGSlice_count_i32(BGSlice *s, enum BGCmpOp op, i32 value);
+size_t BGSlice_count_u32(BGSlice *s, enum BGCmpOp op, u32 value);
+size_t BGSlice_count_i64(BGSlice *s, enum BGCmpOp op, i64 value);
+size_t BGSlice_count_u64(BGSlice *s, enum BGCmpOp op, u64 value);
+size_t BGSlice_count_f32(BGSlice *s, enum BGCmpOp op, f32 value);
+size_t BGSlice_count_f64(BGSlice *s, enum BGCmpOp op, f64 value);
+
+/*
+ * Keep the items x for which `x op value` holds, in order, and return the
+ * new length. Filtering runs a register at a time: the comparison mask
+ * picks the lanes to keep, which are packed together with vpcompress on
+ * AVX-512 and a table-driven lane permute on AVX2.
+ */
+size_t BGSlice_retain_i32(BGSlice *s, enum BGCmpOp op, i32 value);
+size_t BGSlice_retain_u32(BGSlice *s, enum BGCmpOp op, u32 value);
+size_t BGSlice_retain_i64(BGSlice *s, enum BGCmpOp op, i64 value);
+size_t BGSlice_retain_u64(BGSlice *s, enum BGCmpOp op, u64 value);
+size_t BGSlice_retain_f32(BGSlice *s, enum BGCmpOp op, f32 value);
+size_t BGSlice_retain_f64(BGSlice *s, enum BGCmpOp op, f64 value);
+
+/*
+ * Keep item i when keep[i] is nonzero, in order, and return the new length;
+ * keep has one byte per item. Any elem_size works, 4 and 8 byte items take
+ * the same vectorized path as BGSlice_retain_<type>.
+ */
+size_t BGSlice_compact(BGSlice *s, const u8 *keep);
+
+/*
+ * Replace every item with the sum of the items before it, including itself
+ * when inclusive. Sums have the element type: integers wrap around.
+ */
+void BGSlice_prefix_sum_i32(BGSlice *s, bool inclusive);
+void BGSlice_prefix_sum_u32(BGSlice *s, bool inclusive);
+void BGSlice_prefix_sum_i64(BGSlice *s, bool inclusive);
+void BGSlice_prefix_sum_u64(BGSlice *s, bool inclusive);
+void BGSlice_prefix_sum_f32(BGSlice *s, bool inclusive);
+void BGSlice_prefix_sum_f64(BGSlice *s, bool inclusive);
+
+#ifdef __BG_RUNNING_TEST__
+// Pin the instruction set the kernels use, to test every variant.
+void bg_kernels_set_level(enum BGCpuLevel level);
+#endif
+
+#endif // BG_SLICE_KERNELS_H
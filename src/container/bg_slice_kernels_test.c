@@ -0,0 +1,338 @@
+#include "bg_slice_kernels.h"
+#include "bg_slice.h"
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_cpu.h"
+#include "bg_testutils.h"
+#include "bg_types.h"
+
+void
+setUp(void)
+{
+    bg_kernels_set_level(bg_cpu_level());
+}
+
+void
+tearDown(void)
+{
+    bg_kernels_set_level(bg_cpu_level());
+}
+
+///////////////////////
+// Helpers
+//
+
+static const size_t test_lengths[] = { 0,  1,   3,   7,    16,  33,
+                                       64, 100, 257, 1021, 4099 };
+
+/*
+ * Check every kernel for type T against a plain loop, over slices of every
+ * length in test_lengths filled by gen. R is the sum type and A the type
+ * prefix sums wrap in.
+ */
+#define KERNEL_CHECK_DEFINE(T, R, A, gen)                                    \
+    static void check_kernels_##T(void)                                      \
+    {                                                                        \
+        for (size_t t = 0; t < bg_arr_length(test_lengths); t++) {           \
+            size_t n = test_lengths[t];                                      \
+            T *data = malloc((n + 1) * sizeof(T));                           \
+            A *expected = malloc((n + 1) * sizeof(A));                       \
+            for (size_t i = 0; i < n; i++)                                   \
+                data[i] = (gen);                                             \
+            BGSlice *s = BGSlice_new_copy_from_buf(data, n, n, n + 1, NULL); \
+                                                                             \
+            R sum = 0;                                                       \
+            ssize_t amin = -1, amax = -1;                                    \
+            for (size_t i = 0; i < n; i++) {                                 \
+                sum = (R) (sum + (R) data[i]);                               \
+                if (amin < 0 || data[i] < data[amin])                        \
+                    amin = i;                                                \
+                if (amax < 0 || data[i] > data[amax])                        \
+                    amax = i;                                                \
+            }                                                                \
+            TEST_ASSERT_TRUE_MESSAGE(BGSlice_sum_##T(s) == sum, "sum");      \
+            TEST_ASSERT_EQUAL(amin, BGSlice_argmin_##T(s));                  \
+            TEST_ASSERT_EQUAL(amax, BGSlice_argmax_##T(s));                  \
+            T m = 0;                                                         \
+            TEST_ASSERT_EQUAL(n > 0, BGSlice_min_##T(s, &m));                \
+            if (n > 0)                                                       \
+                TEST_ASSERT_TRUE_MESSAGE(m == data[amin], "min");            \
+            TEST_ASSERT_EQUAL(n > 0, BGSlice_max_##T(s, &m));                \
+            if (n > 0)                                                       \
+                TEST_ASSERT_TRUE_MESSAGE(m == data[amax], "max");            \
+                                                                             \
+            T pivot = n > 0 ? data[n / 2] : 0;                               \
+            size_t lt = 0, eq = 0, gt = 0;                                   \
+            for (size_t i = 0; i < n; i++) {                                 \
+                lt += data[i] < pivot;                                       \
+                eq += data[i] == pivot;                                      \
+                gt += data[i] > pivot;                                       \
+            }                                                                \
+            TEST_ASSERT_EQUAL(lt, BGSlice_count_##T(s, BG_CMP_LT, pivot));   \
+            TEST_ASSERT_EQUAL(lt + eq,                                       \
+                              BGSlice_count_##T(s, BG_CMP_LE, pivot));       \
+            TEST_ASSERT_EQUAL(eq, BGSlice_count_##T(s, BG_CMP_EQ, pivot));   \
+            TEST_ASSERT_EQUAL(n - eq,                                        \
+                              BGSlice_count_##T(s, BG_CMP_NE, pivot));       \
+            TEST_ASSERT_EQUAL(gt + eq,                                       \
+                              BGSlice_count_##T(s, BG_CMP_GE, pivot));       \
+            TEST_ASSERT_EQUAL(gt, BGSlice_count_##T(s, BG_CMP_GT, pivot));   \
+                                                                             \
+            A acc = 0;                                                       \
+            for (size_t i = 0; i < n; i++) {                                 \
+                acc += (A) data[i];                                          \
+                expected[i] = acc;                                           \
+            }                                                                \
+            BGSlice_prefix_sum_##T(s, true);                                 \
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, s->buf,               \
+                                             n * sizeof(T),                  \
+                                             "inclusive prefix sum");        \
+            memcpy(s->buf, data, n * sizeof(T));                             \
+            acc = 0;                                                         \
+            for (size_t i = 0; i < n; i++) {                                 \
+                expected[i] = acc;                                           \
+                acc += (A) data[i];                                          \
+            }                                                                \
+            BGSlice_prefix_sum_##T(s, false);                                \
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, s->buf,               \
+                                             n * sizeof(T),                  \
+                                             "exclusive prefix sum");        \
+                                                                             \
+            BGSlice_free(s);                                                 \
+            free(expected);                                                  \
+            free(data);                                                      \
+        }                                                                    \
+    }
+
+// Small integer-valued floats keep every sum exact in any order.
+KERNEL_CHECK_DEFINE(i32, i64, u32, (i32) (rand() % 2001) - 1000)
+KERNEL_CHECK_DEFINE(u32, u64, u32, (u32) rand() * 2654435761u)
+KERNEL_CHECK_DEFINE(i64, i64, u64, ((i64) rand() - RAND_MAX / 2) * 1000003)
+KERNEL_CHECK_DEFINE(u64, u64, u64, ((u64) rand() << 33) ^ (u64) rand())
+KERNEL_CHECK_DEFINE(f32, f64, f32, (f32) (rand() % 2001 - 1000))
+KERNEL_CHECK_DEFINE(f64, f64, f64, (f64) (rand() % 2001 - 1000) * 0.5)
+
+static bool
+test_cmp(f64 x, enum BGCmpOp op, f64 v)
+{
+    switch (op) {
+    case BG_CMP_LT:
+        return x < v;
+    case BG_CMP_LE:
+        return x <= v;
+    case BG_CMP_EQ:
+        return x == v;
+    case BG_CMP_NE:
+        return x != v;
+    case BG_CMP_GE:
+        return x >= v;
+    case BG_CMP_GT:
+        return x > v;
+    }
+    return false;
+}
+
+/*
+ * BGSlice_retain_<T> under every comparison, and BGSlice_compact with a
+ * random keep mask, against a plain filtering loop. Values are compared as
+ * f64 in the reference, which is exact for what gen produces.
+ */
+#define FILTER_CHECK_DEFINE(T, gen)                                          \
+    static void check_filter_##T(void)                                       \
+    {                                                                        \
+        for (size_t t = 0; t < bg_arr_length(test_lengths); t++) {           \
+            size_t n = test_lengths[t];                                      \
+            T *data = malloc((n + 1) * sizeof(T));                           \
+            T *expected = malloc((n + 1) * sizeof(T));                       \
+            u8 *keep = malloc(n + 1);                                        \
+            for (size_t i = 0; i < n; i++)                                   \
+                data[i] = (gen);                                             \
+            T pivot = n > 0 ? data[n / 2] : 0;                               \
+                                                                             \
+            for (int op = BG_CMP_LT; op <= BG_CMP_GT; op++) {                \
+                size_t k = 0;                                                \
+                for (size_t i = 0; i < n; i++) {                             \
+                    if (test_cmp((f64) data[i], op, (f64) pivot))            \
+                        expected[k++] = data[i];                             \
+                }                                                            \
+                BGSlice *s = BGSlice_new_copy_from_buf(data, n, n, n + 1,    \
+                                                       NULL);                \
+                TEST_ASSERT_EQUAL(k, BGSlice_retain_##T(s, op, pivot));      \
+                TEST_ASSERT_EQUAL(k, BGSlice_get_len(s));                    \
+                TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, s->buf,           \
+                                                 k * sizeof(T), "retain");   \
+                BGSlice_free(s);                                             \
+            }                                                                \
+                                                                             \
+            size_t k = 0;                                                    \
+            for (size_t i = 0; i < n; i++) {                                 \
+                keep[i] = rand() % 3 == 0 ? 0 : (u8) (rand() | 1);           \
+                if (keep[i])                                                 \
+                    expected[k++] = data[i];                                 \
+            }                                                                \
+            BGSlice *s = BGSlice_new_copy_from_buf(data, n, n, n + 1, NULL); \
+            TEST_ASSERT_EQUAL(k, BGSlice_compact(s, keep));                  \
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, s->buf,               \
+                                             k * sizeof(T), "compact");      \
+            BGSlice_free(s);                                                 \
+                                                                             \
+            free(keep);                                                      \
+            free(expected);                                                  \
+            free(data);                                                      \
+        }                                                                    \
+    }
+
+// Few distinct values, so that every comparison keeps a fair share.
+FILTER_CHECK_DEFINE(i32, (i32) (rand() % 21) - 10)
+FILTER_CHECK_DEFINE(u32, (u32) (rand() % 21) * 100000000u)
+FILTER_CHECK_DEFINE(i64, ((i64) (rand() % 21) - 10) * ((i64) 1 << 40))
+FILTER_CHECK_DEFINE(u64, (u64) (rand() % 21) << 50)
+FILTER_CHECK_DEFINE(f32, (f32) (rand() % 21 - 10) * 0.25f)
+FILTER_CHECK_DEFINE(f64, (f64) (rand() % 21 - 10) * 0.25)
+
+static void
+check_all_types(void)
+{
+    check_kernels_i32();
+    check_kernels_u32();
+    check_kernels_i64();
+    check_kernels_u64();
+    check_kernels_f32();
+    check_kernels_f64();
+    check_filter_i32();
+    check_filter_u32();
+    check_filter_i64();
+    check_filter_u64();
+    check_filter_f32();
+    check_filter_f64();
+}
+
+///////////////////////
+// Tests
+//
+
+void
+test_kernels_all_levels(void)
+{
+    srand(42);
+    enum BGCpuLevel max_level = bg_cpu_level();
+    for (int level = BG_CPU_SCALAR; level <= (int) max_level; level++) {
+        bg_kernels_set_level(level);
+        check_all_types();
+    }
+}
+
+void
+test_kernels_extremes(void)
+{
+    i32 data[] = { INT32_MAX, INT32_MAX, INT32_MIN, 5, INT32_MIN,
+                   0,         7,         -1,        INT32_MAX };
+    BGSlice *s = BGSlice_new_copy_from_buf(data, 9, 9, 9, NULL);
+    TEST_ASSERT_EQUAL_INT64((i64) INT32_MAX * 3 + (i64) INT32_MIN * 2 + 11,
+                            BGSlice_sum_i32(s));
+    TEST_ASSERT_EQUAL(2, BGSlice_argmin_i32(s));
+    TEST_ASSERT_EQUAL(0, BGSlice_argmax_i32(s));
+    TEST_ASSERT_EQUAL(3, BGSlice_count_i32(s, BG_CMP_EQ, INT32_MAX));
+
+    // Prefix sums wrap like unsigned arithmetic.
+    BGSlice_prefix_sum_i32(s, true);
+    i32 *sums = BGSlice_get_data_ptr(s);
+    TEST_ASSERT_EQUAL_INT32((i32) ((u32) INT32_MAX * 2), sums[1]);
+    TEST_ASSERT_EQUAL_INT32((i32) ((u32) INT32_MAX * 2 + (u32) INT32_MIN),
+                            sums[2]);
+    BGSlice_free(s);
+}
+
+void
+test_kernels_compact_any_size(void)
+{
+    // Items of a size with no vector path move in runs.
+    struct rgb {
+        u8 r, g, b;
+    } data[7] = { { .r = 1 }, { .r = 2 }, { .r = 3 }, { .r = 4 },
+                  { .r = 5 }, { .r = 6 }, { .r = 7 } };
+    u8 keep[7] = { 0, 1, 1, 0, 0, 1, 0 };
+    BGSlice *s = BGSlice_new_copy_from_buf(data, 7, 7, 7, NULL);
+    TEST_ASSERT_EQUAL(3, BGSlice_compact(s, keep));
+    struct rgb *items = BGSlice_get_data_ptr(s);
+    TEST_ASSERT_EQUAL_UINT8(2, items[0].r);
+    TEST_ASSERT_EQUAL_UINT8(3, items[1].r);
+    TEST_ASSERT_EQUAL_UINT8(6, items[2].r);
+    BGSlice_free(s);
+}
+
+void
+test_kernels_elem_size_mismatch(void)
+{
+    BGSlice *s = BGSlice_new(i64, 4, 4, NULL);
+    bg_expect_assertion({ BGSlice_sum_i32(s); }, "sum_i32 on i64 slice");
+    bg_expect_assertion({ BGSlice_prefix_sum_f32(s, true); },
+                        "prefix_sum_f32 on i64 slice");
+    BGSlice_free(s);
+}
+
+typedef struct {
+    void (*test_func)(void);
+    const char *test_name;
+} test_case_t;
+
+static const test_case_t all_tests[] = {
+    { test_kernels_all_levels, "test_kernels_all_levels" },
+    { test_kernels_extremes, "test_kernels_extremes" },
+    { test_kernels_compact_any_size, "test_kernels_compact_any_size" },
+    { test_kernels_elem_size_mismatch, "test_kernels_elem_size_mismatch" },
+};
+
+#define NUM_TESTS (sizeof(all_tests) / sizeof(all_tests[0]))
+
+void
+run_all_tests(void)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        UnityDefaultTestRun(all_tests[i].test_func, all_tests[i].test_name,
+                            __LINE__);
+    }
+}
+
+void
+run_single_test(const char *test_name)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        if (strcmp(all_tests[i].test_name, test_name) == 0) {
+            UnityDefaultTestRun(all_tests[i].test_func,
+                                all_tests[i].test_name, __LINE__);
+            return;
+        }
+    }
+    printf("Test '%s' not found!\n", test_name);
+}
+
+void
+list_all_tests(void)
+{
+    printf("Available tests (%zu total):\n", NUM_TESTS);
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        printf("  [%2zu] %s\n", i, all_tests[i].test_name);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc == 1) {
+        run_all_tests();
+    } else if (argc == 2) {
+        if (strcmp(argv[1], "--list") == 0)
+            list_all_tests();
+        else
+            run_single_test(argv[1]);
+    } else {
+        printf("Usage: %s [test_name|--list]\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
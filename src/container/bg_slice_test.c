@@ -1,9 +1,15 @@
 #include "bg_slice.h"
+#include "bg_slice_typed.h"
 #include "unity.h"
+#include <errno.h>
 #include <signal.h>
 #include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "bg_common.h"
 #include "bg_testutils.h"
@@ -250,6 +256,295 @@ test_BGSlice_copy(void)
     }
 }
 
+///////////////////////
+// Views
+//
+void
+test_BGSlice_views(void)
+{
+    int data[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    {
+        BGSlice *parent = BGSlice_new_copy_from_buf(data, 8, 8, 8, NULL);
+        BGSlice *view = BGSlice_new_from_slice(parent, 2, 6, NULL);
+        TEST_ASSERT_NOT_NULL(view);
+        ASSERT_SLICE_LEN(view, 4);
+        ASSERT_SLICE_CAP(view, 4);
+        TEST_ASSERT_EQUAL(3, *(int *) BGSlice_get(view, 0));
+
+        // Writes are visible through both.
+        int x = 42;
+        BGSlice_set(parent, 3, &x);
+        TEST_ASSERT_EQUAL(42, *(int *) BGSlice_get(view, 1));
+        x = 43;
+        BGSlice_set(view, 3, &x);
+        TEST_ASSERT_EQUAL(43, *(int *) BGSlice_get(parent, 5));
+
+        // Appending to the full view copies it out, parent keeps its items.
+        x = 99;
+        TEST_ASSERT_NOT_NULL(BGSlice_append(view, &x));
+        ASSERT_SLICE_LEN(view, 5);
+        TEST_ASSERT_EQUAL(99, *(int *) BGSlice_get(view, 4));
+        TEST_ASSERT_EQUAL(7, *(int *) BGSlice_get(parent, 6));
+        x = -1;
+        BGSlice_set(view, 0, &x);
+        TEST_ASSERT_EQUAL(3, *(int *) BGSlice_get(parent, 2));
+
+        BGSlice_free(view);
+        BGSlice_free(parent);
+    }
+
+    {
+        // The view outlives its parent; growing the parent copies it away
+        // from the view's memory.
+        BGSlice *parent = BGSlice_new_copy_from_buf(data, 8, 8, 8, NULL);
+        BGSlice *view = BGSlice_new_from_slice(parent, 0, 4, NULL);
+        BGSlice *tail = BGSlice_new_from_slice(view, 2, -1, NULL);
+        ASSERT_SLICE_LEN(tail, 2);
+
+        int x = 9;
+        TEST_ASSERT_NOT_NULL(BGSlice_append(parent, &x));
+        x = 0;
+        BGSlice_set(parent, 0, &x);
+        TEST_ASSERT_EQUAL(1, *(int *) BGSlice_get(view, 0));
+        BGSlice_free(parent);
+
+        TEST_ASSERT_EQUAL_MEMORY(data, BGSlice_get_data_ptr(view),
+                                 4 * sizeof(int));
+        BGSlice_free(view);
+        TEST_ASSERT_EQUAL(4, *(int *) BGSlice_get(tail, 1));
+        BGSlice_free(tail);
+    }
+
+    {
+        // The last view at the start of the block takes the block back.
+        BGSlice *parent = BGSlice_new_copy_from_buf(data, 8, 8, 8, NULL);
+        BGSlice *view = BGSlice_new_from_slice(parent, 0, -1, NULL);
+        BGSlice_free(parent);
+        int x = 9;
+        TEST_ASSERT_NOT_NULL(BGSlice_append(view, &x));
+        TEST_ASSERT_EQUAL(0, view->flags);
+        TEST_ASSERT_EQUAL_MEMORY(data, BGSlice_get_data_ptr(view),
+                                 8 * sizeof(int));
+        BGSlice_free(view);
+    }
+
+    {
+        // Borrowed buffers are neither freed nor grown in place.
+        int buf[4] = { 1, 2, 3, 4 };
+        BGSlice *borrowed = BGSlice_new_from_buf(buf, 4, BG_AUTO, NULL);
+        ASSERT_SLICE_CAP(borrowed, 4);
+        BGSlice *view = BGSlice_new_from_slice(borrowed, 1, 3, NULL);
+        TEST_ASSERT_EQUAL(2, *(int *) BGSlice_get(view, 0));
+        BGSlice_free(view);
+
+        int x = 5;
+        TEST_ASSERT_NOT_NULL(BGSlice_append(borrowed, &x));
+        TEST_ASSERT_TRUE(BGSlice_get_data_ptr(borrowed) != (void *) buf);
+        x = 0;
+        BGSlice_set(borrowed, 0, &x);
+        TEST_ASSERT_EQUAL(1, buf[0]);
+        BGSlice_free(borrowed);
+    }
+
+    {
+        BGSlice *src = BGSlice_new_copy_from_buf(data, 8, 6, 8, NULL);
+        BGSlice *copy = BGSlice_copy_from_slice(src, 1, 4, -1, NULL);
+        ASSERT_SLICE_LEN(copy, 3);
+        ASSERT_SLICE_CAP(copy, 7);
+        TEST_ASSERT_EQUAL_MEMORY(data + 1, BGSlice_get_data_ptr(copy),
+                                 3 * sizeof(int));
+        TEST_ASSERT_TRUE(BGSlice_get_data_ptr(copy)
+                         != BGSlice_get_data_ptr(src));
+        BGSlice_free(copy);
+
+        copy = BGSlice_copy_from_slice(src, -1, -1, 16, NULL);
+        ASSERT_SLICE_LEN(copy, 6);
+        ASSERT_SLICE_CAP(copy, 16);
+        BGSlice_free(copy);
+
+        bg_expect_assertion({ BGSlice_copy_from_slice(src, 4, 2, -1, NULL); },
+                            "copy with low > high");
+        bg_expect_assertion({ BGSlice_copy_from_slice(src, 0, 9, -1, NULL); },
+                            "copy past capacity");
+        bg_expect_assertion({ BGSlice_copy_from_slice(src, 0, 4, 2, NULL); },
+                            "copy into smaller capacity");
+        bg_expect_assertion({ BGSlice_new_from_slice(src, 0, 9, NULL); },
+                            "view past capacity");
+        BGSlice_free(src);
+    }
+}
+
+///////////////////////
+// File mappings
+//
+static void
+write_file(const char *path, const void *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(size, fwrite(data, 1, size, f));
+    fclose(f);
+}
+
+static long
+file_size(const char *path)
+{
+    struct stat st;
+    TEST_ASSERT_EQUAL(0, stat(path, &st));
+    return st.st_size;
+}
+
+void
+test_BGSlice_mmap(void)
+{
+    char path[] = "/tmp/bg_slice_mmap_XXXXXX";
+    close(mkstemp(path));
+    u64 data[1000];
+    for (size_t i = 0; i < bg_arr_length(data); i++)
+        data[i] = i * 3;
+    write_file(path, data, sizeof(data));
+
+    {
+        BGSlice *s = BGSlice_new_mmap(path, sizeof(u64), BG_MMAP_SEQUENTIAL);
+        TEST_ASSERT_NOT_NULL(s);
+        ASSERT_SLICE_LEN(s, 1000);
+        TEST_ASSERT_EQUAL_MEMORY(data, BGSlice_get_data_ptr(s), sizeof(data));
+
+        // Views keep the mapping alive.
+        BGSlice *view = BGSlice_new_from_slice(s, 500, 600, NULL);
+        u64 x = 1;
+        TEST_ASSERT_NOT_NULL(BGSlice_append(s, &x));
+        ASSERT_SLICE_LEN(s, 1001);
+        TEST_ASSERT_EQUAL(0, s->flags);
+        BGSlice_free(s);
+        TEST_ASSERT_EQUAL(1500, *(u64 *) BGSlice_get(view, 0));
+        BGSlice_free(view);
+
+        // Appending to a read-only mapping copied it, the file is intact.
+        TEST_ASSERT_EQUAL(sizeof(data), file_size(path));
+    }
+
+    {
+        BGSlice *s = BGSlice_new_mmap(path, sizeof(u64), BG_MMAP_WRITE);
+        TEST_ASSERT_NOT_NULL(s);
+        u64 x = 7;
+        BGSlice_set(s, 0, &x);
+        for (x = 0; x < 5000; x++)
+            TEST_ASSERT_NOT_NULL(BGSlice_append(s, &x));
+        TEST_ASSERT_EQUAL(BG_SLICE_FLAG_SHARED | BG_SLICE_FLAG_MAPPED,
+                          s->flags);
+        TEST_ASSERT_EQUAL(0, BGSlice_mmap_sync(s));
+        BGSlice_free(s);
+        TEST_ASSERT_EQUAL(6000 * sizeof(u64), file_size(path));
+
+        s = BGSlice_new_mmap(path, sizeof(u64), BG_MMAP_RANDOM);
+        ASSERT_SLICE_LEN(s, 6000);
+        TEST_ASSERT_EQUAL(7, *(u64 *) BGSlice_get(s, 0));
+        TEST_ASSERT_EQUAL(3, *(u64 *) BGSlice_get(s, 1));
+        TEST_ASSERT_EQUAL(4999, *(u64 *) BGSlice_get(s, 5999));
+        BGSlice_free(s);
+    }
+
+    {
+        // Growing with a view alive still grows the file, and the view
+        // keeps seeing writes made through the owner.
+        BGSlice *s = BGSlice_new_mmap(path, sizeof(u64), BG_MMAP_WRITE);
+        BGSlice_set_len(s, 0);
+        for (u64 i = 0; i < 100000; i++)
+            TEST_ASSERT_NOT_NULL(BGSlice_append(s, &i));
+        BGSlice *view = BGSlice_new_from_slice(s, 10, 20, NULL);
+        for (u64 i = 100000; i < 300000; i++)
+            TEST_ASSERT_NOT_NULL(BGSlice_append(s, &i));
+        TEST_ASSERT_EQUAL(BG_SLICE_FLAG_SHARED | BG_SLICE_FLAG_MAPPED,
+                          s->flags);
+        u64 x = 42;
+        BGSlice_set(s, 10, &x);
+        TEST_ASSERT_EQUAL(42, *(u64 *) BGSlice_get(view, 0));
+        TEST_ASSERT_EQUAL(0, BGSlice_mmap_sync(s));
+        BGSlice_free(s);
+        TEST_ASSERT_EQUAL(11, *(u64 *) BGSlice_get(view, 1));
+        BGSlice_free(view);
+        TEST_ASSERT_EQUAL(300000 * sizeof(u64), file_size(path));
+
+        s = BGSlice_new_mmap(path, sizeof(u64), 0);
+        ASSERT_SLICE_LEN(s, 300000);
+        TEST_ASSERT_EQUAL(42, *(u64 *) BGSlice_get(s, 10));
+        TEST_ASSERT_EQUAL(299999, *(u64 *) BGSlice_get(s, 299999));
+        BGSlice_free(s);
+    }
+
+    {
+        unlink(path);
+        TEST_ASSERT_NULL(BGSlice_new_mmap(path, sizeof(u64), 0));
+        TEST_ASSERT_EQUAL(ENOENT, errno);
+
+        BGSlice *s = BGSlice_new_mmap(path, sizeof(u32), BG_MMAP_CREATE);
+        TEST_ASSERT_NOT_NULL(s);
+        ASSERT_SLICE_LEN(s, 0);
+        for (u32 i = 0; i < 3; i++)
+            TEST_ASSERT_NOT_NULL(BGSlice_append(s, &i));
+        BGSlice_free(s);
+        TEST_ASSERT_EQUAL(3 * sizeof(u32), file_size(path));
+
+        TEST_ASSERT_NULL(BGSlice_new_mmap(path, sizeof(u64), 0));
+        TEST_ASSERT_EQUAL(EINVAL, errno);
+    }
+
+    unlink(path);
+}
+
+void
+test_BGSlice_vm(void)
+{
+    {
+        // Reserved: the buffer never moves.
+        BGSlice *s = BGSlice_new_vm(u64, 0, 16, 1 << 20, 0);
+        TEST_ASSERT_NOT_NULL(s);
+        ASSERT_SLICE_LEN(s, 0);
+        TEST_ASSERT_TRUE(BGSlice_get_cap(s) >= 16);
+        void *buf = BGSlice_get_data_ptr(s);
+        BGSlice *view = BGSlice_new_from_slice(s, 0, 0, NULL);
+        for (u64 i = 0; i < 100000; i++)
+            TEST_ASSERT_NOT_NULL(BGSlice_append(s, &i));
+        TEST_ASSERT_TRUE(BGSlice_get_data_ptr(s) == buf);
+        TEST_ASSERT_EQUAL(99999, *(u64 *) BGSlice_get(s, 99999));
+        BGSlice_free(view);
+
+        // Past the reservation, growing fails and leaves s alone.
+        TEST_ASSERT_NULL(BGSlice_grow_to_cap(s, (1 << 20) + 1));
+        TEST_ASSERT_TRUE(BGSlice_get_data_ptr(s) == buf);
+        ASSERT_SLICE_LEN(s, 100000);
+        BGSlice_free(s);
+    }
+
+    {
+        BGSlice *s = BGSlice_new_vm(u32, 10, 10, 0, BG_SLICE_VM_HUGEPAGE);
+        TEST_ASSERT_NOT_NULL(s);
+        u32 *p = BGSlice_get_data_ptr(s);
+        for (u32 i = 0; i < 10; i++) {
+            TEST_ASSERT_EQUAL(0, p[i]);
+            p[i] = i;
+        }
+        for (u32 i = 10; i < 300000; i++)
+            TEST_ASSERT_NOT_NULL(BGSlice_append(s, &i));
+        TEST_ASSERT_EQUAL(BG_SLICE_FLAG_SHARED | BG_SLICE_FLAG_MAPPED,
+                          s->flags);
+        p = BGSlice_get_data_ptr(s);
+        for (u32 i = 0; i < 300000; i++)
+            TEST_ASSERT_EQUAL(i, p[i]);
+
+        // With a view alive, the remapping slice copies out.
+        BGSlice *view = BGSlice_new_from_slice(s, 5, 10, NULL);
+        BGSlice_grow_to_cap(s, BGSlice_get_cap(s) + 1);
+        TEST_ASSERT_EQUAL(0, s->flags);
+        TEST_ASSERT_EQUAL(5, *(u32 *) BGSlice_get(view, 0));
+        BGSlice_free(s);
+        TEST_ASSERT_EQUAL(9, *(u32 *) BGSlice_get(view, 4));
+        BGSlice_free(view);
+    }
+}
+
 extern BGSlice *BGSlice_grow_to_cap(BGSlice *s, size_t cap);
 
 ///////////////////////
@@ -300,6 +595,332 @@ test_BGSlice_new_cap(void)
     BGSlice_free(large_slice);
 }
 
+///////////////////////
+// Bulk operations
+//
+static void
+assert_slice_ints(BGSlice *s, const int *expected, size_t n)
+{
+    ASSERT_SLICE_LEN(s, n);
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected, (int *) BGSlice_get_data_ptr(s),
+                                n);
+}
+
+void
+test_BGSlice_bulk(void)
+{
+    int data[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    BGSlice *s = BGSlice_new(int, 0, 0, NULL);
+
+    TEST_ASSERT_NOT_NULL(BGSlice_append_n(s, data, 4));
+    ASSERT_SLICE_CAP(s, 4);
+    assert_slice_ints(s, data, 4);
+
+    // Appending the slice to itself survives the grow.
+    TEST_ASSERT_NOT_NULL(BGSlice_extend(s, s));
+    assert_slice_ints(s, (int[]) { 0, 1, 2, 3, 0, 1, 2, 3 }, 8);
+
+    BGSlice_erase_range(s, 2, 6);
+    assert_slice_ints(s, (int[]) { 0, 1, 2, 3 }, 4);
+    BGSlice_erase_range(s, 4, 4);
+    BGSlice_erase_range(s, 0, 1);
+    assert_slice_ints(s, (int[]) { 1, 2, 3 }, 3);
+
+    TEST_ASSERT_NOT_NULL(BGSlice_insert_n(s, 1, data + 5, 3));
+    assert_slice_ints(s, (int[]) { 1, 5, 6, 7, 2, 3 }, 6);
+    TEST_ASSERT_NOT_NULL(BGSlice_insert_n(s, 0, data, 1));
+    TEST_ASSERT_NOT_NULL(BGSlice_insert_n(s, 7, data + 4, 1));
+    assert_slice_ints(s, (int[]) { 0, 1, 5, 6, 7, 2, 3, 4 }, 8);
+
+    // Inserting items of the slice itself, before, after and across idx.
+    int *buf = BGSlice_get_data_ptr(s);
+    BGSlice_insert_n(s, 4, buf + 1, 2);
+    assert_slice_ints(s, (int[]) { 0, 1, 5, 6, 1, 5, 7, 2, 3, 4 }, 10);
+    buf = BGSlice_get_data_ptr(s);
+    BGSlice_insert_n(s, 1, buf + 8, 2);
+    assert_slice_ints(s, (int[]) { 0, 3, 4, 1, 5, 6, 1, 5, 7, 2, 3, 4 }, 12);
+    BGSlice_erase_range(s, 6, 12);
+    buf = BGSlice_get_data_ptr(s);
+    BGSlice_insert_n(s, 2, buf + 1, 3);
+    assert_slice_ints(s, (int[]) { 0, 3, 3, 4, 1, 4, 1, 5, 6 }, 9);
+
+    int removed = -1;
+    BGSlice_swap_remove(s, 1, &removed);
+    TEST_ASSERT_EQUAL(3, removed);
+    assert_slice_ints(s, (int[]) { 0, 6, 3, 4, 1, 4, 1, 5 }, 8);
+    BGSlice_swap_remove(s, 7, NULL);
+    assert_slice_ints(s, (int[]) { 0, 6, 3, 4, 1, 4, 1 }, 7);
+
+    bg_expect_assertion({ BGSlice_insert_n(s, 8, data, 1); },
+                        "insert past the end");
+    bg_expect_assertion({ BGSlice_erase_range(s, 3, 8); },
+                        "erase past the end");
+    bg_expect_assertion({ BGSlice_swap_remove(s, 7, NULL); },
+                        "swap_remove past the end");
+    BGSlice_free(s);
+}
+
+///////////////////////
+// Growth policy
+//
+
+// Tracks live allocations, so leaks and frees of foreign pointers show.
+static int tracked_live;
+
+static void *
+tracked_malloc(size_t size)
+{
+    tracked_live++;
+    return malloc(size);
+}
+
+static void *
+tracked_calloc(size_t n, size_t size)
+{
+    tracked_live++;
+    return calloc(n, size);
+}
+
+static void *
+tracked_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        tracked_live++;
+    return realloc(ptr, size);
+}
+
+static void
+tracked_free(void *ptr)
+{
+    if (ptr != NULL)
+        tracked_live--;
+    free(ptr);
+}
+
+static struct Allocator tracked_allocator = {
+    .malloc = tracked_malloc,
+    .calloc = tracked_calloc,
+    .realloc = tracked_realloc,
+    .aligned_alloc = aligned_alloc,
+    .free = tracked_free,
+};
+
+static size_t
+grow_by_ten(size_t cap, size_t elem_size)
+{
+    return cap + 10;
+}
+
+void
+test_BGSlice_growth_policy(void)
+{
+    // Growing from zero capacity.
+    BGSlice *s = BGSlice_new(int, 0, 0, NULL);
+    for (int i = 0; i < 100; i++)
+        TEST_ASSERT_NOT_NULL(BGSlice_append(s, &i));
+    TEST_ASSERT_EQUAL(99, *(int *) BGSlice_get_last(s));
+    BGSlice_free(s);
+
+    struct BGSliceGrowth geometric = { .kind = BG_GROWTH_GEOMETRIC,
+                                       .factor = 3 };
+    struct BGSliceGrowth step = { .kind = BG_GROWTH_STEP, .step = 7 };
+    struct BGSliceGrowth page = { .kind = BG_GROWTH_PAGE };
+    struct BGSliceGrowth custom = { .kind = BG_GROWTH_CUSTOM,
+                                    .fn = grow_by_ten };
+    struct BGSliceOption option = { .growth = &geometric };
+
+    s = BGSlice_new(int, 0, 4, &option);
+    TEST_ASSERT_EQUAL(12, BGSlice_new_cap(s));
+    option.growth = &step;
+    BGSlice_free(s);
+    s = BGSlice_new(int, 0, 4, &option);
+    TEST_ASSERT_EQUAL(11, BGSlice_new_cap(s));
+    BGSlice_free(s);
+    option.growth = &page;
+    s = BGSlice_new(int, 0, 4, &option);
+    TEST_ASSERT_EQUAL(0, BGSlice_new_cap(s) * sizeof(int) % 4096);
+    BGSlice_free(s);
+    option.growth = &custom;
+    s = BGSlice_new(int, 0, 4, &option);
+    for (int i = 0; i < 5; i++)
+        BGSlice_append(s, &i);
+    ASSERT_SLICE_CAP(s, 14);
+
+    // Views inherit the policy.
+    BGSlice *view = BGSlice_new_from_slice(s, 0, 2, NULL);
+    TEST_ASSERT_EQUAL(12, BGSlice_new_cap(view));
+    BGSlice_free(view);
+
+    // Or take option's, allocator included. The view then copies out of
+    // the block with its own allocator instead of reallocating it.
+    struct BGSliceOption view_option = { .allocator = &tracked_allocator,
+                                         .growth = &step };
+    tracked_live = 0;
+    view = BGSlice_new_from_slice(s, 0, 2, &view_option);
+    TEST_ASSERT_EQUAL(1, tracked_live);
+    TEST_ASSERT_EQUAL(9, BGSlice_new_cap(view));
+    BGSlice_free(s);
+    int x = 2;
+    TEST_ASSERT_NOT_NULL(BGSlice_append(view, &x));
+    TEST_ASSERT_EQUAL(2, tracked_live);
+    TEST_ASSERT_EQUAL(1, *(int *) BGSlice_get(view, 1));
+    TEST_ASSERT_EQUAL(2, *(int *) BGSlice_get(view, 2));
+    BGSlice_free(view);
+    TEST_ASSERT_EQUAL(0, tracked_live);
+
+    // Allocating an option zeroes it.
+    struct BGSliceOption *opt = BGSlice_with_growth(NULL, &step);
+    TEST_ASSERT_NULL(opt->allocator);
+    free(opt);
+}
+
+void
+test_BGSlice_reserve_shrink(void)
+{
+    tracked_live = 0;
+    struct BGSliceOption *option =
+        BGSlice_with_allocator(NULL, &tracked_allocator);
+    TEST_ASSERT_EQUAL(1, tracked_live);
+
+    BGSlice *s = BGSlice_new(u64, 0, 4, option);
+    TEST_ASSERT_EQUAL(3, tracked_live);
+    TEST_ASSERT_NOT_NULL(BGSlice_reserve(s, 1000));
+    ASSERT_SLICE_CAP(s, 1000);
+    for (u64 i = 0; i < 1000; i++)
+        BGSlice_append(s, &i);
+    ASSERT_SLICE_CAP(s, 1000);
+    TEST_ASSERT_NOT_NULL(BGSlice_reserve(s, 0));
+    ASSERT_SLICE_CAP(s, 1000);
+
+    BGSlice_set_len(s, 10);
+    TEST_ASSERT_NOT_NULL(BGSlice_shrink_to_fit(s));
+    ASSERT_SLICE_CAP(s, 10);
+    TEST_ASSERT_EQUAL(9, *(u64 *) BGSlice_get(s, 9));
+
+    // Shared buffers stay put while views need them.
+    BGSlice *view = BGSlice_new_from_slice(s, 2, 4, NULL);
+    BGSlice_set_len(s, 3);
+    TEST_ASSERT_NOT_NULL(BGSlice_shrink_to_fit(s));
+    ASSERT_SLICE_CAP(s, 10);
+    BGSlice_free(view);
+    TEST_ASSERT_NOT_NULL(BGSlice_shrink_to_fit(s));
+    ASSERT_SLICE_CAP(s, 3);
+
+    BGSlice_reset(s);
+    TEST_ASSERT_NOT_NULL(BGSlice_shrink_to_fit(s));
+    ASSERT_SLICE_CAP(s, 1);
+    BGSlice_free(s);
+    TEST_ASSERT_EQUAL(1, tracked_live);
+    tracked_allocator.free(option);
+    TEST_ASSERT_EQUAL(0, tracked_live);
+
+    // Reserved VM slices give pages back.
+    s = BGSlice_new_vm(u64, 0, 1, 1 << 20, 0);
+    BGSlice_reserve(s, 100000);
+    BGSlice_set_len(s, 100000);
+    BGSlice_set_len(s, 10);
+    TEST_ASSERT_NOT_NULL(BGSlice_shrink_to_fit(s));
+    TEST_ASSERT_EQUAL(4096 / sizeof(u64), BGSlice_get_cap(s));
+    BGSlice_free(s);
+}
+
+///////////////////////
+// In-place and small slices
+//
+
+struct tagged_node {
+    int id;
+    BGSlice edges;
+    BGSmallSlice(u32, 4) tags;
+};
+
+void
+test_BGSlice_small(void)
+{
+    struct BGSliceOption option = { .allocator = &tracked_allocator };
+    tracked_live = 0;
+
+    // Header by value: only the buffer is allocated.
+    struct tagged_node node = { .id = 1 };
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_init(&node.edges, u64, 0, 2, &option));
+    TEST_ASSERT_EQUAL(1, tracked_live);
+    for (u64 i = 0; i < 100; i++)
+        BGSlice_append(&node.edges, &i);
+    TEST_ASSERT_EQUAL(99, *(u64 *) BGSlice_get_last(&node.edges));
+    bg_expect_assertion({ BGSlice_free(&node.edges); }, "free of init'd");
+
+    // Inline storage: nothing allocated until it overflows.
+    BGSmallSlice_init(&node.tags, &option);
+    TEST_ASSERT_EQUAL(4, BGSlice_get_cap(&node.tags.slice));
+    for (u32 i = 0; i < 4; i++)
+        BGSlice_append(&node.tags.slice, &i);
+    TEST_ASSERT_EQUAL(1, tracked_live);
+    TEST_ASSERT_EQUAL_PTR(node.tags.storage, node.tags.slice.buf);
+
+    u32 five = 5;
+    BGSlice_append(&node.tags.slice, &five);
+    TEST_ASSERT_EQUAL(2, tracked_live);
+    TEST_ASSERT_TRUE(node.tags.slice.buf != (void *) node.tags.storage);
+    u32 *tags = node.tags.slice.buf;
+    for (u32 i = 0; i < 4; i++)
+        TEST_ASSERT_EQUAL_UINT32(i, tags[i]);
+    TEST_ASSERT_EQUAL_UINT32(5, tags[4]);
+
+    BGSlice_deinit(&node.tags.slice);
+    BGSlice_deinit(&node.edges);
+    TEST_ASSERT_EQUAL(0, tracked_live);
+    TEST_ASSERT_NULL(node.edges.buf);
+
+    // Views of an in-place slice are ordinary slices.
+    BGSmallSlice_init(&node.tags, &option);
+    BGSlice_append(&node.tags.slice, &five);
+    BGSlice *view = BGSlice_new_from_slice(&node.tags.slice, -1, -1, NULL);
+    TEST_ASSERT_EQUAL_UINT32(5, *(u32 *) BGSlice_get(view, 0));
+    BGSlice_free(view);
+    BGSlice *heap = BGSlice_new(int, 0, 1, NULL);
+    bg_expect_assertion({ BGSlice_deinit(heap); }, "deinit of heap slice");
+    BGSlice_free(heap);
+    BGSlice_deinit(&node.tags.slice);
+
+    // Heap small slice: header and inline items in one allocation.
+    BGSlice *s = BGSlice_new_small(u64, 8, &option);
+    TEST_ASSERT_EQUAL(1, tracked_live);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) s->buf % _Alignof(max_align_t));
+    for (u64 i = 0; i < 8; i++)
+        BGSlice_append(s, &i);
+    TEST_ASSERT_EQUAL(1, tracked_live);
+    for (u64 i = 8; i < 20; i++)
+        BGSlice_append(s, &i);
+    TEST_ASSERT_EQUAL(2, tracked_live);
+    for (u64 i = 0; i < 20; i++)
+        TEST_ASSERT_EQUAL_UINT64(i, *(u64 *) BGSlice_get(s, i));
+    BGSlice_free(s);
+    TEST_ASSERT_EQUAL(0, tracked_live);
+
+    // A view outlives the small slice it was taken from.
+    s = BGSlice_new_small(u32, 8, &option);
+    for (u32 i = 0; i < 4; i++)
+        BGSlice_append(s, &i);
+    void *inline_buf = s->buf;
+    view = BGSlice_new_from_slice(s, 1, 3, NULL);
+    TEST_ASSERT_TRUE(s->buf != inline_buf);
+    BGSlice_free(s);
+    TEST_ASSERT_EQUAL_UINT32(1, *(u32 *) BGSlice_get(view, 0));
+    TEST_ASSERT_EQUAL_UINT32(2, *(u32 *) BGSlice_get(view, 1));
+    BGSlice_free(view);
+    TEST_ASSERT_EQUAL(0, tracked_live);
+
+    // Likewise for in-place inline storage.
+    BGSmallSlice_init(&node.tags, &option);
+    BGSlice_append(&node.tags.slice, &five);
+    view = BGSlice_new_from_slice(&node.tags.slice, -1, -1, NULL);
+    BGSlice_deinit(&node.tags.slice);
+    memset(node.tags.storage, 0, sizeof(node.tags.storage));
+    TEST_ASSERT_EQUAL_UINT32(5, *(u32 *) BGSlice_get(view, 0));
+    BGSlice_free(view);
+    TEST_ASSERT_EQUAL(0, tracked_live);
+}
+
 ///////////////////////
 // Range
 //
@@ -360,6 +981,151 @@ test_BGSlice_range_early_stop(void)
     BGSlice_free(slice);
 }
 
+struct filter_ctx {
+    size_t calls;
+    size_t next_idx;
+    bool in_order;
+};
+
+// Keeps multiples of three, checking that it sees each index once, in
+// order, with the item still at that index.
+static bool
+keep_multiple_of_three(void *item, size_t idx, void *ctx)
+{
+    struct filter_ctx *f = ctx;
+    f->in_order &= idx == f->next_idx && *(u64 *) item == idx;
+    f->next_idx = idx + 1;
+    f->calls++;
+    return idx % 3 == 0;
+}
+
+void
+test_BGSlice_filter(void)
+{
+    const size_t n = 100;
+    BGSlice *s = BGSlice_new(u64, 0, n, NULL);
+    for (u64 i = 0; i < n; i++)
+        BGSlice_append(s, &i);
+
+    struct filter_ctx f = { .in_order = true };
+    TEST_ASSERT_EQUAL(34, BGSlice_retain_if(s, &f, keep_multiple_of_three));
+    TEST_ASSERT_EQUAL(n, f.calls);
+    TEST_ASSERT_TRUE(f.in_order);
+    TEST_ASSERT_EQUAL(34, BGSlice_get_len(s));
+    for (size_t i = 0; i < 34; i++)
+        TEST_ASSERT_EQUAL_UINT64(i * 3, *(u64 *) BGSlice_get(s, i));
+
+    // Stable partition: multiples of three, then the rest, both ascending.
+    BGSlice_set_len(s, 0);
+    for (u64 i = 0; i < n; i++)
+        BGSlice_append(s, &i);
+    f = (struct filter_ctx) { .in_order = true };
+    size_t n_first = 0;
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_partition(s, &f, keep_multiple_of_three,
+                                               &n_first));
+    TEST_ASSERT_EQUAL(34, n_first);
+    TEST_ASSERT_EQUAL(n, f.calls);
+    TEST_ASSERT_TRUE(f.in_order);
+    TEST_ASSERT_EQUAL(n, BGSlice_get_len(s));
+    u64 *items = BGSlice_get_data_ptr(s);
+    for (size_t i = 0; i < n_first; i++)
+        TEST_ASSERT_EQUAL_UINT64(i * 3, items[i]);
+    for (size_t i = n_first + 1; i < n; i++) {
+        TEST_ASSERT_TRUE(items[i] % 3 != 0);
+        TEST_ASSERT_TRUE(items[i - 1] < items[i]);
+    }
+
+    // The scratch goes back to the slice's allocator.
+    BGSlice_free(s);
+    struct BGSliceOption option = { .allocator = &tracked_allocator };
+    s = BGSlice_new(u64, 0, n, &option);
+    for (u64 i = 0; i < n; i++)
+        BGSlice_append(s, &i);
+    int live = tracked_live;
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_partition(s, &f, keep_multiple_of_three,
+                                               NULL));
+    TEST_ASSERT_EQUAL(live, tracked_live);
+    BGSlice_free(s);
+
+    // Nothing to filter.
+    s = BGSlice_new(u64, 0, 0, NULL);
+    f = (struct filter_ctx) { .in_order = true };
+    TEST_ASSERT_EQUAL(0, BGSlice_retain_if(s, &f, keep_multiple_of_three));
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_partition(s, &f, keep_multiple_of_three,
+                                               &n_first));
+    TEST_ASSERT_EQUAL(0, n_first);
+    TEST_ASSERT_EQUAL(0, f.calls);
+    BGSlice_free(s);
+}
+
+static size_t iter_slice_calls;
+
+static BGSlice *
+iter_next_slice(BGSlice *s)
+{
+    iter_slice_calls++;
+    return s;
+}
+
+void
+test_BGSlice_iterator(void)
+{
+    int data[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    BGSlice *slice =
+        BGSlice_new_copy_from_buf(data, 10, 10, BG_SIZE_AUTO, NULL);
+    TEST_ASSERT_NOT_NULL(slice);
+
+    struct BGSliceIterator it = BGSlice_iter(slice, 0, BG_AUTO);
+    int sum = 0;
+    size_t count = 0;
+    for (int *x; (x = BGSlice_iter_next(&it)) != NULL;) {
+        TEST_ASSERT_EQUAL(count + 1, *x);
+        sum += *x;
+        count++;
+    }
+    TEST_ASSERT_EQUAL(55, sum);
+    TEST_ASSERT_EQUAL(10, count);
+    TEST_ASSERT_EQUAL(10, it.idx);
+    TEST_ASSERT_NULL(BGSlice_iter_next(&it));
+
+    // Sub-range in chunks of 3: [2, 9) is 3 + 3 + 1 items.
+    it = BGSlice_iter(slice, 2, 9);
+    TEST_ASSERT_EQUAL(7, BGSlice_iter_remaining(&it));
+    static const size_t chunk_sizes[] = { 3, 3, 1 };
+    void *chunk;
+    size_t n;
+    int expected = 3;
+    for (size_t c = 0; (n = BGSlice_iter_next_chunk(&it, 3, &chunk)) != 0;
+         c++) {
+        TEST_ASSERT_EQUAL(chunk_sizes[c], n);
+        int *p = chunk;
+        for (size_t i = 0; i < n; i++)
+            TEST_ASSERT_EQUAL(expected++, p[i]);
+    }
+    TEST_ASSERT_EQUAL(10, expected);
+
+    sum = 0;
+    BGSlice_for_each(int, x, slice)
+        sum += *x;
+    TEST_ASSERT_EQUAL(55, sum);
+
+    // The slice expression is evaluated once, and break leaves the loop.
+    iter_slice_calls = 0;
+    sum = 0;
+    BGSlice_for_each(int, x, iter_next_slice(slice)) {
+        if (*x > 4)
+            break;
+        sum += *x;
+    }
+    TEST_ASSERT_EQUAL(1, iter_slice_calls);
+    TEST_ASSERT_EQUAL(10, sum);
+
+    bg_expect_assertion({ BGSlice_iter(slice, 0, 11); }, "high > len");
+    bg_expect_assertion({ BGSlice_iter(slice, 5, 4); }, "low > high");
+
+    BGSlice_free(slice);
+}
+
 // Test with custom allocator option (if needed)
 // void
 // test_BGSlice_with_null_option(void)
@@ -566,6 +1332,59 @@ test_BGSlice_sorting(void)
     }
 }
 
+///////////////////////
+// Typed slices
+//
+struct typed_test_point {
+    int x;
+    int y;
+};
+BG_SLICE_DEFINE_NAMED(point, struct typed_test_point)
+
+void
+test_BGSlice_typed(void)
+{
+    {
+        BGSlice_u64 *s = BGSlice_u64_new(0, 2, NULL);
+        TEST_ASSERT_NOT_NULL(s);
+
+        for (u64 i = 0; i < 100; i++)
+            TEST_ASSERT_NOT_NULL(BGSlice_u64_append(s, i * 3));
+        TEST_ASSERT_EQUAL(100, BGSlice_u64_len(s));
+
+        // typed and generic views share the same header
+        BGSlice *base = BGSlice_u64_base(s);
+        ASSERT_SLICE_LEN(base, 100);
+        for (size_t i = 0; i < 100; i++) {
+            TEST_ASSERT_EQUAL(i * 3, BGSlice_u64_get(s, i));
+            TEST_ASSERT_EQUAL(i * 3, *(u64 *) BGSlice_get(base, i));
+        }
+
+        BGSlice_u64_set(s, 7, 1234);
+        TEST_ASSERT_EQUAL(1234, *(u64 *) BGSlice_get(base, 7));
+
+        bg_expect_assertion({ BGSlice_u64_get(s, 100); }, "OOB access");
+
+        BGSlice_free(base);
+    }
+
+    {
+        BGSlice *s = BGSlice_new(struct typed_test_point, 0, 4, NULL);
+        BGSlice_point *ps = BGSlice_point_from(s);
+        BGSlice_point_append(ps, (struct typed_test_point) { 1, 2 });
+        BGSlice_point_append(ps, (struct typed_test_point) { 3, 4 });
+        TEST_ASSERT_EQUAL(4, BGSlice_point_get_ptr(ps, 1)->y);
+        ASSERT_SLICE_LEN(s, 2);
+
+        BGSlice *ints = BGSlice_new(int, 0, 4, NULL);
+        bg_expect_assertion(
+            { BGSlice_u64_from(ints); }, "mismatched elem_size");
+
+        BGSlice_free(s);
+        BGSlice_free(ints);
+    }
+}
+
 typedef struct {
     void (*test_func)(void);
     const char *test_name;
@@ -581,10 +1400,20 @@ static const test_case_t all_tests[] = {
     // { test_BGSlice_get, "test_BGSlice_get" },
     // { test_BGSlice_copy, "test_BGSlice_copy" },
     // { test_BGSlice_grow_to_cap, "test_BGSlice_grow_to_cap" },
-    // { test_BGSlice_new_cap, "test_BGSlice_new_cap" },
+    { test_BGSlice_new_cap, "test_BGSlice_new_cap" },
     // { test_BGSlice_range_sum, "test_BGSlice_range_sum" },
     // { test_BGSlice_range_early_stop, "test_BGSlice_range_early_stop" },
     { test_BGSlice_sorting, "test_BGSlice_sorting" },
+    { test_BGSlice_typed, "test_BGSlice_typed" },
+    { test_BGSlice_iterator, "test_BGSlice_iterator" },
+    { test_BGSlice_views, "test_BGSlice_views" },
+    { test_BGSlice_mmap, "test_BGSlice_mmap" },
+    { test_BGSlice_vm, "test_BGSlice_vm" },
+    { test_BGSlice_growth_policy, "test_BGSlice_growth_policy" },
+    { test_BGSlice_reserve_shrink, "test_BGSlice_reserve_shrink" },
+    { test_BGSlice_bulk, "test_BGSlice_bulk" },
+    { test_BGSlice_small, "test_BGSlice_small" },
+    { test_BGSlice_filter, "test_BGSlice_filter" },
     // { test_BGSlice_with_null_option, "test_BGSlice_with_null_option" },
     // { test_BGSlice_char_operations, "test_BGSlice_char_operations" }
 };
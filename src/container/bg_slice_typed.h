@@ -0,0 +1,126 @@
+#ifndef BG_SLICE_TYPED_H
+#define BG_SLICE_TYPED_H
+
+#include "bg_common.h"
+#include "bg_slice.h"
+#include "bg_types.h"
+
+/*
+ * Type-specialized slices.
+ *
+ * BG_SLICE_DEFINE(T) emits BGSlice_T, a slice header laid out exactly like
+ * BGSlice_s but with a `T *buf`, plus static inline accessors whose element
+ * size is known at compile time. The generic path pays an out-of-line call,
+ * a runtime elem_size multiply and a memcpy of unknown size for every
+ * element; the typed accessors compile down to plain loads and stores.
+ *
+ * Typed slices are allocated through the generic constructors, so they share
+ * the allocator and growth behaviour of BGSlice. Use BGSlice_T_base() to pass
+ * one to the generic API (including BGSlice_free), and BGSlice_T_from() to
+ * view a generic slice as a typed one.
+ *
+ *     BG_SLICE_DEFINE(u64)
+ *
+ *     BGSlice_u64 *s = BGSlice_u64_new(0, 16, NULL);
+ *     BGSlice_u64_append(s, 42);
+ *     u64 x = BGSlice_u64_get(s, 0);
+ *     BGSlice_free(BGSlice_u64_base(s));
+ *
+ * Use BG_SLICE_DEFINE_NAMED(name, type) when the type is not a single
+ * identifier (e.g. `struct foo` or `char *`).
+ */
+
+#ifndef BG_SLICE_NO_ABORT_ON_OOB
+#    define __bg_slice_typed_bound_check(s, i)                          \
+        bg_assert("BGSlice", (i) < (s)->len,                            \
+                  "tried perform out-of-bound access at index %zu of "  \
+                  "slice length %zu\n",                                 \
+                  (size_t) (i), (s)->len)
+#else
+#    define __bg_slice_typed_bound_check(s, i)
+#endif
+
+#define BG_SLICE_DEFINE(T) BG_SLICE_DEFINE_NAMED(T, T)
+
+#define BG_SLICE_DEFINE_NAMED(Name, T)                                       \
+    typedef union BGSlice_##Name {                                           \
+        BGSlice_s base;                                                      \
+        struct {                                                             \
+            __BG_SLICE_FIELDS(T)                                             \
+        };                                                                   \
+    } BGSlice_##Name;                                                        \
+                                                                             \
+    static inline BGSlice_##Name *BGSlice_##Name##_new(                      \
+        size_t len, size_t cap, struct BGSliceOption *option)                \
+    {                                                                        \
+        return (BGSlice_##Name *) __BGSlice_new(len, cap, sizeof(T),         \
+                                                option);                     \
+    }                                                                        \
+                                                                             \
+    static inline BGSlice_##Name *BGSlice_##Name##_from(BGSlice *s)          \
+    {                                                                        \
+        bg_assert("BGSlice", s == NULL || s->elem_size == sizeof(T),         \
+                  "cannot view slice with elem_size %zu as " #Name           \
+                  " slice (elem_size %zu)",                                  \
+                  s->elem_size, sizeof(T));                                  \
+        return (BGSlice_##Name *) s;                                         \
+    }                                                                        \
+                                                                             \
+    static inline BGSlice *BGSlice_##Name##_base(BGSlice_##Name *s)          \
+    {                                                                        \
+        return &s->base;                                                     \
+    }                                                                        \
+                                                                             \
+    static inline size_t BGSlice_##Name##_len(const BGSlice_##Name *s)       \
+    {                                                                        \
+        return s->len;                                                       \
+    }                                                                        \
+                                                                             \
+    static inline size_t BGSlice_##Name##_cap(const BGSlice_##Name *s)       \
+    {                                                                        \
+        return s->cap;                                                       \
+    }                                                                        \
+                                                                             \
+    static inline T *BGSlice_##Name##_data(BGSlice_##Name *s)                \
+    {                                                                        \
+        return s->buf;                                                       \
+    }                                                                        \
+                                                                             \
+    static inline T *BGSlice_##Name##_get_ptr(BGSlice_##Name *s, size_t i)   \
+    {                                                                        \
+        __bg_slice_typed_bound_check(s, i);                                  \
+        return &s->buf[i];                                                   \
+    }                                                                        \
+                                                                             \
+    static inline T BGSlice_##Name##_get(const BGSlice_##Name *s, size_t i)  \
+    {                                                                        \
+        __bg_slice_typed_bound_check(s, i);                                  \
+        return s->buf[i];                                                    \
+    }                                                                        \
+                                                                             \
+    static inline void BGSlice_##Name##_set(BGSlice_##Name *s, size_t i,     \
+                                            T item)                          \
+    {                                                                        \
+        __bg_slice_typed_bound_check(s, i);                                  \
+        s->buf[i] = item;                                                    \
+    }                                                                        \
+                                                                             \
+    static inline BGSlice_##Name *BGSlice_##Name##_append(BGSlice_##Name *s, \
+                                                          T item)            \
+    {                                                                        \
+        if (bg_unlikely(s->len >= s->cap)) {                                 \
+            if (BGSlice_grow(&s->base) == NULL)                              \
+                return NULL;                                                 \
+        }                                                                    \
+        s->buf[s->len++] = item;                                             \
+        return s;                                                            \
+    }
+
+BG_SLICE_DEFINE(i32)
+BG_SLICE_DEFINE(u32)
+BG_SLICE_DEFINE(i64)
+BG_SLICE_DEFINE(u64)
+BG_SLICE_DEFINE(f32)
+BG_SLICE_DEFINE(f64)
+
+#endif // BG_SLICE_TYPED_H
@@ -0,0 +1,295 @@
+#include "bg_soa.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_slice.h"
+#include "bg_sort.h"
+#include "bg_types.h"
+#include "mem/bg_allocator.h"
+
+#define assert_soa(condition, fmt, ...) \
+    bg_assert("BGSoA", condition, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+#define assert_soa_field(t, field)                                      \
+    assert_soa((field) < (t)->n_fields,                                 \
+               "field %zu out of range for a container of %zu fields", \
+               (size_t) (field), (t)->n_fields)
+
+BGSoA *
+BGSoA_new(const struct BGSoAField *fields, size_t n_fields, size_t cap,
+          struct BGSliceOption *option)
+{
+    assert_soa(fields != NULL && n_fields > 0, "schema cannot be empty");
+    // Check the whole schema before allocating anything.
+    for (size_t i = 0; i < n_fields; i++) {
+        size_t align = fields[i].align;
+        assert_soa(fields[i].size > 0, "field %zu has size zero", i);
+        assert_soa(align > 0 && (align & (align - 1)) == 0
+                       && align <= _Alignof(max_align_t),
+                   "field %zu has unsupported alignment %zu", i, align);
+    }
+
+    struct Allocator *allocator =
+        option != NULL && option->allocator != NULL ? option->allocator
+                                                    : malloc_allocator;
+    BGSoA *t = bg_allocator_calloc(allocator, 1, sizeof(BGSoA));
+    if (t == NULL)
+        return NULL;
+    t->allocator = allocator;
+    t->n_fields = n_fields;
+    t->offsets = bg_allocator_calloc(allocator, n_fields, sizeof(size_t));
+    t->columns = bg_allocator_calloc(allocator, n_fields, sizeof(BGSlice *));
+    if (t->offsets == NULL || t->columns == NULL)
+        goto err;
+
+    // C struct layout: each field at the next multiple of its alignment,
+    // the whole padded to the largest alignment.
+    size_t offset = 0, max_align = 1;
+    for (size_t i = 0; i < n_fields; i++) {
+        size_t size = fields[i].size, align = fields[i].align;
+        offset = (offset + align - 1) & ~(align - 1);
+        t->offsets[i] = offset;
+        offset += size;
+        if (align > max_align)
+            max_align = align;
+
+        t->columns[i] = __BGSlice_new(0, cap > 0 ? cap : 1, size, option);
+        if (t->columns[i] == NULL)
+            goto err;
+    }
+    t->record_size = (offset + max_align - 1) & ~(max_align - 1);
+    return t;
+
+err:
+    BGSoA_free(t);
+    return NULL;
+}
+
+void
+BGSoA_free(BGSoA *t)
+{
+    if (bg_unlikely(t == NULL))
+        return;
+    if (t->columns != NULL) {
+        for (size_t i = 0; i < t->n_fields; i++)
+            BGSlice_free(t->columns[i]);
+    }
+    bg_allocator_free(t->allocator, t->columns);
+    bg_allocator_free(t->allocator, t->offsets);
+    bg_allocator_free(t->allocator, t);
+}
+
+size_t
+BGSoA_len(BGSoA *t)
+{
+    assert_soa(t != NULL, "container cannot be NULL");
+    return t->columns[0]->len;
+}
+
+BGSlice *
+BGSoA_column(BGSoA *t, size_t field)
+{
+    assert_soa(t != NULL, "container cannot be NULL");
+    assert_soa_field(t, field);
+    return t->columns[field];
+}
+
+void *
+BGSoA_column_data(BGSoA *t, size_t field)
+{
+    return BGSoA_column(t, field)->buf;
+}
+
+void *
+BGSoA_get_field(BGSoA *t, size_t idx, size_t field)
+{
+    return BGSlice_get(BGSoA_column(t, field), idx);
+}
+
+BGSoA *
+BGSoA_reserve(BGSoA *t, size_t additional)
+{
+    assert_soa(t != NULL, "container cannot be NULL");
+
+    // A column that did grow before a later one failed keeps its extra
+    // capacity; lengths are untouched either way.
+    for (size_t i = 0; i < t->n_fields; i++) {
+        if (BGSlice_reserve(t->columns[i], additional) == NULL)
+            return NULL;
+    }
+    return t;
+}
+
+BGSoA *
+BGSoA_push(BGSoA *t, const void *record)
+{
+    return BGSoA_push_n(t, record, 1);
+}
+
+BGSoA *
+BGSoA_push_n(BGSoA *t, const void *records, size_t n)
+{
+    assert_soa(t != NULL, "container cannot be NULL");
+    assert_soa(records != NULL || n == 0, "records cannot be NULL");
+
+    // Grow by the columns' policy rather than to exactly len + n, so that
+    // pushing one record at a time stays amortized O(1). Capacities can
+    // differ after a failed grow, so each column is checked.
+    size_t len = BGSoA_len(t);
+    for (size_t i = 0; i < t->n_fields; i++) {
+        BGSlice *c = t->columns[i];
+        if (len + n <= c->cap)
+            continue;
+        size_t cap = BGSlice_new_cap(c);
+        if (cap < len + n)
+            cap = len + n;
+        if (BGSlice_grow_to_cap(c, cap) == NULL)
+            return NULL;
+    }
+
+    for (size_t i = 0; i < t->n_fields; i++) {
+        BGSlice *c = t->columns[i];
+        size_t size = c->elem_size;
+        const char *src = (const char *) records + t->offsets[i];
+        char *dst = (char *) c->buf + len * size;
+        for (size_t j = 0; j < n; j++, src += t->record_size, dst += size)
+            memcpy(dst, src, size);
+        c->len = len + n;
+    }
+    return t;
+}
+
+void
+BGSoA_get(BGSoA *t, size_t idx, void *record)
+{
+    assert_soa(t != NULL && record != NULL, "arguments cannot be NULL");
+
+    for (size_t i = 0; i < t->n_fields; i++) {
+        BGSlice *c = t->columns[i];
+        memcpy((char *) record + t->offsets[i], BGSlice_get(c, idx),
+               c->elem_size);
+    }
+}
+
+void
+BGSoA_set(BGSoA *t, size_t idx, const void *record)
+{
+    assert_soa(t != NULL && record != NULL, "arguments cannot be NULL");
+
+    for (size_t i = 0; i < t->n_fields; i++) {
+        BGSlice *c = t->columns[i];
+        memcpy(BGSlice_get(c, idx), (const char *) record + t->offsets[i],
+               c->elem_size);
+    }
+}
+
+void
+BGSoA_erase_range(BGSoA *t, size_t lo, size_t hi)
+{
+    assert_soa(t != NULL, "container cannot be NULL");
+
+    for (size_t i = 0; i < t->n_fields; i++)
+        BGSlice_erase_range(t->columns[i], lo, hi);
+}
+
+void
+BGSoA_swap_remove(BGSoA *t, size_t idx)
+{
+    assert_soa(t != NULL, "container cannot be NULL");
+
+    for (size_t i = 0; i < t->n_fields; i++)
+        BGSlice_swap_remove(t->columns[i], idx, NULL);
+}
+
+////////////////////
+// Sorting
+//
+// The key column is sorted indirectly: a slice of pointers to its items is
+// sorted with BGSlice_sort_by_cached_key (stable, keys copied next to their
+// pointer so the sort itself runs over contiguous memory). The sorted
+// pointers are the permutation, which is then gathered into each column
+// through one scratch buffer.
+
+static comparable
+soa_sort_key(void *item, size_t idx)
+{
+    return *(comparable *) item;
+}
+
+// dst[i] = src[perm[i]] for items of size bytes.
+static void
+soa_gather(char *restrict dst, const char *restrict src, const size_t *perm,
+           size_t n, size_t size)
+{
+    switch (size) {
+    case 4:
+        for (size_t i = 0; i < n; i++)
+            memcpy(dst + i * 4, src + perm[i] * 4, 4);
+        break;
+    case 8:
+        for (size_t i = 0; i < n; i++)
+            memcpy(dst + i * 8, src + perm[i] * 8, 8);
+        break;
+    default:
+        for (size_t i = 0; i < n; i++)
+            memcpy(dst + i * size, src + perm[i] * size, size);
+        break;
+    }
+}
+
+enum BGStatus
+BGSoA_sort_by(BGSoA *t, size_t field, void *ctx,
+              BGSlice_sort_comparator comparator)
+{
+    assert_soa(t != NULL, "container cannot be NULL");
+    assert_soa_field(t, field);
+
+    size_t n = BGSoA_len(t);
+    if (n <= 1)
+        return BG_OK;
+
+    BGSlice *keys = t->columns[field];
+    size_t key_size = keys->elem_size;
+    char *base = keys->buf;
+
+    struct BGSliceOption option = { .allocator = t->allocator };
+    BGSlice *order = BGSlice_new(comparable, n, n, &option);
+    if (order == NULL)
+        return BG_ERR_ALLOC;
+    comparable *items = order->buf;
+    for (size_t i = 0; i < n; i++)
+        items[i] = (comparable) base + i * key_size;
+
+    enum BGStatus status = BGSlice_sort_by_cached_key(
+        order, ctx, soa_sort_key, key_size, comparator);
+    if (status != BG_OK)
+        goto free_order;
+
+    size_t max_size = 0;
+    for (size_t i = 0; i < t->n_fields; i++) {
+        if (t->columns[i]->elem_size > max_size)
+            max_size = t->columns[i]->elem_size;
+    }
+    status = BG_ERR_ALLOC;
+    size_t *perm =
+        bg_allocator_malloc(t->allocator, n * (sizeof(size_t) + max_size));
+    if (perm == NULL)
+        goto free_order;
+    char *scratch = (char *) (perm + n);
+
+    for (size_t i = 0; i < n; i++)
+        perm[i] = (size_t) ((char *) items[i] - base) / key_size;
+    for (size_t i = 0; i < t->n_fields; i++) {
+        BGSlice *c = t->columns[i];
+        soa_gather(scratch, c->buf, perm, n, c->elem_size);
+        memcpy(c->buf, scratch, n * c->elem_size);
+    }
+    status = BG_OK;
+
+    bg_allocator_free(t->allocator, perm);
+free_order:
+    BGSlice_free(order);
+    return status;
+}
@@ -0,0 +1,104 @@
+#ifndef BG_SOA_H
+#define BG_SOA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "bg_slice.h"
+#include "bg_sort.h"
+#include "bg_types.h"
+
+/*
+ * Structure-of-arrays record container: one BGSlice column per field, all
+ * of the same length. A scan that reads one field touches only that field's
+ * bytes, instead of dragging whole records through the cache.
+ *
+ * The schema lists each field's size and alignment in declaration order,
+ * which also fixes the layout of the record struct that BGSoA_push and
+ * BGSoA_get scatter from and gather into: fields are placed the way a C
+ * compiler lays out a struct, so BG_SOA_FIELD over every member of a struct,
+ * in order, describes that struct.
+ *
+ *     struct point { f32 x; f32 y; u64 id; };
+ *     const struct BGSoAField schema[] = {
+ *         BG_SOA_FIELD(struct point, x),
+ *         BG_SOA_FIELD(struct point, y),
+ *         BG_SOA_FIELD(struct point, id),
+ *     };
+ *     BGSoA *t = BGSoA_new(schema, 3, 0, NULL);
+ *     BGSoA_push(t, &(struct point) { 1, 2, 42 });
+ *     f64 sum_x = BGSlice_sum_f32(BGSoA_column(t, 0));
+ *
+ * Operations that add or remove records do so in every column or, on
+ * failure, in none.
+ */
+
+struct BGSoAField {
+    size_t size;
+    // A power of two no larger than alignof(max_align_t): columns are plain
+    // heap buffers.
+    size_t align;
+};
+
+#define BG_SOA_FIELD(type, member)                               \
+    ((struct BGSoAField) {                                       \
+        .size = sizeof(((type *) 0)->member),                    \
+        .align = _Alignof(__typeof__(((type *) 0)->member)),     \
+    })
+
+typedef struct BGSoA {
+    size_t n_fields;
+    // Size of the record struct the schema describes, and where each field
+    // sits in it.
+    size_t record_size;
+    size_t *offsets;
+    BGSlice **columns;
+    struct Allocator *allocator;
+} BGSoA;
+
+// Columns are created with option (allocator, growth policy) and room for
+// cap records. NULL on failure.
+BGSoA *BGSoA_new(const struct BGSoAField *fields, size_t n_fields,
+                 size_t cap, struct BGSliceOption *option);
+void BGSoA_free(BGSoA *t);
+
+size_t BGSoA_len(BGSoA *t);
+
+/*
+ * Column of field as a slice, for reading and writing items in place and
+ * for the kernels in bg_slice_kernels.h. Do not change its length.
+ */
+BGSlice *BGSoA_column(BGSoA *t, size_t field);
+// Contiguous items of field, valid until the container next grows.
+void *BGSoA_column_data(BGSoA *t, size_t field);
+void *BGSoA_get_field(BGSoA *t, size_t idx, size_t field);
+
+// Make room for additional more records in every column.
+BGSoA *BGSoA_reserve(BGSoA *t, size_t additional);
+// Append one record (push) or n consecutive ones (push_n), scattering each
+// field to its column. NULL on failure, t unchanged.
+BGSoA *BGSoA_push(BGSoA *t, const void *record);
+BGSoA *BGSoA_push_n(BGSoA *t, const void *records, size_t n);
+// Gather record idx into a record struct (get), or scatter one over it
+// (set).
+void BGSoA_get(BGSoA *t, size_t idx, void *record);
+void BGSoA_set(BGSoA *t, size_t idx, const void *record);
+
+// Remove records [lo, hi), keeping the order of the rest.
+void BGSoA_erase_range(BGSoA *t, size_t lo, size_t hi);
+// Remove record idx by moving the last record into its place.
+void BGSoA_swap_remove(BGSoA *t, size_t idx);
+
+/*
+ * Stable sort of the records by field. comparator is called like
+ * BGSlice_sort_by_cached_key calls it, with a view of elem_size the field's
+ * size, so the BGSlice_comparator_* for the field's type work; NULL
+ * compares the raw bytes. Keys are copied out once, the sort runs over
+ * them, and the resulting permutation is applied to every column. Needs
+ * about n * (field size + 32) bytes of scratch plus the widest column.
+ */
+enum BGStatus BGSoA_sort_by(BGSoA *t, size_t field, void *ctx,
+                            BGSlice_sort_comparator comparator);
+
+#endif // BG_SOA_H
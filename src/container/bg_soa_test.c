@@ -0,0 +1,249 @@
+#include "bg_soa.h"
+#include "bg_slice_kernels.h"
+#include "unity.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_testutils.h"
+#include "bg_types.h"
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+struct rec {
+    u8 tag;
+    f64 score;
+    u16 group;
+    f32 weight;
+    u64 id;
+};
+
+static const struct BGSoAField rec_schema[] = {
+    BG_SOA_FIELD(struct rec, tag),    BG_SOA_FIELD(struct rec, score),
+    BG_SOA_FIELD(struct rec, group),  BG_SOA_FIELD(struct rec, weight),
+    BG_SOA_FIELD(struct rec, id),
+};
+
+enum { REC_TAG, REC_SCORE, REC_GROUP, REC_WEIGHT, REC_ID, REC_FIELDS };
+
+static struct rec
+make_rec(u64 i)
+{
+    return (struct rec) {
+        .tag = (u8) (i * 7),
+        .score = (f64) i / 4,
+        .group = (u16) (i % 5),
+        .weight = (f32) ((i * 37) % 101),
+        .id = i,
+    };
+}
+
+// Records compare field by field: padding bytes are never copied.
+static void
+assert_rec_equal(struct rec expected, struct rec actual)
+{
+    TEST_ASSERT_EQUAL_UINT8(expected.tag, actual.tag);
+    TEST_ASSERT_TRUE(expected.score == actual.score);
+    TEST_ASSERT_EQUAL_UINT16(expected.group, actual.group);
+    TEST_ASSERT_TRUE(expected.weight == actual.weight);
+    TEST_ASSERT_EQUAL_UINT64(expected.id, actual.id);
+}
+
+void
+test_BGSoA_layout(void)
+{
+    BGSoA *t = BGSoA_new(rec_schema, REC_FIELDS, 0, NULL);
+    TEST_ASSERT_NOT_NULL(t);
+    TEST_ASSERT_EQUAL(sizeof(struct rec), t->record_size);
+    TEST_ASSERT_EQUAL(offsetof(struct rec, tag), t->offsets[REC_TAG]);
+    TEST_ASSERT_EQUAL(offsetof(struct rec, score), t->offsets[REC_SCORE]);
+    TEST_ASSERT_EQUAL(offsetof(struct rec, group), t->offsets[REC_GROUP]);
+    TEST_ASSERT_EQUAL(offsetof(struct rec, weight), t->offsets[REC_WEIGHT]);
+    TEST_ASSERT_EQUAL(offsetof(struct rec, id), t->offsets[REC_ID]);
+    TEST_ASSERT_EQUAL(0, BGSoA_len(t));
+    TEST_ASSERT_EQUAL(sizeof(f64), BGSoA_column(t, REC_SCORE)->elem_size);
+
+    bg_expect_assertion({ BGSoA_column(t, REC_FIELDS); },
+                        "column out of range");
+    struct BGSoAField bad = { .size = 4, .align = 3 };
+    bg_expect_assertion({ BGSoA_new(&bad, 1, 0, NULL); }, "bad alignment");
+    BGSoA_free(t);
+}
+
+void
+test_BGSoA_push_get(void)
+{
+    BGSoA *t = BGSoA_new(rec_schema, REC_FIELDS, 2, NULL);
+    for (u64 i = 0; i < 1000; i++) {
+        struct rec r = make_rec(i);
+        TEST_ASSERT_NOT_NULL(BGSoA_push(t, &r));
+    }
+    struct rec batch[300];
+    for (u64 i = 0; i < 300; i++)
+        batch[i] = make_rec(1000 + i);
+    TEST_ASSERT_NOT_NULL(BGSoA_push_n(t, batch, 300));
+    TEST_ASSERT_EQUAL(1300, BGSoA_len(t));
+    for (size_t f = 0; f < REC_FIELDS; f++)
+        TEST_ASSERT_EQUAL(1300, BGSlice_get_len(BGSoA_column(t, f)));
+
+    struct rec r;
+    for (u64 i = 0; i < 1300; i++) {
+        BGSoA_get(t, i, &r);
+        assert_rec_equal(make_rec(i), r);
+    }
+
+    // Columns are plain contiguous arrays.
+    u64 *ids = BGSoA_column_data(t, REC_ID);
+    f32 *weights = BGSoA_column_data(t, REC_WEIGHT);
+    f64 sum = 0;
+    for (size_t i = 0; i < 1300; i++) {
+        TEST_ASSERT_EQUAL_UINT64(i, ids[i]);
+        sum += weights[i];
+    }
+    TEST_ASSERT_TRUE(sum == BGSlice_sum_f32(BGSoA_column(t, REC_WEIGHT)));
+    TEST_ASSERT_EQUAL_PTR(&ids[17], BGSoA_get_field(t, 17, REC_ID));
+
+    r = make_rec(5000);
+    BGSoA_set(t, 3, &r);
+    struct rec got;
+    BGSoA_get(t, 3, &got);
+    assert_rec_equal(r, got);
+
+    BGSoA_free(t);
+}
+
+void
+test_BGSoA_erase(void)
+{
+    BGSoA *t = BGSoA_new(rec_schema, REC_FIELDS, 16, NULL);
+    for (u64 i = 0; i < 10; i++) {
+        struct rec r = make_rec(i);
+        BGSoA_push(t, &r);
+    }
+
+    BGSoA_erase_range(t, 2, 5);
+    TEST_ASSERT_EQUAL(7, BGSoA_len(t));
+    const u64 after_erase[] = { 0, 1, 5, 6, 7, 8, 9 };
+    struct rec r;
+    for (size_t i = 0; i < 7; i++) {
+        BGSoA_get(t, i, &r);
+        assert_rec_equal(make_rec(after_erase[i]), r);
+    }
+
+    BGSoA_swap_remove(t, 1);
+    TEST_ASSERT_EQUAL(6, BGSoA_len(t));
+    BGSoA_get(t, 1, &r);
+    assert_rec_equal(make_rec(9), r);
+    for (size_t f = 0; f < REC_FIELDS; f++)
+        TEST_ASSERT_EQUAL(6, BGSlice_get_len(BGSoA_column(t, f)));
+
+    BGSoA_free(t);
+}
+
+void
+test_BGSoA_sort_by(void)
+{
+    BGSoA *t = BGSoA_new(rec_schema, REC_FIELDS, 0, NULL);
+    for (u64 i = 0; i < 500; i++) {
+        struct rec r = make_rec(i);
+        BGSoA_push(t, &r);
+    }
+
+    TEST_ASSERT_EQUAL(BG_OK, BGSoA_sort_by(t, REC_WEIGHT, NULL,
+                                           BGSlice_comparator_f32_asc));
+    struct rec prev, r;
+    BGSoA_get(t, 0, &prev);
+    for (size_t i = 1; i < 500; i++) {
+        BGSoA_get(t, i, &r);
+        // Every field moved with its record, and ties keep their order.
+        assert_rec_equal(make_rec(r.id), r);
+        TEST_ASSERT_TRUE(prev.weight <= r.weight);
+        if (prev.weight == r.weight)
+            TEST_ASSERT_TRUE(prev.id < r.id);
+        prev = r;
+    }
+
+    // Raw byte order on a one-byte field.
+    TEST_ASSERT_EQUAL(BG_OK, BGSoA_sort_by(t, REC_TAG, NULL, NULL));
+    BGSoA_get(t, 0, &prev);
+    for (size_t i = 1; i < 500; i++) {
+        BGSoA_get(t, i, &r);
+        assert_rec_equal(make_rec(r.id), r);
+        TEST_ASSERT_TRUE(prev.tag <= r.tag);
+        prev = r;
+    }
+
+    BGSoA_free(t);
+}
+
+typedef struct {
+    void (*test_func)(void);
+    const char *test_name;
+} test_case_t;
+
+static const test_case_t all_tests[] = {
+    { test_BGSoA_layout, "test_BGSoA_layout" },
+    { test_BGSoA_push_get, "test_BGSoA_push_get" },
+    { test_BGSoA_erase, "test_BGSoA_erase" },
+    { test_BGSoA_sort_by, "test_BGSoA_sort_by" },
+};
+
+#define NUM_TESTS (sizeof(all_tests) / sizeof(all_tests[0]))
+
+void
+run_all_tests(void)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        UnityDefaultTestRun(all_tests[i].test_func, all_tests[i].test_name,
+                            __LINE__);
+    }
+}
+
+void
+run_single_test(const char *test_name)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        if (strcmp(all_tests[i].test_name, test_name) == 0) {
+            UnityDefaultTestRun(all_tests[i].test_func,
+                                all_tests[i].test_name, __LINE__);
+            return;
+        }
+    }
+    printf("Test '%s' not found!\n", test_name);
+}
+
+void
+list_all_tests(void)
+{
+    printf("Available tests (%zu total):\n", NUM_TESTS);
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        printf("  [%2zu] %s\n", i, all_tests[i].test_name);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc == 1) {
+        run_all_tests();
+    } else if (argc == 2) {
+        if (strcmp(argv[1], "--list") == 0)
+            list_all_tests();
+        else
+            run_single_test(argv[1]);
+    } else {
+        printf("Usage: %s [test_name|--list]\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,2576 @@
+#include "bg_sort.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_cpu.h"
+#include "bg_slice.h"
+#include "bg_sortnet.h"
+#include "bg_types.h"
+#include "mem/bg_allocator.h"
+#include "threading/bg_threading.h"
+
+// Ranges shorter than this are finished with insertion sort.
+#define BG_SORT_INSERTION_THRESHOLD 24
+// Ranges longer than this use Tukey's ninther instead of median-of-3.
+#define BG_SORT_NINTHER_THRESHOLD 128
+// How many elements partial insertion sort may move before giving up.
+#define BG_SORT_PARTIAL_INSERTION_LIMIT 8
+// Elements up to this size use a stack buffer as the swap temporary.
+#define BG_SORT_STACK_TMP_SIZE 64
+
+#define assert_sort(condition, fmt, ...) \
+    bg_assert("BGSort", condition, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+/*
+ * Everything the sort loops need, resolved once per call: the raw element
+ * array, the comparator triple and a one-element temporary.
+ */
+struct bg_sort_ctx {
+    char *base;
+    size_t elem_size;
+    // Passed as the first argument of the comparator.
+    BGSlice_s *s;
+    void *ctx;
+    // NULL when items are their own keys, which saves a call per compare.
+    BGSlice_sort_key_fn key_fn;
+    BGSlice_sort_comparator comparator;
+    char *tmp;
+    struct Allocator *allocator;
+    char stack_tmp[BG_SORT_STACK_TMP_SIZE];
+};
+
+static enum BGStatus
+bg_sort_ctx_init(struct bg_sort_ctx *c, BGSlice_s *s, void *ctx,
+                 BGSlice_sort_key_fn key_fn,
+                 BGSlice_sort_comparator comparator)
+{
+    c->base = s->buf;
+    c->elem_size = s->elem_size;
+    c->s = s;
+    c->ctx = ctx;
+    c->key_fn = key_fn;
+    c->comparator =
+        comparator == NULL ? BGSlice_default_comparator_asc : comparator;
+    c->allocator = s->allocator;
+
+    if (c->elem_size <= BG_SORT_STACK_TMP_SIZE) {
+        c->tmp = c->stack_tmp;
+    } else {
+        c->tmp = bg_allocator_malloc(c->allocator, c->elem_size);
+        if (c->tmp == NULL)
+            return BG_ERR_ALLOC;
+    }
+    return BG_OK;
+}
+
+static void
+bg_sort_ctx_deinit(struct bg_sort_ctx *c)
+{
+    if (c->tmp != c->stack_tmp)
+        bg_allocator_free(c->allocator, c->tmp);
+}
+
+static inline char *
+sort_at(struct bg_sort_ctx *c, size_t i)
+{
+    return c->base + i * c->elem_size;
+}
+
+// Copy one element. Small power-of-two sizes get fixed-size copies that
+// compile to plain moves instead of a memcpy call.
+static inline void
+sort_copy(void *dst, const void *src, size_t size)
+{
+    switch (size) {
+    case 4:
+        memcpy(dst, src, 4);
+        break;
+    case 8:
+        memcpy(dst, src, 8);
+        break;
+    case 16:
+        memcpy(dst, src, 16);
+        break;
+    default:
+        memcpy(dst, src, size);
+        break;
+    }
+}
+
+// a < b. ia and ib are the indices reported to key_fn.
+static inline bool
+sort_less(struct bg_sort_ctx *c, char *a, size_t ia, char *b, size_t ib)
+{
+    comparable ka = (comparable) a;
+    comparable kb = (comparable) b;
+    if (c->key_fn != NULL) {
+        ka = c->key_fn(a, ia);
+        kb = c->key_fn(b, ib);
+    }
+    return c->comparator(c->s, ka, kb, c->ctx) < 0;
+}
+
+static inline bool
+sort_less_idx(struct bg_sort_ctx *c, size_t i, size_t j)
+{
+    return sort_less(c, sort_at(c, i), i, sort_at(c, j), j);
+}
+
+static inline void
+sort_swap(struct bg_sort_ctx *c, size_t i, size_t j)
+{
+    char *a = sort_at(c, i);
+    char *b = sort_at(c, j);
+    sort_copy(c->tmp, a, c->elem_size);
+    sort_copy(a, b, c->elem_size);
+    sort_copy(b, c->tmp, c->elem_size);
+}
+
+static void
+sort_reverse(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    while (begin + 1 < end) {
+        sort_swap(c, begin, end - 1);
+        begin++;
+        end--;
+    }
+}
+
+////////////////////
+// Insertion sort
+//
+
+/*
+ * Move the element at cur left to its place in the sorted range
+ * [begin, cur), shifting the elements in between with a single memmove.
+ * When guarded is false the caller guarantees an element <= all others sits
+ * at begin - 1, so the scan needs no bound check. Returns how far the
+ * element moved.
+ */
+static inline size_t
+sort_insert_one(struct bg_sort_ctx *c, size_t begin, size_t cur,
+                bool guarded)
+{
+    size_t es = c->elem_size;
+    char *cur_ptr = sort_at(c, cur);
+
+    if (!sort_less(c, cur_ptr, cur, cur_ptr - es, cur - 1))
+        return 0;
+
+    size_t pos = cur - 1;
+    if (guarded) {
+        while (pos > begin
+               && sort_less(c, cur_ptr, cur, sort_at(c, pos - 1), pos - 1))
+            pos--;
+    } else {
+        while (sort_less(c, cur_ptr, cur, sort_at(c, pos - 1), pos - 1))
+            pos--;
+    }
+
+    char *pos_ptr = sort_at(c, pos);
+    sort_copy(c->tmp, cur_ptr, es);
+    memmove(pos_ptr + es, pos_ptr, (cur - pos) * es);
+    sort_copy(pos_ptr, c->tmp, es);
+    return cur - pos;
+}
+
+static void
+sort_insertion(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    for (size_t cur = begin + 1; cur < end; cur++)
+        sort_insert_one(c, begin, cur, true);
+}
+
+static void
+sort_insertion_unguarded(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    for (size_t cur = begin + 1; cur < end; cur++)
+        sort_insert_one(c, begin, cur, false);
+}
+
+/*
+ * Insertion sort that gives up once it has moved more than
+ * BG_SORT_PARTIAL_INSERTION_LIMIT elements. Returns true if the range ended
+ * up sorted.
+ */
+static bool
+sort_insertion_partial(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    size_t moved = 0;
+    for (size_t cur = begin + 1; cur < end; cur++) {
+        moved += sort_insert_one(c, begin, cur, true);
+        if (moved > BG_SORT_PARTIAL_INSERTION_LIMIT)
+            return cur + 1 == end;
+    }
+    return true;
+}
+
+////////////////////
+// Heapsort
+//
+
+static void
+sort_sift_down(struct bg_sort_ctx *c, size_t begin, size_t root, size_t n)
+{
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n
+            && sort_less_idx(c, begin + child, begin + child + 1))
+            child++;
+        if (!sort_less_idx(c, begin + root, begin + child))
+            break;
+        sort_swap(c, begin + root, begin + child);
+        root = child;
+    }
+}
+
+static void
+sort_heap(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    size_t n = end - begin;
+    for (size_t i = n / 2; i-- > 0;)
+        sort_sift_down(c, begin, i, n);
+    for (size_t last = n - 1; last > 0; last--) {
+        sort_swap(c, begin, begin + last);
+        sort_sift_down(c, begin, 0, last);
+    }
+}
+
+////////////////////
+// Pattern-defeating quicksort
+//
+// Follows Orson Peters' pdqsort. The pivot is kept in place at begin while
+// partitioning instead of being copied out, so every compared item lives in
+// the slice and key_fn always sees a real index.
+//
+
+static inline void
+sort2(struct bg_sort_ctx *c, size_t a, size_t b)
+{
+    if (sort_less_idx(c, b, a))
+        sort_swap(c, a, b);
+}
+
+static inline void
+sort3(struct bg_sort_ctx *c, size_t a, size_t b, size_t d)
+{
+    sort2(c, a, b);
+    sort2(c, b, d);
+    sort2(c, a, b);
+}
+
+/*
+ * Partition [begin, end) around the pivot at begin. Elements equal to the
+ * pivot go right. Returns the final pivot position; *already_partitioned is
+ * set when no element had to be swapped.
+ */
+static size_t
+sort_partition_right(struct bg_sort_ctx *c, size_t begin, size_t end,
+                     bool *already_partitioned)
+{
+    size_t first = begin;
+    size_t last = end;
+
+    // The median selection left an element >= pivot at end - 1, so this
+    // scan cannot run off the end.
+    while (sort_less_idx(c, ++first, begin))
+        ;
+
+    if (first - 1 == begin) {
+        while (first < last && !sort_less_idx(c, --last, begin))
+            ;
+    } else {
+        while (!sort_less_idx(c, --last, begin))
+            ;
+    }
+
+    *already_partitioned = first >= last;
+
+    while (first < last) {
+        sort_swap(c, first, last);
+        while (sort_less_idx(c, ++first, begin))
+            ;
+        while (!sort_less_idx(c, --last, begin))
+            ;
+    }
+
+    size_t pivot_pos = first - 1;
+    if (pivot_pos != begin)
+        sort_swap(c, begin, pivot_pos);
+    return pivot_pos;
+}
+
+/*
+ * Partition [begin, end) around the pivot at begin, putting elements equal
+ * to the pivot on the left. Used when the pivot equals the element just
+ * before the range, i.e. the range starts with a run of equal keys.
+ */
+static size_t
+sort_partition_left(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    size_t first = begin;
+    size_t last = end;
+
+    while (sort_less_idx(c, begin, --last))
+        ;
+
+    if (last + 1 == end) {
+        while (first < last && !sort_less_idx(c, begin, ++first))
+            ;
+    } else {
+        while (!sort_less_idx(c, begin, ++first))
+            ;
+    }
+
+    while (first < last) {
+        sort_swap(c, first, last);
+        while (sort_less_idx(c, begin, --last))
+            ;
+        while (!sort_less_idx(c, begin, ++first))
+            ;
+    }
+
+    if (last != begin)
+        sort_swap(c, begin, last);
+    return last;
+}
+
+// Scramble a few elements of an unbalanced partition so the next pivot
+// choice does not hit the same pattern again.
+static void
+sort_break_patterns(struct bg_sort_ctx *c, size_t begin, size_t pivot_pos,
+                    size_t end)
+{
+    size_t l_size = pivot_pos - begin;
+    size_t r_size = end - (pivot_pos + 1);
+
+    if (l_size >= BG_SORT_INSERTION_THRESHOLD) {
+        size_t q = l_size / 4;
+        sort_swap(c, begin, begin + q);
+        sort_swap(c, pivot_pos - 1, pivot_pos - q);
+        if (l_size > BG_SORT_NINTHER_THRESHOLD) {
+            sort_swap(c, begin + 1, begin + (q + 1));
+            sort_swap(c, begin + 2, begin + (q + 2));
+            sort_swap(c, pivot_pos - 2, pivot_pos - (q + 1));
+            sort_swap(c, pivot_pos - 3, pivot_pos - (q + 2));
+        }
+    }
+
+    if (r_size >= BG_SORT_INSERTION_THRESHOLD) {
+        size_t q = r_size / 4;
+        sort_swap(c, pivot_pos + 1, pivot_pos + (1 + q));
+        sort_swap(c, end - 1, end - q);
+        if (r_size > BG_SORT_NINTHER_THRESHOLD) {
+            sort_swap(c, pivot_pos + 2, pivot_pos + (2 + q));
+            sort_swap(c, pivot_pos + 3, pivot_pos + (3 + q));
+            sort_swap(c, end - 2, end - (1 + q));
+            sort_swap(c, end - 3, end - (2 + q));
+        }
+    }
+}
+
+/*
+ * Move the pivot candidate (median of 3, or Tukey's ninther on long ranges)
+ * to begin. Also leaves an element >= the pivot at end - 1, which
+ * sort_partition_right relies on.
+ */
+static inline void
+sort_choose_pivot(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    size_t size = end - begin;
+    size_t s2 = size / 2;
+    if (size > BG_SORT_NINTHER_THRESHOLD) {
+        sort3(c, begin, begin + s2, end - 1);
+        sort3(c, begin + 1, begin + (s2 - 1), end - 2);
+        sort3(c, begin + 2, begin + (s2 + 1), end - 3);
+        sort3(c, begin + (s2 - 1), begin + s2, begin + (s2 + 1));
+        sort_swap(c, begin, begin + s2);
+    } else {
+        sort3(c, begin + s2, begin, end - 1);
+    }
+}
+
+static void
+sort_pdq_loop(struct bg_sort_ctx *c, size_t begin, size_t end,
+              int bad_allowed, bool leftmost)
+{
+    for (;;) {
+        size_t size = end - begin;
+
+        if (size < BG_SORT_INSERTION_THRESHOLD) {
+            if (leftmost)
+                sort_insertion(c, begin, end);
+            else
+                sort_insertion_unguarded(c, begin, end);
+            return;
+        }
+
+        sort_choose_pivot(c, begin, end);
+
+        // If the pivot equals the element before the range, everything
+        // equal to it is already in its final place: skip over it.
+        if (!leftmost && !sort_less_idx(c, begin - 1, begin)) {
+            begin = sort_partition_left(c, begin, end) + 1;
+            continue;
+        }
+
+        bool already_partitioned;
+        size_t pivot_pos =
+            sort_partition_right(c, begin, end, &already_partitioned);
+
+        size_t l_size = pivot_pos - begin;
+        size_t r_size = end - (pivot_pos + 1);
+        bool highly_unbalanced = l_size < size / 8 || r_size < size / 8;
+
+        if (highly_unbalanced) {
+            if (--bad_allowed == 0) {
+                sort_heap(c, begin, end);
+                return;
+            }
+            sort_break_patterns(c, begin, pivot_pos, end);
+        } else if (already_partitioned
+                   && sort_insertion_partial(c, begin, pivot_pos)
+                   && sort_insertion_partial(c, pivot_pos + 1, end)) {
+            return;
+        }
+
+        // Recurse into the smaller side and loop on the larger one so the
+        // stack depth stays logarithmic.
+        if (l_size < r_size) {
+            sort_pdq_loop(c, begin, pivot_pos, bad_allowed, leftmost);
+            begin = pivot_pos + 1;
+            leftmost = false;
+        } else {
+            sort_pdq_loop(c, pivot_pos + 1, end, bad_allowed, false);
+            end = pivot_pos;
+        }
+    }
+}
+
+static inline int
+sort_log2(size_t n)
+{
+    return 64 - __builtin_clzll((unsigned long long) n | 1);
+}
+
+/*
+ * Handle input that is already sorted or strictly descending in O(n).
+ * Returns true if [begin, end) is sorted on return. Bails out at the first
+ * element that breaks the initial run, so random input costs a couple of
+ * comparisons.
+ */
+static bool
+sort_presorted(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    size_t i = begin + 1;
+    while (i < end && !sort_less_idx(c, i, i - 1))
+        i++;
+    if (i == end)
+        return true;
+    if (i != begin + 1)
+        return false;
+
+    while (i < end && sort_less_idx(c, i, i - 1))
+        i++;
+    if (i != end)
+        return false;
+    sort_reverse(c, begin, end);
+    return true;
+}
+
+////////////////////
+// Primitive element types
+//
+// The same pdqsort instantiated per primitive type: a plain `<` replaces the
+// key_fn/comparator calls, and ranges of up to BG_SORTNET_MAX elements go to
+// a sorting network instead of insertion sort. Used by BGSlice_sort_primitive
+// and by BGSlice_pdqsort when it is handed one of the BGSlice_comparator_*
+// functions.
+//
+
+#define BG_SORT_PRIM_DEFINE(T)                                                \
+    static inline void sort_##T##_swap(T *a, size_t i, size_t j)             \
+    {                                                                        \
+        T t = a[i];                                                          \
+        a[i] = a[j];                                                         \
+        a[j] = t;                                                            \
+    }                                                                        \
+                                                                             \
+    static inline void sort_##T##_sort2(T *a, size_t i, size_t j)            \
+    {                                                                        \
+        if (a[j] < a[i])                                                     \
+            sort_##T##_swap(a, i, j);                                        \
+    }                                                                        \
+                                                                             \
+    static inline void sort_##T##_sort3(T *a, size_t i, size_t j, size_t k)  \
+    {                                                                        \
+        sort_##T##_sort2(a, i, j);                                           \
+        sort_##T##_sort2(a, j, k);                                           \
+        sort_##T##_sort2(a, i, j);                                           \
+    }                                                                        \
+                                                                             \
+    static void sort_##T##_sift_down(T *a, size_t root, size_t n)            \
+    {                                                                        \
+        for (;;) {                                                           \
+            size_t child = 2 * root + 1;                                     \
+            if (child >= n)                                                  \
+                return;                                                      \
+            if (child + 1 < n && a[child] < a[child + 1])                    \
+                child++;                                                     \
+            if (!(a[root] < a[child]))                                       \
+                return;                                                      \
+            sort_##T##_swap(a, root, child);                                 \
+            root = child;                                                    \
+        }                                                                    \
+    }                                                                        \
+                                                                             \
+    static void sort_##T##_heap(T *a, size_t n)                              \
+    {                                                                        \
+        for (size_t i = n / 2; i-- > 0;)                                     \
+            sort_##T##_sift_down(a, i, n);                                   \
+        for (size_t end = n - 1; end > 0; end--) {                           \
+            sort_##T##_swap(a, 0, end);                                      \
+            sort_##T##_sift_down(a, 0, end);                                 \
+        }                                                                    \
+    }                                                                        \
+                                                                             \
+    static bool sort_##T##_insertion_partial(T *a, size_t begin, size_t end) \
+    {                                                                        \
+        size_t moved = 0;                                                    \
+        for (size_t cur = begin + 1; cur < end; cur++) {                     \
+            T x = a[cur];                                                    \
+            size_t i = cur;                                                  \
+            for (; i > begin && x < a[i - 1]; i--)                           \
+                a[i] = a[i - 1];                                             \
+            a[i] = x;                                                        \
+            moved += cur - i;                                                \
+            if (moved > BG_SORT_PARTIAL_INSERTION_LIMIT)                     \
+                return cur + 1 == end;                                       \
+        }                                                                    \
+        return true;                                                         \
+    }                                                                        \
+                                                                             \
+    static size_t sort_##T##_partition_right(T *a, size_t begin, size_t end, \
+                                             bool *already_partitioned)      \
+    {                                                                        \
+        T pivot = a[begin];                                                  \
+        size_t first = begin;                                                \
+        size_t last = end;                                                   \
+                                                                             \
+        while (a[++first] < pivot)                                           \
+            ;                                                                \
+        if (first - 1 == begin) {                                            \
+            while (first < last && !(a[--last] < pivot))                     \
+                ;                                                            \
+        } else {                                                             \
+            while (!(a[--last] < pivot))                                     \
+                ;                                                            \
+        }                                                                    \
+                                                                             \
+        *already_partitioned = first >= last;                                \
+                                                                             \
+        while (first < last) {                                               \
+            sort_##T##_swap(a, first, last);                                 \
+            while (a[++first] < pivot)                                       \
+                ;                                                            \
+            while (!(a[--last] < pivot))                                     \
+                ;                                                            \
+        }                                                                    \
+                                                                             \
+        size_t pivot_pos = first - 1;                                        \
+        a[begin] = a[pivot_pos];                                             \
+        a[pivot_pos] = pivot;                                                \
+        return pivot_pos;                                                    \
+    }                                                                        \
+                                                                             \
+    static size_t sort_##T##_partition_left(T *a, size_t begin, size_t end)  \
+    {                                                                        \
+        T pivot = a[begin];                                                  \
+        size_t first = begin;                                                \
+        size_t last = end;                                                   \
+                                                                             \
+        while (pivot < a[--last])                                            \
+            ;                                                                \
+        if (last + 1 == end) {                                               \
+            while (first < last && !(pivot < a[++first]))                    \
+                ;                                                            \
+        } else {                                                             \
+            while (!(pivot < a[++first]))                                    \
+                ;                                                            \
+        }                                                                    \
+                                                                             \
+        while (first < last) {                                               \
+            sort_##T##_swap(a, first, last);                                 \
+            while (pivot < a[--last])                                        \
+                ;                                                            \
+            while (!(pivot < a[++first]))                                    \
+                ;                                                            \
+        }                                                                    \
+                                                                             \
+        a[begin] = a[last];                                                  \
+        a[last] = pivot;                                                     \
+        return last;                                                         \
+    }                                                                        \
+                                                                             \
+    static void sort_##T##_pdq_loop(T *a, size_t begin, size_t end,          \
+                                    int bad_allowed, bool leftmost,          \
+                                    enum BGCpuLevel level)                   \
+    {                                                                        \
+        for (;;) {                                                           \
+            size_t size = end - begin;                                       \
+                                                                             \
+            if (size <= BG_SORTNET_MAX) {                                    \
+                bg_sortnet_##T##_level(a + begin, size, level);              \
+                return;                                                      \
+            }                                                                \
+                                                                             \
+            size_t s2 = size / 2;                                            \
+            if (size > BG_SORT_NINTHER_THRESHOLD) {                          \
+                sort_##T##_sort3(a, begin, begin + s2, end - 1);             \
+                sort_##T##_sort3(a, begin + 1, begin + (s2 - 1), end - 2);   \
+                sort_##T##_sort3(a, begin + 2, begin + (s2 + 1), end - 3);   \
+                sort_##T##_sort3(a, begin + (s2 - 1), begin + s2,            \
+                                 begin + (s2 + 1));                          \
+                sort_##T##_swap(a, begin, begin + s2);                       \
+            } else {                                                         \
+                sort_##T##_sort3(a, begin + s2, begin, end - 1);             \
+            }                                                                \
+                                                                             \
+            if (!leftmost && !(a[begin - 1] < a[begin])) {                   \
+                begin = sort_##T##_partition_left(a, begin, end) + 1;        \
+                continue;                                                    \
+            }                                                                \
+                                                                             \
+            bool already_partitioned;                                        \
+            size_t pivot_pos = sort_##T##_partition_right(                   \
+                a, begin, end, &already_partitioned);                        \
+                                                                             \
+            size_t l_size = pivot_pos - begin;                               \
+            size_t r_size = end - (pivot_pos + 1);                           \
+            if (l_size < size / 8 || r_size < size / 8) {                    \
+                if (--bad_allowed == 0) {                                    \
+                    sort_##T##_heap(a + begin, size);                        \
+                    return;                                                  \
+                }                                                            \
+                if (l_size >= BG_SORT_INSERTION_THRESHOLD) {                 \
+                    size_t q = l_size / 4;                                   \
+                    sort_##T##_swap(a, begin, begin + q);                    \
+                    sort_##T##_swap(a, pivot_pos - 1, pivot_pos - q);        \
+                }                                                            \
+                if (r_size >= BG_SORT_INSERTION_THRESHOLD) {                 \
+                    size_t q = r_size / 4;                                   \
+                    sort_##T##_swap(a, pivot_pos + 1, pivot_pos + (1 + q));  \
+                    sort_##T##_swap(a, end - 1, end - q);                    \
+                }                                                            \
+            } else if (already_partitioned                                   \
+                       && sort_##T##_insertion_partial(a, begin, pivot_pos)  \
+                       && sort_##T##_insertion_partial(a, pivot_pos + 1,     \
+                                                       end)) {               \
+                return;                                                      \
+            }                                                                \
+                                                                             \
+            if (l_size < r_size) {                                           \
+                sort_##T##_pdq_loop(a, begin, pivot_pos, bad_allowed,        \
+                                    leftmost, level);                        \
+                begin = pivot_pos + 1;                                       \
+                leftmost = false;                                            \
+            } else {                                                         \
+                sort_##T##_pdq_loop(a, pivot_pos + 1, end, bad_allowed,      \
+                                    false, level);                           \
+                end = pivot_pos;                                             \
+            }                                                                \
+        }                                                                    \
+    }                                                                        \
+                                                                             \
+    static void sort_##T(T *a, size_t n)                                     \
+    {                                                                        \
+        size_t i = 1;                                                        \
+        while (i < n && !(a[i] < a[i - 1]))                                  \
+            i++;                                                             \
+        if (i == n)                                                          \
+            return;                                                          \
+        if (i == 1) {                                                        \
+            while (i < n && a[i] < a[i - 1])                                 \
+                i++;                                                         \
+            if (i == n) {                                                    \
+                for (size_t l = 0, r = n - 1; l < r; l++, r--)               \
+                    sort_##T##_swap(a, l, r);                                \
+                return;                                                      \
+            }                                                                \
+        }                                                                    \
+        sort_##T##_pdq_loop(a, 0, n, sort_log2(n), true, bg_cpu_level());    \
+    }                                                                        \
+                                                                             \
+    ssize_t BGSlice_comparator_##T##_asc(BGSlice_s *s, comparable a,         \
+                                         comparable b, void *ctx)            \
+    {                                                                        \
+        T x, y;                                                              \
+        memcpy(&x, a, sizeof(T));                                            \
+        memcpy(&y, b, sizeof(T));                                            \
+        return (y < x) - (x < y);                                            \
+    }                                                                        \
+                                                                             \
+    ssize_t BGSlice_comparator_##T##_desc(BGSlice_s *s, comparable a,        \
+                                          comparable b, void *ctx)           \
+    {                                                                        \
+        return BGSlice_comparator_##T##_asc(s, b, a, ctx);                   \
+    }
+
+BG_SORT_PRIM_DEFINE(i32)
+BG_SORT_PRIM_DEFINE(u32)
+BG_SORT_PRIM_DEFINE(i64)
+BG_SORT_PRIM_DEFINE(u64)
+BG_SORT_PRIM_DEFINE(f32)
+BG_SORT_PRIM_DEFINE(f64)
+
+static const struct {
+    size_t elem_size;
+    BGSlice_sort_comparator asc;
+    BGSlice_sort_comparator desc;
+} sort_prim_comparators[] = {
+    [BG_PRIM_I32] = { sizeof(i32), BGSlice_comparator_i32_asc,
+                      BGSlice_comparator_i32_desc },
+    [BG_PRIM_U32] = { sizeof(u32), BGSlice_comparator_u32_asc,
+                      BGSlice_comparator_u32_desc },
+    [BG_PRIM_I64] = { sizeof(i64), BGSlice_comparator_i64_asc,
+                      BGSlice_comparator_i64_desc },
+    [BG_PRIM_U64] = { sizeof(u64), BGSlice_comparator_u64_asc,
+                      BGSlice_comparator_u64_desc },
+    [BG_PRIM_F32] = { sizeof(f32), BGSlice_comparator_f32_asc,
+                      BGSlice_comparator_f32_desc },
+    [BG_PRIM_F64] = { sizeof(f64), BGSlice_comparator_f64_asc,
+                      BGSlice_comparator_f64_desc },
+};
+
+#define BG_PRIM_COUNT \
+    (sizeof(sort_prim_comparators) / sizeof(sort_prim_comparators[0]))
+
+// The element type implied by one of the BGSlice_comparator_* functions, or
+// -1 for any other comparator.
+static int
+sort_prim_type_of(BGSlice_s *s, BGSlice_sort_comparator comparator,
+                  bool *descending)
+{
+    for (size_t t = 0; t < BG_PRIM_COUNT; t++) {
+        if (sort_prim_comparators[t].elem_size != s->elem_size)
+            continue;
+        if (comparator == sort_prim_comparators[t].asc) {
+            *descending = false;
+            return (int) t;
+        }
+        if (comparator == sort_prim_comparators[t].desc) {
+            *descending = true;
+            return (int) t;
+        }
+    }
+    return -1;
+}
+
+enum BGStatus
+BGSlice_sort_primitive(BGSlice_s *s, enum BGPrimType type, bool descending)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+    assert_sort((size_t) type < BG_PRIM_COUNT, "unknown primitive type %d",
+                (int) type);
+    assert_sort(s->elem_size == sort_prim_comparators[type].elem_size,
+                "slice elem_size %zu does not match the primitive type size "
+                "%zu",
+                s->elem_size, sort_prim_comparators[type].elem_size);
+
+    size_t n = s->len;
+    if (n <= 1)
+        return BG_OK;
+
+    switch (type) {
+    case BG_PRIM_I32:
+        sort_i32((i32 *) s->buf, n);
+        break;
+    case BG_PRIM_U32:
+        sort_u32((u32 *) s->buf, n);
+        break;
+    case BG_PRIM_I64:
+        sort_i64((i64 *) s->buf, n);
+        break;
+    case BG_PRIM_U64:
+        sort_u64((u64 *) s->buf, n);
+        break;
+    case BG_PRIM_F32:
+        sort_f32((f32 *) s->buf, n);
+        break;
+    case BG_PRIM_F64:
+        sort_f64((f64 *) s->buf, n);
+        break;
+    }
+
+    if (descending) {
+        struct bg_sort_ctx c;
+        if (bg_sort_ctx_init(&c, s, NULL, NULL, NULL) != BG_OK)
+            return BG_ERR_ALLOC;
+        sort_reverse(&c, 0, n);
+        bg_sort_ctx_deinit(&c);
+    }
+    return BG_OK;
+}
+
+enum BGStatus
+BGSlice_pdqsort(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                BGSlice_sort_comparator comparator)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+
+    if (s->len <= 1)
+        return BG_OK;
+
+    bool descending;
+    int type;
+    if (key_fn == NULL
+        && (type = sort_prim_type_of(s, comparator, &descending)) >= 0)
+        return BGSlice_sort_primitive(s, (enum BGPrimType) type, descending);
+
+    struct bg_sort_ctx c;
+    if (bg_sort_ctx_init(&c, s, ctx, key_fn, comparator) != BG_OK)
+        return BG_ERR_ALLOC;
+
+    if (!sort_presorted(&c, 0, s->len))
+        sort_pdq_loop(&c, 0, s->len, sort_log2(s->len), true);
+
+    bg_sort_ctx_deinit(&c);
+    return BG_OK;
+}
+
+enum BGStatus
+BGSlice_insertion_sort(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                       BGSlice_sort_comparator comparator)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+
+    if (s->len <= 1)
+        return BG_OK;
+
+    struct bg_sort_ctx c;
+    if (bg_sort_ctx_init(&c, s, ctx, key_fn, comparator) != BG_OK)
+        return BG_ERR_ALLOC;
+
+    sort_insertion(&c, 0, s->len);
+
+    bg_sort_ctx_deinit(&c);
+    return BG_OK;
+}
+
+enum BGStatus
+BGSlice_heapsort(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                 BGSlice_sort_comparator comparator)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+
+    if (s->len <= 1)
+        return BG_OK;
+
+    struct bg_sort_ctx c;
+    if (bg_sort_ctx_init(&c, s, ctx, key_fn, comparator) != BG_OK)
+        return BG_ERR_ALLOC;
+
+    sort_heap(&c, 0, s->len);
+
+    bg_sort_ctx_deinit(&c);
+    return BG_OK;
+}
+
+////////////////////
+// Key-cached sort
+//
+// key_fn runs once per item into an array of (key, index) entries. The
+// entries are sorted, and the resulting permutation is applied to the items
+// by following its cycles, which moves every item exactly once. Ties are
+// broken by index, so the sort is stable.
+//
+
+struct sort_cached_key {
+    // What the user's comparator sees as s: elem_size is the key size.
+    BGSlice_s key_view;
+    BGSlice_sort_comparator comparator;
+    void *ctx;
+    // Offset of the item index within an entry.
+    size_t index_offset;
+};
+
+static inline size_t
+sort_entry_index(const char *entry, size_t index_offset)
+{
+    size_t index;
+    memcpy(&index, entry + index_offset, sizeof(index));
+    return index;
+}
+
+static inline void
+sort_entry_set_index(char *entry, size_t index_offset, size_t index)
+{
+    memcpy(entry + index_offset, &index, sizeof(index));
+}
+
+static ssize_t
+sort_cached_key_compare(BGSlice_s *s, comparable a, comparable b, void *ctx)
+{
+    struct sort_cached_key *ck = ctx;
+
+    ssize_t r = ck->comparator(&ck->key_view, a, b, ck->ctx);
+    if (r != 0)
+        return r;
+
+    size_t ia = sort_entry_index((char *) a, ck->index_offset);
+    size_t ib = sort_entry_index((char *) b, ck->index_offset);
+    return (ia > ib) - (ia < ib);
+}
+
+/*
+ * Move the item at entry[i].index to position i for every i. Visited
+ * entries get their own position as index, which marks their cycle done.
+ */
+static void
+sort_apply_permutation(struct bg_sort_ctx *c, char *entries,
+                       size_t entry_size, size_t index_offset, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        size_t src = sort_entry_index(entries + i * entry_size, index_offset);
+        if (src == i)
+            continue;
+
+        sort_copy(c->tmp, sort_at(c, i), c->elem_size);
+        size_t hole = i;
+        while (src != i) {
+            sort_copy(sort_at(c, hole), sort_at(c, src), c->elem_size);
+            sort_entry_set_index(entries + hole * entry_size, index_offset,
+                                 hole);
+            hole = src;
+            src = sort_entry_index(entries + hole * entry_size, index_offset);
+        }
+        sort_copy(sort_at(c, hole), c->tmp, c->elem_size);
+        sort_entry_set_index(entries + hole * entry_size, index_offset, hole);
+    }
+}
+
+enum BGStatus
+BGSlice_sort_by_cached_key(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                           size_t key_size, BGSlice_sort_comparator comparator)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+    assert_sort(key_fn != NULL, "key_fn cannot be NULL");
+    assert_sort(key_size > 0, "key_size cannot be zero");
+
+    size_t n = s->len;
+    if (n <= 1)
+        return BG_OK;
+
+    // Keep the index word-aligned so entries copy as whole words.
+    size_t index_offset =
+        (key_size + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+    size_t entry_size = index_offset + sizeof(size_t);
+
+    char *entries = bg_allocator_malloc(s->allocator, n * entry_size);
+    if (entries == NULL)
+        return BG_ERR_ALLOC;
+
+    char *item = s->buf;
+    for (size_t i = 0; i < n; i++, item += s->elem_size) {
+        char *entry = entries + i * entry_size;
+        memcpy(entry, key_fn(item, i), key_size);
+        sort_entry_set_index(entry, index_offset, i);
+    }
+
+    struct sort_cached_key ck = {
+        .key_view = *s,
+        .comparator =
+            comparator == NULL ? BGSlice_default_comparator_asc : comparator,
+        .ctx = ctx,
+        .index_offset = index_offset,
+    };
+    ck.key_view.buf = entries;
+    ck.key_view.elem_size = key_size;
+
+    BGSlice_s entry_slice = {
+        .cap = n,
+        .len = n,
+        .elem_size = entry_size,
+        .buf = entries,
+        .allocator = s->allocator,
+    };
+
+    enum BGStatus status = BG_ERR_ALLOC;
+    struct bg_sort_ctx c;
+    if (bg_sort_ctx_init(&c, &entry_slice, &ck, NULL, sort_cached_key_compare)
+        != BG_OK)
+        goto free_entries;
+    if (!sort_presorted(&c, 0, n))
+        sort_pdq_loop(&c, 0, n, sort_log2(n), true);
+    bg_sort_ctx_deinit(&c);
+
+    if (bg_sort_ctx_init(&c, s, NULL, NULL, NULL) != BG_OK)
+        goto free_entries;
+    sort_apply_permutation(&c, entries, entry_size, index_offset, n);
+    bg_sort_ctx_deinit(&c);
+    status = BG_OK;
+
+free_entries:
+    bg_allocator_free(s->allocator, entries);
+    return status;
+}
+
+////////////////////
+// Selection
+//
+// Introselect: quickselect with the same pivots and partitions as pdqsort,
+// narrowing to the side that holds nth. If partitions keep coming out
+// unbalanced it switches to median-of-medians pivots, which bounds the
+// worst case at O(n).
+//
+
+static void sort_select(struct bg_sort_ctx *c, size_t begin, size_t end,
+                        size_t nth, int bad_allowed);
+
+/*
+ * Median of medians: move the median of each group of five to the front,
+ * select their median in linear time and move it to begin. Then put an
+ * element >= it at end - 1 for sort_partition_right. Returns false if the
+ * pivot is the maximum of the range, in which case it was moved to end - 1
+ * instead.
+ */
+static bool
+sort_mom_pivot(struct bg_sort_ctx *c, size_t begin, size_t end)
+{
+    size_t n_groups = (end - begin) / 5;
+    for (size_t g = 0; g < n_groups; g++) {
+        size_t lo = begin + g * 5;
+        sort_insertion(c, lo, lo + 5);
+        sort_swap(c, begin + g, lo + 2);
+    }
+
+    size_t mid = begin + n_groups / 2;
+    sort_select(c, begin, begin + n_groups, mid, 0);
+    sort_swap(c, begin, mid);
+
+    size_t j = end - 1;
+    while (j > begin && sort_less_idx(c, j, begin))
+        j--;
+    if (j == begin) {
+        sort_swap(c, begin, end - 1);
+        return false;
+    }
+    sort_swap(c, j, end - 1);
+    return true;
+}
+
+/*
+ * Partially order [begin, end) so that nth holds the element it would hold
+ * if the range were sorted, with nothing greater before it and nothing
+ * smaller after it. bad_allowed == 0 uses median-of-medians pivots
+ * throughout.
+ */
+static void
+sort_select(struct bg_sort_ctx *c, size_t begin, size_t end, size_t nth,
+            int bad_allowed)
+{
+    bool leftmost = true;
+    bool use_mom = bad_allowed == 0;
+
+    while (end - begin >= BG_SORT_INSERTION_THRESHOLD) {
+        size_t size = end - begin;
+
+        if (use_mom) {
+            if (!sort_mom_pivot(c, begin, end)) {
+                if (nth == end - 1)
+                    return;
+                end--;
+                continue;
+            }
+        } else {
+            sort_choose_pivot(c, begin, end);
+        }
+
+        // A run of elements equal to the one before the range: they are
+        // all in their final place.
+        if (!leftmost && !sort_less_idx(c, begin - 1, begin)) {
+            size_t last_equal = sort_partition_left(c, begin, end);
+            if (nth <= last_equal)
+                return;
+            begin = last_equal + 1;
+            continue;
+        }
+
+        bool already_partitioned;
+        size_t pivot_pos =
+            sort_partition_right(c, begin, end, &already_partitioned);
+        if (pivot_pos == nth)
+            return;
+
+        size_t l_size = pivot_pos - begin;
+        size_t r_size = end - (pivot_pos + 1);
+        if (!use_mom && (l_size < size / 8 || r_size < size / 8)
+            && --bad_allowed == 0)
+            use_mom = true;
+
+        if (nth < pivot_pos) {
+            end = pivot_pos;
+        } else {
+            begin = pivot_pos + 1;
+            leftmost = false;
+        }
+    }
+    sort_insertion(c, begin, end);
+}
+
+enum BGStatus
+BGSlice_nth_element(BGSlice_s *s, size_t nth, void *ctx,
+                    BGSlice_sort_key_fn key_fn,
+                    BGSlice_sort_comparator comparator)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+    assert_sort(nth < s->len, "nth %zu out of range for slice of length %zu",
+                nth, s->len);
+
+    struct bg_sort_ctx c;
+    if (bg_sort_ctx_init(&c, s, ctx, key_fn, comparator) != BG_OK)
+        return BG_ERR_ALLOC;
+
+    sort_select(&c, 0, s->len, nth, sort_log2(s->len));
+
+    bg_sort_ctx_deinit(&c);
+    return BG_OK;
+}
+
+enum BGStatus
+BGSlice_partial_sort(BGSlice_s *s, size_t k, void *ctx,
+                     BGSlice_sort_key_fn key_fn,
+                     BGSlice_sort_comparator comparator)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+
+    size_t n = s->len;
+    if (k > n)
+        k = n;
+    if (k == 0)
+        return BG_OK;
+
+    struct bg_sort_ctx c;
+    if (bg_sort_ctx_init(&c, s, ctx, key_fn, comparator) != BG_OK)
+        return BG_ERR_ALLOC;
+
+    // Select first so only the k winners pay for the O(k log k) sort.
+    if (k < n)
+        sort_select(&c, 0, n, k - 1, sort_log2(n));
+    if (!sort_presorted(&c, 0, k))
+        sort_pdq_loop(&c, 0, k, sort_log2(k), true);
+
+    bg_sort_ctx_deinit(&c);
+    return BG_OK;
+}
+
+////////////////////
+// Top-k
+//
+// A max-heap of the k best items seen so far, with the worst of them at the
+// root: a new item either loses against the root in one comparison or
+// replaces it and sifts down in O(log k).
+//
+
+struct BGTopK {
+    BGSlice_s *items;
+    size_t k;
+    // Items pushed so far, reported to key_fn as the item's index.
+    size_t seen;
+    // Stream position of each kept item, moved along with it; NULL without
+    // key_fn, which is the only one to look at positions.
+    size_t *pos;
+    // Comparator triple over items; base is fixed since items never grows.
+    struct bg_sort_ctx c;
+};
+
+static inline bool
+topk_less(struct bg_sort_ctx *c, size_t *pos, size_t i, size_t j)
+{
+    return sort_less(c, sort_at(c, i), pos != NULL ? pos[i] : 0,
+                     sort_at(c, j), pos != NULL ? pos[j] : 0);
+}
+
+static inline void
+topk_swap(struct bg_sort_ctx *c, size_t *pos, size_t i, size_t j)
+{
+    sort_swap(c, i, j);
+    if (pos != NULL) {
+        size_t tmp = pos[i];
+        pos[i] = pos[j];
+        pos[j] = tmp;
+    }
+}
+
+static void
+topk_sift_up(struct bg_sort_ctx *c, size_t *pos, size_t i)
+{
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!topk_less(c, pos, parent, i))
+            break;
+        topk_swap(c, pos, parent, i);
+        i = parent;
+    }
+}
+
+static void
+topk_sift_down(struct bg_sort_ctx *c, size_t *pos, size_t root, size_t n)
+{
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && topk_less(c, pos, child, child + 1))
+            child++;
+        if (!topk_less(c, pos, root, child))
+            break;
+        topk_swap(c, pos, root, child);
+        root = child;
+    }
+}
+
+BGTopK *
+BGTopK_new(size_t k, size_t elem_size, void *ctx, BGSlice_sort_key_fn key_fn,
+           BGSlice_sort_comparator comparator, struct BGSliceOption *option)
+{
+    assert_sort(k > 0, "k cannot be zero");
+
+    BGSlice_s *items = __BGSlice_new(0, k, elem_size, option);
+    if (items == NULL)
+        return NULL;
+
+    struct Allocator *allocator = items->allocator;
+    BGTopK *t = bg_allocator_malloc(allocator, sizeof(BGTopK));
+    if (t == NULL) {
+        BGSlice_free(items);
+        return NULL;
+    }
+    t->items = items;
+    t->k = k;
+    t->seen = 0;
+    t->pos = NULL;
+    if (key_fn != NULL) {
+        t->pos = bg_allocator_malloc(allocator, k * sizeof(size_t));
+        if (t->pos == NULL)
+            goto fail;
+    }
+    if (bg_sort_ctx_init(&t->c, items, ctx, key_fn, comparator) != BG_OK)
+        goto fail;
+    return t;
+
+fail:
+    if (t->pos != NULL)
+        bg_allocator_free(allocator, t->pos);
+    bg_allocator_free(allocator, t);
+    BGSlice_free(items);
+    return NULL;
+}
+
+bool
+BGTopK_push(BGTopK *t, void *item)
+{
+    assert_sort(t != NULL, "top-k cannot be NULL");
+
+    struct bg_sort_ctx *c = &t->c;
+    size_t idx = t->seen++;
+    size_t len = t->items->len;
+    size_t slot;
+
+    if (len < t->k) {
+        slot = len;
+        t->items->len++;
+    } else {
+        // Ties keep the item that came first.
+        size_t root_idx = t->pos != NULL ? t->pos[0] : 0;
+        if (!sort_less(c, item, idx, sort_at(c, 0), root_idx))
+            return false;
+        slot = 0;
+    }
+
+    sort_copy(sort_at(c, slot), item, c->elem_size);
+    if (t->pos != NULL)
+        t->pos[slot] = idx;
+    if (slot == len)
+        topk_sift_up(c, t->pos, len);
+    else
+        topk_sift_down(c, t->pos, 0, len);
+    return true;
+}
+
+size_t
+BGTopK_push_slice(BGTopK *t, BGSlice_s *s)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+    assert_sort(s->elem_size == t->c.elem_size,
+                "slice elem_size %zu does not match top-k elem_size %zu",
+                s->elem_size, t->c.elem_size);
+
+    size_t kept = 0;
+    char *item = s->buf;
+    for (size_t i = 0; i < s->len; i++, item += s->elem_size)
+        kept += BGTopK_push(t, item);
+    return kept;
+}
+
+size_t
+BGTopK_len(BGTopK *t)
+{
+    return t->items->len;
+}
+
+void *
+BGTopK_threshold(BGTopK *t)
+{
+    if (t->items->len < t->k)
+        return NULL;
+    return t->items->buf;
+}
+
+BGSlice *
+BGTopK_to_slice(BGTopK *t, struct BGSliceOption *option)
+{
+    size_t len = t->items->len;
+    // A zero capacity buffer may come back as NULL, so ask for one.
+    BGSlice_s *out = __BGSlice_new(len, len == 0 ? 1 : len,
+                                   t->c.elem_size, option);
+    if (out == NULL)
+        return NULL;
+    memcpy(out->buf, t->items->buf, len * t->c.elem_size);
+
+    // The positions are consumed by the sort, so it works on a copy too.
+    size_t *pos = NULL;
+    if (t->pos != NULL && len > 1) {
+        pos = bg_allocator_malloc(t->items->allocator, len * sizeof(size_t));
+        if (pos == NULL) {
+            BGSlice_free(out);
+            return NULL;
+        }
+        memcpy(pos, t->pos, len * sizeof(size_t));
+    }
+
+    // Same comparator, pointed at the copy, which is already a heap. tmp
+    // still points into t->c.
+    struct bg_sort_ctx c = t->c;
+    c.base = out->buf;
+    c.s = out;
+    for (size_t last = len; last-- > 1;) {
+        topk_swap(&c, pos, 0, last);
+        topk_sift_down(&c, pos, 0, last);
+    }
+    if (pos != NULL)
+        bg_allocator_free(t->items->allocator, pos);
+    return out;
+}
+
+void
+BGTopK_free(BGTopK *t)
+{
+    if (t == NULL)
+        return;
+    struct Allocator *allocator = t->items->allocator;
+    bg_sort_ctx_deinit(&t->c);
+    if (t->pos != NULL)
+        bg_allocator_free(allocator, t->pos);
+    BGSlice_free(t->items);
+    bg_allocator_free(allocator, t);
+}
+
+////////////////////
+// Merging
+//
+
+static inline char *
+sort_elem(char *base, size_t i, size_t elem_size)
+{
+    return base + i * elem_size;
+}
+
+/*
+ * Stable merge of src[a_lo, a_hi) and src[b_lo, b_hi) into dst starting at
+ * index out. On equal keys the element from the first run goes first.
+ */
+static void
+sort_merge_into(struct bg_sort_ctx *c, char *src, size_t a_lo, size_t a_hi,
+                size_t b_lo, size_t b_hi, char *dst, size_t out)
+{
+    size_t es = c->elem_size;
+    size_t i = a_lo;
+    size_t j = b_lo;
+
+    while (i < a_hi && j < b_hi) {
+        char *a = sort_elem(src, i, es);
+        char *b = sort_elem(src, j, es);
+        if (sort_less(c, b, j, a, i)) {
+            sort_copy(sort_elem(dst, out++, es), b, es);
+            j++;
+        } else {
+            sort_copy(sort_elem(dst, out++, es), a, es);
+            i++;
+        }
+    }
+    memcpy(sort_elem(dst, out, es), sort_elem(src, i, es), (a_hi - i) * es);
+    out += a_hi - i;
+    memcpy(sort_elem(dst, out, es), sort_elem(src, j, es), (b_hi - j) * es);
+}
+
+/*
+ * How many of the first k outputs of merging src[a_lo, a_lo + a_len) with
+ * src[b_lo, b_lo + b_len) come from the first run (the "co-rank" of k).
+ * Splitting a merge at co-ranks lets independent workers produce disjoint
+ * slices of the output while keeping the merge stable.
+ */
+static size_t
+sort_co_rank(struct bg_sort_ctx *c, char *src, size_t a_lo, size_t a_len,
+             size_t b_lo, size_t b_len, size_t k)
+{
+    size_t es = c->elem_size;
+    size_t lo = k > b_len ? k - b_len : 0;
+    size_t hi = k < a_len ? k : a_len;
+
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        size_t j = k - i;
+        // Taking i items from A is too few if B[j - 1] >= A[i].
+        if (j > 0
+            && !sort_less(c, sort_elem(src, b_lo + j - 1, es), b_lo + j - 1,
+                          sort_elem(src, a_lo + i, es), a_lo + i))
+            lo = i + 1;
+        else
+            hi = i;
+    }
+    return lo;
+}
+
+////////////////////
+// Timsort
+//
+// Stable natural merge sort after Tim Peters' listsort: the input is cut
+// into ascending runs (strictly descending runs are reversed), runs shorter
+// than minrun are extended with insertion sort, and a stack of pending runs
+// is merged so that run lengths keep a Fibonacci-like shape. Merges copy the
+// shorter run out to scratch and switch to galloping when one side keeps
+// winning. Already sorted input is a single run: n - 1 comparisons and no
+// scratch at all.
+//
+
+// Consecutive wins before a merge starts galloping.
+#define BG_SORT_MIN_GALLOP 7
+// Enough pending runs for any 64-bit length given the stack invariants.
+#define BG_SORT_MAX_RUNS 85
+
+struct sort_run {
+    size_t base;
+    size_t len;
+};
+
+struct sort_tim {
+    struct bg_sort_ctx *c;
+    // Scratch for the shorter run of a merge. Allocated from allocator on
+    // the first merge when NULL.
+    char *tmp;
+    size_t tmp_cap;
+    struct Allocator *allocator;
+    size_t min_gallop;
+    struct sort_run runs[BG_SORT_MAX_RUNS];
+    size_t n_runs;
+};
+
+// Index reported to key_fn for element k of arr. Elements copied out to
+// scratch keep reporting the index they had in the slice.
+#define TIM_AT(arr, k) sort_elem((arr), (k), es)
+
+/*
+ * Length of the run starting at lo. A strictly descending run is reversed
+ * in place; strictness keeps equal elements in order.
+ */
+static size_t
+sort_tim_count_run(struct bg_sort_ctx *c, size_t lo, size_t hi)
+{
+    size_t i = lo + 1;
+    if (i == hi)
+        return 1;
+
+    if (sort_less_idx(c, i, lo)) {
+        while (i + 1 < hi && sort_less_idx(c, i + 1, i))
+            i++;
+        sort_reverse(c, lo, i + 1);
+    } else {
+        while (i + 1 < hi && !sort_less_idx(c, i + 1, i))
+            i++;
+    }
+    return i + 1 - lo;
+}
+
+// Between 32 and 64, chosen so n / minrun is a power of two or just below.
+static size_t
+sort_tim_minrun(size_t n)
+{
+    size_t r = 0;
+    while (n >= 64) {
+        r |= n & 1;
+        n >>= 1;
+    }
+    return n + r;
+}
+
+/*
+ * Position of key in the sorted arr[0, n), to the left of any equal
+ * elements, searching outwards from hint. arr[i] reports idx0 + i to
+ * key_fn.
+ */
+static size_t
+sort_tim_gallop_left(struct bg_sort_ctx *c, char *key, size_t key_idx,
+                     char *arr, size_t idx0, size_t n, size_t hint)
+{
+    size_t es = c->elem_size;
+    ssize_t last = 0;
+    ssize_t ofs = 1;
+    ssize_t h = (ssize_t) hint;
+
+    if (sort_less(c, TIM_AT(arr, hint), idx0 + hint, key, key_idx)) {
+        // arr[hint] < key: gallop right until arr[hint + ofs] >= key.
+        ssize_t max_ofs = (ssize_t) n - h;
+        while (ofs < max_ofs
+               && sort_less(c, TIM_AT(arr, h + ofs), idx0 + h + ofs, key,
+                            key_idx)) {
+            last = ofs;
+            ofs = (ofs << 1) + 1;
+        }
+        if (ofs > max_ofs)
+            ofs = max_ofs;
+        last += h;
+        ofs += h;
+    } else {
+        // key <= arr[hint]: gallop left until arr[hint - ofs] < key.
+        ssize_t max_ofs = h + 1;
+        while (ofs < max_ofs
+               && !sort_less(c, TIM_AT(arr, h - ofs), idx0 + h - ofs, key,
+                             key_idx)) {
+            last = ofs;
+            ofs = (ofs << 1) + 1;
+        }
+        if (ofs > max_ofs)
+            ofs = max_ofs;
+        ssize_t k = last;
+        last = h - ofs;
+        ofs = h - k;
+    }
+
+    // arr[last] < key <= arr[ofs]; binary search the gap.
+    last++;
+    while (last < ofs) {
+        ssize_t m = last + (ofs - last) / 2;
+        if (sort_less(c, TIM_AT(arr, m), idx0 + m, key, key_idx))
+            last = m + 1;
+        else
+            ofs = m;
+    }
+    return (size_t) ofs;
+}
+
+// Like sort_tim_gallop_left, but to the right of any equal elements.
+static size_t
+sort_tim_gallop_right(struct bg_sort_ctx *c, char *key, size_t key_idx,
+                      char *arr, size_t idx0, size_t n, size_t hint)
+{
+    size_t es = c->elem_size;
+    ssize_t last = 0;
+    ssize_t ofs = 1;
+    ssize_t h = (ssize_t) hint;
+
+    if (sort_less(c, key, key_idx, TIM_AT(arr, hint), idx0 + hint)) {
+        // key < arr[hint]: gallop left until arr[hint - ofs] <= key.
+        ssize_t max_ofs = h + 1;
+        while (ofs < max_ofs
+               && sort_less(c, key, key_idx, TIM_AT(arr, h - ofs),
+                            idx0 + h - ofs)) {
+            last = ofs;
+            ofs = (ofs << 1) + 1;
+        }
+        if (ofs > max_ofs)
+            ofs = max_ofs;
+        ssize_t k = last;
+        last = h - ofs;
+        ofs = h - k;
+    } else {
+        // arr[hint] <= key: gallop right until key < arr[hint + ofs].
+        ssize_t max_ofs = (ssize_t) n - h;
+        while (ofs < max_ofs
+               && !sort_less(c, key, key_idx, TIM_AT(arr, h + ofs),
+                             idx0 + h + ofs)) {
+            last = ofs;
+            ofs = (ofs << 1) + 1;
+        }
+        if (ofs > max_ofs)
+            ofs = max_ofs;
+        last += h;
+        ofs += h;
+    }
+
+    // arr[last] <= key < arr[ofs]; binary search the gap.
+    last++;
+    while (last < ofs) {
+        ssize_t m = last + (ofs - last) / 2;
+        if (sort_less(c, key, key_idx, TIM_AT(arr, m), idx0 + m))
+            ofs = m;
+        else
+            last = m + 1;
+    }
+    return (size_t) ofs;
+}
+
+static enum BGStatus
+sort_tim_reserve(struct sort_tim *ts, size_t n, size_t total)
+{
+    if (n <= ts->tmp_cap)
+        return BG_OK;
+
+    // Never more than half the range, so allocate that once.
+    size_t cap = total / 2 + 1;
+    ts->tmp = bg_allocator_malloc(ts->allocator, cap * ts->c->elem_size);
+    if (ts->tmp == NULL)
+        return BG_ERR_ALLOC;
+    ts->tmp_cap = cap;
+    return BG_OK;
+}
+
+/*
+ * Merge adjacent runs a[0, na) and b[0, nb) with na <= nb, where a is
+ * known to start with an element > b[0] and b to end with one >= a's last.
+ * a is copied to scratch and the merge fills the slice from the left.
+ */
+static void
+sort_tim_merge_lo(struct sort_tim *ts, size_t base_a, size_t na,
+                  size_t base_b, size_t nb)
+{
+    struct bg_sort_ctx *c = ts->c;
+    size_t es = c->elem_size;
+    char *tmp = ts->tmp;
+    size_t min_gallop = ts->min_gallop;
+
+    memcpy(tmp, sort_at(c, base_a), na * es);
+    size_t dest = base_a;
+    size_t pa = 0;
+    size_t pb = base_b;
+
+    sort_copy(sort_at(c, dest++), sort_at(c, pb++), es);
+    if (--nb == 0)
+        goto succeed;
+    if (na == 1)
+        goto copy_b;
+
+    for (;;) {
+        size_t a_count = 0;
+        size_t b_count = 0;
+
+        // Plain merge until one side wins min_gallop times in a row.
+        for (;;) {
+            if (sort_less(c, sort_at(c, pb), pb, TIM_AT(tmp, pa),
+                          base_a + pa)) {
+                sort_copy(sort_at(c, dest++), sort_at(c, pb++), es);
+                a_count = 0;
+                if (--nb == 0)
+                    goto succeed;
+                if (++b_count >= min_gallop)
+                    break;
+            } else {
+                sort_copy(sort_at(c, dest++), TIM_AT(tmp, pa++), es);
+                b_count = 0;
+                if (--na == 1)
+                    goto copy_b;
+                if (++a_count >= min_gallop)
+                    break;
+            }
+        }
+
+        // Gallop while it keeps paying off, making it cheaper to enter
+        // next time.
+        min_gallop++;
+        do {
+            min_gallop -= min_gallop > 1;
+            ts->min_gallop = min_gallop;
+
+            size_t k = sort_tim_gallop_right(c, sort_at(c, pb), pb,
+                                             TIM_AT(tmp, pa), base_a + pa,
+                                             na, 0);
+            a_count = k;
+            if (k != 0) {
+                memcpy(sort_at(c, dest), TIM_AT(tmp, pa), k * es);
+                dest += k;
+                pa += k;
+                na -= k;
+                if (na == 1)
+                    goto copy_b;
+                // Only an inconsistent comparator gets here.
+                if (na == 0)
+                    goto succeed;
+            }
+            sort_copy(sort_at(c, dest++), sort_at(c, pb++), es);
+            if (--nb == 0)
+                goto succeed;
+
+            k = sort_tim_gallop_left(c, TIM_AT(tmp, pa), base_a + pa,
+                                     sort_at(c, pb), pb, nb, 0);
+            b_count = k;
+            if (k != 0) {
+                memmove(sort_at(c, dest), sort_at(c, pb), k * es);
+                dest += k;
+                pb += k;
+                nb -= k;
+                if (nb == 0)
+                    goto succeed;
+            }
+            sort_copy(sort_at(c, dest++), TIM_AT(tmp, pa++), es);
+            if (--na == 1)
+                goto copy_b;
+        } while (a_count >= BG_SORT_MIN_GALLOP
+                 || b_count >= BG_SORT_MIN_GALLOP);
+        min_gallop++;
+        ts->min_gallop = min_gallop;
+    }
+
+succeed:
+    if (na != 0)
+        memcpy(sort_at(c, dest), TIM_AT(tmp, pa), na * es);
+    return;
+
+copy_b:
+    // The last element of a goes after everything left in b.
+    memmove(sort_at(c, dest), sort_at(c, pb), nb * es);
+    sort_copy(sort_at(c, dest + nb), TIM_AT(tmp, pa), es);
+}
+
+/*
+ * Mirror of sort_tim_merge_lo for na > nb: b is copied to scratch and the
+ * merge fills the slice from the right.
+ */
+static void
+sort_tim_merge_hi(struct sort_tim *ts, size_t base_a, size_t na,
+                  size_t base_b, size_t nb)
+{
+    struct bg_sort_ctx *c = ts->c;
+    size_t es = c->elem_size;
+    char *tmp = ts->tmp;
+    size_t min_gallop = ts->min_gallop;
+
+    memcpy(tmp, sort_at(c, base_b), nb * es);
+    // One past the next slot to fill, and one past the next unmerged
+    // element of each run.
+    size_t dest = base_b + nb;
+    size_t pa = base_a + na;
+    size_t pb = nb;
+
+    sort_copy(sort_at(c, --dest), sort_at(c, --pa), es);
+    if (--na == 0)
+        goto succeed;
+    if (nb == 1)
+        goto copy_a;
+
+    for (;;) {
+        size_t a_count = 0;
+        size_t b_count = 0;
+
+        for (;;) {
+            if (sort_less(c, TIM_AT(tmp, pb - 1), base_b + pb - 1,
+                          sort_at(c, pa - 1), pa - 1)) {
+                sort_copy(sort_at(c, --dest), sort_at(c, --pa), es);
+                b_count = 0;
+                if (--na == 0)
+                    goto succeed;
+                if (++a_count >= min_gallop)
+                    break;
+            } else {
+                sort_copy(sort_at(c, --dest), TIM_AT(tmp, --pb), es);
+                a_count = 0;
+                if (--nb == 1)
+                    goto copy_a;
+                if (++b_count >= min_gallop)
+                    break;
+            }
+        }
+
+        min_gallop++;
+        do {
+            min_gallop -= min_gallop > 1;
+            ts->min_gallop = min_gallop;
+
+            // Elements of a greater than b's last go first.
+            size_t k = na
+                       - sort_tim_gallop_right(c, TIM_AT(tmp, pb - 1),
+                                               base_b + pb - 1,
+                                               sort_at(c, base_a), base_a,
+                                               na, na - 1);
+            a_count = k;
+            if (k != 0) {
+                dest -= k;
+                pa -= k;
+                memmove(sort_at(c, dest), sort_at(c, pa), k * es);
+                na -= k;
+                if (na == 0)
+                    goto succeed;
+            }
+            sort_copy(sort_at(c, --dest), TIM_AT(tmp, --pb), es);
+            if (--nb == 1)
+                goto copy_a;
+
+            k = nb
+                - sort_tim_gallop_left(c, sort_at(c, pa - 1), pa - 1, tmp,
+                                       base_b, nb, nb - 1);
+            b_count = k;
+            if (k != 0) {
+                dest -= k;
+                pb -= k;
+                memcpy(sort_at(c, dest), TIM_AT(tmp, pb), k * es);
+                nb -= k;
+                if (nb == 1)
+                    goto copy_a;
+                // Only an inconsistent comparator gets here.
+                if (nb == 0)
+                    goto succeed;
+            }
+            sort_copy(sort_at(c, --dest), sort_at(c, --pa), es);
+            if (--na == 0)
+                goto succeed;
+        } while (a_count >= BG_SORT_MIN_GALLOP
+                 || b_count >= BG_SORT_MIN_GALLOP);
+        min_gallop++;
+        ts->min_gallop = min_gallop;
+    }
+
+succeed:
+    if (nb != 0)
+        memcpy(sort_at(c, dest - nb), tmp, nb * es);
+    return;
+
+copy_a:
+    // The first element of b goes before everything left in a.
+    dest -= na;
+    pa -= na;
+    memmove(sort_at(c, dest), sort_at(c, pa), na * es);
+    sort_copy(sort_at(c, dest - 1), tmp, es);
+}
+
+// Merge pending runs i and i + 1.
+static enum BGStatus
+sort_tim_merge_at(struct sort_tim *ts, size_t i, size_t total)
+{
+    struct bg_sort_ctx *c = ts->c;
+    size_t es = c->elem_size;
+    size_t base_a = ts->runs[i].base;
+    size_t na = ts->runs[i].len;
+    size_t base_b = ts->runs[i + 1].base;
+    size_t nb = ts->runs[i + 1].len;
+
+    ts->runs[i].len = na + nb;
+    if (i + 3 == ts->n_runs)
+        ts->runs[i + 1] = ts->runs[i + 2];
+    ts->n_runs--;
+
+    // Elements of a that are <= b[0] are already in place, and so are
+    // elements of b that are >= a's last.
+    size_t k = sort_tim_gallop_right(c, sort_at(c, base_b), base_b,
+                                     sort_at(c, base_a), base_a, na, 0);
+    base_a += k;
+    na -= k;
+    if (na == 0)
+        return BG_OK;
+
+    nb = sort_tim_gallop_left(c, TIM_AT(c->base, base_a + na - 1),
+                              base_a + na - 1, sort_at(c, base_b), base_b,
+                              nb, nb - 1);
+    if (nb == 0)
+        return BG_OK;
+
+    if (sort_tim_reserve(ts, na < nb ? na : nb, total) != BG_OK)
+        return BG_ERR_ALLOC;
+
+    if (na <= nb)
+        sort_tim_merge_lo(ts, base_a, na, base_b, nb);
+    else
+        sort_tim_merge_hi(ts, base_a, na, base_b, nb);
+    return BG_OK;
+}
+
+/*
+ * Restore the invariants on the top of the run stack:
+ * runs[n - 3].len > runs[n - 2].len + runs[n - 1].len and
+ * runs[n - 2].len > runs[n - 1].len, checking one level deeper as well.
+ */
+static enum BGStatus
+sort_tim_merge_collapse(struct sort_tim *ts, size_t total)
+{
+    struct sort_run *r = ts->runs;
+    while (ts->n_runs > 1) {
+        size_t n = ts->n_runs - 2;
+        if ((n > 0 && r[n - 1].len <= r[n].len + r[n + 1].len)
+            || (n > 1 && r[n - 2].len <= r[n - 1].len + r[n].len)) {
+            if (r[n - 1].len < r[n + 1].len)
+                n--;
+        } else if (r[n].len > r[n + 1].len) {
+            break;
+        }
+        if (sort_tim_merge_at(ts, n, total) != BG_OK)
+            return BG_ERR_ALLOC;
+    }
+    return BG_OK;
+}
+
+static enum BGStatus
+sort_tim_merge_force(struct sort_tim *ts, size_t total)
+{
+    struct sort_run *r = ts->runs;
+    while (ts->n_runs > 1) {
+        size_t n = ts->n_runs - 2;
+        if (n > 0 && r[n - 1].len < r[n + 1].len)
+            n--;
+        if (sort_tim_merge_at(ts, n, total) != BG_OK)
+            return BG_ERR_ALLOC;
+    }
+    return BG_OK;
+}
+
+/*
+ * Timsort [begin, end). With tmp == NULL, scratch for (end - begin) / 2
+ * elements is taken from allocator on the first merge and freed before
+ * returning; otherwise tmp must hold that many.
+ */
+static enum BGStatus
+sort_tim(struct bg_sort_ctx *c, size_t begin, size_t end, char *tmp,
+         struct Allocator *allocator)
+{
+    size_t n = end - begin;
+    if (n < 2)
+        return BG_OK;
+
+    struct sort_tim ts = {
+        .c = c,
+        .tmp = tmp,
+        .tmp_cap = tmp == NULL ? 0 : n / 2 + 1,
+        .allocator = allocator,
+        .min_gallop = BG_SORT_MIN_GALLOP,
+    };
+
+    enum BGStatus status = BG_OK;
+    size_t min_run = sort_tim_minrun(n);
+    size_t lo = begin;
+    while (lo < end) {
+        size_t run = sort_tim_count_run(c, lo, end);
+        if (run < min_run) {
+            size_t force = end - lo < min_run ? end - lo : min_run;
+            for (size_t cur = lo + run; cur < lo + force; cur++)
+                sort_insert_one(c, lo, cur, true);
+            run = force;
+        }
+
+        ts.runs[ts.n_runs].base = lo;
+        ts.runs[ts.n_runs].len = run;
+        ts.n_runs++;
+        status = sort_tim_merge_collapse(&ts, n);
+        if (status != BG_OK)
+            goto done;
+        lo += run;
+    }
+    status = sort_tim_merge_force(&ts, n);
+
+done:
+    if (tmp == NULL && ts.tmp != NULL)
+        bg_allocator_free(allocator, ts.tmp);
+    return status;
+}
+
+#undef TIM_AT
+
+enum BGStatus
+BGSlice_stable_sort(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                    BGSlice_sort_comparator comparator,
+                    struct Allocator *scratch)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+
+    if (s->len <= 1)
+        return BG_OK;
+
+    struct bg_sort_ctx c;
+    if (bg_sort_ctx_init(&c, s, ctx, key_fn, comparator) != BG_OK)
+        return BG_ERR_ALLOC;
+
+    enum BGStatus status = sort_tim(&c, 0, s->len, NULL,
+                                    scratch == NULL ? s->allocator : scratch);
+
+    bg_sort_ctx_deinit(&c);
+    return status;
+}
+
+////////////////////
+// Parallel sort
+//
+// Sort T chunks concurrently, then merge adjacent runs pairwise until one
+// run is left. Each pairwise merge is itself split at co-ranks into
+// segments sized so every round keeps all threads busy. Chunk boundaries
+// and merge splits depend only on the length and thread count, so the
+// output is reproducible; with .stable it is also stable.
+//
+
+#define BG_PSORT_DEFAULT_CUTOFF ((size_t) 1 << 16)
+// Smallest chunk worth handing to a thread.
+#define BG_PSORT_MIN_CHUNK ((size_t) 1 << 12)
+
+struct psort_job {
+    BGThreadPool *pool;
+    size_t n_threads;
+    bool stable;
+    BGSlice_s *s;
+    void *ctx;
+    BGSlice_sort_key_fn key_fn;
+    BGSlice_sort_comparator comparator;
+    char *scratch;
+};
+
+struct psort_task {
+    // Each task owns its context so the swap temporary is not shared.
+    struct bg_sort_ctx c;
+    struct psort_job *job;
+    enum BGStatus status;
+
+    // Chunk sort: [begin, end) of the slice buffer.
+    size_t begin;
+    size_t end;
+
+    // Merge: src[a_lo, a_hi) + src[b_lo, b_hi) -> dst[out...).
+    char *src;
+    char *dst;
+    size_t a_lo;
+    size_t a_hi;
+    size_t b_lo;
+    size_t b_hi;
+    size_t out;
+};
+
+static void
+psort_run_chunk(void *arg)
+{
+    struct psort_task *t = arg;
+    struct psort_job *job = t->job;
+
+    t->status = bg_sort_ctx_init(&t->c, job->s, job->ctx, job->key_fn,
+                                 job->comparator);
+    if (t->status != BG_OK)
+        return;
+
+    if (job->stable) {
+        t->status = sort_tim(&t->c, t->begin, t->end,
+                             sort_elem(job->scratch, t->begin,
+                                       t->c.elem_size),
+                             NULL);
+    } else if (!sort_presorted(&t->c, t->begin, t->end)) {
+        sort_pdq_loop(&t->c, t->begin, t->end, sort_log2(t->end - t->begin),
+                      true);
+    }
+    bg_sort_ctx_deinit(&t->c);
+}
+
+static void
+psort_run_merge(void *arg)
+{
+    struct psort_task *t = arg;
+    sort_merge_into(&t->c, t->src, t->a_lo, t->a_hi, t->b_lo, t->b_hi,
+                    t->dst, t->out);
+}
+
+static void
+psort_run_copy(void *arg)
+{
+    struct psort_task *t = arg;
+    size_t es = t->c.elem_size;
+    memcpy(sort_elem(t->dst, t->begin, es), sort_elem(t->src, t->begin, es),
+           (t->end - t->begin) * es);
+}
+
+static void
+psort_submit(BGThreadPool *pool, BGThreadPool_task_fn fn,
+             struct psort_task *t)
+{
+    if (!BGThreadPool_submit(pool, fn, t))
+        fn(t);
+}
+
+/*
+ * Queue the merge of runs src[lo, mid) and src[mid, hi) into dst as
+ * `segments` independent tasks. Returns the number of tasks used.
+ */
+static size_t
+psort_queue_merge(struct psort_job *job, struct psort_task *tasks,
+                  struct bg_sort_ctx *c, char *src, char *dst, size_t lo,
+                  size_t mid, size_t hi, size_t segments)
+{
+    size_t len = hi - lo;
+    size_t a_len = mid - lo;
+    size_t b_len = hi - mid;
+    size_t prev_k = 0;
+    size_t prev_i = 0;
+
+    for (size_t seg = 0; seg < segments; seg++) {
+        size_t k = len * (seg + 1) / segments;
+        size_t i = seg + 1 == segments
+                       ? a_len
+                       : sort_co_rank(c, src, lo, a_len, mid, b_len, k);
+
+        struct psort_task *t = &tasks[seg];
+        t->c = *c;
+        t->job = job;
+        t->src = src;
+        t->dst = dst;
+        t->a_lo = lo + prev_i;
+        t->a_hi = lo + i;
+        t->b_lo = mid + (prev_k - prev_i);
+        t->b_hi = mid + (k - i);
+        t->out = lo + prev_k;
+        psort_submit(job->pool, psort_run_merge, t);
+
+        prev_k = k;
+        prev_i = i;
+    }
+    return segments;
+}
+
+static enum BGStatus
+psort_run(struct psort_job *job, size_t n_chunks)
+{
+    BGSlice_s *s = job->s;
+    size_t n = s->len;
+    size_t es = s->elem_size;
+    struct Allocator *allocator = s->allocator;
+    enum BGStatus ret = BG_OK;
+
+    // One task per chunk, then at most one per thread plus one per pair in
+    // every merge round.
+    size_t n_tasks = n_chunks + job->n_threads + 1;
+    struct psort_task *tasks =
+        bg_allocator_calloc(allocator, n_tasks, sizeof(struct psort_task));
+    size_t *bounds =
+        bg_allocator_malloc(allocator, (n_chunks + 1) * sizeof(size_t));
+    if (tasks == NULL || bounds == NULL) {
+        ret = BG_ERR_ALLOC;
+        goto done;
+    }
+
+    for (size_t i = 0; i <= n_chunks; i++)
+        bounds[i] = n * i / n_chunks;
+
+    for (size_t i = 0; i < n_chunks; i++) {
+        tasks[i].job = job;
+        tasks[i].begin = bounds[i];
+        tasks[i].end = bounds[i + 1];
+        psort_submit(job->pool, psort_run_chunk, &tasks[i]);
+    }
+    BGThreadPool_wait(job->pool);
+    for (size_t i = 0; i < n_chunks; i++) {
+        if (tasks[i].status != BG_OK) {
+            ret = tasks[i].status;
+            goto done;
+        }
+    }
+
+    // Merging only compares, so all merge tasks share one context.
+    struct bg_sort_ctx c = {
+        .elem_size = es,
+        .s = s,
+        .ctx = job->ctx,
+        .key_fn = job->key_fn,
+        .comparator = job->comparator == NULL ? BGSlice_default_comparator_asc
+                                              : job->comparator,
+    };
+
+    char *src = s->buf;
+    char *dst = job->scratch;
+    size_t n_runs = n_chunks;
+    while (n_runs > 1) {
+        size_t used = 0;
+        size_t next_runs = 0;
+        for (size_t r = 0; r < n_runs; r += 2) {
+            size_t lo = bounds[r];
+            if (r + 1 == n_runs) {
+                // Odd run out: carry it over unchanged.
+                struct psort_task *t = &tasks[used++];
+                t->c = c;
+                t->src = src;
+                t->dst = dst;
+                t->begin = lo;
+                t->end = bounds[r + 1];
+                psort_submit(job->pool, psort_run_copy, t);
+                bounds[next_runs++] = lo;
+                continue;
+            }
+            size_t mid = bounds[r + 1];
+            size_t hi = bounds[r + 2];
+            size_t segments = (hi - lo) * job->n_threads / n;
+            if (segments == 0)
+                segments = 1;
+            used += psort_queue_merge(job, &tasks[used], &c, src, dst, lo,
+                                      mid, hi, segments);
+            bounds[next_runs++] = lo;
+        }
+        bounds[next_runs] = n;
+        n_runs = next_runs;
+        BGThreadPool_wait(job->pool);
+        bg_swap(char *, src, dst);
+    }
+
+    if (src != s->buf) {
+        size_t used = job->n_threads;
+        for (size_t i = 0; i < used; i++) {
+            struct psort_task *t = &tasks[i];
+            t->c = c;
+            t->src = src;
+            t->dst = s->buf;
+            t->begin = n * i / used;
+            t->end = n * (i + 1) / used;
+            psort_submit(job->pool, psort_run_copy, t);
+        }
+        BGThreadPool_wait(job->pool);
+    }
+
+done:
+    bg_allocator_free(allocator, bounds);
+    bg_allocator_free(allocator, tasks);
+    return ret;
+}
+
+enum BGStatus
+BGSlice_parallel_sort(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                      BGSlice_sort_comparator comparator,
+                      struct BGParallelSortOption *option)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+
+    struct BGParallelSortOption opt = { 0 };
+    if (option != NULL)
+        opt = *option;
+
+    size_t cutoff = opt.sequential_cutoff == 0 ? BG_PSORT_DEFAULT_CUTOFF
+                                               : opt.sequential_cutoff;
+    size_t n_threads = opt.pool != NULL ? BGThreadPool_size(opt.pool)
+                                        : opt.n_threads;
+    if (n_threads == 0)
+        n_threads = bg_cpu_count();
+
+    size_t n = s->len;
+    size_t n_chunks = n / BG_PSORT_MIN_CHUNK;
+    if (n_chunks > n_threads)
+        n_chunks = n_threads;
+
+    if (n < cutoff || n_chunks < 2) {
+        if (opt.stable)
+            return BGSlice_stable_sort(s, ctx, key_fn, comparator, NULL);
+        return BGSlice_pdqsort(s, ctx, key_fn, comparator);
+    }
+
+    struct psort_job job = {
+        .n_threads = n_threads,
+        .stable = opt.stable,
+        .s = s,
+        .ctx = ctx,
+        .key_fn = key_fn,
+        .comparator = comparator,
+    };
+
+    job.scratch = bg_allocator_malloc(s->allocator, n * s->elem_size);
+    if (job.scratch == NULL)
+        return BG_ERR_ALLOC;
+
+    enum BGStatus ret = BG_OK;
+    job.pool = opt.pool;
+    if (job.pool == NULL) {
+        job.pool = BGThreadPool_new(n_threads, s->allocator);
+        if (job.pool == NULL) {
+            ret = BG_ERR_ALLOC;
+            goto free_scratch;
+        }
+    }
+
+    ret = psort_run(&job, n_chunks);
+
+    if (opt.pool == NULL)
+        BGThreadPool_free(job.pool);
+free_scratch:
+    bg_allocator_free(s->allocator, job.scratch);
+    return ret;
+}
+
+////////////////////
+// Radix sort
+//
+// LSD radix sort over order-preserving unsigned keys. All digit histograms
+// are built in a single pass, and digits where every key falls into the
+// same bucket are skipped, so e.g. small values in a 64-bit key only pay for
+// the low digits. 32-bit keys use three 11-bit digits, 64-bit keys eight
+// 8-bit digits, which keeps the histograms in L1.
+//
+
+struct radix_pair32 {
+    u32 key;
+    u32 idx;
+};
+
+struct radix_pair64 {
+    u64 key;
+    u64 idx;
+};
+
+#define RADIX_KEY_PLAIN(x) (x)
+#define RADIX_KEY_PAIR(x) ((x).key)
+
+/*
+ * Define radix_lsd_<name>(src, dst, n), which sorts n items of type T by
+ * KEY(item) using dst as scratch, and returns whichever of src and dst
+ * holds the sorted result.
+ */
+#define BG_RADIX_DEFINE(name, T, KEY, key_bits, digit_bits)                  \
+    static T *radix_lsd_##name(T *src, T *dst, size_t n)                     \
+    {                                                                        \
+        enum {                                                               \
+            DIGITS = ((key_bits) + (digit_bits) - 1) / (digit_bits),         \
+            BUCKETS = 1 << (digit_bits),                                     \
+        };                                                                   \
+        const u64 mask = BUCKETS - 1;                                        \
+        size_t hist[DIGITS][BUCKETS];                                        \
+        memset(hist, 0, sizeof(hist));                                       \
+                                                                             \
+        for (size_t i = 0; i < n; i++) {                                     \
+            u64 k = KEY(src[i]);                                             \
+            for (int d = 0; d < DIGITS; d++)                                 \
+                hist[d][(k >> (d * (digit_bits))) & mask]++;                 \
+        }                                                                    \
+                                                                             \
+        for (int d = 0; d < DIGITS; d++) {                                   \
+            size_t *h = hist[d];                                             \
+            int shift = d * (digit_bits);                                    \
+            if (h[(KEY(src[0]) >> shift) & mask] == n)                       \
+                continue;                                                    \
+                                                                             \
+            size_t sum = 0;                                                  \
+            for (size_t b = 0; b < BUCKETS; b++) {                           \
+                size_t count = h[b];                                         \
+                h[b] = sum;                                                  \
+                sum += count;                                                \
+            }                                                                \
+            for (size_t i = 0; i < n; i++) {                                 \
+                T item = src[i];                                             \
+                dst[h[(KEY(item) >> shift) & mask]++] = item;                \
+            }                                                                \
+            bg_swap(T *, src, dst);                                          \
+        }                                                                    \
+        return src;                                                          \
+    }
+
+BG_RADIX_DEFINE(u32, u32, RADIX_KEY_PLAIN, 32, 11)
+BG_RADIX_DEFINE(u64, u64, RADIX_KEY_PLAIN, 64, 8)
+BG_RADIX_DEFINE(pair32, struct radix_pair32, RADIX_KEY_PAIR, 32, 11)
+BG_RADIX_DEFINE(pair64, struct radix_pair64, RADIX_KEY_PAIR, 64, 8)
+
+#define RADIX_SIGN32 ((u32) 1 << 31)
+#define RADIX_SIGN64 ((u64) 1 << 63)
+
+static inline u32
+radix_encode32(u32 k, enum BGRadixKey key_type)
+{
+    switch (key_type) {
+    case BG_RADIX_KEY_I32:
+        return k ^ RADIX_SIGN32;
+    case BG_RADIX_KEY_F32:
+        return (k & RADIX_SIGN32) ? ~k : k ^ RADIX_SIGN32;
+    default:
+        return k;
+    }
+}
+
+static inline u32
+radix_decode32(u32 k, enum BGRadixKey key_type)
+{
+    switch (key_type) {
+    case BG_RADIX_KEY_I32:
+        return k ^ RADIX_SIGN32;
+    case BG_RADIX_KEY_F32:
+        return (k & RADIX_SIGN32) ? k ^ RADIX_SIGN32 : ~k;
+    default:
+        return k;
+    }
+}
+
+static inline u64
+radix_encode64(u64 k, enum BGRadixKey key_type)
+{
+    switch (key_type) {
+    case BG_RADIX_KEY_I64:
+        return k ^ RADIX_SIGN64;
+    case BG_RADIX_KEY_F64:
+        return (k & RADIX_SIGN64) ? ~k : k ^ RADIX_SIGN64;
+    default:
+        return k;
+    }
+}
+
+static inline u64
+radix_decode64(u64 k, enum BGRadixKey key_type)
+{
+    switch (key_type) {
+    case BG_RADIX_KEY_I64:
+        return k ^ RADIX_SIGN64;
+    case BG_RADIX_KEY_F64:
+        return (k & RADIX_SIGN64) ? k ^ RADIX_SIGN64 : ~k;
+    default:
+        return k;
+    }
+}
+
+static inline bool
+radix_key_is_wide(enum BGRadixKey key_type)
+{
+    return key_type == BG_RADIX_KEY_U64 || key_type == BG_RADIX_KEY_I64
+           || key_type == BG_RADIX_KEY_F64;
+}
+
+// The items are the keys: encode in place, sort, decode back.
+static enum BGStatus
+radix_sort_plain(BGSlice_s *s, enum BGRadixKey key_type)
+{
+    size_t n = s->len;
+    void *tmp = bg_allocator_malloc(s->allocator, n * s->elem_size);
+    if (tmp == NULL)
+        return BG_ERR_ALLOC;
+
+    if (radix_key_is_wide(key_type)) {
+        u64 *keys = s->buf;
+        for (size_t i = 0; i < n; i++)
+            keys[i] = radix_encode64(keys[i], key_type);
+        u64 *sorted = radix_lsd_u64(keys, tmp, n);
+        for (size_t i = 0; i < n; i++)
+            keys[i] = radix_decode64(sorted[i], key_type);
+    } else {
+        u32 *keys = s->buf;
+        for (size_t i = 0; i < n; i++)
+            keys[i] = radix_encode32(keys[i], key_type);
+        u32 *sorted = radix_lsd_u32(keys, tmp, n);
+        for (size_t i = 0; i < n; i++)
+            keys[i] = radix_decode32(sorted[i], key_type);
+    }
+
+    bg_allocator_free(s->allocator, tmp);
+    return BG_OK;
+}
+
+static inline void *
+radix_key_ptr(BGSlice_s *s, BGSlice_sort_key_fn key_fn, size_t i)
+{
+    char *item = (char *) s->buf + i * s->elem_size;
+    return key_fn == NULL ? (comparable) item : key_fn(item, i);
+}
+
+/*
+ * Sort (key, index) pairs, then gather the items into scratch in sorted
+ * order and copy them back. Each item is moved twice regardless of how many
+ * digit passes run, which matters for wide records.
+ */
+static enum BGStatus
+radix_sort_records(BGSlice_s *s, BGSlice_sort_key_fn key_fn,
+                   enum BGRadixKey key_type)
+{
+    size_t n = s->len;
+    size_t es = s->elem_size;
+    bool narrow_pairs = !radix_key_is_wide(key_type) && n <= UINT32_MAX;
+    size_t pair_size = narrow_pairs ? sizeof(struct radix_pair32)
+                                    : sizeof(struct radix_pair64);
+
+    void *pairs = bg_allocator_malloc(s->allocator, 2 * n * pair_size);
+    if (pairs == NULL)
+        return BG_ERR_ALLOC;
+    char *records = bg_allocator_malloc(s->allocator, n * es);
+    if (records == NULL) {
+        bg_allocator_free(s->allocator, pairs);
+        return BG_ERR_ALLOC;
+    }
+
+    char *buf = s->buf;
+    if (narrow_pairs) {
+        struct radix_pair32 *p = pairs;
+        for (size_t i = 0; i < n; i++) {
+            u32 k;
+            memcpy(&k, radix_key_ptr(s, key_fn, i), sizeof(k));
+            p[i] = (struct radix_pair32) { radix_encode32(k, key_type),
+                                           (u32) i };
+        }
+        struct radix_pair32 *sorted = radix_lsd_pair32(p, p + n, n);
+        for (size_t i = 0; i < n; i++)
+            memcpy(records + i * es, buf + sorted[i].idx * es, es);
+    } else {
+        struct radix_pair64 *p = pairs;
+        for (size_t i = 0; i < n; i++) {
+            u64 k;
+            if (radix_key_is_wide(key_type)) {
+                memcpy(&k, radix_key_ptr(s, key_fn, i), sizeof(k));
+                k = radix_encode64(k, key_type);
+            } else {
+                u32 k32;
+                memcpy(&k32, radix_key_ptr(s, key_fn, i), sizeof(k32));
+                k = radix_encode32(k32, key_type);
+            }
+            p[i] = (struct radix_pair64) { k, i };
+        }
+        struct radix_pair64 *sorted = radix_lsd_pair64(p, p + n, n);
+        for (size_t i = 0; i < n; i++)
+            memcpy(records + i * es, buf + sorted[i].idx * es, es);
+    }
+    memcpy(buf, records, n * es);
+
+    bg_allocator_free(s->allocator, records);
+    bg_allocator_free(s->allocator, pairs);
+    return BG_OK;
+}
+
+enum BGStatus
+BGSlice_radix_sort(BGSlice_s *s, BGSlice_sort_key_fn key_fn,
+                   enum BGRadixKey key_type)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+    assert_sort(key_fn != NULL
+                    || s->elem_size >= (radix_key_is_wide(key_type) ? 8 : 4),
+                "item of size %zu is too small to hold the radix key",
+                s->elem_size);
+
+    if (s->len <= 1)
+        return BG_OK;
+
+    size_t key_size = radix_key_is_wide(key_type) ? 8 : 4;
+    if (key_fn == NULL && s->elem_size == key_size)
+        return radix_sort_plain(s, key_type);
+    return radix_sort_records(s, key_fn, key_type);
+}
+
+bool
+BGSlice_is_sorted(BGSlice_s *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                  BGSlice_sort_comparator comparator)
+{
+    assert_sort(s != NULL, "slice cannot be NULL");
+
+    // Comparing never needs the temporary, so skip bg_sort_ctx_init.
+    struct bg_sort_ctx c = {
+        .base = s->buf,
+        .elem_size = s->elem_size,
+        .s = s,
+        .ctx = ctx,
+        .key_fn = key_fn,
+        .comparator = comparator == NULL ? BGSlice_default_comparator_asc
+                                         : comparator,
+    };
+
+    for (size_t i = 1; i < s->len; i++) {
+        if (sort_less_idx(&c, i, i - 1))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,210 @@
+#ifndef BG_SORT_H
+#define BG_SORT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "bg_slice.h"
+#include "bg_types.h"
+#include "mem/bg_allocator.h"
+#include "threading/bg_threading.h"
+
+/*
+ * Sorting engines over BGSlice.
+ *
+ * Every sort takes the same (ctx, key_fn, comparator) triple as
+ * BGSlice_qsort: key_fn maps an item to the comparable passed to the
+ * comparator (NULL means the item itself), and comparator defaults to
+ * BGSlice_default_comparator_asc when NULL. ctx is handed to the comparator
+ * untouched.
+ */
+
+// Pattern-defeating quicksort: introsort with median-of-3/ninther pivots,
+// insertion sort on small ranges, heapsort fallback when partitions keep
+// coming out unbalanced, and O(n) handling of already sorted input. Not
+// stable. This is what BGSlice_qsort uses.
+enum BGStatus BGSlice_pdqsort(BGSlice *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                              BGSlice_sort_comparator comparator);
+
+// Shifting insertion sort. Stable, O(n^2); only meant for short slices.
+enum BGStatus BGSlice_insertion_sort(BGSlice *s, void *ctx,
+                                     BGSlice_sort_key_fn key_fn,
+                                     BGSlice_sort_comparator comparator);
+
+// In-place heapsort. Not stable, O(n log n) worst case.
+enum BGStatus BGSlice_heapsort(BGSlice *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                               BGSlice_sort_comparator comparator);
+
+/*
+ * Stable sort: timsort. Finds ascending and strictly descending runs already
+ * present in the data, extends short ones with insertion sort and merges
+ * them with galloping, so sorted, reversed and append-mostly input (a sorted
+ * prefix plus a few new items) sorts in close to linear time. Scratch for up
+ * to n / 2 elements comes from the scratch allocator (the slice's allocator
+ * when NULL) and is only requested once two runs actually need merging.
+ */
+enum BGStatus BGSlice_stable_sort(BGSlice *s, void *ctx,
+                                  BGSlice_sort_key_fn key_fn,
+                                  BGSlice_sort_comparator comparator,
+                                  struct Allocator *scratch);
+
+/*
+ * Sort by a key that is expensive to compute. key_fn (required) is called
+ * exactly once per item and must return a pointer to key_size bytes, which
+ * are copied out. The (key, index) pairs are sorted, then the items are
+ * moved into place by following the permutation's cycles, so each item is
+ * copied once no matter how large elem_size is. The comparator is called
+ * with a view whose elem_size is key_size; NULL compares the key bytes with
+ * memcmp. Stable. Needs n * (key_size + 8) bytes, rounded up, of scratch
+ * from the slice's allocator.
+ */
+enum BGStatus BGSlice_sort_by_cached_key(BGSlice *s, void *ctx,
+                                         BGSlice_sort_key_fn key_fn,
+                                         size_t key_size,
+                                         BGSlice_sort_comparator comparator);
+
+/*
+ * Reorder the slice so that the item at nth is the one a full sort would put
+ * there, no item before it compares greater and no item after it compares
+ * smaller. Introselect: O(n) on average, with a median-of-medians fallback
+ * that keeps the worst case O(n) too. Not stable.
+ */
+enum BGStatus BGSlice_nth_element(BGSlice *s, size_t nth, void *ctx,
+                                  BGSlice_sort_key_fn key_fn,
+                                  BGSlice_sort_comparator comparator);
+
+/*
+ * Sort only the first k items: afterwards [0, k) holds the k smallest in
+ * order and the rest in no particular order. O(n + k log k). k larger than
+ * the length sorts the whole slice.
+ */
+enum BGStatus BGSlice_partial_sort(BGSlice *s, size_t k, void *ctx,
+                                   BGSlice_sort_key_fn key_fn,
+                                   BGSlice_sort_comparator comparator);
+
+/*
+ * Streaming top-k: keeps the k items that come first in comparator order
+ * (pass a descending comparator for the k largest) out of everything pushed,
+ * in O(k) memory. Rejecting an item costs one comparison, keeping it
+ * O(log k). key_fn sees the item's position in the stream as its index.
+ */
+typedef struct BGTopK BGTopK;
+
+BGTopK *BGTopK_new(size_t k, size_t elem_size, void *ctx,
+                   BGSlice_sort_key_fn key_fn,
+                   BGSlice_sort_comparator comparator,
+                   struct BGSliceOption *option);
+// Returns whether the item was kept. The item is copied.
+bool BGTopK_push(BGTopK *t, void *item);
+// Push every item of s. Returns how many were kept at the time.
+size_t BGTopK_push_slice(BGTopK *t, BGSlice *s);
+size_t BGTopK_len(BGTopK *t);
+// The worst item kept, which a new item has to beat; NULL until k items
+// have been pushed.
+void *BGTopK_threshold(BGTopK *t);
+// The kept items as a new slice, in comparator order.
+BGSlice *BGTopK_to_slice(BGTopK *t, struct BGSliceOption *option);
+void BGTopK_free(BGTopK *t);
+
+enum BGPrimType {
+    BG_PRIM_I32,
+    BG_PRIM_U32,
+    BG_PRIM_I64,
+    BG_PRIM_U64,
+    BG_PRIM_F32,
+    BG_PRIM_F64,
+};
+
+/*
+ * pdqsort specialised for slices of a primitive type: elements are compared
+ * with `<` directly and short ranges are sorted with SIMD sorting networks
+ * (see bg_sortnet.h). The slice's elem_size must match the type. Floating
+ * point slices must not contain NaN.
+ */
+enum BGStatus BGSlice_sort_primitive(BGSlice *s, enum BGPrimType type,
+                                     bool descending);
+
+/*
+ * Comparators for primitive element types. Passing one of these to
+ * BGSlice_qsort or BGSlice_pdqsort without a key_fn takes the
+ * BGSlice_sort_primitive path.
+ */
+ssize_t BGSlice_comparator_i32_asc(BGSlice *s, comparable a, comparable b,
+                                   void *ctx);
+ssize_t BGSlice_comparator_i32_desc(BGSlice *s, comparable a, comparable b,
+                                    void *ctx);
+ssize_t BGSlice_comparator_u32_asc(BGSlice *s, comparable a, comparable b,
+                                   void *ctx);
+ssize_t BGSlice_comparator_u32_desc(BGSlice *s, comparable a, comparable b,
+                                    void *ctx);
+ssize_t BGSlice_comparator_i64_asc(BGSlice *s, comparable a, comparable b,
+                                   void *ctx);
+ssize_t BGSlice_comparator_i64_desc(BGSlice *s, comparable a, comparable b,
+                                    void *ctx);
+ssize_t BGSlice_comparator_u64_asc(BGSlice *s, comparable a, comparable b,
+                                   void *ctx);
+ssize_t BGSlice_comparator_u64_desc(BGSlice *s, comparable a, comparable b,
+                                    void *ctx);
+ssize_t BGSlice_comparator_f32_asc(BGSlice *s, comparable a, comparable b,
+                                   void *ctx);
+ssize_t BGSlice_comparator_f32_desc(BGSlice *s, comparable a, comparable b,
+                                    void *ctx);
+ssize_t BGSlice_comparator_f64_asc(BGSlice *s, comparable a, comparable b,
+                                   void *ctx);
+ssize_t BGSlice_comparator_f64_desc(BGSlice *s, comparable a, comparable b,
+                                    void *ctx);
+
+struct BGParallelSortOption {
+    // Worker count; 0 means one per online CPU. Ignored when pool is set.
+    size_t n_threads;
+    // Slices shorter than this are sorted on the calling thread. 0 picks a
+    // default of 64K elements.
+    size_t sequential_cutoff;
+    // Keep equal elements in their original order.
+    bool stable;
+    // Reuse an existing pool instead of starting threads for this call.
+    BGThreadPool *pool;
+};
+
+/*
+ * Multi-threaded sort: the slice is cut into one chunk per thread, chunks
+ * are sorted concurrently (pdqsort, or timsort when stable), then merged
+ * pairwise with each merge split across the workers. The result does not
+ * depend on thread scheduling. Needs one slice worth of scratch from the
+ * slice's allocator. option may be NULL.
+ */
+enum BGStatus BGSlice_parallel_sort(BGSlice *s, void *ctx,
+                                    BGSlice_sort_key_fn key_fn,
+                                    BGSlice_sort_comparator comparator,
+                                    struct BGParallelSortOption *option);
+
+/*
+ * Key types understood by BGSlice_radix_sort. Signed and floating point keys
+ * are bit-flipped into an order-preserving unsigned form before sorting.
+ * Floats order as -inf < ... < -0.0 < +0.0 < ... < +inf; NaNs sort to the
+ * ends according to their sign bit.
+ */
+enum BGRadixKey {
+    BG_RADIX_KEY_U32,
+    BG_RADIX_KEY_I32,
+    BG_RADIX_KEY_F32,
+    BG_RADIX_KEY_U64,
+    BG_RADIX_KEY_I64,
+    BG_RADIX_KEY_F64,
+};
+
+/*
+ * Stable LSD radix sort, ascending. key_fn must return a pointer to the
+ * item's key of the given type (it need not be aligned); NULL means the key
+ * is at the start of the item. Items of any elem_size are supported. Scratch
+ * memory comes from the slice's allocator: n keys when the items are the
+ * keys themselves, otherwise n (key, index) pairs twice plus one copy of the
+ * items.
+ */
+enum BGStatus BGSlice_radix_sort(BGSlice *s, BGSlice_sort_key_fn key_fn,
+                                 enum BGRadixKey key_type);
+
+bool BGSlice_is_sorted(BGSlice *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                       BGSlice_sort_comparator comparator);
+
+#endif // BG_SORT_H
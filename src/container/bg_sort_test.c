@@ -0,0 +1,934 @@
+#include "bg_sort.h"
+#include "bg_slice.h"
+#include "bg_sortnet.h"
+#include "unity.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "bg_common.h"
+#include "bg_testutils.h"
+#include "bg_types.h"
+
+void
+setUp(void)
+{
+    // Called before each test
+}
+
+void
+tearDown(void)
+{
+    // Called after each test
+}
+
+///////////////////////
+// Helpers
+//
+
+static ssize_t
+int_comparator(BGSlice *s, comparable a, comparable b, void *ctx)
+{
+    int x = *(int *) a;
+    int y = *(int *) b;
+    return (x > y) - (x < y);
+}
+
+static int
+libc_int_comparator(const void *a, const void *b)
+{
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+enum pattern {
+    PATTERN_RANDOM,
+    PATTERN_SORTED,
+    PATTERN_REVERSED,
+    PATTERN_EQUAL,
+    PATTERN_FEW_UNIQUE,
+    PATTERN_ORGAN_PIPE,
+    PATTERN_SAWTOOTH,
+    PATTERN_COUNT,
+};
+
+static void
+fill_pattern(int *data, size_t n, enum pattern pattern, unsigned seed)
+{
+    srand(seed);
+    for (size_t i = 0; i < n; i++) {
+        switch (pattern) {
+        case PATTERN_RANDOM:
+            data[i] = rand() - RAND_MAX / 2;
+            break;
+        case PATTERN_SORTED:
+            data[i] = (int) i;
+            break;
+        case PATTERN_REVERSED:
+            data[i] = (int) (n - i);
+            break;
+        case PATTERN_EQUAL:
+            data[i] = 7;
+            break;
+        case PATTERN_FEW_UNIQUE:
+            data[i] = rand() % 4;
+            break;
+        case PATTERN_ORGAN_PIPE:
+            data[i] = (int) (i < n / 2 ? i : n - i);
+            break;
+        case PATTERN_SAWTOOTH:
+            data[i] = (int) (i % 17);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+typedef enum BGStatus (*sort_fn)(BGSlice *s, void *ctx,
+                                 BGSlice_sort_key_fn key_fn,
+                                 BGSlice_sort_comparator comparator);
+
+// Sort every pattern at a few sizes and compare against libc qsort.
+static void
+check_sort_fn(sort_fn sort, size_t max_n)
+{
+    static const size_t sizes[] = { 0,  1,   2,    3,    7,     23,
+                                    24, 129, 1000, 4096, 100000 };
+
+    for (size_t si = 0; si < bg_arr_length(sizes); si++) {
+        size_t n = sizes[si];
+        if (n > max_n)
+            continue;
+        for (int p = 0; p < PATTERN_COUNT; p++) {
+            int *data = malloc((n + 1) * sizeof(int));
+            int *expected = malloc((n + 1) * sizeof(int));
+            fill_pattern(data, n, p, (unsigned) (n * 31 + p));
+            memcpy(expected, data, n * sizeof(int));
+            qsort(expected, n, sizeof(int), libc_int_comparator);
+
+            BGSlice *s = BGSlice_new_copy_from_buf(data, n, n, n, NULL);
+            TEST_ASSERT_NOT_NULL(s);
+            TEST_ASSERT_EQUAL(BG_OK, sort(s, NULL, NULL, int_comparator));
+            TEST_ASSERT_EQUAL_MEMORY(expected, BGSlice_get_data_ptr(s),
+                                     n * sizeof(int));
+
+            BGSlice_free(s);
+            free(data);
+            free(expected);
+        }
+    }
+}
+
+///////////////////////
+// Tests
+//
+
+void
+test_BGSlice_pdqsort(void)
+{
+    check_sort_fn(BGSlice_pdqsort, SIZE_MAX);
+}
+
+void
+test_BGSlice_heapsort(void)
+{
+    check_sort_fn(BGSlice_heapsort, SIZE_MAX);
+}
+
+void
+test_BGSlice_insertion_sort(void)
+{
+    check_sort_fn(BGSlice_insertion_sort, 4096);
+}
+
+void
+test_BGSlice_qsort_desc(void)
+{
+    u8 data[] = { 5, 1, 4, 1, 6, 7, 9, 2, 3, 5, 200, 0, 13, 8, 8, 42,
+                  5, 1, 4, 1, 6, 7, 9, 2, 3, 5, 200, 0, 13, 8, 8, 42 };
+    BGSlice *s = BGSlice_new_copy_all_from_array(data, bg_arr_length(data),
+                                                 BG_AUTO, NULL);
+    TEST_ASSERT_NOT_NULL(s);
+
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_qsort(s, NULL, NULL,
+                                           BGSlice_default_comparator_desc));
+    TEST_ASSERT_TRUE(
+        BGSlice_is_sorted(s, NULL, NULL, BGSlice_default_comparator_desc));
+    TEST_ASSERT_EQUAL(200, *(u8 *) BGSlice_get(s, 0));
+    TEST_ASSERT_EQUAL(0, *(u8 *) BGSlice_get_last(s));
+
+    BGSlice_free(s);
+}
+
+struct record {
+    char name[24];
+    int priority;
+    int payload[8];
+};
+
+static comparable
+record_key(void *item, size_t idx)
+{
+    return (comparable) &((struct record *) item)->priority;
+}
+
+void
+test_BGSlice_pdqsort_key_fn(void)
+{
+    size_t n = 5000;
+    BGSlice *s = BGSlice_new(struct record, 0, n, NULL);
+    TEST_ASSERT_NOT_NULL(s);
+
+    srand(1);
+    for (size_t i = 0; i < n; i++) {
+        struct record r = { .priority = rand() % 1000 };
+        for (int j = 0; j < 8; j++)
+            r.payload[j] = r.priority * j;
+        snprintf(r.name, sizeof(r.name), "r%d", r.priority);
+        BGSlice_append(s, &r);
+    }
+
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_qsort(s, NULL, record_key,
+                                           int_comparator));
+    TEST_ASSERT_TRUE(BGSlice_is_sorted(s, NULL, record_key, int_comparator));
+
+    // Records must have moved as a whole.
+    for (size_t i = 0; i < n; i++) {
+        struct record *r = BGSlice_get(s, i);
+        char name[24];
+        snprintf(name, sizeof(name), "r%d", r->priority);
+        TEST_ASSERT_EQUAL(0, strcmp(name, r->name));
+        TEST_ASSERT_EQUAL(r->priority * 7, r->payload[7]);
+    }
+
+    BGSlice_free(s);
+}
+
+static comparable
+int_identity_key(void *item, size_t idx)
+{
+    return (comparable) item;
+}
+
+static size_t lower_name_calls;
+
+// A computed key: the record name lowercased. The buffer only has to live
+// until the sort copies it out.
+static comparable
+record_lower_name_key(void *item, size_t idx)
+{
+    static char key[24];
+    struct record *r = item;
+    lower_name_calls++;
+    for (size_t i = 0; i < sizeof(key); i++)
+        key[i] = (char) tolower((unsigned char) r->name[i]);
+    return (comparable) key;
+}
+
+static ssize_t
+name_comparator(BGSlice *s, comparable a, comparable b, void *ctx)
+{
+    return strncmp((char *) a, (char *) b, s->elem_size);
+}
+
+void
+test_BGSlice_sort_by_cached_key(void)
+{
+    size_t n = 20000;
+    BGSlice *s = BGSlice_new(struct record, 0, n, NULL);
+    TEST_ASSERT_NOT_NULL(s);
+
+    srand(2);
+    for (size_t i = 0; i < n; i++) {
+        // priority holds the insertion order to check stability.
+        struct record r = { .priority = (int) i };
+        int v = rand() % 500;
+        snprintf(r.name, sizeof(r.name), i % 2 ? "Item%03d" : "iTEM%03d", v);
+        for (int j = 0; j < 8; j++)
+            r.payload[j] = (int) i * j;
+        BGSlice_append(s, &r);
+    }
+
+    lower_name_calls = 0;
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_sort_by_cached_key(
+                                 s, NULL, record_lower_name_key, 24,
+                                 name_comparator));
+    TEST_ASSERT_EQUAL(n, lower_name_calls);
+
+    for (size_t i = 1; i < n; i++) {
+        struct record *prev = BGSlice_get(s, i - 1);
+        struct record *cur = BGSlice_get(s, i);
+        int order = strcasecmp(prev->name, cur->name);
+        TEST_ASSERT_TRUE(order <= 0);
+        if (order == 0)
+            TEST_ASSERT_TRUE(prev->priority < cur->priority);
+        TEST_ASSERT_EQUAL(cur->priority * 7, cur->payload[7]);
+    }
+
+    // Reversed input.
+    BGSlice *ints = BGSlice_new(int, 0, 100, NULL);
+    for (int i = 100; i > 0; i--)
+        BGSlice_append(ints, &i);
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_sort_by_cached_key(
+                                 ints, NULL, int_identity_key, sizeof(int),
+                                 int_comparator));
+    for (int i = 0; i < 100; i++)
+        TEST_ASSERT_EQUAL(i + 1, *(int *) BGSlice_get(ints, i));
+
+    BGSlice_free(ints);
+    BGSlice_free(s);
+}
+
+///////////////////////
+// Selection
+//
+
+void
+test_BGSlice_nth_element(void)
+{
+    static const size_t sizes[] = { 1, 2, 23, 24, 100, 1000, 50000 };
+
+    for (size_t si = 0; si < bg_arr_length(sizes); si++) {
+        size_t n = sizes[si];
+        int *expected = malloc(n * sizeof(int));
+        for (int p = 0; p < PATTERN_COUNT; p++) {
+            BGSlice *s = BGSlice_new(int, n, n, NULL);
+            int *data = BGSlice_get_data_ptr(s);
+            fill_pattern(expected, n, p, (unsigned) (n + p));
+            qsort(expected, n, sizeof(int), libc_int_comparator);
+
+            size_t nths[] = { 0, n / 2, n - 1, n / 10 };
+            for (size_t i = 0; i < bg_arr_length(nths); i++) {
+                size_t nth = nths[i];
+                fill_pattern(data, n, p, (unsigned) (n + p));
+                TEST_ASSERT_EQUAL(BG_OK, BGSlice_nth_element(s, nth, NULL,
+                                                             NULL,
+                                                             int_comparator));
+                TEST_ASSERT_EQUAL(expected[nth], data[nth]);
+                for (size_t j = 0; j < nth; j++)
+                    TEST_ASSERT_TRUE(data[j] <= data[nth]);
+                for (size_t j = nth + 1; j < n; j++)
+                    TEST_ASSERT_TRUE(data[j] >= data[nth]);
+            }
+            BGSlice_free(s);
+        }
+        free(expected);
+    }
+}
+
+static ssize_t
+int_desc_comparator(BGSlice *s, comparable a, comparable b, void *ctx)
+{
+    return int_comparator(s, b, a, ctx);
+}
+
+// Compares by value / 4, so two thirds of the items below are equal.
+static ssize_t
+coarse_comparator(BGSlice *s, comparable a, comparable b, void *ctx)
+{
+    int x = *(int *) a / 4;
+    int y = *(int *) b / 4;
+    return (x > y) - (x < y);
+}
+
+void
+test_BGSlice_nth_element_many_equal(void)
+{
+    size_t n = 100000;
+    BGSlice *s = BGSlice_new(int, n, n, NULL);
+    int *data = BGSlice_get_data_ptr(s);
+    for (size_t i = 0; i < n; i++)
+        data[i] = (int) (i % 3 == 0 ? i : 4);
+
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_nth_element(s, n / 2, NULL, NULL,
+                                                 coarse_comparator));
+    for (size_t j = 0; j < n; j++) {
+        ssize_t order = coarse_comparator(s, (comparable) &data[j],
+                                               (comparable) &data[n / 2],
+                                               NULL);
+        TEST_ASSERT_TRUE(j < n / 2 ? order <= 0 : order >= 0);
+    }
+    BGSlice_free(s);
+}
+
+void
+test_BGSlice_partial_sort(void)
+{
+    size_t n = 100000;
+    BGSlice *s = BGSlice_new(int, n, n, NULL);
+    int *data = BGSlice_get_data_ptr(s);
+    int *expected = malloc(n * sizeof(int));
+
+    static const size_t ks[] = { 0, 1, 100, 5000, 100000, 200000 };
+    for (size_t ki = 0; ki < bg_arr_length(ks); ki++) {
+        size_t k = ks[ki] < n ? ks[ki] : n;
+        fill_pattern(data, n, PATTERN_RANDOM, 42);
+        memcpy(expected, data, n * sizeof(int));
+        qsort(expected, n, sizeof(int), libc_int_comparator);
+
+        TEST_ASSERT_EQUAL(BG_OK, BGSlice_partial_sort(s, ks[ki], NULL, NULL,
+                                                      int_comparator));
+        TEST_ASSERT_EQUAL_MEMORY(expected, data, k * sizeof(int));
+    }
+
+    free(expected);
+    BGSlice_free(s);
+}
+
+void
+test_BGTopK(void)
+{
+    size_t n = 200000;
+    size_t k = 100;
+    int *data = malloc(n * sizeof(int));
+    fill_pattern(data, n, PATTERN_RANDOM, 9);
+
+    BGTopK *top =
+        BGTopK_new(k, sizeof(int), NULL, NULL, int_desc_comparator, NULL);
+    TEST_ASSERT_NOT_NULL(top);
+    TEST_ASSERT_NULL(BGTopK_threshold(top));
+    for (size_t i = 0; i < n; i++)
+        BGTopK_push(top, &data[i]);
+    TEST_ASSERT_EQUAL(k, BGTopK_len(top));
+
+    qsort(data, n, sizeof(int), libc_int_comparator);
+    TEST_ASSERT_EQUAL(data[n - k], *(int *) BGTopK_threshold(top));
+
+    BGSlice *result = BGTopK_to_slice(top, NULL);
+    TEST_ASSERT_EQUAL(k, BGSlice_get_len(result));
+    for (size_t i = 0; i < k; i++)
+        TEST_ASSERT_EQUAL(data[n - 1 - i], *(int *) BGSlice_get(result, i));
+
+    // The heap keeps working after a snapshot.
+    int big = INT32_MAX;
+    TEST_ASSERT_TRUE(BGTopK_push(top, &big));
+    int small = INT32_MIN;
+    TEST_ASSERT_FALSE(BGTopK_push(top, &small));
+
+    BGSlice_free(result);
+    BGTopK_free(top);
+    free(data);
+}
+
+#define TOPK_STREAM_LEN 1000
+
+// Weight of the item pushed at each position of the stream.
+static int topk_weights[TOPK_STREAM_LEN];
+
+static comparable
+topk_weight_key(void *item, size_t idx)
+{
+    return (comparable) &topk_weights[idx];
+}
+
+void
+test_BGTopK_stream_index(void)
+{
+    size_t n = TOPK_STREAM_LEN;
+    size_t k = 10;
+    // A permutation of [0, n): the k heaviest weigh n - 1 down to n - k.
+    for (size_t i = 0; i < n; i++)
+        topk_weights[i] = (int) (i * 7919 % n);
+
+    BGTopK *top = BGTopK_new(k, sizeof(int), NULL, topk_weight_key,
+                             int_desc_comparator, NULL);
+    TEST_ASSERT_NOT_NULL(top);
+    // Each item is its position, which the key function is not given.
+    for (int i = 0; i < (int) n; i++)
+        BGTopK_push(top, &i);
+    TEST_ASSERT_EQUAL(k, BGTopK_len(top));
+    int *threshold = BGTopK_threshold(top);
+    TEST_ASSERT_EQUAL_INT(n - k, topk_weights[*threshold]);
+
+    BGSlice *result = BGTopK_to_slice(top, NULL);
+    TEST_ASSERT_EQUAL(k, BGSlice_get_len(result));
+    for (size_t i = 0; i < k; i++) {
+        int pos = *(int *) BGSlice_get(result, i);
+        TEST_ASSERT_EQUAL_INT(n - 1 - i, topk_weights[pos]);
+    }
+    BGSlice_free(result);
+    BGTopK_free(top);
+}
+
+///////////////////////
+// Radix sort
+//
+
+static int
+libc_float_comparator(const void *a, const void *b)
+{
+    float x = *(const float *) a;
+    float y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+static int
+libc_u64_comparator(const void *a, const void *b)
+{
+    u64 x = *(const u64 *) a;
+    u64 y = *(const u64 *) b;
+    return (x > y) - (x < y);
+}
+
+void
+test_BGSlice_radix_sort_plain(void)
+{
+    size_t n = 100000;
+
+    // i32 with negatives
+    {
+        int *expected = malloc(n * sizeof(int));
+        BGSlice *s = BGSlice_new(int, n, n, NULL);
+        fill_pattern(BGSlice_get_data_ptr(s), n, PATTERN_RANDOM, 3);
+        memcpy(expected, BGSlice_get_data_ptr(s), n * sizeof(int));
+        qsort(expected, n, sizeof(int), libc_int_comparator);
+
+        TEST_ASSERT_EQUAL(BG_OK,
+                          BGSlice_radix_sort(s, NULL, BG_RADIX_KEY_I32));
+        TEST_ASSERT_EQUAL_MEMORY(expected, BGSlice_get_data_ptr(s),
+                                 n * sizeof(int));
+        BGSlice_free(s);
+        free(expected);
+    }
+
+    // f32 with negatives and signed zeros
+    {
+        float *expected = malloc(n * sizeof(float));
+        BGSlice *s = BGSlice_new(float, n, n, NULL);
+        float *data = BGSlice_get_data_ptr(s);
+        srand(4);
+        for (size_t i = 0; i < n; i++)
+            data[i] = (float) (rand() - RAND_MAX / 2) / 1000.0f;
+        data[0] = -0.0f;
+        data[1] = 0.0f;
+        memcpy(expected, data, n * sizeof(float));
+        qsort(expected, n, sizeof(float), libc_float_comparator);
+
+        TEST_ASSERT_EQUAL(BG_OK,
+                          BGSlice_radix_sort(s, NULL, BG_RADIX_KEY_F32));
+        for (size_t i = 0; i < n; i++)
+            TEST_ASSERT_TRUE(expected[i] == data[i]);
+        BGSlice_free(s);
+        free(expected);
+    }
+
+    // u64 where only the low digits vary
+    {
+        u64 *expected = malloc(n * sizeof(u64));
+        BGSlice *s = BGSlice_new(u64, n, n, NULL);
+        u64 *data = BGSlice_get_data_ptr(s);
+        srand(5);
+        for (size_t i = 0; i < n; i++)
+            data[i] = (u64) rand() % 5000 + ((u64) 1 << 40);
+        memcpy(expected, data, n * sizeof(u64));
+        qsort(expected, n, sizeof(u64), libc_u64_comparator);
+
+        TEST_ASSERT_EQUAL(BG_OK,
+                          BGSlice_radix_sort(s, NULL, BG_RADIX_KEY_U64));
+        TEST_ASSERT_EQUAL_MEMORY(expected, data, n * sizeof(u64));
+        BGSlice_free(s);
+        free(expected);
+    }
+}
+
+struct event {
+    u32 seq;
+    i64 timestamp;
+    char tag[20];
+};
+
+static comparable
+event_timestamp_key(void *item, size_t idx)
+{
+    return (comparable) &((struct event *) item)->timestamp;
+}
+
+void
+test_BGSlice_radix_sort_records_stable(void)
+{
+    size_t n = 20000;
+    BGSlice *s = BGSlice_new(struct event, 0, n, NULL);
+
+    srand(6);
+    for (size_t i = 0; i < n; i++) {
+        struct event e = { .seq = (u32) i,
+                           .timestamp = (i64) (rand() % 100) - 50 };
+        snprintf(e.tag, sizeof(e.tag), "ev%zu", i);
+        BGSlice_append(s, &e);
+    }
+
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_radix_sort(s, event_timestamp_key,
+                                                BG_RADIX_KEY_I64));
+
+    for (size_t i = 1; i < n; i++) {
+        struct event *prev = BGSlice_get(s, i - 1);
+        struct event *cur = BGSlice_get(s, i);
+        TEST_ASSERT_TRUE(prev->timestamp <= cur->timestamp);
+        if (prev->timestamp == cur->timestamp)
+            TEST_ASSERT_TRUE(prev->seq < cur->seq);
+
+        char tag[20];
+        snprintf(tag, sizeof(tag), "ev%u", cur->seq);
+        TEST_ASSERT_EQUAL(0, strcmp(tag, cur->tag));
+    }
+
+    BGSlice_free(s);
+}
+
+///////////////////////
+// Stable sort
+//
+
+static enum BGStatus
+stable_sort_default_scratch(BGSlice *s, void *ctx, BGSlice_sort_key_fn key_fn,
+                            BGSlice_sort_comparator comparator)
+{
+    return BGSlice_stable_sort(s, ctx, key_fn, comparator, NULL);
+}
+
+void
+test_BGSlice_stable_sort(void)
+{
+    check_sort_fn(stable_sort_default_scratch, SIZE_MAX);
+}
+
+static size_t scratch_allocs;
+static size_t scratch_max_bytes;
+
+static void *
+counting_malloc(size_t size)
+{
+    scratch_allocs++;
+    if (size > scratch_max_bytes)
+        scratch_max_bytes = size;
+    return malloc(size);
+}
+
+static struct Allocator counting_allocator = {
+    .malloc = counting_malloc,
+    .calloc = calloc,
+    .realloc = realloc,
+    .aligned_alloc = aligned_alloc,
+    .free = free,
+};
+
+// Order by timestamp, then tag; seq records the original position.
+static ssize_t
+event_comparator(BGSlice *s, comparable a, comparable b, void *ctx)
+{
+    struct event *x = (struct event *) a;
+    struct event *y = (struct event *) b;
+    if (x->timestamp != y->timestamp)
+        return (x->timestamp > y->timestamp) - (x->timestamp < y->timestamp);
+    return strcmp(x->tag, y->tag);
+}
+
+void
+test_BGSlice_stable_sort_events(void)
+{
+    size_t n = 50000;
+    BGSlice *s = BGSlice_new(struct event, 0, n, NULL);
+
+    // Append-mostly: a sorted log with a few late arrivals at the end.
+    for (size_t i = 0; i < n; i++) {
+        struct event e = { .seq = (u32) i, .timestamp = (i64) (i / 3) };
+        if (i >= n - 100)
+            e.timestamp = rand() % (i64) (n / 3);
+        snprintf(e.tag, sizeof(e.tag), "%c", 'a' + (int) (i % 2));
+        BGSlice_append(s, &e);
+    }
+
+    scratch_allocs = 0;
+    scratch_max_bytes = 0;
+    TEST_ASSERT_EQUAL(BG_OK,
+                      BGSlice_stable_sort(s, NULL, NULL, event_comparator,
+                                          &counting_allocator));
+    TEST_ASSERT_EQUAL(1, scratch_allocs);
+    TEST_ASSERT_TRUE(scratch_max_bytes <= (n / 2 + 1) * sizeof(struct event));
+
+    for (size_t i = 1; i < n; i++) {
+        struct event *prev = BGSlice_get(s, i - 1);
+        struct event *cur = BGSlice_get(s, i);
+        ssize_t order = event_comparator(s, (comparable) prev,
+                                         (comparable) cur, NULL);
+        TEST_ASSERT_TRUE(order <= 0);
+        if (order == 0)
+            TEST_ASSERT_TRUE(prev->seq < cur->seq);
+    }
+
+    // Sorted input is a single run and needs no scratch.
+    scratch_allocs = 0;
+    TEST_ASSERT_EQUAL(BG_OK,
+                      BGSlice_stable_sort(s, NULL, NULL, event_comparator,
+                                          &counting_allocator));
+    TEST_ASSERT_EQUAL(0, scratch_allocs);
+
+    BGSlice_free(s);
+}
+
+///////////////////////
+// Parallel sort
+//
+
+void
+test_BGSlice_parallel_sort(void)
+{
+    static const size_t threads[] = { 1, 2, 3, 4, 7 };
+    size_t n = 300000;
+    int *expected = malloc(n * sizeof(int));
+
+    for (size_t ti = 0; ti < bg_arr_length(threads); ti++) {
+        for (int p = 0; p < PATTERN_COUNT; p++) {
+            BGSlice *s = BGSlice_new(int, n, n, NULL);
+            fill_pattern(BGSlice_get_data_ptr(s), n, p, (unsigned) p);
+            memcpy(expected, BGSlice_get_data_ptr(s), n * sizeof(int));
+            qsort(expected, n, sizeof(int), libc_int_comparator);
+
+            struct BGParallelSortOption option = {
+                .n_threads = threads[ti],
+                .sequential_cutoff = 1000,
+            };
+            TEST_ASSERT_EQUAL(BG_OK, BGSlice_parallel_sort(s, NULL, NULL,
+                                                           int_comparator,
+                                                           &option));
+            TEST_ASSERT_EQUAL_MEMORY(expected, BGSlice_get_data_ptr(s),
+                                     n * sizeof(int));
+            BGSlice_free(s);
+        }
+    }
+
+    free(expected);
+}
+
+static ssize_t
+event_timestamp_comparator(BGSlice *s, comparable a, comparable b, void *ctx)
+{
+    i64 x = *(i64 *) a;
+    i64 y = *(i64 *) b;
+    return (x > y) - (x < y);
+}
+
+void
+test_BGSlice_parallel_sort_stable(void)
+{
+    size_t n = 100000;
+    BGThreadPool *pool = BGThreadPool_new(4, NULL);
+    TEST_ASSERT_NOT_NULL(pool);
+
+    for (int round = 0; round < 3; round++) {
+        BGSlice *s = BGSlice_new(struct event, 0, n, NULL);
+        srand(7 + round);
+        for (size_t i = 0; i < n; i++) {
+            struct event e = { .seq = (u32) i, .timestamp = rand() % 64 };
+            BGSlice_append(s, &e);
+        }
+
+        struct BGParallelSortOption option = {
+            .sequential_cutoff = 1000,
+            .stable = true,
+            .pool = pool,
+        };
+        TEST_ASSERT_EQUAL(BG_OK, BGSlice_parallel_sort(
+                                     s, NULL, event_timestamp_key,
+                                     event_timestamp_comparator, &option));
+
+        for (size_t i = 1; i < n; i++) {
+            struct event *prev = BGSlice_get(s, i - 1);
+            struct event *cur = BGSlice_get(s, i);
+            TEST_ASSERT_TRUE(prev->timestamp <= cur->timestamp);
+            if (prev->timestamp == cur->timestamp)
+                TEST_ASSERT_TRUE(prev->seq < cur->seq);
+        }
+        BGSlice_free(s);
+    }
+
+    BGThreadPool_free(pool);
+}
+
+///////////////////////
+// Primitive types
+//
+
+#define CHECK_SORTNET(T, value)                                             \
+    do {                                                                    \
+        T a[BG_SORTNET_MAX];                                                \
+        T expected[BG_SORTNET_MAX];                                         \
+        for (size_t n = 0; n <= BG_SORTNET_MAX; n++) {                      \
+            for (int round = 0; round < 20; round++) {                      \
+                for (size_t i = 0; i < n; i++)                              \
+                    a[i] = (T) (value);                                     \
+                memcpy(expected, a, n * sizeof(T));                         \
+                for (size_t i = 1; i < n; i++)                              \
+                    for (size_t j = i; j > 0 && expected[j] < expected[j - 1]; \
+                         j--)                                               \
+                        bg_swap(T, expected[j], expected[j - 1]);           \
+                bg_sortnet_##T##_level(a, n, level);                        \
+                TEST_ASSERT_EQUAL_MEMORY(expected, a, n * sizeof(T));       \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+void
+test_bg_sortnet(void)
+{
+    srand(11);
+    // Every level the machine can run, from scalar up.
+    for (int level = BG_CPU_SCALAR; level <= (int) bg_cpu_level(); level++) {
+        CHECK_SORTNET(i32, rand() % 100 - 50);
+        CHECK_SORTNET(u32, rand() % 2 ? (u32) (rand() % 100)
+                           : UINT32_MAX - (u32) rand());
+        CHECK_SORTNET(i64, ((i64) rand() << 32) - ((i64) rand() << 16));
+        CHECK_SORTNET(u64, rand() % 2 ? (u64) rand() : UINT64_MAX - rand());
+        CHECK_SORTNET(f32, (rand() % 200 - 100) / 8.0f);
+        CHECK_SORTNET(f64, (rand() - RAND_MAX / 2) * 1e-3);
+    }
+}
+
+static int
+libc_f64_desc_comparator(const void *a, const void *b)
+{
+    f64 x = *(const f64 *) a;
+    f64 y = *(const f64 *) b;
+    return (x < y) - (x > y);
+}
+
+static enum BGStatus
+qsort_i32_asc(BGSlice *s, void *ctx, BGSlice_sort_key_fn key_fn,
+              BGSlice_sort_comparator comparator)
+{
+    return BGSlice_qsort(s, ctx, key_fn, BGSlice_comparator_i32_asc);
+}
+
+void
+test_BGSlice_qsort_primitive(void)
+{
+    check_sort_fn(qsort_i32_asc, SIZE_MAX);
+
+    size_t n = 50000;
+    f64 *expected = malloc(n * sizeof(f64));
+    BGSlice *s = BGSlice_new(f64, n, n, NULL);
+    f64 *data = BGSlice_get_data_ptr(s);
+    srand(3);
+    for (size_t i = 0; i < n; i++)
+        data[i] = expected[i] = (rand() % 1000) * 0.25 - 100.0;
+    qsort(expected, n, sizeof(f64), libc_f64_desc_comparator);
+
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_qsort(s, NULL, NULL,
+                                           BGSlice_comparator_f64_desc));
+    TEST_ASSERT_EQUAL_MEMORY(expected, data, n * sizeof(f64));
+    TEST_ASSERT_TRUE(
+        BGSlice_is_sorted(s, NULL, NULL, BGSlice_comparator_f64_desc));
+
+    BGSlice_free(s);
+    free(expected);
+}
+
+void
+test_BGSlice_sort_primitive(void)
+{
+    size_t n = 20000;
+    BGSlice *s = BGSlice_new(u64, n, n, NULL);
+    u64 *data = BGSlice_get_data_ptr(s);
+    srand(5);
+    for (size_t i = 0; i < n; i++)
+        data[i] = ((u64) rand() << 40) ^ (u64) rand();
+    data[0] = UINT64_MAX;
+    data[1] = 0;
+
+    TEST_ASSERT_EQUAL(BG_OK, BGSlice_sort_primitive(s, BG_PRIM_U64, false));
+    TEST_ASSERT_TRUE(
+        BGSlice_is_sorted(s, NULL, NULL, BGSlice_comparator_u64_asc));
+    TEST_ASSERT_EQUAL_UINT64(0, data[0]);
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, data[n - 1]);
+
+    bg_expect_assertion(
+        { BGSlice_sort_primitive(s, BG_PRIM_I32, false); },
+        "test_BGSlice_sort_primitive elem_size mismatch");
+
+    BGSlice_free(s);
+}
+
+typedef struct {
+    void (*test_func)(void);
+    const char *test_name;
+} test_case_t;
+
+static const test_case_t all_tests[] = {
+    { test_BGSlice_pdqsort, "test_BGSlice_pdqsort" },
+    { test_BGSlice_heapsort, "test_BGSlice_heapsort" },
+    { test_BGSlice_insertion_sort, "test_BGSlice_insertion_sort" },
+    { test_BGSlice_qsort_desc, "test_BGSlice_qsort_desc" },
+    { test_BGSlice_pdqsort_key_fn, "test_BGSlice_pdqsort_key_fn" },
+    { test_BGSlice_sort_by_cached_key, "test_BGSlice_sort_by_cached_key" },
+    { test_BGSlice_nth_element, "test_BGSlice_nth_element" },
+    { test_BGSlice_nth_element_many_equal,
+      "test_BGSlice_nth_element_many_equal" },
+    { test_BGSlice_partial_sort, "test_BGSlice_partial_sort" },
+    { test_BGTopK, "test_BGTopK" },
+    { test_BGTopK_stream_index, "test_BGTopK_stream_index" },
+    { test_BGSlice_radix_sort_plain, "test_BGSlice_radix_sort_plain" },
+    { test_BGSlice_radix_sort_records_stable,
+      "test_BGSlice_radix_sort_records_stable" },
+    { test_BGSlice_stable_sort, "test_BGSlice_stable_sort" },
+    { test_BGSlice_stable_sort_events, "test_BGSlice_stable_sort_events" },
+    { test_BGSlice_parallel_sort, "test_BGSlice_parallel_sort" },
+    { test_BGSlice_parallel_sort_stable,
+      "test_BGSlice_parallel_sort_stable" },
+    { test_bg_sortnet, "test_bg_sortnet" },
+    { test_BGSlice_qsort_primitive, "test_BGSlice_qsort_primitive" },
+    { test_BGSlice_sort_primitive, "test_BGSlice_sort_primitive" },
+};
+
+#define NUM_TESTS (sizeof(all_tests) / sizeof(all_tests[0]))
+
+void
+run_all_tests(void)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        UnityDefaultTestRun(all_tests[i].test_func, all_tests[i].test_name,
+                            __LINE__);
+    }
+}
+
+void
+run_single_test(const char *test_name)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        if (strcmp(all_tests[i].test_name, test_name) == 0) {
+            UnityDefaultTestRun(all_tests[i].test_func,
+                                all_tests[i].test_name, __LINE__);
+            return;
+        }
+    }
+    printf("Test '%s' not found!\n", test_name);
+}
+
+void
+list_all_tests(void)
+{
+    printf("Available tests (%zu total):\n", NUM_TESTS);
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        printf("  [%2zu] %s\n", i, all_tests[i].test_name);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc == 1) {
+        run_all_tests();
+    } else if (argc == 2) {
+        if (strcmp(argv[1], "--list") == 0)
+            list_all_tests();
+        else
+            run_single_test(argv[1]);
+    } else {
+        printf("Usage: %s [test_name|--list]\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,591 @@
+#include "bg_sortnet.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_cpu.h"
+#include "bg_types.h"
+
+/*
+ * All variants run the same bitonic network over a padded block of N
+ * elements (N a power of two):
+ *
+ *     for (k = 2; k <= N; k *= 2)
+ *         for (j = k / 2; j > 0; j /= 2)
+ *             for each i with partner l = i ^ j > i:
+ *                 put min(a[i], a[l]) first if (i & k) == 0, else last
+ *
+ * With W lanes per register, stages with j >= W compare whole registers
+ * against each other, and stages with j < W compare a register against a
+ * lane permutation of itself and blend the lanes back by a mask derived
+ * from bits j and k of each lane's index.
+ */
+
+#define assert_sortnet(condition, fmt, ...) \
+    bg_assert("BGSortnet", condition, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+////////////////////
+// Scalar
+//
+
+#define BG_SORTNET_SCALAR_DEFINE(T)                                      \
+    static void sortnet_scalar_##T(T *a, size_t N)                       \
+    {                                                                    \
+        for (size_t k = 2; k <= N; k <<= 1) {                            \
+            for (size_t j = k >> 1; j > 0; j >>= 1) {                    \
+                for (size_t i = 0; i < N; i++) {                         \
+                    size_t l = i ^ j;                                    \
+                    if (l < i)                                           \
+                        continue;                                        \
+                    T x = a[i];                                          \
+                    T y = a[l];                                          \
+                    T lo = y < x ? y : x;                                \
+                    T hi = y < x ? x : y;                                \
+                    bool asc = (i & k) == 0;                             \
+                    a[i] = asc ? lo : hi;                                \
+                    a[l] = asc ? hi : lo;                                \
+                }                                                        \
+            }                                                            \
+        }                                                                \
+    }
+
+BG_SORTNET_SCALAR_DEFINE(i32)
+BG_SORTNET_SCALAR_DEFINE(u32)
+BG_SORTNET_SCALAR_DEFINE(i64)
+BG_SORTNET_SCALAR_DEFINE(u64)
+BG_SORTNET_SCALAR_DEFINE(f32)
+BG_SORTNET_SCALAR_DEFINE(f64)
+
+#if BG_CPU_X86
+
+/*
+ * Define sortnet_<isa>_<T>(a, N) from the per-type register operations
+ * <isa>_<T>_{load,store,min,max,perm,select}. The network body is force
+ * inlined once per block size so the loops fully unroll and the block stays
+ * in registers.
+ */
+#    define BG_SORTNET_SIMD_DEFINE(isa, T, V, W, target)                      \
+        static inline __attribute__((always_inline)) BG_TARGET(target) void \
+            sortnet_##isa##_##T##_n(T *a, size_t N)                          \
+        {                                                                    \
+            for (size_t k = 2; k <= N; k <<= 1) {                            \
+                for (size_t j = k >> 1; j > 0; j >>= 1) {                    \
+                    for (size_t v = 0; v < N; v += (W)) {                    \
+                        if (j >= (W)) {                                      \
+                            if (v & j)                                       \
+                                continue;                                    \
+                            V x = isa##_##T##_load(a + v);                   \
+                            V y = isa##_##T##_load(a + v + j);               \
+                            V mn = isa##_##T##_min(x, y);                    \
+                            V mx = isa##_##T##_max(x, y);                    \
+                            bool asc = (v & k) == 0;                         \
+                            isa##_##T##_store(a + v, asc ? mn : mx);         \
+                            isa##_##T##_store(a + v + j, asc ? mx : mn);     \
+                        } else {                                             \
+                            V x = isa##_##T##_load(a + v);                   \
+                            V p = isa##_##T##_perm(x, j);                    \
+                            isa##_##T##_store(                               \
+                                a + v,                                       \
+                                isa##_##T##_select(isa##_##T##_min(x, p),    \
+                                                   isa##_##T##_max(x, p), v, \
+                                                   j, k));                   \
+                        }                                                    \
+                    }                                                        \
+                }                                                            \
+            }                                                                \
+        }                                                                    \
+                                                                             \
+        static BG_TARGET(target) void sortnet_##isa##_##T(T *a, size_t N)    \
+        {                                                                    \
+            switch (N) {                                                     \
+            case 4:                                                          \
+                sortnet_##isa##_##T##_n(a, 4);                               \
+                break;                                                       \
+            case 8:                                                          \
+                sortnet_##isa##_##T##_n(a, 8);                               \
+                break;                                                       \
+            case 16:                                                         \
+                sortnet_##isa##_##T##_n(a, 16);                              \
+                break;                                                       \
+            default:                                                         \
+                sortnet_##isa##_##T##_n(a, 32);                              \
+                break;                                                       \
+            }                                                                \
+        }
+
+////////////////////
+// AVX2: 8 x 32-bit or 4 x 64-bit lanes
+//
+
+#    define AVX2 BG_TARGET("avx2")
+
+// Lanes that take the max in a (j, k) stage: bit j xor bit k of the index.
+static inline AVX2 __m256i
+avx2_mask32(size_t v, size_t j, size_t k)
+{
+    __m256i idx = _mm256_add_epi32(_mm256_set1_epi32((int) v),
+                                   _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i zero = _mm256_setzero_si256();
+    __m256i bj = _mm256_cmpeq_epi32(
+        _mm256_and_si256(idx, _mm256_set1_epi32((int) j)), zero);
+    __m256i bk = _mm256_cmpeq_epi32(
+        _mm256_and_si256(idx, _mm256_set1_epi32((int) k)), zero);
+    return _mm256_xor_si256(bj, bk);
+}
+
+static inline AVX2 __m256i
+avx2_mask64(size_t v, size_t j, size_t k)
+{
+    __m256i idx = _mm256_add_epi64(_mm256_set1_epi64x((long long) v),
+                                   _mm256_setr_epi64x(0, 1, 2, 3));
+    __m256i zero = _mm256_setzero_si256();
+    __m256i bj = _mm256_cmpeq_epi64(
+        _mm256_and_si256(idx, _mm256_set1_epi64x((long long) j)), zero);
+    __m256i bk = _mm256_cmpeq_epi64(
+        _mm256_and_si256(idx, _mm256_set1_epi64x((long long) k)), zero);
+    return _mm256_xor_si256(bj, bk);
+}
+
+// Swap lanes i and i ^ j.
+static inline AVX2 __m256i
+avx2_perm32(__m256i x, size_t j)
+{
+    switch (j) {
+    case 1:
+        return _mm256_shuffle_epi32(x, 0xB1);
+    case 2:
+        return _mm256_shuffle_epi32(x, 0x4E);
+    default:
+        return _mm256_permute2x128_si256(x, x, 0x01);
+    }
+}
+
+static inline AVX2 __m256i
+avx2_perm64(__m256i x, size_t j)
+{
+    if (j == 1)
+        return _mm256_shuffle_epi32(x, 0x4E);
+    return _mm256_permute2x128_si256(x, x, 0x01);
+}
+
+static inline AVX2 __m256i
+avx2_min_epi64(__m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+}
+
+static inline AVX2 __m256i
+avx2_max_epi64(__m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b));
+}
+
+static inline AVX2 __m256i
+avx2_min_epu64(__m256i a, __m256i b)
+{
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign),
+                                    _mm256_xor_si256(b, sign));
+    return _mm256_blendv_epi8(a, b, gt);
+}
+
+static inline AVX2 __m256i
+avx2_max_epu64(__m256i a, __m256i b)
+{
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign),
+                                    _mm256_xor_si256(b, sign));
+    return _mm256_blendv_epi8(b, a, gt);
+}
+
+#    define BG_SORTNET_AVX2_INT_OPS(T, bits, MIN, MAX)                        \
+        static inline AVX2 __m256i avx2_##T##_load(const T *p)               \
+        {                                                                    \
+            return _mm256_loadu_si256((const __m256i *) p);                  \
+        }                                                                    \
+        static inline AVX2 void avx2_##T##_store(T *p, __m256i x)            \
+        {                                                                    \
+            _mm256_storeu_si256((__m256i *) p, x);                           \
+        }                                                                    \
+        static inline AVX2 __m256i avx2_##T##_min(__m256i a, __m256i b)      \
+        {                                                                    \
+            return MIN(a, b);                                                \
+        }                                                                    \
+        static inline AVX2 __m256i avx2_##T##_max(__m256i a, __m256i b)      \
+        {                                                                    \
+            return MAX(a, b);                                                \
+        }                                                                    \
+        static inline AVX2 __m256i avx2_##T##_perm(__m256i x, size_t j)      \
+        {                                                                    \
+            return avx2_perm##bits(x, j);                                    \
+        }                                                                    \
+        static inline AVX2 __m256i avx2_##T##_select(                        \
+            __m256i mn, __m256i mx, size_t v, size_t j, size_t k)            \
+        {                                                                    \
+            return _mm256_blendv_epi8(mn, mx, avx2_mask##bits(v, j, k));     \
+        }
+
+BG_SORTNET_AVX2_INT_OPS(i32, 32, _mm256_min_epi32, _mm256_max_epi32)
+BG_SORTNET_AVX2_INT_OPS(u32, 32, _mm256_min_epu32, _mm256_max_epu32)
+BG_SORTNET_AVX2_INT_OPS(i64, 64, avx2_min_epi64, avx2_max_epi64)
+BG_SORTNET_AVX2_INT_OPS(u64, 64, avx2_min_epu64, avx2_max_epu64)
+
+static inline AVX2 __m256
+avx2_f32_load(const f32 *p)
+{
+    return _mm256_loadu_ps(p);
+}
+
+static inline AVX2 void
+avx2_f32_store(f32 *p, __m256 x)
+{
+    _mm256_storeu_ps(p, x);
+}
+
+static inline AVX2 __m256
+avx2_f32_min(__m256 a, __m256 b)
+{
+    return _mm256_min_ps(a, b);
+}
+
+static inline AVX2 __m256
+avx2_f32_max(__m256 a, __m256 b)
+{
+    return _mm256_max_ps(a, b);
+}
+
+static inline AVX2 __m256
+avx2_f32_perm(__m256 x, size_t j)
+{
+    switch (j) {
+    case 1:
+        return _mm256_permute_ps(x, 0xB1);
+    case 2:
+        return _mm256_permute_ps(x, 0x4E);
+    default:
+        return _mm256_permute2f128_ps(x, x, 0x01);
+    }
+}
+
+static inline AVX2 __m256
+avx2_f32_select(__m256 mn, __m256 mx, size_t v, size_t j, size_t k)
+{
+    return _mm256_blendv_ps(mn, mx, _mm256_castsi256_ps(avx2_mask32(v, j, k)));
+}
+
+static inline AVX2 __m256d
+avx2_f64_load(const f64 *p)
+{
+    return _mm256_loadu_pd(p);
+}
+
+static inline AVX2 void
+avx2_f64_store(f64 *p, __m256d x)
+{
+    _mm256_storeu_pd(p, x);
+}
+
+static inline AVX2 __m256d
+avx2_f64_min(__m256d a, __m256d b)
+{
+    return _mm256_min_pd(a, b);
+}
+
+static inline AVX2 __m256d
+avx2_f64_max(__m256d a, __m256d b)
+{
+    return _mm256_max_pd(a, b);
+}
+
+static inline AVX2 __m256d
+avx2_f64_perm(__m256d x, size_t j)
+{
+    if (j == 1)
+        return _mm256_permute_pd(x, 0x5);
+    return _mm256_permute2f128_pd(x, x, 0x01);
+}
+
+static inline AVX2 __m256d
+avx2_f64_select(__m256d mn, __m256d mx, size_t v, size_t j, size_t k)
+{
+    return _mm256_blendv_pd(mn, mx, _mm256_castsi256_pd(avx2_mask64(v, j, k)));
+}
+
+BG_SORTNET_SIMD_DEFINE(avx2, i32, __m256i, 8, "avx2")
+BG_SORTNET_SIMD_DEFINE(avx2, u32, __m256i, 8, "avx2")
+BG_SORTNET_SIMD_DEFINE(avx2, i64, __m256i, 4, "avx2")
+BG_SORTNET_SIMD_DEFINE(avx2, u64, __m256i, 4, "avx2")
+BG_SORTNET_SIMD_DEFINE(avx2, f32, __m256, 8, "avx2")
+BG_SORTNET_SIMD_DEFINE(avx2, f64, __m256d, 4, "avx2")
+
+////////////////////
+// SSE4.2: 4 x 32-bit or 2 x 64-bit lanes
+//
+
+#    define SSE42 BG_TARGET("sse4.2")
+
+static inline SSE42 __m128i
+sse42_mask32(size_t v, size_t j, size_t k)
+{
+    __m128i idx = _mm_add_epi32(_mm_set1_epi32((int) v),
+                                _mm_setr_epi32(0, 1, 2, 3));
+    __m128i zero = _mm_setzero_si128();
+    __m128i bj =
+        _mm_cmpeq_epi32(_mm_and_si128(idx, _mm_set1_epi32((int) j)), zero);
+    __m128i bk =
+        _mm_cmpeq_epi32(_mm_and_si128(idx, _mm_set1_epi32((int) k)), zero);
+    return _mm_xor_si128(bj, bk);
+}
+
+static inline SSE42 __m128i
+sse42_mask64(size_t v, size_t j, size_t k)
+{
+    __m128i idx = _mm_add_epi64(_mm_set1_epi64x((long long) v),
+                                _mm_set_epi64x(1, 0));
+    __m128i zero = _mm_setzero_si128();
+    __m128i bj = _mm_cmpeq_epi64(
+        _mm_and_si128(idx, _mm_set1_epi64x((long long) j)), zero);
+    __m128i bk = _mm_cmpeq_epi64(
+        _mm_and_si128(idx, _mm_set1_epi64x((long long) k)), zero);
+    return _mm_xor_si128(bj, bk);
+}
+
+static inline SSE42 __m128i
+sse42_perm32(__m128i x, size_t j)
+{
+    if (j == 1)
+        return _mm_shuffle_epi32(x, 0xB1);
+    return _mm_shuffle_epi32(x, 0x4E);
+}
+
+static inline SSE42 __m128i
+sse42_perm64(__m128i x, size_t j)
+{
+    (void) j;
+    return _mm_shuffle_epi32(x, 0x4E);
+}
+
+static inline SSE42 __m128i
+sse42_min_epi64(__m128i a, __m128i b)
+{
+    return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(a, b));
+}
+
+static inline SSE42 __m128i
+sse42_max_epi64(__m128i a, __m128i b)
+{
+    return _mm_blendv_epi8(b, a, _mm_cmpgt_epi64(a, b));
+}
+
+static inline SSE42 __m128i
+sse42_min_epu64(__m128i a, __m128i b)
+{
+    __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    __m128i gt =
+        _mm_cmpgt_epi64(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+    return _mm_blendv_epi8(a, b, gt);
+}
+
+static inline SSE42 __m128i
+sse42_max_epu64(__m128i a, __m128i b)
+{
+    __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    __m128i gt =
+        _mm_cmpgt_epi64(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+    return _mm_blendv_epi8(b, a, gt);
+}
+
+#    define BG_SORTNET_SSE42_INT_OPS(T, bits, MIN, MAX)                      \
+        static inline SSE42 __m128i sse42_##T##_load(const T *p)            \
+        {                                                                   \
+            return _mm_loadu_si128((const __m128i *) p);                    \
+        }                                                                   \
+        static inline SSE42 void sse42_##T##_store(T *p, __m128i x)         \
+        {                                                                   \
+            _mm_storeu_si128((__m128i *) p, x);                             \
+        }                                                                   \
+        static inline SSE42 __m128i sse42_##T##_min(__m128i a, __m128i b)   \
+        {                                                                   \
+            return MIN(a, b);                                               \
+        }                                                                   \
+        static inline SSE42 __m128i sse42_##T##_max(__m128i a, __m128i b)   \
+        {                                                                   \
+            return MAX(a, b);                                               \
+        }                                                                   \
+        static inline SSE42 __m128i sse42_##T##_perm(__m128i x, size_t j)   \
+        {                                                                   \
+            return sse42_perm##bits(x, j);                                  \
+        }                                                                   \
+        static inline SSE42 __m128i sse42_##T##_select(                     \
+            __m128i mn, __m128i mx, size_t v, size_t j, size_t k)           \
+        {                                                                   \
+            return _mm_blendv_epi8(mn, mx, sse42_mask##bits(v, j, k));      \
+        }
+
+BG_SORTNET_SSE42_INT_OPS(i32, 32, _mm_min_epi32, _mm_max_epi32)
+BG_SORTNET_SSE42_INT_OPS(u32, 32, _mm_min_epu32, _mm_max_epu32)
+BG_SORTNET_SSE42_INT_OPS(i64, 64, sse42_min_epi64, sse42_max_epi64)
+BG_SORTNET_SSE42_INT_OPS(u64, 64, sse42_min_epu64, sse42_max_epu64)
+
+static inline SSE42 __m128
+sse42_f32_load(const f32 *p)
+{
+    return _mm_loadu_ps(p);
+}
+
+static inline SSE42 void
+sse42_f32_store(f32 *p, __m128 x)
+{
+    _mm_storeu_ps(p, x);
+}
+
+static inline SSE42 __m128
+sse42_f32_min(__m128 a, __m128 b)
+{
+    return _mm_min_ps(a, b);
+}
+
+static inline SSE42 __m128
+sse42_f32_max(__m128 a, __m128 b)
+{
+    return _mm_max_ps(a, b);
+}
+
+static inline SSE42 __m128
+sse42_f32_perm(__m128 x, size_t j)
+{
+    if (j == 1)
+        return _mm_shuffle_ps(x, x, 0xB1);
+    return _mm_shuffle_ps(x, x, 0x4E);
+}
+
+static inline SSE42 __m128
+sse42_f32_select(__m128 mn, __m128 mx, size_t v, size_t j, size_t k)
+{
+    return _mm_blendv_ps(mn, mx, _mm_castsi128_ps(sse42_mask32(v, j, k)));
+}
+
+static inline SSE42 __m128d
+sse42_f64_load(const f64 *p)
+{
+    return _mm_loadu_pd(p);
+}
+
+static inline SSE42 void
+sse42_f64_store(f64 *p, __m128d x)
+{
+    _mm_storeu_pd(p, x);
+}
+
+static inline SSE42 __m128d
+sse42_f64_min(__m128d a, __m128d b)
+{
+    return _mm_min_pd(a, b);
+}
+
+static inline SSE42 __m128d
+sse42_f64_max(__m128d a, __m128d b)
+{
+    return _mm_max_pd(a, b);
+}
+
+static inline SSE42 __m128d
+sse42_f64_perm(__m128d x, size_t j)
+{
+    (void) j;
+    return _mm_shuffle_pd(x, x, 0x1);
+}
+
+static inline SSE42 __m128d
+sse42_f64_select(__m128d mn, __m128d mx, size_t v, size_t j, size_t k)
+{
+    return _mm_blendv_pd(mn, mx, _mm_castsi128_pd(sse42_mask64(v, j, k)));
+}
+
+BG_SORTNET_SIMD_DEFINE(sse42, i32, __m128i, 4, "sse4.2")
+BG_SORTNET_SIMD_DEFINE(sse42, u32, __m128i, 4, "sse4.2")
+BG_SORTNET_SIMD_DEFINE(sse42, i64, __m128i, 2, "sse4.2")
+BG_SORTNET_SIMD_DEFINE(sse42, u64, __m128i, 2, "sse4.2")
+BG_SORTNET_SIMD_DEFINE(sse42, f32, __m128, 4, "sse4.2")
+BG_SORTNET_SIMD_DEFINE(sse42, f64, __m128d, 2, "sse4.2")
+
+#endif // BG_CPU_X86
+
+////////////////////
+// Entry points
+//
+
+static inline size_t
+sortnet_block_size(size_t n, size_t lanes)
+{
+    size_t N = 4;
+    while (N < n)
+        N <<= 1;
+    return N < lanes ? lanes : N;
+}
+
+/*
+ * Pad a into a block of N, run the network for the chosen instruction set
+ * and copy the n smallest back. A full block is sorted in place.
+ */
+#define BG_SORTNET_ENTRY_DEFINE(T, sentinel)                                  \
+    static void sortnet_run_##T(T *a, size_t n, size_t lanes,                \
+                                void (*network)(T *, size_t))                \
+    {                                                                        \
+        size_t N = sortnet_block_size(n, lanes);                             \
+        if (N == n) {                                                        \
+            network(a, N);                                                   \
+            return;                                                          \
+        }                                                                    \
+        T block[BG_SORTNET_MAX];                                             \
+        memcpy(block, a, n * sizeof(T));                                     \
+        for (size_t i = n; i < N; i++)                                       \
+            block[i] = (sentinel);                                           \
+        network(block, N);                                                   \
+        memcpy(a, block, n * sizeof(T));                                     \
+    }                                                                        \
+                                                                             \
+    void bg_sortnet_##T##_level(T *a, size_t n, enum BGCpuLevel level)       \
+    {                                                                        \
+        assert_sortnet(n <= BG_SORTNET_MAX,                                  \
+                       "sorting network takes at most %d elements, got %zu", \
+                       BG_SORTNET_MAX, n);                                   \
+        if (n <= 1)                                                          \
+            return;                                                          \
+        BG_SORTNET_DISPATCH(T, a, n, level);                                 \
+        sortnet_run_##T(a, n, 1, sortnet_scalar_##T);                        \
+    }                                                                        \
+                                                                             \
+    void bg_sortnet_##T(T *a, size_t n)                                      \
+    {                                                                        \
+        bg_sortnet_##T##_level(a, n, bg_cpu_level());                        \
+    }
+
+#if BG_CPU_X86
+#    define BG_SORTNET_DISPATCH(T, a, n, level)                             \
+        do {                                                               \
+            if ((level) >= BG_CPU_AVX2) {                                  \
+                sortnet_run_##T(a, n, 32 / sizeof(T), sortnet_avx2_##T);   \
+                return;                                                    \
+            }                                                              \
+            if ((level) >= BG_CPU_SSE42) {                                 \
+                sortnet_run_##T(a, n, 16 / sizeof(T), sortnet_sse42_##T);  \
+                return;                                                    \
+            }                                                              \
+        } while (0)
+#else
+#    define BG_SORTNET_DISPATCH(T, a, n, level) \
+        do {                                    \
+            (void) (level);                     \
+        } while (0)
+#endif
+
+BG_SORTNET_ENTRY_DEFINE(i32, INT32_MAX)
+BG_SORTNET_ENTRY_DEFINE(u32, UINT32_MAX)
+BG_SORTNET_ENTRY_DEFINE(i64, INT64_MAX)
+BG_SORTNET_ENTRY_DEFINE(u64, UINT64_MAX)
+BG_SORTNET_ENTRY_DEFINE(f32, INFINITY)
+BG_SORTNET_ENTRY_DEFINE(f64, INFINITY)
@@ -0,0 +1,41 @@
+#ifndef BG_SORTNET_H
+#define BG_SORTNET_H
+
+#include <unistd.h>
+
+#include "bg_cpu.h"
+#include "bg_types.h"
+
+/*
+ * Sorting networks for short arrays of primitive types.
+ *
+ * The input is padded with the type's maximum value up to a block of 4, 8,
+ * 16 or 32 elements and sorted with a bitonic network: branch-free, and with
+ * AVX2 or SSE4.2 every compare-exchange stage works on a whole register at a
+ * time. The instruction set is picked at runtime (see bg_cpu.h); a scalar
+ * network is the fallback.
+ *
+ * Floating point inputs must not contain NaN.
+ */
+
+#define BG_SORTNET_MAX 32
+
+// Sort n <= BG_SORTNET_MAX elements ascending.
+void bg_sortnet_i32(i32 *a, size_t n);
+void bg_sortnet_u32(u32 *a, size_t n);
+void bg_sortnet_i64(i64 *a, size_t n);
+void bg_sortnet_u64(u64 *a, size_t n);
+void bg_sortnet_f32(f32 *a, size_t n);
+void bg_sortnet_f64(f64 *a, size_t n);
+
+// Same, with the instruction set chosen by the caller, e.g. resolved once
+// per sort. Levels above what the network supports fall back to the best
+// supported one.
+void bg_sortnet_i32_level(i32 *a, size_t n, enum BGCpuLevel level);
+void bg_sortnet_u32_level(u32 *a, size_t n, enum BGCpuLevel level);
+void bg_sortnet_i64_level(i64 *a, size_t n, enum BGCpuLevel level);
+void bg_sortnet_u64_level(u64 *a, size_t n, enum BGCpuLevel level);
+void bg_sortnet_f32_level(f32 *a, size_t n, enum BGCpuLevel level);
+void bg_sortnet_f64_level(f64 *a, size_t n, enum BGCpuLevel level);
+
+#endif // BG_SORTNET_H
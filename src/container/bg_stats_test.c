@@ -0,0 +1,176 @@
+#include "bg_slice.h"
+#include "bg_stats.h"
+#include "unity.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_testutils.h"
+#include "bg_types.h"
+
+// Built with -DBG_STATS; see the test-stats target.
+
+void
+setUp(void)
+{
+    bg_stats_reset();
+}
+
+void
+tearDown(void)
+{
+}
+
+void
+test_stats_slice_growth(void)
+{
+    BGSlice *s = BGSlice_new(u64, 0, 4, NULL);
+    struct BGStats st = bg_stats_snapshot();
+    TEST_ASSERT_EQUAL_UINT64(0, st.slice_grows);
+    // Header and buffer.
+    TEST_ASSERT_EQUAL_UINT64(2, st.allocs - st.frees);
+
+    for (u64 i = 0; i < 100; i++)
+        BGSlice_append(s, &i);
+    st = bg_stats_snapshot();
+    TEST_ASSERT_TRUE(st.slice_grows > 0);
+    TEST_ASSERT_EQUAL_UINT64(st.slice_grows, st.reallocs);
+    TEST_ASSERT_EQUAL_UINT64(0, st.slice_shrinks);
+    TEST_ASSERT_EQUAL_UINT64(BGSlice_get_cap(s) * sizeof(u64),
+                             st.peak_cap_bytes);
+    // Every move copies at most the items that existed before it.
+    TEST_ASSERT_TRUE(st.bytes_copied < 100 * sizeof(u64) * st.slice_grows);
+
+    u64 grows = st.slice_grows;
+    BGSlice_reserve(s, 1000);
+    BGSlice_shrink_to_fit(s);
+    st = bg_stats_snapshot();
+    TEST_ASSERT_EQUAL_UINT64(grows + 1, st.slice_grows);
+    TEST_ASSERT_EQUAL_UINT64(1, st.slice_shrinks);
+    TEST_ASSERT_EQUAL_UINT64(1100 * sizeof(u64), st.peak_cap_bytes);
+
+    BGSlice_free(s);
+    st = bg_stats_snapshot();
+    TEST_ASSERT_EQUAL_UINT64(st.allocs, st.frees);
+}
+
+void
+test_stats_borrowed_copy(void)
+{
+    u64 buf[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    BGSlice *s = BGSlice_new_from_buf(buf, 8, 8, NULL);
+    u64 item = 9;
+    BGSlice_append(s, &item);
+
+    // Growing out of a borrowed buffer copies every item.
+    struct BGStats st = bg_stats_snapshot();
+    TEST_ASSERT_EQUAL_UINT64(1, st.slice_grows);
+    TEST_ASSERT_EQUAL_UINT64(8 * sizeof(u64), st.bytes_copied);
+    BGSlice_free(s);
+}
+
+#define STATS_THREADS 4
+#define STATS_APPENDS 1000
+
+static void *
+stats_worker(void *arg)
+{
+    BGSlice *s = BGSlice_new(u64, 0, 1, NULL);
+    for (u64 i = 0; i < STATS_APPENDS; i++)
+        BGSlice_append(s, &i);
+    *(u64 *) arg = bg_stats_snapshot().slice_grows;
+    BGSlice_free(s);
+    return NULL;
+}
+
+void
+test_stats_threads(void)
+{
+    // One thread's grows, counted on its own.
+    u64 solo = 0;
+    pthread_t t;
+    pthread_create(&t, NULL, stats_worker, &solo);
+    pthread_join(t, NULL);
+    TEST_ASSERT_TRUE(solo > 0);
+
+    // Exited threads' counts are kept.
+    bg_stats_reset();
+    u64 seen[STATS_THREADS];
+    pthread_t threads[STATS_THREADS];
+    for (int i = 0; i < STATS_THREADS; i++)
+        pthread_create(&threads[i], NULL, stats_worker, &seen[i]);
+    for (int i = 0; i < STATS_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    struct BGStats st = bg_stats_snapshot();
+    TEST_ASSERT_EQUAL_UINT64(solo * STATS_THREADS, st.slice_grows);
+    TEST_ASSERT_EQUAL_UINT64(st.allocs, st.frees);
+
+    bg_stats_reset();
+    st = bg_stats_snapshot();
+    TEST_ASSERT_EQUAL_UINT64(0, st.slice_grows);
+    TEST_ASSERT_EQUAL_UINT64(0, st.allocs);
+    TEST_ASSERT_EQUAL_UINT64(0, st.peak_cap_bytes);
+}
+
+typedef struct {
+    void (*test_func)(void);
+    const char *test_name;
+} test_case_t;
+
+static const test_case_t all_tests[] = {
+    { test_stats_slice_growth, "test_stats_slice_growth" },
+    { test_stats_borrowed_copy, "test_stats_borrowed_copy" },
+    { test_stats_threads, "test_stats_threads" },
+};
+
+#define NUM_TESTS (sizeof(all_tests) / sizeof(all_tests[0]))
+
+void
+run_all_tests(void)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        UnityDefaultTestRun(all_tests[i].test_func, all_tests[i].test_name,
+                            __LINE__);
+    }
+}
+
+void
+run_single_test(const char *test_name)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        if (strcmp(all_tests[i].test_name, test_name) == 0) {
+            UnityDefaultTestRun(all_tests[i].test_func,
+                                all_tests[i].test_name, __LINE__);
+            return;
+        }
+    }
+    printf("Test '%s' not found!\n", test_name);
+}
+
+void
+list_all_tests(void)
+{
+    printf("Available tests (%zu total):\n", NUM_TESTS);
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        printf("  [%2zu] %s\n", i, all_tests[i].test_name);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc == 1) {
+        run_all_tests();
+    } else if (argc == 2) {
+        if (strcmp(argv[1], "--list") == 0)
+            list_all_tests();
+        else
+            run_single_test(argv[1]);
+    } else {
+        printf("Usage: %s [test_name|--list]\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
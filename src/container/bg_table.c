@@ -0,0 +1,212 @@
+#include "bg_table.h"
+
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_types.h"
+
+#define assert_table(condition, fmt, ...) \
+    bg_assert("BGTable", condition, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+#define TABLE_MIN_CAP 8
+// Keys looked up together by get_batch.
+#define TABLE_GROUP 16
+
+/*
+ * A slot is empty when its key is 0, so key 0 itself is kept out of the
+ * slots, in zero_value.
+ */
+struct table_slot {
+    u64 key;
+    u64 value;
+};
+
+struct BGTable {
+    struct table_slot *slots;
+    // A power of two.
+    size_t cap;
+    // 64 - log2(cap): the hash is the top bits of the product.
+    u32 shift;
+    // Keys in slots, not counting key 0.
+    size_t len;
+    bool has_zero;
+    u64 zero_value;
+    struct Allocator *allocator;
+};
+
+static inline size_t
+table_hash(BGTable *t, u64 key)
+{
+    return (size_t) ((key * 0x9E3779B97F4A7C15ull) >> t->shift);
+}
+
+static struct table_slot *
+table_alloc_slots(struct Allocator *allocator, size_t cap)
+{
+    struct table_slot *slots = bg_allocator_aligned_alloc(
+        allocator, 64, cap * sizeof(struct table_slot));
+    if (slots != NULL)
+        memset(slots, 0, cap * sizeof(struct table_slot));
+    return slots;
+}
+
+// Slot holding key, or the empty slot where it would go, probing from the
+// slot key hashes to.
+static inline struct table_slot *
+table_probe(BGTable *t, u64 key, size_t home)
+{
+    size_t mask = t->cap - 1;
+    for (size_t i = home;; i = (i + 1) & mask) {
+        struct table_slot *slot = &t->slots[i];
+        if (slot->key == key || slot->key == 0)
+            return slot;
+    }
+}
+
+static inline struct table_slot *
+table_find(BGTable *t, u64 key)
+{
+    return table_probe(t, key, table_hash(t, key));
+}
+
+BGTable *
+BGTable_new(size_t cap, struct Allocator *allocator)
+{
+    if (allocator == NULL)
+        allocator = malloc_allocator;
+
+    size_t slots = TABLE_MIN_CAP;
+    while (slots / 4 * 3 < cap)
+        slots *= 2;
+    BGTable *t = bg_allocator_malloc(allocator, sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    t->slots = table_alloc_slots(allocator, slots);
+    if (t->slots == NULL) {
+        bg_allocator_free(allocator, t);
+        return NULL;
+    }
+    t->cap = slots;
+    t->shift = 64 - __builtin_ctzll(slots);
+    t->len = 0;
+    t->has_zero = false;
+    t->zero_value = 0;
+    t->allocator = allocator;
+    return t;
+}
+
+void
+BGTable_free(BGTable *t)
+{
+    if (bg_unlikely(t == NULL))
+        return;
+    bg_allocator_free(t->allocator, t->slots);
+    bg_allocator_free(t->allocator, t);
+}
+
+size_t
+BGTable_len(BGTable *t)
+{
+    assert_table(t != NULL, "table cannot be NULL");
+    return t->len + t->has_zero;
+}
+
+static enum BGStatus
+table_grow(BGTable *t)
+{
+    struct table_slot *old = t->slots;
+    size_t old_cap = t->cap;
+    struct table_slot *slots = table_alloc_slots(t->allocator, old_cap * 2);
+    if (slots == NULL)
+        return BG_ERR_ALLOC;
+    t->slots = slots;
+    t->cap = old_cap * 2;
+    t->shift--;
+    for (size_t i = 0; i < old_cap; i++)
+        if (old[i].key != 0)
+            *table_find(t, old[i].key) = old[i];
+    bg_allocator_free(t->allocator, old);
+    return BG_OK;
+}
+
+enum BGStatus
+BGTable_put(BGTable *t, u64 key, u64 value)
+{
+    assert_table(t != NULL, "table cannot be NULL");
+
+    if (key == 0) {
+        t->has_zero = true;
+        t->zero_value = value;
+        return BG_OK;
+    }
+    struct table_slot *slot = table_find(t, key);
+    if (slot->key == key) {
+        slot->value = value;
+        return BG_OK;
+    }
+    if (t->len + 1 > t->cap / 4 * 3) {
+        if (table_grow(t) != BG_OK)
+            return BG_ERR_ALLOC;
+        slot = table_find(t, key);
+    }
+    slot->key = key;
+    slot->value = value;
+    t->len++;
+    return BG_OK;
+}
+
+bool
+BGTable_get(BGTable *t, u64 key, u64 *value)
+{
+    assert_table(t != NULL, "table cannot be NULL");
+
+    if (key == 0) {
+        if (t->has_zero && value != NULL)
+            *value = t->zero_value;
+        return t->has_zero;
+    }
+    struct table_slot *slot = table_find(t, key);
+    if (slot->key == 0)
+        return false;
+    if (value != NULL)
+        *value = slot->value;
+    return true;
+}
+
+enum BGStatus
+BGTable_get_batch(BGTable *t, const u64 *keys, size_t n, u64 missing,
+                  BGSlice *out)
+{
+    assert_table(t != NULL && out != NULL, "arguments cannot be NULL");
+    assert_table(keys != NULL || n == 0, "keys cannot be NULL");
+    assert_table(out->elem_size == sizeof(u64),
+                 "out must be a slice of u64, not of %zu byte items",
+                 out->elem_size);
+
+    if (BGSlice_reserve(out, n) == NULL)
+        return BG_ERR_ALLOC;
+    u64 *values = (u64 *) out->buf + out->len;
+    size_t home[TABLE_GROUP];
+    for (size_t i = 0; i < n; i += TABLE_GROUP) {
+        size_t g = n - i < TABLE_GROUP ? n - i : TABLE_GROUP;
+        for (size_t j = 0; j < g; j++) {
+            home[j] = table_hash(t, keys[i + j]);
+            __builtin_prefetch(&t->slots[home[j]]);
+        }
+        for (size_t j = 0; j < g; j++) {
+            u64 key = keys[i + j];
+            u64 value = missing;
+            if (key == 0) {
+                if (t->has_zero)
+                    value = t->zero_value;
+            } else {
+                struct table_slot *slot = table_probe(t, key, home[j]);
+                if (slot->key != 0)
+                    value = slot->value;
+            }
+            values[i + j] = value;
+        }
+    }
+    BGSlice_set_len(out, out->len + n);
+    return BG_OK;
+}
@@ -0,0 +1,44 @@
+#ifndef BG_TABLE_H
+#define BG_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bg_slice.h"
+#include "bg_types.h"
+#include "mem/bg_allocator.h"
+
+/*
+ * Hash index from u64 keys to u64 values, for lookups by id: open
+ * addressing with linear probing over 16-byte slots, four to a cache line,
+ * so that most lookups read a single line. Keys are spread with Fibonacci
+ * hashing, and the table doubles before it is three quarters full. Items
+ * can be added and overwritten but not removed.
+ */
+
+typedef struct BGTable BGTable;
+
+// Room for cap items before the first growth; 0 for a small default. NULL
+// on failure; allocator may be NULL.
+BGTable *BGTable_new(size_t cap, struct Allocator *allocator);
+void BGTable_free(BGTable *t);
+size_t BGTable_len(BGTable *t);
+
+// Insert key or overwrite its value. BG_ERR_ALLOC when the table had to
+// grow and could not, leaving it as it was.
+enum BGStatus BGTable_put(BGTable *t, u64 key, u64 value);
+// The value of key in *value, unless NULL; false if key is absent.
+bool BGTable_get(BGTable *t, u64 key, u64 *value);
+
+/*
+ * Look up n keys at once and append their values to out, a slice of u64,
+ * with missing standing in for absent keys. Keys are taken in groups: the
+ * slots of a whole group are hashed and prefetched before any of them is
+ * probed, so the cache misses of a group overlap instead of following one
+ * another. Worth it once the table is well past the cache; BG_ERR_ALLOC if
+ * out could not grow.
+ */
+enum BGStatus BGTable_get_batch(BGTable *t, const u64 *keys, size_t n,
+                                u64 missing, BGSlice *out);
+
+#endif // BG_TABLE_H
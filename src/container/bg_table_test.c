@@ -0,0 +1,165 @@
+#include "bg_table.h"
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "bg_common.h"
+#include "bg_testutils.h"
+#include "bg_types.h"
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+void
+test_table_put_get(void)
+{
+    BGTable *t = BGTable_new(0, NULL);
+    u64 v = 0;
+    TEST_ASSERT_FALSE(BGTable_get(t, 42, &v));
+    TEST_ASSERT_FALSE(BGTable_get(t, 0, &v));
+
+    // Key 0 is kept apart from the slots, where it marks an empty one.
+    TEST_ASSERT_EQUAL(BG_OK, BGTable_put(t, 0, 7));
+    TEST_ASSERT_EQUAL(BG_OK, BGTable_put(t, 42, 1));
+    TEST_ASSERT_EQUAL(BG_OK, BGTable_put(t, 42, 2));
+    TEST_ASSERT_EQUAL(2, BGTable_len(t));
+    TEST_ASSERT_TRUE(BGTable_get(t, 0, &v));
+    TEST_ASSERT_EQUAL_UINT64(7, v);
+    TEST_ASSERT_TRUE(BGTable_get(t, 42, &v));
+    TEST_ASSERT_EQUAL_UINT64(2, v);
+    TEST_ASSERT_TRUE(BGTable_get(t, 42, NULL));
+
+    // Growing many times over keeps everything.
+    for (u64 k = 1; k <= 10000; k++)
+        TEST_ASSERT_EQUAL(BG_OK, BGTable_put(t, k * 3, k));
+    TEST_ASSERT_EQUAL(10001, BGTable_len(t));
+    for (u64 k = 1; k <= 10000; k++) {
+        TEST_ASSERT_TRUE(BGTable_get(t, k * 3, &v));
+        TEST_ASSERT_EQUAL_UINT64(k, v);
+        TEST_ASSERT_FALSE(BGTable_get(t, k * 3 + 1, NULL));
+    }
+    TEST_ASSERT_TRUE(BGTable_get(t, 42, &v));
+    TEST_ASSERT_EQUAL_UINT64(14, v);
+    BGTable_free(t);
+}
+
+void
+test_table_get_batch(void)
+{
+    BGTable *t = BGTable_new(1000, NULL);
+    for (u64 k = 0; k < 1000; k++)
+        BGTable_put(t, k * 2, k + 100);
+
+    // Present and absent keys, 0 among them, over a few partial groups.
+    size_t n = 203;
+    u64 *keys = malloc(n * sizeof(u64));
+    for (size_t i = 0; i < n; i++)
+        keys[i] = (u64) rand() % 2500;
+    keys[5] = 0;
+    BGSlice *out = BGSlice_new(u64, 0, 1, NULL);
+    u64 first = 1;
+    BGSlice_append(out, &first);
+    TEST_ASSERT_EQUAL(BG_OK,
+                      BGTable_get_batch(t, keys, n, (u64) -1, out));
+    TEST_ASSERT_EQUAL(n + 1, out->len);
+    u64 *values = out->buf;
+    TEST_ASSERT_EQUAL_UINT64(1, values[0]);
+    for (size_t i = 0; i < n; i++) {
+        u64 v = (u64) -1;
+        BGTable_get(t, keys[i], &v);
+        TEST_ASSERT_EQUAL_UINT64(v, values[i + 1]);
+    }
+    TEST_ASSERT_EQUAL_UINT64(100, values[6]);
+
+    TEST_ASSERT_EQUAL(BG_OK, BGTable_get_batch(t, NULL, 0, 0, out));
+    TEST_ASSERT_EQUAL(n + 1, out->len);
+    BGSlice_free(out);
+    free(keys);
+    BGTable_free(t);
+}
+
+void
+test_table_alloc_failure(void)
+{
+    struct Allocator failing = bg_failing_allocator(1);
+    BGTable *t = BGTable_new(0, &failing);
+    for (u64 k = 1; k <= 6; k++)
+        TEST_ASSERT_EQUAL(BG_OK, BGTable_put(t, k, k));
+    // The seventh key needs room that cannot be had; the table is intact.
+    TEST_ASSERT_EQUAL(BG_ERR_ALLOC, BGTable_put(t, 7, 7));
+    TEST_ASSERT_EQUAL(6, BGTable_len(t));
+    TEST_ASSERT_FALSE(BGTable_get(t, 7, NULL));
+    u64 v;
+    TEST_ASSERT_TRUE(BGTable_get(t, 6, &v));
+    TEST_ASSERT_EQUAL_UINT64(6, v);
+    BGTable_free(t);
+}
+
+typedef struct {
+    void (*test_func)(void);
+    const char *test_name;
+} test_case_t;
+
+static const test_case_t all_tests[] = {
+    { test_table_put_get, "test_table_put_get" },
+    { test_table_get_batch, "test_table_get_batch" },
+    { test_table_alloc_failure, "test_table_alloc_failure" },
+};
+
+#define NUM_TESTS (sizeof(all_tests) / sizeof(all_tests[0]))
+
+void
+run_all_tests(void)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        UnityDefaultTestRun(all_tests[i].test_func, all_tests[i].test_name,
+                            __LINE__);
+    }
+}
+
+void
+run_single_test(const char *test_name)
+{
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        if (strcmp(all_tests[i].test_name, test_name) == 0) {
+            UnityDefaultTestRun(all_tests[i].test_func,
+                                all_tests[i].test_name, __LINE__);
+            return;
+        }
+    }
+    printf("Test '%s' not found!\n", test_name);
+}
+
+void
+list_all_tests(void)
+{
+    printf("Available tests (%zu total):\n", NUM_TESTS);
+    for (size_t i = 0; i < NUM_TESTS; i++) {
+        printf("  [%2zu] %s\n", i, all_tests[i].test_name);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc == 1) {
+        run_all_tests();
+    } else if (argc == 2) {
+        if (strcmp(argv[1], "--list") == 0)
+            list_all_tests();
+        else
+            run_single_test(argv[1]);
+    } else {
+        printf("Usage: %s [test_name|--list]\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
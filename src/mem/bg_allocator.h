@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "bg_stats.h"
+
 typedef struct Allocator {
     void *(*malloc)(size_t size);
     void *(*calloc)(size_t size, size_t elem_size);
@@ -20,4 +22,64 @@ static Allocator *malloc_allocator = &(struct Allocator) {
     .free = free,
 };
 
+/*
+ * Call an allocator through these rather than its function pointers: they
+ * feed the BG_STATS counters (see bg_stats.h) and are plain calls otherwise.
+ */
+static inline void *
+bg_allocator_malloc(struct Allocator *a, size_t size)
+{
+    void *ptr = a->malloc(size);
+    if (ptr != NULL) {
+        bg_stats_add(allocs, 1);
+        bg_stats_add(bytes_allocated, size);
+    }
+    return ptr;
+}
+
+static inline void *
+bg_allocator_calloc(struct Allocator *a, size_t n, size_t elem_size)
+{
+    void *ptr = a->calloc(n, elem_size);
+    if (ptr != NULL) {
+        bg_stats_add(allocs, 1);
+        bg_stats_add(bytes_allocated, n * elem_size);
+    }
+    return ptr;
+}
+
+static inline void *
+bg_allocator_realloc(struct Allocator *a, void *ptr, size_t size)
+{
+    void *new_ptr = a->realloc(ptr, size);
+    if (new_ptr != NULL) {
+        if (ptr == NULL)
+            bg_stats_add(allocs, 1);
+        else
+            bg_stats_add(reallocs, 1);
+        bg_stats_add(bytes_allocated, size);
+    }
+    return new_ptr;
+}
+
+static inline void *
+bg_allocator_aligned_alloc(struct Allocator *a, size_t alignment,
+                           size_t size)
+{
+    void *ptr = a->aligned_alloc(alignment, size);
+    if (ptr != NULL) {
+        bg_stats_add(allocs, 1);
+        bg_stats_add(bytes_allocated, size);
+    }
+    return ptr;
+}
+
+static inline void
+bg_allocator_free(struct Allocator *a, void *ptr)
+{
+    if (ptr != NULL)
+        bg_stats_add(frees, 1);
+    a->free(ptr);
+}
+
 #endif // BG_ALLOCATOR_H
\ No newline at end of file
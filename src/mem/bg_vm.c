@@ -0,0 +1,182 @@
+#ifdef __linux__
+#    define _GNU_SOURCE
+#endif
+
+#include "bg_vm.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_NORESERVE
+#    define MAP_NORESERVE 0
+#endif
+
+size_t
+bg_vm_page_size(void)
+{
+    static size_t page_size;
+    if (page_size == 0)
+        page_size = (size_t) sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+size_t
+bg_vm_page_align(size_t size)
+{
+    size_t page = bg_vm_page_size();
+    return (size + page - 1) & ~(page - 1);
+}
+
+void *
+bg_vm_map_file(int fd, size_t size, bool writable)
+{
+    int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+    void *addr =
+        mmap(NULL, bg_vm_page_align(size), prot, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+    return addr;
+}
+
+void *
+bg_vm_remap_file(void *addr, size_t old_size, size_t new_size, int fd,
+                 bool writable)
+{
+    old_size = bg_vm_page_align(old_size);
+    new_size = bg_vm_page_align(new_size);
+    if (old_size == new_size)
+        return addr;
+
+#ifdef __linux__
+    (void) fd;
+    (void) writable;
+    void *new_addr = mremap(addr, old_size, new_size, MREMAP_MAYMOVE);
+    if (new_addr == MAP_FAILED)
+        return NULL;
+    return new_addr;
+#else
+    // The pages live in the file, so mapping it again loses nothing.
+    void *new_addr = bg_vm_map_file(fd, new_size, writable);
+    if (new_addr == NULL)
+        return NULL;
+    munmap(addr, old_size);
+    return new_addr;
+#endif
+}
+
+int
+bg_vm_unmap(void *addr, size_t size)
+{
+    return munmap(addr, bg_vm_page_align(size));
+}
+
+void *
+bg_vm_map_anon(size_t size)
+{
+    void *addr = mmap(NULL, bg_vm_page_align(size), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+    return addr;
+}
+
+void *
+bg_vm_remap(void *addr, size_t old_size, size_t new_size)
+{
+    old_size = bg_vm_page_align(old_size);
+    new_size = bg_vm_page_align(new_size);
+    if (old_size == new_size)
+        return addr;
+
+#ifdef __linux__
+    void *new_addr = mremap(addr, old_size, new_size, MREMAP_MAYMOVE);
+    if (new_addr == MAP_FAILED)
+        return NULL;
+    return new_addr;
+#else
+    void *new_addr = bg_vm_map_anon(new_size);
+    if (new_addr == NULL)
+        return NULL;
+    memcpy(new_addr, addr, old_size < new_size ? old_size : new_size);
+    munmap(addr, old_size);
+    return new_addr;
+#endif
+}
+
+void *
+bg_vm_reserve(size_t size, size_t align)
+{
+    size_t page = bg_vm_page_size();
+    if (align < page)
+        align = page;
+    size = bg_vm_page_align(size);
+
+    // Over-reserve by the alignment and trim both ends.
+    size_t padded = size + align - page;
+    char *addr = mmap(NULL, padded, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    char *aligned =
+        (char *) (((uintptr_t) addr + align - 1) & ~(uintptr_t) (align - 1));
+    if (aligned > addr)
+        munmap(addr, aligned - addr);
+    if (addr + padded > aligned + size)
+        munmap(aligned + size, addr + padded - (aligned + size));
+    return aligned;
+}
+
+int
+bg_vm_commit(void *addr, size_t size)
+{
+    return mprotect(addr, bg_vm_page_align(size), PROT_READ | PROT_WRITE);
+}
+
+int
+bg_vm_decommit(void *addr, size_t size)
+{
+    size = bg_vm_page_align(size);
+    // Remapping the range over itself drops its pages on every system.
+    void *res = mmap(addr, size, PROT_NONE,
+                     MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                     -1, 0);
+    return res == MAP_FAILED ? -1 : 0;
+}
+
+int
+bg_vm_advise(void *addr, size_t size, enum BGVmAdvice advice)
+{
+    int flag = MADV_NORMAL;
+    switch (advice) {
+    case BG_VM_NORMAL:
+        flag = MADV_NORMAL;
+        break;
+    case BG_VM_SEQUENTIAL:
+        flag = MADV_SEQUENTIAL;
+        break;
+    case BG_VM_RANDOM:
+        flag = MADV_RANDOM;
+        break;
+    case BG_VM_WILLNEED:
+        flag = MADV_WILLNEED;
+        break;
+    case BG_VM_HUGEPAGE:
+#ifdef MADV_HUGEPAGE
+        flag = MADV_HUGEPAGE;
+        break;
+#else
+        return 0;
+#endif
+    }
+    return madvise(addr, bg_vm_page_align(size), flag);
+}
+
+int
+bg_vm_sync(void *addr, size_t size)
+{
+    return msync(addr, bg_vm_page_align(size), MS_SYNC);
+}
@@ -0,0 +1,64 @@
+#ifndef BG_VM_H
+#define BG_VM_H
+
+#include <stdbool.h>
+#include <unistd.h>
+
+/*
+ * Thin wrappers over the virtual memory syscalls (mmap and friends). They
+ * return NULL or -1 on failure with errno set by the failing call, and take
+ * sizes in bytes; mappings are rounded up to whole pages.
+ */
+
+enum BGVmAdvice {
+    BG_VM_NORMAL,
+    // Pages will be read in order: read ahead aggressively, drop early.
+    BG_VM_SEQUENTIAL,
+    // Pages will be touched in no particular order: don't read ahead.
+    BG_VM_RANDOM,
+    // Start reading the pages in now.
+    BG_VM_WILLNEED,
+    // Back the range with transparent huge pages where possible. Ignored
+    // where the system has none.
+    BG_VM_HUGEPAGE,
+};
+
+// Transparent huge page size on x86-64; reservations meant for huge pages
+// are aligned to it.
+#define BG_VM_HUGEPAGE_SIZE ((size_t) 2 << 20)
+
+size_t bg_vm_page_size(void);
+// size rounded up to a multiple of the page size.
+size_t bg_vm_page_align(size_t size);
+
+// Map size bytes of fd from offset 0, shared with the file, so that writes
+// through a writable mapping end up in it. size may exceed the file size.
+void *bg_vm_map_file(int fd, size_t size, bool writable);
+// Resize a file mapping, moving it if it cannot grow in place. The old
+// address is invalid afterwards unless NULL is returned.
+void *bg_vm_remap_file(void *addr, size_t old_size, size_t new_size, int fd,
+                       bool writable);
+int bg_vm_unmap(void *addr, size_t size);
+
+// Private zero-filled read-write memory.
+void *bg_vm_map_anon(size_t size);
+// Resize an anonymous mapping, moving it if it cannot grow in place. On
+// Linux the pages are moved by mremap, never copied.
+void *bg_vm_remap(void *addr, size_t old_size, size_t new_size);
+
+/*
+ * Reserve address space only: no memory is used until parts of it are
+ * committed, and until then they must not be touched. align is a power of
+ * two, 0 meaning the page size.
+ */
+void *bg_vm_reserve(size_t size, size_t align);
+// Make [addr, addr + size) of a reservation usable, zero-filled.
+int bg_vm_commit(void *addr, size_t size);
+// Give the memory of a committed range back to the system; the range is
+// reserved again.
+int bg_vm_decommit(void *addr, size_t size);
+int bg_vm_advise(void *addr, size_t size, enum BGVmAdvice advice);
+// Write dirty pages of a file mapping back to the file and wait for it.
+int bg_vm_sync(void *addr, size_t size);
+
+#endif // BG_VM_H
@@ -0,0 +1,176 @@
+#include "bg_threading.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "bg_common.h"
+#include "container/bg_slice.h"
+#include "mem/bg_allocator.h"
+
+#define assert_pool(condition, fmt, ...) \
+    bg_assert("BGThreadPool", condition, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+struct bg_task {
+    BGThreadPool_task_fn fn;
+    void *arg;
+};
+
+struct BGThreadPool {
+    pthread_mutex_t lock;
+    // Signalled when a task is queued or the pool shuts down.
+    pthread_cond_t task_ready;
+    // Signalled when the last pending task finishes.
+    pthread_cond_t idle;
+    // Queue of struct bg_task; tasks[head..len) are waiting.
+    BGSlice *tasks;
+    size_t head;
+    // Queued plus running tasks.
+    size_t pending;
+    bool shutdown;
+    size_t n_threads;
+    pthread_t *threads;
+    struct Allocator *allocator;
+};
+
+size_t
+bg_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (size_t) n;
+}
+
+static void *
+bg_thread_pool_worker(void *arg)
+{
+    BGThreadPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->head == pool->tasks->len && !pool->shutdown)
+            pthread_cond_wait(&pool->task_ready, &pool->lock);
+        if (pool->head == pool->tasks->len)
+            break;
+
+        struct bg_task task = *(struct bg_task *) BGSlice_get(pool->tasks,
+                                                             pool->head);
+        pool->head++;
+        // Rewind the queue once drained so it does not grow forever.
+        if (pool->head == pool->tasks->len) {
+            BGSlice_reset(pool->tasks);
+            pool->head = 0;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        task.fn(task.arg);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+BGThreadPool *
+BGThreadPool_new(size_t n_threads, struct Allocator *allocator)
+{
+    if (allocator == NULL)
+        allocator = malloc_allocator;
+    if (n_threads == 0)
+        n_threads = bg_cpu_count();
+
+    BGThreadPool *pool =
+        bg_allocator_calloc(allocator, 1, sizeof(BGThreadPool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->allocator = allocator;
+    pool->threads =
+        bg_allocator_calloc(allocator, n_threads, sizeof(pthread_t));
+    if (pool->threads == NULL)
+        goto free_pool;
+
+    struct BGSliceOption option = { .allocator = allocator };
+    pool->tasks = BGSlice_new(struct bg_task, 0, 64, &option);
+    if (pool->tasks == NULL)
+        goto free_threads;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (; pool->n_threads < n_threads; pool->n_threads++) {
+        if (pthread_create(&pool->threads[pool->n_threads], NULL,
+                           bg_thread_pool_worker, pool)
+            != 0) {
+            BGThreadPool_free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+
+free_threads:
+    bg_allocator_free(allocator, pool->threads);
+free_pool:
+    bg_allocator_free(allocator, pool);
+    return NULL;
+}
+
+size_t
+BGThreadPool_size(BGThreadPool *pool)
+{
+    assert_pool(pool != NULL, "pool cannot be NULL");
+
+    return pool->n_threads;
+}
+
+bool
+BGThreadPool_submit(BGThreadPool *pool, BGThreadPool_task_fn fn, void *arg)
+{
+    assert_pool(pool != NULL, "pool cannot be NULL");
+    assert_pool(fn != NULL, "task function cannot be NULL");
+
+    struct bg_task task = { .fn = fn, .arg = arg };
+
+    pthread_mutex_lock(&pool->lock);
+    bool queued = BGSlice_append(pool->tasks, &task) != NULL;
+    if (queued) {
+        pool->pending++;
+        pthread_cond_signal(&pool->task_ready);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return queued;
+}
+
+void
+BGThreadPool_wait(BGThreadPool *pool)
+{
+    assert_pool(pool != NULL, "pool cannot be NULL");
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending != 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void
+BGThreadPool_free(BGThreadPool *pool)
+{
+    if (bg_unlikely(pool == NULL))
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->n_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_mutex_destroy(&pool->lock);
+    BGSlice_free(pool->tasks);
+    bg_allocator_free(pool->allocator, pool->threads);
+    bg_allocator_free(pool->allocator, pool);
+}
@@ -0,0 +1,34 @@
+#ifndef BG_THREADING_H
+#define BG_THREADING_H
+
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "mem/bg_allocator.h"
+
+/*
+ * Fixed-size pool of worker threads consuming a FIFO task queue.
+ *
+ * Tasks are plain (fn, arg) pairs. BGThreadPool_wait blocks until every
+ * task submitted so far has finished, which is how callers fork/join a batch
+ * of work. A pool must only be driven from one submitting thread at a time.
+ */
+
+typedef void (*BGThreadPool_task_fn)(void *arg);
+
+typedef struct BGThreadPool BGThreadPool;
+
+// Number of online CPUs, at least 1.
+size_t bg_cpu_count(void);
+
+// n_threads == 0 starts one worker per online CPU. allocator may be NULL.
+BGThreadPool *BGThreadPool_new(size_t n_threads, struct Allocator *allocator);
+size_t BGThreadPool_size(BGThreadPool *pool);
+// Returns false if the task could not be queued; the task has not run.
+bool BGThreadPool_submit(BGThreadPool *pool, BGThreadPool_task_fn fn,
+                         void *arg);
+void BGThreadPool_wait(BGThreadPool *pool);
+// Waits for queued tasks, then stops and joins the workers.
+void BGThreadPool_free(BGThreadPool *pool);
+
+#endif // BG_THREADING_H